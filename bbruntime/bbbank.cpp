@@ -46,6 +46,14 @@ static inline void debugBank( bbBank *b,int offset ){
 	}
 }
 
+char *bankData( bbBank *b,int offset,int count ){
+	if( debug ){
+		debugBank( b,offset+count-1 );
+		if( offset<0 ) RTEX( "Offset out of range" );
+	}
+	return b->data+offset;
+}
+
 bbBank *bbCreateBank( int size ){
 	bbBank *b=d_new bbBank( size );
 	bank_set.insert( b );
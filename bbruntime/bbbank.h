@@ -4,4 +4,9 @@
 
 #include "bbsys.h"
 
+struct bbBank;
+
+//returns pointer to count bytes of bank data at offset, for commands that use banks as buffers
+char *bankData( bbBank *b,int offset,int count );
+
 #endif
\ No newline at end of file
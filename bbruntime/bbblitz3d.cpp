@@ -3,6 +3,7 @@
 
 #include "bbblitz3d.h"
 #include "bbgraphics.h"
+#include "bbbank.h"
 #include "../blitz3d/blitz3d.h"
 #include "../blitz3d/world.h"
 #include "../blitz3d/texture.h"
@@ -18,19 +19,25 @@
 #include "../blitz3d/meshutil.h"
 #include "../blitz3d/pivot.h"
 #include "../blitz3d/planemodel.h"
+#include "../blitz3d/staticmodel.h"
 #include "../blitz3d/terrain.h"
+#include "../blitz3d/terrainpager.h"
 #include "../blitz3d/listener.h"
 #include "../blitz3d/cachedtexture.h"
+#include "../blitz3d/threadpool.h"
+#include "../blitz3d/asyncload.h"
+#include "../blitz3d/meshcache.h"
 
 gxScene *gx_scene;
 extern gxFileSystem *gx_filesys;
 
-static int tri_count;
+static int tri_count,state_count,draw_count;
 static World *world;
 
 static set<Brush*> brush_set;
 static set<Texture*> texture_set;
 static set<Entity*> entity_set;
+static set<AsyncLoad*> async_set;
 
 static Listener *listener;
 
@@ -47,7 +54,7 @@ static Vector projected,tformed;
 
 static ObjCollision picked;
 
-extern float stats3d[10];
+extern float stats3d[32];
 
 static Loader_X loader_x;
 static Loader_3DS loader_3ds;
@@ -64,6 +71,12 @@ static inline void debugTexture( Texture *t ){
 static inline void debugBrush( Brush *b ){
 	if( debug && !brush_set.count( b ) ) RTEX( "Brush does not exist" );
 }
+static inline void debugAsyncLoad( AsyncLoad *l,int type ){
+	if( debug ){
+		if( !async_set.count( l ) ) RTEX( "Async load does not exist" );
+		if( l->getType()!=type ) RTEX( type==AsyncLoad::LOAD_MESH ? "Async load is not a mesh" : "Async load is not a texture" );
+	}
+}
 static inline void debugEntity( Entity *e ){
 	if( debug && !entity_set.count(e) ) RTEX( "Entity does not exist" );
 }
@@ -144,6 +157,27 @@ static inline void debugVertex( Surface *s,int n,int t ){
 	}
 }
 
+static void collapseMesh( MeshModel *mesh,Entity *e ){
+	while( e->children() ){
+		collapseMesh( mesh,e->children() );
+	}
+	if( Model *p=e->getModel() ){
+		if( MeshModel *t=p->getMeshModel() ){
+			t->transform( e->getWorldTform() );
+			mesh->add( *t );
+		}
+	}
+	delete e;
+}
+
+static Entity *collapseMesh( Entity *e ){
+	MeshModel *m=d_new MeshModel();
+	collapseMesh( m,e );
+	return m;
+}
+
+//load a mesh file, collapsed if hint has HINT_COLLAPSE - from the mesh cache if it's up to date,
+//else from the file and cached
 static Entity *loadEntity( string t,int hint ){
 	t=tolower(t);
 	int n=t.rfind( "." );if( n==string::npos ) return 0;
@@ -158,24 +192,15 @@ static Entity *loadEntity( string t,int hint ){
 	const Transform &conv=loader_mat_map[ext];
 
 	CachedTexture::setPath( filenamepath( t ) );
-	Entity *e=l->load( t,conv,hint );
+	Entity *e=MeshCache::load( t,conv,hint );
+	if( !e && (e=l->load( t,conv,hint )) ){
+		if( hint & MeshLoader::HINT_COLLAPSE ) e=collapseMesh( e );
+		MeshCache::save( e,t,conv,hint );
+	}
 	CachedTexture::setPath( "" );
 	return e;
 }
 
-static void collapseMesh( MeshModel *mesh,Entity *e ){
-	while( e->children() ){
-		collapseMesh( mesh,e->children() );
-	}
-	if( Model *p=e->getModel() ){
-		if( MeshModel *t=p->getMeshModel() ){
-			t->transform( e->getWorldTform() );
-			mesh->add( *t );
-		}
-	}
-	delete e;
-}
-
 static void insert( Entity *e ){
 	if( debug ) entity_set.insert( e );
 	e->setVisible(true);
@@ -217,6 +242,24 @@ void  bbLoaderMatrix( BBStr *ext,float xx,float xy,float xz,float yx,float yy,fl
 	delete ext;
 }
 
+void  bbMeshCache( BBStr *dir ){
+	MeshCache::setDir( *dir );
+	delete dir;
+}
+
+//bring the cache of a mesh file up to date, returns false if it can't be cached
+int   bbBakeMesh( BBStr *f,int anim ){
+	debug3d();
+	string t=tolower( *f );
+	delete f;
+	if( !MeshCache::getDir().size() ) return 0;
+	int hint=anim ? 0 : MeshLoader::HINT_COLLAPSE;
+	Entity *e=loadEntity( t,hint );
+	if( !e ) return 0;
+	delete e;
+	return MeshCache::fresh( t,hint );
+}
+
 int   bbHWTexUnits(){
 	debug3d();
 	return gx_scene->hwTexUnits();
@@ -293,8 +336,12 @@ void  bbRenderWorld( float tween ){
 
 #ifndef BETA
 	tri_count=gx_scene->getTrianglesDrawn();
+	state_count=gx_scene->getStateChanges();
+	draw_count=gx_scene->getDrawCalls();
 	world->render( tween );
 	tri_count=gx_scene->getTrianglesDrawn()-tri_count;
+	state_count=gx_scene->getStateChanges()-state_count;
+	draw_count=gx_scene->getDrawCalls()-draw_count;
 	return;
 #endif
 
@@ -341,10 +388,26 @@ int  bbTrisRendered(){
 	return tri_count;
 }
 
+int  bbStateChanges(){
+	return state_count;
+}
+
+int  bbDrawCalls(){
+	return draw_count;
+}
+
 float  bbStats3D( int n ){
 	return stats3d[n];
 }
 
+void  bbWorldThreads( int n ){
+	ThreadPool::setThreads( n );
+}
+
+void  bbSortTransparent( int enable ){
+	Model::setSortTransparent( !!enable );
+}
+
 //////////////////////
 // TEXTURE COMMANDS //
 //////////////////////
@@ -552,9 +615,7 @@ Entity *  bbLoadMesh( BBStr *f,Entity *p ){
 	delete f;
 
 	if( !e ) return 0;
-	MeshModel *m=d_new MeshModel();
-	collapseMesh( m,e );
-	return insertEntity( m,p );
+	return insertEntity( e,p );
 }
 
 Entity *  bbLoadAnimMesh( BBStr *f,Entity *p ){
@@ -661,9 +722,9 @@ void  bbAddMesh( MeshModel *src,MeshModel *dest ){
 	dest->add( *src );
 }
 
-void  bbUpdateNormals( MeshModel *m ){
+void  bbUpdateNormals( MeshModel *m,float angle ){
 	debugMesh(m);
-	m->updateNormals();
+	m->updateNormals( angle*dtor );
 }
 
 void  bbLightMesh( MeshModel *m,float r,float g,float b,float range,float x,float y,float z ){
@@ -714,6 +775,94 @@ void bbMeshCullBox( MeshModel *m,float x,float y,float z,float width,float heigh
 }
 
 
+/////////////////////////
+// ASYNC LOAD COMMANDS //
+/////////////////////////
+static AsyncLoad *startLoad( int type,const string &file,int flags ){
+	AsyncLoad *l=d_new AsyncLoad( type,file,flags );
+	async_set.insert( l );
+	return l;
+}
+
+static void freeLoad( AsyncLoad *l ){
+	async_set.erase( l );
+	delete l;
+}
+
+AsyncLoad *  bbLoadMeshAsync( BBStr *f ){
+	AsyncLoad *l=startLoad( AsyncLoad::LOAD_MESH,tolower( *f ),MeshLoader::HINT_COLLAPSE );
+	delete f;
+	return l;
+}
+
+AsyncLoad *  bbLoadAnimMeshAsync( BBStr *f ){
+	AsyncLoad *l=startLoad( AsyncLoad::LOAD_MESH,tolower( *f ),0 );
+	delete f;
+	return l;
+}
+
+AsyncLoad *  bbLoadTextureAsync( BBStr *f,int flags ){
+	AsyncLoad *l=startLoad( AsyncLoad::LOAD_TEXTURE,*f,flags );
+	delete f;
+	return l;
+}
+
+int  bbAsyncLoadReady( AsyncLoad *l ){
+	if( debug && !async_set.count( l ) ) RTEX( "Async load does not exist" );
+	return l->ready();
+}
+
+float  bbAsyncLoadProgress( AsyncLoad *l ){
+	if( debug && !async_set.count( l ) ) RTEX( "Async load does not exist" );
+	return l->progress();
+}
+
+//finish a mesh load, waiting for it if need be - the load is freed
+Entity *  bbAsyncLoadEntity( AsyncLoad *l,Entity *p ){
+	debugAsyncLoad( l,AsyncLoad::LOAD_MESH );
+	debugParent(p);
+	l->wait();
+
+	Entity *e;
+	int hint=l->getFlags();
+	if( Loader_B3D::Staged *staged=l->getStaged() ){
+		CachedTexture::setPath( filenamepath( l->getFile() ) );
+		if( e=Loader_B3D::build( staged ) ){
+			if( hint & MeshLoader::HINT_COLLAPSE ) e=collapseMesh( e );
+			MeshCache::save( e,l->getFile(),loader_mat_map["b3d"],hint );
+		}
+		CachedTexture::setPath( "" );
+	}else{
+		e=loadEntity( l->getFile(),hint );
+	}
+	freeLoad( l );
+
+	if( !e ) return 0;
+	if( hint & MeshLoader::HINT_COLLAPSE ) return insertEntity( e,p );
+	if( Animator *anim=e->getObject()->getAnimator() ){
+		anim->animate( 1,0,0,0 );
+	}
+	return insertEntity( e,p );
+}
+
+//finish a texture load, waiting for it if need be - the load is freed
+Texture *  bbAsyncLoadTexture( AsyncLoad *l ){
+	debug3d();
+	debugAsyncLoad( l,AsyncLoad::LOAD_TEXTURE );
+	l->wait();
+	Texture *t=d_new Texture( l->getFile(),l->getFlags() );
+	freeLoad( l );
+	if( !t->getCanvas(0) ){ delete t;return 0; }
+	texture_set.insert( t );
+	return t;
+}
+
+void  bbFreeAsyncLoad( AsyncLoad *l ){
+	if( !l ) return;
+	if( debug && !async_set.count( l ) ) RTEX( "Async load does not exist" );
+	freeLoad( l );
+}
+
 //////////////////////
 // SURFACE COMMANDS //
 //////////////////////
@@ -998,6 +1147,43 @@ Entity *  bbEntityPick( Object *src,float range ){
 	return doPick( l,0 );
 }
 
+//rays are 6 floats each: x,y,z,dx,dy,dz
+//results are 10 ints/floats each: entity,x,y,z,nx,ny,nz,time,surface,triangle
+int  bbLinePicks( bbBank *rays,bbBank *results,int count,float radius ){
+	debug3d();
+	if( count<=0 ) return 0;
+
+	const float *r=(const float*)bankData( rays,0,count*24 );
+	int *out=(int*)bankData( results,0,count*40 );
+
+	static vector<Line> lines;
+	static vector<ObjCollision> colls;
+	lines.resize( count );
+	colls.resize( count );
+
+	for( int k=0;k<count;++k,r+=6 ){
+		lines[k]=Line( Vector( r[0],r[1],r[2] ),Vector( r[3],r[4],r[5] ) );
+	}
+
+	int hits=world->traceRays( &lines[0],count,radius,&colls[0] );
+
+	for( int k=0;k<count;++k,out+=10 ){
+		const ObjCollision &c=colls[k];
+		float *f=(float*)out;
+		out[0]=(int)c.with;
+		if( !c.with ){
+			memset( out+1,0,36 );
+			continue;
+		}
+		f[1]=c.coords.x;f[2]=c.coords.y;f[3]=c.coords.z;
+		f[4]=c.collision.normal.x;f[5]=c.collision.normal.y;f[6]=c.collision.normal.z;
+		f[7]=c.collision.time;
+		out[8]=(int)c.collision.surface;
+		out[9]=c.collision.index;
+	}
+	return hits;
+}
+
 int  bbEntityVisible( Object *src,Object *dest ){
 	if( debug ){ debugObject(src);debugObject(dest); }
 
@@ -1145,6 +1331,10 @@ void  bbSpriteViewMode( Sprite *s,int mode ){
 	s->setViewmode( mode );
 }
 
+void  bbSpriteBatchSize( int n ){
+	Sprite::reserveBatch( n );
+}
+
 /////////////////////
 // MIRROR COMMANDS //
 /////////////////////
@@ -1274,6 +1464,25 @@ Entity *  bbLoadTerrain( BBStr *file,Entity *p ){
 	return insertEntity( t,p );
 }
 
+Entity *  bbLoadTerrainPaged( BBStr *file,int n,int tile_size,int max_tiles,Entity *p ){
+	debugParent(p);
+	int shift=0,tile_shift=0;
+	while( (1<<shift)<n ) ++shift;
+	if( (1<<shift)!=n ) RTEX( "Illegal terrain size" );
+	//terrain vertex coords are shorts, and bintree ids of bigger terrains overflow an int
+	if( shift>14 ) RTEX( "Terrain size must be no more than 16384" );
+	while( (1<<tile_shift)<tile_size ) ++tile_shift;
+	if( (1<<tile_shift)!=tile_size ) RTEX( "Illegal terrain tile size" );
+	TerrainPager *pager=d_new TerrainPager( *file,shift,tile_shift,max_tiles );
+	delete file;
+	if( !pager->valid() ){
+		delete pager;
+		return 0;
+	}
+	Terrain *t=d_new Terrain( shift,pager );
+	return insertEntity( t,p );
+}
+
 void  bbTerrainDetail( Terrain *t,int n,int m ){
 	debugTerrain(t);
 	t->setDetail( n,!!m );
@@ -1284,6 +1493,12 @@ void  bbTerrainShading( Terrain *t,int enable ){
 	t->setShading( !!enable );
 }
 
+void  bbTerrainMode( Terrain *t,int mode ){
+	debugTerrain(t);
+	if( mode<0 || mode>1 ) RTEX( "Illegal terrain mode" );
+	t->setMode( mode );
+}
+
 float  bbTerrainX( Terrain *t,float x,float y,float z ){
 	debugTerrain(t);
 	return terrainVector( t,x,y,z ).x;
@@ -1374,6 +1589,25 @@ void  bbShowEntity( Entity *e ){
 	e->getObject()->reset();
 }
 
+Entity *  bbBakeStatic( Entity *e,float chunk_size ){
+	debugEntity(e);
+	StaticModel *t=d_new StaticModel( e,chunk_size );
+	if( !t->numMeshes() ){
+		delete t;
+		return 0;
+	}
+	return insertEntity( t,0 );
+}
+
+void  bbUnbakeStatic( Entity *e ){
+	if( debug ){
+		debugEntity(e);
+		if( !e->getModel() || !e->getModel()->getStaticModel() ) RTEX( "Entity is not a baked model" );
+	}
+	e->getModel()->getStaticModel()->unbake();
+	bbFreeEntity( e );
+}
+
 void  bbEntityParent( Entity *e,Entity *p,int global ){
 	if( debug ){
 		debugEntity(e);
@@ -1908,6 +2142,7 @@ BBStr *bbEntityClass( Entity *e ){
 		else if( t->getMeshModel() ) p="Mesh";
 		else if( t->getMD2Model() ) p="MD2";
 		else if( t->getBSPModel() ) p="BSP";
+		else if( t->getStaticModel() ) p="Static";
 	}
 	return new BBStr(p);
 }
@@ -1921,6 +2156,7 @@ void  bbClearWorld( int e,int b,int t ){
 	}
 	if( t ){
 		while( texture_set.size() ) bbFreeTexture( *texture_set.begin() );
+		CachedTexture::flush();
 	}
 }
 
@@ -1930,6 +2166,14 @@ int  bbActiveTextures(){
 	return active_texs;
 }
 
+void  bbTextureCacheBudget( int bytes ){
+	CachedTexture::setBudget( bytes );
+}
+
+int  bbTextureCacheStats( int n ){
+	return CachedTexture::getStat( n );
+}
+
 void blitz3d_open(){
 	gx_scene=gx_graphics->createScene( 0 );
 	if( !gx_scene ) RTEX( "Unable to create 3D Scene" );
@@ -1948,16 +2192,19 @@ void blitz3d_open(){
 
 void blitz3d_close(){
 	if( !gx_scene ) return;
+	while( async_set.size() ) freeLoad( *async_set.begin() );
+	AsyncLoad::shutdown();
 	bbClearWorld( 1,1,1 );
 	Texture::clearFilters();
 	loader_mat_map.clear();
 	delete world;
+	ThreadPool::setThreads( 1 );
 	gx_graphics->freeScene( gx_scene );
 	gx_scene=0;
 }
 
 bool blitz3d_create(){
-	tri_count=0;
+	tri_count=state_count=draw_count=0;
 	gx_scene=0;world=0;
 	return true;
 }
@@ -1969,6 +2216,8 @@ bool blitz3d_destroy(){
 
 void blitz3d_link( void (*rtSym)( const char *sym,void *pc ) ){
 	rtSym( "LoaderMatrix$file_ext#xx#xy#xz#yx#yy#yz#zx#zy#zz",bbLoaderMatrix );
+	rtSym( "MeshCache$dir",bbMeshCache );
+	rtSym( "%BakeMesh$file%animated=0",bbBakeMesh );
 	rtSym( "HWMultiTex%enable",bbHWMultiTex );
 	rtSym( "%HWTexUnits",bbHWTexUnits );
 	rtSym( "%GfxDriverCaps3D",bbGfxDriverCaps3D );
@@ -1984,8 +2233,14 @@ void blitz3d_link( void (*rtSym)( const char *sym,void *pc ) ){
 	rtSym( "RenderWorld#tween=1",bbRenderWorld );
 	rtSym( "ClearWorld%entities=1%brushes=1%textures=1",bbClearWorld );
 	rtSym( "%ActiveTextures",bbActiveTextures );
+	rtSym( "TextureCacheBudget%bytes",bbTextureCacheBudget );
+	rtSym( "%TextureCacheStats%type",bbTextureCacheStats );
 	rtSym( "%TrisRendered",bbTrisRendered );
+	rtSym( "%StateChanges",bbStateChanges );
+	rtSym( "%DrawCalls",bbDrawCalls );
 	rtSym( "#Stats3D%type",bbStats3D );
+	rtSym( "WorldThreads%count",bbWorldThreads );
+	rtSym( "SortTransparent%enable",bbSortTransparent );
 
 	rtSym( "%CreateTexture%width%height%flags=0%frames=1",bbCreateTexture );
 	rtSym( "%LoadTexture$file%flags=1",bbLoadTexture );
@@ -2018,6 +2273,14 @@ void blitz3d_link( void (*rtSym)( const char *sym,void *pc ) ){
 
 	rtSym( "%LoadMesh$file%parent=0",bbLoadMesh );
 	rtSym( "%LoadAnimMesh$file%parent=0",bbLoadAnimMesh );
+	rtSym( "%LoadMeshAsync$file",bbLoadMeshAsync );
+	rtSym( "%LoadAnimMeshAsync$file",bbLoadAnimMeshAsync );
+	rtSym( "%LoadTextureAsync$file%flags=1",bbLoadTextureAsync );
+	rtSym( "%AsyncLoadReady%load",bbAsyncLoadReady );
+	rtSym( "#AsyncLoadProgress%load",bbAsyncLoadProgress );
+	rtSym( "%AsyncLoadEntity%load%parent=0",bbAsyncLoadEntity );
+	rtSym( "%AsyncLoadTexture%load",bbAsyncLoadTexture );
+	rtSym( "FreeAsyncLoad%load",bbFreeAsyncLoad );
 	rtSym( "%LoadAnimSeq%entity$file",bbLoadAnimSeq );
 
 	rtSym( "%CreateMesh%parent=0",bbCreateMesh );
@@ -2033,7 +2296,7 @@ void blitz3d_link( void (*rtSym)( const char *sym,void *pc ) ){
 	rtSym( "FlipMesh%mesh",bbFlipMesh );
 	rtSym( "PaintMesh%mesh%brush",bbPaintMesh );
 	rtSym( "AddMesh%source_mesh%dest_mesh",bbAddMesh );
-	rtSym( "UpdateNormals%mesh",bbUpdateNormals );
+	rtSym( "UpdateNormals%mesh#max_angle=0",bbUpdateNormals );
 	rtSym( "LightMesh%mesh#red#green#blue#range=0#x=0#y=0#z=0",bbLightMesh );
 	rtSym( "#MeshWidth%mesh",bbMeshWidth );
 	rtSym( "#MeshHeight%mesh",bbMeshHeight );
@@ -2093,6 +2356,7 @@ void blitz3d_link( void (*rtSym)( const char *sym,void *pc ) ){
 	rtSym( "%EntityPick%entity#range",bbEntityPick );
 	rtSym( "%LinePick#x#y#z#dx#dy#dz#radius=0",bbLinePick );
 	rtSym( "%CameraPick%camera#viewport_x#viewport_y",bbCameraPick );
+	rtSym( "%LinePicks%ray_bank%result_bank%count#radius=0",bbLinePicks );
 
 	rtSym( "#PickedX",bbPickedX );
 	rtSym( "#PickedY",bbPickedY );
@@ -2118,6 +2382,7 @@ void blitz3d_link( void (*rtSym)( const char *sym,void *pc ) ){
 	rtSym( "ScaleSprite%sprite#x_scale#y_scale",bbScaleSprite );
 	rtSym( "HandleSprite%sprite#x_handle#y_handle",bbHandleSprite );
 	rtSym( "SpriteViewMode%sprite%view_mode",bbSpriteViewMode );
+	rtSym( "SpriteBatchSize%sprites",bbSpriteBatchSize );
 
 	rtSym( "%LoadMD2$file%parent=0",bbLoadMD2 );
 	rtSym( "AnimateMD2%md2%mode=1#speed=1%first_frame=0%last_frame=9999#transition=0",bbAnimateMD2 );
@@ -2135,8 +2400,10 @@ void blitz3d_link( void (*rtSym)( const char *sym,void *pc ) ){
 
 	rtSym( "%CreateTerrain%grid_size%parent=0",bbCreateTerrain );
 	rtSym( "%LoadTerrain$heightmap_file%parent=0",bbLoadTerrain );
+	rtSym( "%LoadTerrainPaged$raw_file%grid_size%tile_size=256%max_tiles=64%parent=0",bbLoadTerrainPaged );
 	rtSym( "TerrainDetail%terrain%detail_level%morph=0",bbTerrainDetail );
 	rtSym( "TerrainShading%terrain%enable",bbTerrainShading );
+	rtSym( "TerrainMode%terrain%mode",bbTerrainMode );
 	rtSym( "#TerrainX%terrain#world_x#world_y#world_z",bbTerrainX );
 	rtSym( "#TerrainY%terrain#world_x#world_y#world_z",bbTerrainY );
 	rtSym( "#TerrainZ%terrain#world_x#world_y#world_z",bbTerrainZ );
@@ -2224,6 +2491,8 @@ void blitz3d_link( void (*rtSym)( const char *sym,void *pc ) ){
 	rtSym( "HideEntity%entity",bbHideEntity );
 	rtSym( "ShowEntity%entity",bbShowEntity );
 	rtSym( "FreeEntity%entity",bbFreeEntity );
+	rtSym( "%BakeStatic%entity#chunk_size=64",bbBakeStatic );
+	rtSym( "UnbakeStatic%baked",bbUnbakeStatic );
 
 	rtSym( "NameEntity%entity$name",bbNameEntity );
 	rtSym( "$EntityName%entity",bbEntityName );
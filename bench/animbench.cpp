@@ -0,0 +1,154 @@
+//
+// Animation key memory and sampling time.
+//
+// A character is a tree of pivots with position, scale and rotation keys on every frame, the way
+// exporters usually write B3D files. Heap use of its keys is counted by replacing operator new.
+//
+// Playback updates the animators of many copies of the character, which share their keys. Seeking
+// samples the keys at random times. Only APIs older than the key cursors are used, so the same
+// program can be built against an older animation.cpp to compare. Checksums should match.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/pivot.h"
+
+#include <new>
+
+static const int BONES=60;
+static const int FRAMES=300;		//a key every frame
+static const int CHARS=100;
+static const int UPDATES=1000;
+static const int SEEKS=1000000;
+
+//live heap bytes
+static size_t heap_bytes;
+
+static const size_t HEAP_HEADER=16;	//keeps malloc's alignment
+
+void *operator new( size_t size ){
+	char *p=(char*)malloc( size+HEAP_HEADER );
+	if( !p ) throw std::bad_alloc();
+	*(size_t*)p=size;
+	heap_bytes+=size;
+	return p+HEAP_HEADER;
+}
+
+void operator delete( void *q ){
+	if( !q ) return;
+	char *p=(char*)q-HEAP_HEADER;
+	heap_bytes-=*(size_t*)p;
+	free( p );
+}
+
+static Pivot *createCharacter( vector<Animation> &anims ){
+
+	Pivot *root=d_new Pivot();
+	vector<Pivot*> bones;
+
+	for( int k=0;k<BONES;++k ){
+		Pivot *bone=d_new Pivot();
+		bone->setParent( k ? bones[rand()%k] : root );
+		bones.push_back( bone );
+	}
+
+	size_t bytes=heap_bytes;
+
+	anims.clear();
+	for( int k=0;k<BONES;++k ){
+		Animation anim;
+		for( int f=0;f<FRAMES;++f ){
+			anim.setPositionKey( f,Vector( benchRand(-.1f,.1f),1,benchRand(-.1f,.1f) ) );
+			anim.setScaleKey( f,Vector( 1,benchRand(.9f,1.1f),1 ) );
+			anim.setRotationKey( f,yawQuat( benchRand(-1,1) )*pitchQuat( benchRand(-1,1) ) );
+		}
+		bones[k]->setAnimation( anim );
+		anims.push_back( anim );
+	}
+
+	bytes=heap_bytes-bytes;
+	int keys=BONES*FRAMES*3;
+	printf( "%i bones, %i keys: %8.1fKB, %5.1f bytes per key\n",BONES,keys,bytes/1024.0,(float)bytes/keys );
+
+	root->setAnimator( d_new Animator( root,FRAMES ) );
+	return root;
+}
+
+static float sum( const Vector &v ){
+	return v.x+v.y+v.z;
+}
+
+static float sum( const Quat &q ){
+	return q.w+sum( q.v );
+}
+
+static float checksum( Entity *e ){
+	float n=0;
+	for( Entity *p=e->children();p;p=p->successor() ){
+		n+=sum( p->getLocalPosition() )+sum( p->getLocalScale() )+sum( p->getLocalRotation() );
+		n+=checksum( p );
+	}
+	return n;
+}
+
+static void playback( Pivot *proto ){
+
+	vector<Object*> chars;
+	for( int k=0;k<CHARS;++k ){
+		Object *t=proto->copy();
+		t->getAnimator()->animate( Animator::ANIM_MODE_LOOP,.5f,0,0 );
+		chars.push_back( t );
+	}
+
+	double t=benchTime();
+	for( int n=0;n<UPDATES;++n ){
+		for( int k=0;k<CHARS;++k ) chars[k]->getAnimator()->update( 1 );
+	}
+	t=benchTime()-t;
+
+	float check=0;
+	for( int k=0;k<CHARS;++k ) check+=checksum( chars[k] );
+
+	double samples=(double)CHARS*BONES*3*UPDATES;
+	printf( "playback: %i characters, %8.2fms per update, %6.1fns per key sample, checksum %.4f\n",
+		CHARS,t*1000/UPDATES,t*1e9/samples,check );
+
+	for( int k=0;k<CHARS;++k ) delete chars[k];
+}
+
+static void seek( const vector<Animation> &anims ){
+
+	srand( 2 );
+	vector<float> times;
+	for( int k=0;k<SEEKS;++k ) times.push_back( benchRand( 0,FRAMES-1 ) );
+
+	float check=0;
+	double t=benchTime();
+	for( int k=0;k<SEEKS;++k ){
+		const Animation &anim=anims[k%BONES];
+		float time=times[k];
+		check+=sum( anim.getPosition( time ) )+sum( anim.getScale( time ) )+sum( anim.getRotation( time ) );
+	}
+	t=benchTime()-t;
+
+	printf( "seek: %i random times, %6.1fns per key sample, checksum %.4f\n",
+		SEEKS,t*1e9/(SEEKS*3.0),check );
+}
+
+int main(){
+
+	gxStubOpen();
+
+	srand( 1 );
+	vector<Animation> anims;
+	Pivot *proto=createCharacter( anims );
+
+	playback( proto );
+	seek( anims );
+
+	anims.clear();
+	delete proto;
+
+	gxStubClose();
+	return 0;
+}
@@ -0,0 +1,209 @@
+//
+// B3D load time. A small and a large animated mesh are written out, then loaded with Loader_B3D.
+//
+// The mesh has normals and one set of tex coords, and a third of its vertices are weighted to a
+// chain of bones with rotation keys. Only Loader_B3D::load is used, so the same program can be
+// built against an older loader_b3d.cpp to compare. Checksums should match.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/loader_b3d.h"
+#include "../blitz3d/meshmodel.h"
+
+static const char *FILENAME="b3dbench.b3d";
+static const int BONES=30;
+static const int FRAMES=100;
+static const int RUNS=3;
+
+//
+// B3D writer - chunk sizes are patched in when a chunk ends.
+//
+static FILE *out;
+static vector<long> chunks;
+
+static void writeInt( int n ){
+	fwrite( &n,4,1,out );
+}
+
+static void writeFloat( float n ){
+	fwrite( &n,4,1,out );
+}
+
+static void writeString( const char *t ){
+	fwrite( t,strlen(t)+1,1,out );
+}
+
+static void beginChunk( const char *tag ){
+	fwrite( tag,4,1,out );
+	writeInt( 0 );
+	chunks.push_back( ftell( out ) );
+}
+
+static void endChunk(){
+	long start=chunks.back(),end=ftell( out );
+	chunks.pop_back();
+	fseek( out,start-4,SEEK_SET );
+	writeInt( end-start );
+	fseek( out,end,SEEK_SET );
+}
+
+static void writeNode( const char *name,const Vector &pos ){
+	writeString( name );
+	writeFloat( pos.x );writeFloat( pos.y );writeFloat( pos.z );
+	writeFloat( 1 );writeFloat( 1 );writeFloat( 1 );
+	writeFloat( 1 );writeFloat( 0 );writeFloat( 0 );writeFloat( 0 );
+}
+
+static void writeBone( int bone,int n_verts ){
+	char name[16];
+	sprintf( name,"bone%i",bone );
+
+	beginChunk( "NODE" );
+	writeNode( name,Vector( 0,bone ? 1.0f : 0,0 ) );
+
+	//every third vertex, split between the bones
+	beginChunk( "BONE" );
+	for( int k=bone*3;k<n_verts;k+=BONES*3 ){
+		writeInt( k );
+		writeFloat( 1 );
+	}
+	endChunk();
+
+	beginChunk( "KEYS" );
+	writeInt( 4 );
+	for( int k=0;k<FRAMES;++k ){
+		Quat q=rollQuat( sinf( k*.1f )*.1f );
+		writeInt( k );
+		writeFloat( q.w );writeFloat( q.v.x );writeFloat( q.v.y );writeFloat( q.v.z );
+	}
+	endChunk();
+
+	if( bone+1<BONES ) writeBone( bone+1,n_verts );
+
+	endChunk();
+}
+
+static void writeFile( int n_verts,int n_tris ){
+
+	out=fopen( FILENAME,"wb" );
+
+	beginChunk( "BB3D" );
+	writeInt( 1 );
+
+	beginChunk( "BRUS" );
+	writeInt( 0 );
+	writeString( "brush" );
+	writeFloat( 1 );writeFloat( 1 );writeFloat( 1 );writeFloat( 1 );
+	writeFloat( 0 );
+	writeInt( 1 );
+	writeInt( 0 );
+	endChunk();
+
+	beginChunk( "NODE" );
+	writeNode( "mesh",Vector() );
+
+	beginChunk( "MESH" );
+	writeInt( -1 );
+
+	beginChunk( "VRTS" );
+	writeInt( 1 );
+	writeInt( 1 );
+	writeInt( 2 );
+	srand( 1 );
+	for( int k=0;k<n_verts;++k ){
+		writeFloat( benchRand(-1,1) );writeFloat( k*BONES/(float)n_verts );writeFloat( benchRand(-1,1) );
+		writeFloat( 0 );writeFloat( 1 );writeFloat( 0 );
+		writeFloat( benchRand(0,1) );writeFloat( benchRand(0,1) );
+	}
+	endChunk();
+
+	beginChunk( "TRIS" );
+	writeInt( 0 );
+	for( int k=0;k<n_tris;++k ){
+		writeInt( k%n_verts );writeInt( (k+1)%n_verts );writeInt( (k+2)%n_verts );
+	}
+	endChunk();
+
+	endChunk();
+
+	beginChunk( "ANIM" );
+	writeInt( 0 );
+	writeInt( FRAMES );
+	writeFloat( 30 );
+	endChunk();
+
+	writeBone( 0,n_verts );
+
+	endChunk();
+
+	endChunk();
+
+	fclose( out );
+}
+
+static float checksum( MeshModel *mesh ){
+	float n=0;
+	const MeshModel::SurfaceList &surfs=mesh->getSurfaces();
+	for( int k=0;k<surfs.size();++k ){
+		Surface *surf=surfs[k];
+		for( int j=0;j<surf->numVertices();++j ){
+			const Surface::Vertex &v=surf->getVertex( j );
+			n+=v.coords.x+v.coords.y+v.coords.z+v.tex_coords[0][0];
+			//weights are only set for weighted vertices
+			if( v.bone_bones[0]!=255 ) n+=v.bone_bones[0]+v.bone_weights[0];
+		}
+		for( int j=0;j<surf->numTriangles();++j ){
+			n+=surf->getTriangle( j ).verts[0]*1e-6f;
+		}
+	}
+	return n;
+}
+
+static void bench( int n_verts,int n_tris ){
+
+	writeFile( n_verts,n_tris );
+
+	FILE *f=fopen( FILENAME,"rb" );
+	fseek( f,0,SEEK_END );
+	long size=ftell( f );
+	fclose( f );
+
+	Loader_B3D loader;
+	double best=0;
+	float check=0;
+	int verts=0,tris=0;
+	for( int k=0;k<RUNS;++k ){
+		double t=benchTime();
+		MeshModel *mesh=loader.load( FILENAME,Transform(),0 );
+		t=benchTime()-t;
+		if( !k || t<best ) best=t;
+
+		CHECK( mesh!=0 );
+		if( !mesh ) break;
+		check=checksum( mesh );
+		verts=tris=0;
+		const MeshModel::SurfaceList &surfs=mesh->getSurfaces();
+		for( int j=0;j<surfs.size();++j ){
+			verts+=surfs[j]->numVertices();
+			tris+=surfs[j]->numTriangles();
+		}
+		delete mesh;
+	}
+
+	printf( "%8.1fKB, %7i verts, %7i tris: %9.2fms best of %i, checksum %.4f\n",
+		size/1024.0,verts,tris,best*1000,RUNS,check );
+
+	remove( FILENAME );
+}
+
+int main(){
+
+	gxStubOpen();
+
+	bench( 3000,3000 );
+	bench( 1000000,1000000 );
+
+	gxStubClose();
+	return benchFailed() ? 1 : 0;
+}
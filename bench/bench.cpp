@@ -0,0 +1,39 @@
+#include "bench.h"
+#include "../blitz3d/object.h"
+
+#include <chrono>
+
+static int failed;
+
+double benchTime(){
+	return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+float benchRand( float lo,float hi ){
+	return rand()/(RAND_MAX+1.0f)*(hi-lo)+lo;
+}
+
+static void insert( Entity *e ){
+	e->setVisible( true );
+	e->setEnabled( true );
+	e->getObject()->reset();
+	for( Entity *p=e->children();p;p=p->successor() ){
+		insert( p );
+	}
+}
+
+Entity *benchInsert( Entity *e,Entity *p ){
+	e->setParent( p );
+	insert( e );
+	return e;
+}
+
+void benchCheck( bool cond,const char *expr,const char *file,int line ){
+	if( cond ) return;
+	printf( "%s(%i): CHECK( %s ) failed\n",file,line,expr );
+	++failed;
+}
+
+int benchFailed(){
+	return failed;
+}
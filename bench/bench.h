@@ -0,0 +1,28 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "gxstub.h"
+
+#include "../blitz3d/entity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//wall clock in seconds
+double benchTime();
+
+//random float in [lo,hi)
+float benchRand( float lo,float hi );
+
+//add an entity and its children to the world, the way the runtime's create commands do
+Entity *benchInsert( Entity *e,Entity *p=0 );
+
+//fail the run if cond is false
+#define CHECK( cond ) benchCheck( (cond),#cond,__FILE__,__LINE__ )
+
+void benchCheck( bool cond,const char *expr,const char *file,int line );
+
+//number of failed CHECKs - returned from main
+int benchFailed();
+
+#endif
@@ -0,0 +1,114 @@
+//
+// UpdateWorld cost for N spheres moving around a box and colliding with each
+// other. The box grows with N, so each sphere has about the same number of
+// neighbours and update time should grow close to linearly.
+//
+// Then the same world is updated with more WorldThreads. The threaded update
+// collides against start of update transforms, so it doesn't match the serial
+// one, but it must give bit identical positions for any thread count.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/world.h"
+#include "../blitz3d/pivot.h"
+#include "../blitz3d/threadpool.h"
+
+static const int FRAMES=100;
+static const float RADIUS=1;
+static const float SPACING=6;	//average distance between spheres
+
+struct Mover{
+	Pivot *pivot;
+	Vector vel;
+};
+
+static int runFrames( World *world,vector<Mover> &movers,float size,int frames ){
+	int colls=0;
+	for( int frame=0;frame<frames;++frame ){
+		for( int k=0;k<movers.size();++k ){
+			Mover &m=movers[k];
+			Vector v=m.pivot->getWorldPosition()+m.vel;
+			if( v.x<-size || v.x>size ) m.vel.x=-m.vel.x;
+			if( v.y<-size || v.y>size ) m.vel.y=-m.vel.y;
+			if( v.z<-size || v.z>size ) m.vel.z=-m.vel.z;
+			m.pivot->setWorldPosition( v );
+		}
+		world->update( 1 );
+		for( int k=0;k<movers.size();++k ){
+			colls+=movers[k].pivot->getCollisions().size();
+		}
+	}
+	return colls;
+}
+
+//returns ms per update, and final sphere positions
+static double bench( int n,int threads,int *colls,vector<Vector> &pos ){
+
+	World *world=d_new World();
+	world->addCollision( 1,1,World::COLLISION_METHOD_SPHERE,World::COLLISION_RESPONSE_SLIDE );
+
+	srand( 1 );
+	float size=cbrt( (float)n )*SPACING*.5f;
+
+	vector<Mover> movers;
+	for( int k=0;k<n;++k ){
+		Mover m;
+		m.pivot=d_new Pivot();
+		m.pivot->setLocalPosition( Vector( benchRand(-size,size),benchRand(-size,size),benchRand(-size,size) ) );
+		m.pivot->setCollisionType( 1 );
+		m.pivot->setCollisionRadii( Vector( RADIUS,RADIUS,RADIUS ) );
+		m.vel=Vector( benchRand(-.5f,.5f),benchRand(-.5f,.5f),benchRand(-.5f,.5f) );
+		benchInsert( m.pivot );
+		movers.push_back( m );
+	}
+
+	ThreadPool::setThreads( threads );
+
+	//settle overlaps from the random start before timing
+	runFrames( world,movers,size,10 );
+
+	double t=benchTime();
+	*colls=runFrames( world,movers,size,FRAMES );
+	t=benchTime()-t;
+
+	ThreadPool::setThreads( 1 );
+
+	pos.clear();
+	for( int k=0;k<movers.size();++k ){
+		pos.push_back( movers[k].pivot->getWorldPosition() );
+		delete movers[k].pivot;
+	}
+	delete world;
+
+	return t*1000/FRAMES;
+}
+
+int main(){
+
+	gxStubOpen();
+
+	int colls;
+	vector<Vector> pos,threaded_pos;
+
+	for( int n=250;n<=8000;n*=2 ){
+		double ms=bench( n,1,&colls,pos );
+		printf( "%6i spheres: %8.3fms per update, %8.1f collisions per update\n",n,ms,(float)colls/FRAMES );
+	}
+
+	const int n=4000;
+	double serial_ms=bench( n,1,&colls,pos );
+
+	for( int threads=2;threads<=16;threads*=2 ){
+		double ms=bench( n,threads,&colls,pos );
+		if( threads==2 ) threaded_pos=pos;
+		bool same=!memcmp( &pos[0],&threaded_pos[0],n*sizeof(Vector) );
+		CHECK( same );
+		printf( "%6i spheres, %2i threads: %8.3fms per update, %5.2fx serial%s\n",
+			n,threads,ms,serial_ms/ms,same ? "" : ", positions differ from 2 threads!" );
+	}
+
+	gxStubClose();
+
+	return benchFailed() ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+//
+// Frustum culling of 100k random boxes, with each Frustum::cull variant. All variants must agree
+// with the 8 corner test on which boxes are visible.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/frustum.h"
+
+static const int BOXES=100000;
+static const int PASSES=20;
+static const float SIZE=500;		//boxes are in a cube this size, around the eye
+
+static vector<Box> boxes;
+static vector<char> corner_vis,vis;
+
+static void report( const char *desc,double t ){
+	int n=0;
+	for( int k=0;k<BOXES;++k ) n+=vis[k];
+	bool same=!memcmp( &vis[0],&corner_vis[0],BOXES );
+	CHECK( same );
+	printf( "%-24s %7.3fms per %i boxes, %i visible%s\n",
+		desc,t*1000/PASSES,BOXES,n,same ? "" : ", differs from corner test!" );
+}
+
+int main(){
+
+	gxStubOpen();
+
+	srand( 1 );
+	for( int k=0;k<BOXES;++k ){
+		Vector c( benchRand(-SIZE,SIZE),benchRand(-SIZE,SIZE),benchRand(-SIZE,SIZE) );
+		Vector e( benchRand(.5f,5),benchRand(.5f,5),benchRand(.5f,5) );
+		boxes.push_back( Box( c-e,c+e ) );
+	}
+	corner_vis.resize( BOXES );
+	vis.resize( BOXES );
+
+	Transform cam;
+	cam.m=Matrix( yawQuat( .3f )*pitchQuat( .2f ) );
+	Frustum f( Frustum( 1,SIZE,2,1.5f ),cam );
+
+	double t;
+	int k,pass;
+
+	t=benchTime();
+	for( pass=0;pass<PASSES;++pass ){
+		for( k=0;k<BOXES;++k ){
+			Vector v[8];
+			for( int j=0;j<8;++j ) v[j]=boxes[k].corner( j );
+			corner_vis[k]=f.cull( v,8 );
+		}
+	}
+	t=benchTime()-t;
+	vis=corner_vis;
+	report( "corners:",t );
+
+	t=benchTime();
+	for( pass=0;pass<PASSES;++pass ){
+		for( k=0;k<BOXES;++k ) vis[k]=f.cull( boxes[k] );
+	}
+	report( "centre/extent:",benchTime()-t );
+
+	//boxes in a local space, as models are
+	Transform tf;
+	tf.v=Vector( 0,0,0 );
+	vector<int> last_plane( BOXES,0 );
+	t=benchTime();
+	for( pass=0;pass<PASSES;++pass ){
+		for( k=0;k<BOXES;++k ) vis[k]=f.cull( boxes[k],tf,last_plane[k] );
+	}
+	report( "local, plane coherency:",benchTime()-t );
+
+	t=benchTime();
+	for( pass=0;pass<PASSES;++pass ){
+		for( k=0;k<BOXES;++k ){
+			int clip=63;
+			vis[k]=f.cull( boxes[k],clip );
+		}
+	}
+	report( "clip mask:",benchTime()-t );
+
+	t=benchTime();
+	for( pass=0;pass<PASSES;++pass ){
+		f.cull( &boxes[0],BOXES,&vis[0] );
+	}
+	report( "SSE batch:",benchTime()-t );
+
+	gxStubClose();
+
+	return benchFailed() ? 1 : 0;
+}
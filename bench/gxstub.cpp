@@ -0,0 +1,273 @@
+#include "gxstub.h"
+
+#include <stdint.h>
+
+gxRuntime *gx_runtime;
+gxGraphics *gx_graphics;
+gxScene *gx_scene;
+
+gxStats gx_stats;
+
+class Sound;
+
+void gxStubOpen(){
+	gx_graphics=new gxGraphics( 0,0,0,0,true );
+	gx_scene=new gxScene( gx_graphics,0 );
+	gxStubReset();
+}
+
+void gxStubClose(){
+	delete gx_scene;gx_scene=0;
+	delete gx_graphics;gx_graphics=0;
+}
+
+void gxStubReset(){
+	memset( &gx_stats,0,sizeof(gx_stats) );
+}
+
+/////////////
+// RUNTIME //
+/////////////
+void gxRuntime::debugLog( const char *t ){
+}
+
+//////////////
+// GRAPHICS //
+//////////////
+gxGraphics::gxGraphics( gxRuntime *rt,IDirectDraw7 *dd,IDirectDrawSurface7 *fs,IDirectDrawSurface7 *bs,bool d3d ):
+runtime(rt),dirDraw(dd),dir3dDev(0){
+}
+
+gxGraphics::~gxGraphics(){
+}
+
+void gxGraphics::copy( gxCanvas *dest,int dx,int dy,int dw,int dh,gxCanvas *src,int sx,int sy,int sw,int sh ){
+}
+
+//no surfaces, so textures are never loaded
+gxCanvas *gxGraphics::createCanvas( int w,int h,int flags ){
+	return 0;
+}
+
+gxCanvas *gxGraphics::loadCanvas( const string &f,int flags ){
+	return 0;
+}
+
+bool gxGraphics::preloadImage( const string &f ){
+	return false;
+}
+
+void gxGraphics::discardImage( const string &f ){
+}
+
+void gxGraphics::freeCanvas( gxCanvas *c ){
+}
+
+gxMesh *gxGraphics::createMesh( int max_verts,int max_tris,int flags ){
+	return new gxMesh( this,0,new WORD[max_tris*3],max_verts,max_tris );
+}
+
+void gxGraphics::freeMesh( gxMesh *mesh ){
+	delete mesh;
+}
+
+////////////
+// CANVAS //
+////////////
+int gxCanvas::getModify()const{
+	return 0;
+}
+
+bool gxCanvas::lock()const{
+	return false;
+}
+
+void gxCanvas::unlock()const{
+}
+
+void gxCanvas::setCubeFace( int face ){
+}
+
+int gxCanvas::getWidth()const{
+	return 0;
+}
+
+int gxCanvas::getHeight()const{
+	return 0;
+}
+
+int gxCanvas::getDepth()const{
+	return 0;
+}
+
+//////////
+// MESH //
+//////////
+
+//vertex_buff holds system memory in place of a vertex buffer
+gxMesh::gxMesh( gxGraphics *g,IDirect3DVertexBuffer7 *vs,WORD *is,int max_vs,int max_ts ):
+graphics(g),locked_verts(0),vertex_buff((IDirect3DVertexBuffer7*)new dxVertex[max_vs]),
+tri_indices(is),max_verts(max_vs),max_tris(max_ts),mesh_dirty(false){
+}
+
+gxMesh::~gxMesh(){
+	delete[] (dxVertex*)vertex_buff;
+	delete[] tri_indices;
+}
+
+bool gxMesh::lock( bool all ){
+	if( locked_verts ) return true;
+	++gx_stats.mesh_locks;
+	if( all ) ++gx_stats.mesh_discards;
+	locked_verts=(dxVertex*)vertex_buff;
+	mesh_dirty=false;
+	return true;
+}
+
+void gxMesh::unlock(){
+	locked_verts=0;
+}
+
+void gxMesh::render( int first_vert,int vert_cnt,int first_tri,int tri_cnt ){
+	unlock();
+}
+
+void gxMesh::backup(){
+	unlock();
+}
+
+void gxMesh::restore(){
+	mesh_dirty=true;
+}
+
+///////////
+// SCENE //
+///////////
+gxScene::gxScene( gxGraphics *g,gxCanvas *t ):
+graphics(g),dir3dDev(0),target(t){
+}
+
+gxScene::~gxScene(){
+}
+
+void gxScene::setFlippedTris( bool enable ){
+}
+
+void gxScene::setAmbient2( const float rgb[3] ){
+}
+
+void gxScene::setFogColor( const float rgb[3] ){
+}
+
+void gxScene::setFogRange( float nr,float fr ){
+}
+
+void gxScene::setFogMode( int mode ){
+}
+
+void gxScene::setZMode( int mode ){
+}
+
+void gxScene::setViewport( int x,int y,int w,int h ){
+}
+
+void gxScene::setOrthoProj( float nr,float fr,float nr_w,float nr_h ){
+}
+
+void gxScene::setPerspProj( float nr,float fr,float nr_w,float nr_h ){
+}
+
+void gxScene::setViewMatrix( const Matrix *matrix ){
+}
+
+void gxScene::setWorldMatrix( const Matrix *matrix ){
+}
+
+void gxScene::setRenderState( const RenderState &rs ){
+	++gx_stats.state_changes;
+}
+
+bool gxScene::begin( const vector<gxLight*> &lights ){
+	return true;
+}
+
+void gxScene::clear( const float rgb[3],float alpha,float z,bool clear_argb,bool clear_z ){
+}
+
+void gxScene::render( gxMesh *mesh,int first_vert,int vert_cnt,int first_tri,int tri_cnt ){
+	mesh->render( first_vert,vert_cnt,first_tri,tri_cnt );
+	++gx_stats.draws;
+	gx_stats.tris+=tri_cnt;
+}
+
+void gxScene::renderInstances( gxMesh *mesh,int first_vert,int vert_cnt,int first_tri,int tri_cnt,const Matrix *matrices,int count ){
+	mesh->render( first_vert,vert_cnt,first_tri,tri_cnt );
+	++gx_stats.instance_draws;
+	gx_stats.tris+=tri_cnt*count;
+}
+
+void gxScene::end(){
+}
+
+gxLight *gxScene::createLight( int flags ){
+	return new gxLight( this,flags );
+}
+
+void gxScene::freeLight( gxLight *l ){
+	delete l;
+}
+
+int gxScene::getTrianglesDrawn()const{
+	return gx_stats.tris;
+}
+
+int gxScene::getStateChanges()const{
+	return gx_stats.state_changes;
+}
+
+int gxScene::getDrawCalls()const{
+	return gx_stats.draws+gx_stats.instance_draws;
+}
+
+///////////
+// LIGHT //
+///////////
+gxLight::gxLight( gxScene *s,int type ):
+scene(s){
+	memset( &d3d_light,0,sizeof(d3d_light) );
+}
+
+gxLight::~gxLight(){
+}
+
+void gxLight::setRange( float range ){
+}
+
+void gxLight::setPosition( const float pos[3] ){
+}
+
+void gxLight::setDirection( const float dir[3] ){
+}
+
+void gxLight::setConeAngles( float inner,float outer ){
+}
+
+///////////
+// SOUND //
+///////////
+uint32_t bbPlay3dSound( Sound *sound,float x,float y,float z,float vx,float vy,float vz ){
+	return 0;
+}
+
+int bbChannelPlaying( uint32_t channel ){
+	return 0;
+}
+
+void bbSet3dChannel( uint32_t channel,float x,float y,float z,float vx,float vy,float vz ){
+}
+
+void bbSet3dListenerConfig( float roll,float dopp,float dist ){
+}
+
+void bbSet3dListener( float x,float y,float z,float kx,float ky,float kz,float jx,float jy,float jz,float vx,float vy,float vz ){
+}
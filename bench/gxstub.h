@@ -0,0 +1,27 @@
+#ifndef GXSTUB_H
+#define GXSTUB_H
+
+//
+// Headless stand-ins for the gxruntime and sound commands blitz3d uses.
+//
+// Meshes are plain system memory, nothing is drawn, and every lock, draw and
+// state change is counted in gx_stats.
+//
+
+#include "../blitz3d/std.h"
+
+struct gxStats{
+	int mesh_locks,mesh_discards;
+	int draws,instance_draws,tris;
+	int state_changes;
+};
+
+extern gxStats gx_stats;
+
+//create gx_graphics and gx_scene
+void gxStubOpen();
+void gxStubClose();
+
+void gxStubReset();
+
+#endif
@@ -0,0 +1,74 @@
+//
+// MeshCollider build and sphere query time on random triangle soups.
+//
+// Only the constructor and collide() are used, so the same program can be built against an
+// older meshcollider.cpp to compare trees. Hit counts and the sum of hit times should match.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/meshcollider.h"
+
+static const float SIZE=100;		//soup is in a cube this size
+static const float TRI_SIZE=2;
+static const int QUERIES=20000;
+
+static void bench( int n_tris ){
+
+	srand( 1 );
+
+	vector<MeshCollider::Vertex> verts;
+	vector<MeshCollider::Triangle> tris;
+	for( int k=0;k<n_tris;++k ){
+		Vector c( benchRand(0,SIZE),benchRand(0,SIZE),benchRand(0,SIZE) );
+		MeshCollider::Triangle t;
+		t.surface=0;
+		t.index=k;
+		for( int j=0;j<3;++j ){
+			MeshCollider::Vertex v;
+			v.coords=c+Vector( benchRand(-TRI_SIZE,TRI_SIZE),benchRand(-TRI_SIZE,TRI_SIZE),benchRand(-TRI_SIZE,TRI_SIZE) )*.5f;
+			t.verts[j]=verts.size();
+			verts.push_back( v );
+		}
+		tris.push_back( t );
+	}
+
+	vector<Line> lines;
+	for( int k=0;k<QUERIES;++k ){
+		Vector o( benchRand(0,SIZE),benchRand(0,SIZE),benchRand(0,SIZE) );
+		Vector d( benchRand(-1,1),benchRand(-1,1),benchRand(-1,1) );
+		lines.push_back( Line( o,d*5 ) );
+	}
+
+	double t0=benchTime();
+	MeshCollider *coll=d_new MeshCollider( verts,tris );
+	double t1=benchTime();
+
+	int hits=0;
+	double time_sum=0;
+	Transform tf;
+	for( int k=0;k<QUERIES;++k ){
+		Collision c;
+		if( !coll->collide( lines[k],.5f,&c,tf ) ) continue;
+		++hits;
+		time_sum+=c.time;
+	}
+	double t2=benchTime();
+
+	printf( "%7i tris: build %8.1fms, %i queries %8.1fms, %i hits, time sum %.4f\n",
+		n_tris,(t1-t0)*1000,QUERIES,(t2-t1)*1000,hits,time_sum );
+
+	delete coll;
+}
+
+int main(){
+
+	gxStubOpen();
+
+	bench( 10000 );
+	bench( 100000 );
+	bench( 500000 );
+
+	gxStubClose();
+	return 0;
+}
@@ -0,0 +1,142 @@
+//
+// UpdateNormals time on 4 surfaces of 50k vertices each - about 200k in all, as surfaces can't
+// have more than 64k vertices. Each quad of a bumpy grid has its own 4 vertices, so normals are
+// only smooth if vertices are welded by position.
+//
+// The map<Vector,Vector> code Surface::updateNormals used to have is timed too, and plain
+// updateNormals must give the same normals.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/meshmodel.h"
+#include "../blitz3d/threadpool.h"
+
+static const int SURFACES=4;
+static const int GRID=112;		//quads per side, 4 verts each
+static const int RUNS=5;
+
+//bumps, and ridges sharp enough to keep hard edges with a max_angle
+static float height( int x,int z ){
+	return sinf( x*.3f )*cosf( z*.2f )*.5f+fabsf( x%32-16.0f )*1.5f;
+}
+
+static void createSurfaces( MeshModel *mesh ){
+	for( int s=0;s<SURFACES;++s ){
+		Surface *surf=mesh->createSurface( Brush() );
+		int x0=(s&1)*GRID,z0=(s>>1)*GRID;
+		for( int z=z0;z<z0+GRID;++z ){
+			for( int x=x0;x<x0+GRID;++x ){
+				int base=surf->numVertices();
+				for( int k=0;k<4;++k ){
+					int vx=x+(k&1),vz=z+(k>>1);
+					Surface::Vertex v;
+					v.coords=Vector( vx,height( vx,vz ),vz );
+					surf->addVertex( v );
+				}
+				Surface::Triangle t;
+				t.verts[0]=base;t.verts[1]=base+2;t.verts[2]=base+1;
+				surf->addTriangle( t );
+				t.verts[0]=base+1;t.verts[1]=base+2;t.verts[2]=base+3;
+				surf->addTriangle( t );
+			}
+		}
+	}
+}
+
+//the old implementation
+static void mapNormals( const Surface *surf,vector<Vector> &out ){
+	int k;
+	map<Vector,Vector> norm_map;
+	for( k=0;k<surf->numTriangles();++k ){
+		const Surface::Triangle &t=surf->getTriangle( k );
+		const Vector &v0=surf->getVertex( t.verts[0] ).coords;
+		const Vector &v1=surf->getVertex( t.verts[1] ).coords;
+		const Vector &v2=surf->getVertex( t.verts[2] ).coords;
+		Vector n=(v1-v0).cross(v2-v0);
+		if( n.length()<=EPSILON ) continue;
+		n.normalize();
+		norm_map[v0]+=n;
+		norm_map[v1]+=n;
+		norm_map[v2]+=n;
+	}
+	out.resize( surf->numVertices() );
+	for( k=0;k<surf->numVertices();++k ){
+		out[k]=norm_map[surf->getVertex( k ).coords].normalized();
+	}
+}
+
+static float checksum( const Vector &n ){
+	return n.x+n.y*2+n.z*3;
+}
+
+static void report( const char *desc,double best,float check ){
+	printf( "%-28s %8.2fms best of %i, checksum %.4f\n",desc,best*1000,RUNS,check );
+}
+
+int main(){
+
+	gxStubOpen();
+
+	MeshModel *mesh=d_new MeshModel();
+	createSurfaces( mesh );
+	const MeshModel::SurfaceList &surfs=mesh->getSurfaces();
+
+	int verts=0,tris=0,k,run;
+	for( k=0;k<surfs.size();++k ){
+		verts+=surfs[k]->numVertices();
+		tris+=surfs[k]->numTriangles();
+	}
+	printf( "%i surfaces, %i verts, %i tris\n",SURFACES,verts,tris );
+
+	vector<Vector> old_norms[SURFACES];
+	double best=0;
+	float check=0;
+	for( run=0;run<RUNS;++run ){
+		double t=benchTime();
+		for( k=0;k<SURFACES;++k ) mapNormals( surfs[k],old_norms[k] );
+		t=benchTime()-t;
+		if( !run || t<best ) best=t;
+	}
+	for( k=0;k<SURFACES;++k ){
+		for( int j=0;j<old_norms[k].size();++j ) check+=checksum( old_norms[k][j] );
+	}
+	report( "map:",best,check );
+
+	static const float angles[]={ 0,45 };
+	static const int threads[]={ 1,4 };
+	for( int a=0;a<2;++a ){
+		for( int th=0;th<2;++th ){
+			ThreadPool::setThreads( threads[th] );
+			for( run=0;run<RUNS;++run ){
+				double t=benchTime();
+				for( k=0;k<SURFACES;++k ) surfs[k]->updateNormals( angles[a]*PI/180 );
+				t=benchTime()-t;
+				if( !run || t<best ) best=t;
+			}
+			ThreadPool::setThreads( 1 );
+
+			check=0;
+			float max_diff=0;
+			for( k=0;k<SURFACES;++k ){
+				for( int j=0;j<surfs[k]->numVertices();++j ){
+					const Vector &n=surfs[k]->getVertex( j ).normal;
+					check+=checksum( n );
+					float d=n.distance( old_norms[k][j] );
+					if( d>max_diff ) max_diff=d;
+				}
+			}
+			//without an angle, normals must match the old code
+			if( !angles[a] ) CHECK( max_diff<1e-5f );
+
+			char desc[64];
+			sprintf( desc,"updateNormals( %i ), %i threads:",(int)angles[a],threads[th] );
+			report( desc,best,check );
+		}
+	}
+
+	delete mesh;
+
+	gxStubClose();
+	return benchFailed() ? 1 : 0;
+}
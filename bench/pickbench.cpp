@@ -0,0 +1,95 @@
+//
+// LinePick cost for a world of pickable spheres, some of which move between batches of picks.
+//
+// Each frame moves some spheres, then casts a batch of rays, so the time includes bringing pick
+// bounds up to date. Hits must match those of a new World, which builds its pick bounds from
+// scratch. Only World::traceRays is used, so the same program can be built against an older
+// world.cpp to compare.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/world.h"
+#include "../blitz3d/pivot.h"
+
+static const int SPHERES=20000;
+static const int RAYS=1000;
+static const int FRAMES=100;
+static const float SIZE=1000;	//spheres are in a square this size
+
+static vector<Pivot*> spheres;
+static vector<Line> rays;
+static vector<ObjCollision> results;
+
+static void moveSphere( Pivot *p ){
+	p->setLocalPosition( Vector( benchRand( 0,SIZE ),benchRand( -2,2 ),benchRand( 0,SIZE ) ) );
+}
+
+static void castRays(){
+	srand( 2 );
+	rays.clear();
+	for( int k=0;k<RAYS;++k ){
+		Vector o( benchRand( 0,SIZE ),10,benchRand( 0,SIZE ) );
+		rays.push_back( Line( o,Vector( benchRand( -50,50 ),-20,benchRand( -50,50 ) ) ) );
+	}
+}
+
+static void bench( World *world,int moved ){
+
+	double t=0;
+	int hits=0;
+	for( int frame=0;frame<FRAMES;++frame ){
+		double t0=benchTime();
+		for( int k=0;k<moved;++k ) moveSphere( spheres[rand()%SPHERES] );
+		hits+=world->traceRays( &rays[0],RAYS,0,&results[0] );
+		t+=benchTime()-t0;
+	}
+
+	//same hits as pick bounds built from scratch
+	vector<ObjCollision> fresh( RAYS );
+	World *check=d_new World();
+	check->traceRays( &rays[0],RAYS,0,&fresh[0] );
+	delete check;
+	int diffs=0;
+	for( int k=0;k<RAYS;++k ){
+		if( fresh[k].with!=results[k].with ) ++diffs;
+	}
+	CHECK( !diffs );
+
+	printf( "%6i of %i spheres moved: %8.3fms per %i picks, %.1f hits%s\n",
+		moved,SPHERES,t*1000/FRAMES,RAYS,hits/(float)FRAMES,diffs ? ", differs from new World!" : "" );
+}
+
+int main(){
+
+	gxStubOpen();
+
+	World *world=d_new World();
+
+	srand( 1 );
+	for( int k=0;k<SPHERES;++k ){
+		Pivot *p=d_new Pivot();
+		p->setPickGeometry( World::COLLISION_METHOD_SPHERE );
+		p->setCollisionRadii( Vector( 1,1,1 ) );
+		moveSphere( p );
+		benchInsert( p );
+		spheres.push_back( p );
+	}
+	castRays();
+	results.resize( RAYS );
+
+	//first picks build the pick bounds
+	world->traceRays( &rays[0],RAYS,0,&results[0] );
+
+	bench( world,0 );
+	bench( world,20 );
+	bench( world,200 );
+	bench( world,2000 );
+	bench( world,SPHERES );
+
+	for( int k=0;k<spheres.size();++k ) delete spheres[k];
+	delete world;
+
+	gxStubClose();
+	return benchFailed() ? 1 : 0;
+}
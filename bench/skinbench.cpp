@@ -0,0 +1,128 @@
+//
+// Skinning throughput: RenderWorld with N boned characters, each a tube of
+// rings skinned to a chain of bones, with the chain bending every frame.
+//
+// With more than one WorldThreads, characters are skinned up front by the
+// threaded batch pass.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/world.h"
+#include "../blitz3d/camera.h"
+#include "../blitz3d/pivot.h"
+#include "../blitz3d/meshmodel.h"
+#include "../blitz3d/meshloader.h"
+#include "../blitz3d/threadpool.h"
+
+static const int BONES=30;
+static const int RING_VERTS=100;	//BONES*RING_VERTS verts per character
+static const int FRAMES=50;
+
+static MeshModel *createCharacter(){
+
+	MeshModel *mesh=d_new MeshModel();
+	Surface *surf=mesh->createSurface( Brush() );
+
+	vector<Object*> objs;
+	objs.push_back( mesh );
+	Object *parent=mesh;
+	for( int k=0;k<BONES;++k ){
+		Pivot *bone=d_new Pivot();
+		bone->setParent( parent );
+		bone->setLocalPosition( Vector( 0,k ? 1 : 0,0 ) );
+		objs.push_back( bone );
+		parent=bone;
+	}
+
+	//ring k is between bones k and k+1
+	for( int k=0;k<BONES;++k ){
+		for( int j=0;j<RING_VERTS;++j ){
+			float an=j*TWOPI/RING_VERTS;
+			Surface::Vertex v;
+			v.coords=Vector( cosf( an )*.5f,k+.5f,sinf( an )*.5f );
+			v.normal=Vector( cosf( an ),0,sinf( an ) );
+			MeshLoader::addBone( v,.5f,k+1 );
+			if( k+1<BONES ) MeshLoader::addBone( v,.5f,k+2 );
+			surf->addVertex( v );
+		}
+	}
+	for( int k=0;k+1<BONES;++k ){
+		for( int j=0;j<RING_VERTS;++j ){
+			int v0=k*RING_VERTS+j,v1=k*RING_VERTS+(j+1)%RING_VERTS;
+			Surface::Triangle t;
+			t.verts[0]=v0;t.verts[1]=v1;t.verts[2]=v1+RING_VERTS;
+			surf->addTriangle( t );
+			t.verts[0]=v0;t.verts[1]=v1+RING_VERTS;t.verts[2]=v0+RING_VERTS;
+			surf->addTriangle( t );
+		}
+	}
+
+	mesh->setAnimator( d_new Animator( objs,1 ) );
+	mesh->createBones();
+	return mesh;
+}
+
+//bend every bone of a character
+static void bend( Entity *e,float an ){
+	for( Entity *p=e->children();p;p=p->children() ){
+		p->setLocalRotation( rollQuat( an ) );
+	}
+}
+
+static void bench( int n,int threads ){
+
+	World *world=d_new World();
+
+	Camera *cam=d_new Camera();
+	cam->setViewport( 0,0,640,480 );
+	benchInsert( cam );
+
+	//only copies are drawn
+	MeshModel *proto=createCharacter();
+	proto->setVisible( false );
+
+	vector<Entity*> chars;
+	for( int k=0;k<n;++k ){
+		Object *t=proto->copy();
+		t->setLocalPosition( Vector( (k%20-10)*2.0f,(k/20%20-10)*2.0f,100 ) );
+		benchInsert( t );
+		chars.push_back( t );
+	}
+
+	ThreadPool::setThreads( threads );
+
+	gxStubReset();
+
+	double t=benchTime();
+	for( int frame=0;frame<FRAMES;++frame ){
+		for( int k=0;k<chars.size();++k ) bend( chars[k],sinf( frame*.1f+k )*.05f );
+		world->render( 1 );
+	}
+	t=benchTime()-t;
+
+	ThreadPool::setThreads( 1 );
+
+	double verts=(double)n*BONES*RING_VERTS*FRAMES;
+	printf( "%4i characters, %2i threads: %8.2fms per frame, %6.1fM verts/sec, %i draws\n",
+		n,threads,t*1000/FRAMES,verts/t/1000000,gx_stats.draws/FRAMES );
+
+	for( int k=0;k<chars.size();++k ) delete chars[k];
+	delete proto;
+	delete cam;
+	delete world;
+}
+
+int main(){
+
+	gxStubOpen();
+
+	bench( 50,1 );
+	bench( 200,1 );
+	bench( 200,2 );
+	bench( 200,4 );
+	bench( 200,8 );
+
+	gxStubClose();
+	return 0;
+}
@@ -0,0 +1,81 @@
+//
+// Sprite batching: sprites sharing a brush go out in one draw, and the shared
+// vertex buffer is locked once per draw, with discard only when the ring wraps.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/world.h"
+#include "../blitz3d/camera.h"
+#include "../blitz3d/sprite.h"
+
+static const int OPAQUE_BRUSHES=4;
+static const int OPAQUE_SPRITES=32;		//per brush
+static const int ALPHA_SPRITES=128;
+static const int RING_SPRITES=1024;		//default batch size
+
+static Sprite *createSprite( const Vector &color,float alpha ){
+	Sprite *s=d_new Sprite();
+	s->setFX( gxScene::FX_FULLBRIGHT );
+	s->setColor( color );
+	if( alpha<1 ){
+		s->setAlpha( alpha );
+		s->setBlend( gxScene::BLEND_ALPHA );
+	}
+	s->setLocalPosition( Vector( benchRand(-5,5),benchRand(-5,5),benchRand(20,100) ) );
+	benchInsert( s );
+	return s;
+}
+
+int main(){
+
+	gxStubOpen();
+
+	World *world=d_new World();
+
+	Camera *cam=d_new Camera();
+	cam->setViewport( 0,0,640,480 );
+	benchInsert( cam );
+
+	vector<Entity*> ents;
+	ents.push_back( cam );
+
+	//interleave opaque brushes, so batching has to sort them
+	for( int k=0;k<OPAQUE_SPRITES;++k ){
+		for( int j=0;j<OPAQUE_BRUSHES;++j ){
+			ents.push_back( createSprite( Vector( j*.25f,1,1 ),1 ) );
+		}
+	}
+	for( int k=0;k<ALPHA_SPRITES;++k ){
+		ents.push_back( createSprite( Vector( 1,1,1 ),.5f ) );
+	}
+
+	int per_frame=OPAQUE_BRUSHES*OPAQUE_SPRITES+ALPHA_SPRITES;
+	int frames=RING_SPRITES/per_frame*2;
+
+	for( int frame=0;frame<frames;++frame ){
+		gxStubReset();
+
+		world->render( 1 );
+
+		//one draw per opaque brush, and one for the alpha sprites
+		CHECK( gx_stats.draws==OPAQUE_BRUSHES+1 );
+		CHECK( gx_stats.mesh_locks==OPAQUE_BRUSHES+1 );
+		CHECK( gx_stats.tris==per_frame*2 );
+
+		//frames fill the ring exactly, so it only wraps at the start of a frame
+		bool wrap=frame && !(frame%(RING_SPRITES/per_frame));
+		CHECK( gx_stats.mesh_discards==(wrap ? 1 : 0) );
+
+		printf( "frame %i: draws=%i locks=%i discards=%i tris=%i\n",
+			frame,gx_stats.draws,gx_stats.mesh_locks,gx_stats.mesh_discards,gx_stats.tris );
+	}
+
+	for( int k=0;k<ents.size();++k ) delete ents[k];
+	delete world;
+
+	gxStubClose();
+
+	if( benchFailed() ) printf( "%i checks failed\n",benchFailed() );
+	return benchFailed() ? 1 : 0;
+}
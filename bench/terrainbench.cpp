@@ -0,0 +1,86 @@
+//
+// RenderWorld cost of a 512 terrain in ROAM and chunked mode, with a camera flying low over it.
+//
+// Times include refining or picking chunk levels, and filling stub vertex and index buffers.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/world.h"
+#include "../blitz3d/camera.h"
+#include "../blitz3d/terrain.h"
+
+static const int SIZE_SHIFT=9;
+static const int FRAMES=500;
+
+static Terrain *createTerrain(){
+
+	Terrain *t=d_new Terrain( SIZE_SHIFT );
+
+	int size=1<<SIZE_SHIFT;
+	srand( 1 );
+	for( int z=0;z<size;++z ){
+		for( int x=0;x<size;++x ){
+			float h=sinf( x*.02f )*cosf( z*.03f )*.3f+sinf( x*.11f+z*.07f )*.1f+benchRand( 0,.02f )+.5f;
+			t->setHeight( x,z,h,false );
+		}
+	}
+	t->setLocalScale( Vector( 4,200,4 ) );
+	benchInsert( t );
+	return t;
+}
+
+static void bench( Terrain *terr,int mode,int detail ){
+
+	World *world=d_new World();
+
+	Camera *cam=d_new Camera();
+	cam->setViewport( 0,0,640,480 );
+	cam->setRange( 1,4000 );
+	benchInsert( cam );
+
+	terr->setMode( mode );
+	terr->setDetail( detail,false );
+
+	float size=(1<<SIZE_SHIFT)*4;
+
+	double t=0;
+	int tris=0;
+	for( int frame=0;frame<=FRAMES;++frame ){
+		float an=frame*TWOPI/FRAMES;
+		cam->setLocalPosition( Vector( size*.5f+cosf( an )*size*.3f,200,size*.5f+sinf( an )*size*.3f ) );
+		cam->setLocalRotation( yawQuat( -an )*pitchQuat( .3f ) );
+
+		gxStubReset();
+
+		//first frame builds the tessellation or chunk meshes
+		double t0=benchTime();
+		world->render( 1 );
+		if( frame ) t+=benchTime()-t0;
+
+		tris+=gx_stats.tris;
+	}
+
+	printf( "%-7s detail %5i: %8.3fms per frame, %7i tris per frame\n",
+		mode ? "chunked" : "ROAM",detail,t*1000/FRAMES,tris/(FRAMES+1) );
+
+	delete cam;
+	delete world;
+}
+
+int main(){
+
+	gxStubOpen();
+
+	Terrain *terr=createTerrain();
+
+	for( int mode=0;mode<2;++mode ){
+		bench( terr,mode,2000 );
+		bench( terr,mode,10000 );
+	}
+
+	delete terr;
+
+	gxStubClose();
+	return 0;
+}
@@ -0,0 +1,131 @@
+//
+// World transform update cost for deep and wide hierarchies.
+//
+// Each case changes some local transforms and then reads world transforms back, once per frame.
+// Only the transform setters and getters are used, so the same program can be built against an
+// older entity.cpp to compare. Checksums should match.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/pivot.h"
+
+static const int FRAMES=1000;
+
+static Pivot *createChain( int n,vector<Entity*> &out ){
+	out.clear();
+	Pivot *root=d_new Pivot();
+	Entity *parent=root;
+	for( int k=0;k<n;++k ){
+		Pivot *p=d_new Pivot();
+		p->setParent( parent );
+		p->setLocalPosition( Vector( 0,1,0 ) );
+		out.push_back( p );
+		parent=p;
+	}
+	return root;
+}
+
+static Pivot *createFan( int n,vector<Entity*> &out ){
+	out.clear();
+	Pivot *root=d_new Pivot();
+	for( int k=0;k<n;++k ){
+		Pivot *p=d_new Pivot();
+		p->setParent( root );
+		p->setLocalPosition( Vector( k%100,k/100,0 ) );
+		out.push_back( p );
+	}
+	return root;
+}
+
+static float sum( const Vector &v ){
+	return v.x+v.y+v.z;
+}
+
+static void report( const char *desc,double t,float check ){
+	printf( "%-40s %8.3fms per frame, checksum %.4f\n",desc,t*1000/FRAMES,check );
+}
+
+//move root, read every node
+static void moveRoot( const char *desc,Entity *root,const vector<Entity*> &nodes ){
+	float check=0;
+	double t=benchTime();
+	for( int frame=0;frame<FRAMES;++frame ){
+		root->setLocalPosition( Vector( frame*.01f,0,0 ) );
+		root->setLocalRotation( yawQuat( frame*.001f ) );
+		for( int k=0;k<nodes.size();++k ) check+=sum( nodes[k]->getWorldPosition() );
+	}
+	report( desc,benchTime()-t,check );
+}
+
+//move root, read the last node only
+static void moveRootReadLeaf( const char *desc,Entity *root,const vector<Entity*> &nodes ){
+	float check=0;
+	double t=benchTime();
+	for( int frame=0;frame<FRAMES;++frame ){
+		root->setLocalPosition( Vector( frame*.01f,0,0 ) );
+		check+=sum( nodes.back()->getWorldPosition() );
+	}
+	report( desc,benchTime()-t,check );
+}
+
+//move root and read it back a few times, as a player moved in steps is, then read every node
+static void stepRoot( const char *desc,Entity *root,const vector<Entity*> &nodes ){
+	float check=0;
+	double t=benchTime();
+	for( int frame=0;frame<FRAMES;++frame ){
+		for( int k=0;k<10;++k ){
+			root->setLocalPosition( Vector( frame*.01f+k*.001f,0,0 ) );
+			check+=sum( root->getWorldPosition() );
+		}
+		for( int k=0;k<nodes.size();++k ) check+=sum( nodes[k]->getWorldPosition() );
+	}
+	report( desc,benchTime()-t,check );
+}
+
+//rotate every node, as animation does, then read every node
+static void poseAll( const char *desc,Entity *root,const vector<Entity*> &nodes ){
+	float check=0;
+	double t=benchTime();
+	for( int frame=0;frame<FRAMES;++frame ){
+		for( int k=0;k<nodes.size();++k ) nodes[k]->setLocalRotation( rollQuat( sinf( frame*.01f+k )*.01f ) );
+		for( int k=0;k<nodes.size();++k ) check+=sum( nodes[k]->getWorldPosition() );
+	}
+	report( desc,benchTime()-t,check );
+}
+
+//position every node and read it straight back, as a script loop calling PositionEntity and EntityX does
+static void positionLoop( const char *desc,Entity *root,const vector<Entity*> &nodes ){
+	float check=0;
+	double t=benchTime();
+	for( int frame=0;frame<FRAMES;++frame ){
+		for( int k=0;k<nodes.size();++k ){
+			nodes[k]->setLocalPosition( Vector( 0,1,frame*.001f ) );
+			check+=nodes[k]->getWorldPosition().z;
+		}
+	}
+	report( desc,benchTime()-t,check );
+}
+
+int main(){
+
+	gxStubOpen();
+
+	vector<Entity*> nodes;
+
+	Pivot *chain=createChain( 300,nodes );
+	moveRoot( "300 chain, move root, read all:",chain,nodes );
+	moveRootReadLeaf( "300 chain, move root, read leaf:",chain,nodes );
+	poseAll( "300 chain, rotate all, read all:",chain,nodes );
+	positionLoop( "300 chain, position and read each:",chain,nodes );
+	delete chain;
+
+	Pivot *fan=createFan( 10000,nodes );
+	moveRoot( "10000 fan, move root, read all:",fan,nodes );
+	stepRoot( "10000 fan, step root 10 times, read all:",fan,nodes );
+	poseAll( "10000 fan, rotate all, read all:",fan,nodes );
+	delete fan;
+
+	gxStubClose();
+	return 0;
+}
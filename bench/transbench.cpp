@@ -0,0 +1,68 @@
+//
+// RenderWorld cost for N alpha blended sprites in front of a camera, which have to be sorted far
+// to near every frame. The camera sways from side to side so the order keeps changing.
+//
+// Sprites are all in view, so everything that isn't sorting is the same for a given N whichever
+// way they're sorted. The same program can be built against an older world.cpp to compare.
+//
+
+#include "bench.h"
+
+#include "../blitz3d/world.h"
+#include "../blitz3d/camera.h"
+#include "../blitz3d/sprite.h"
+
+static const int FRAMES=50;
+
+static void bench( int n ){
+
+	World *world=d_new World();
+
+	Camera *cam=d_new Camera();
+	cam->setViewport( 0,0,640,480 );
+	benchInsert( cam );
+
+	srand( 1 );
+	vector<Sprite*> sprites;
+	for( int k=0;k<n;++k ){
+		Sprite *s=d_new Sprite();
+		s->setFX( gxScene::FX_FULLBRIGHT );
+		s->setAlpha( .5f );
+		s->setBlend( gxScene::BLEND_ALPHA );
+		float z=benchRand( 20,100 );
+		s->setLocalPosition( Vector( benchRand(-.5f,.5f)*z,benchRand(-.3f,.3f)*z,z ) );
+		benchInsert( s );
+		sprites.push_back( s );
+	}
+
+	//first render builds lists and buffers
+	world->render( 1 );
+
+	gxStubReset();
+
+	double t=benchTime();
+	for( int frame=0;frame<FRAMES;++frame ){
+		cam->setLocalPosition( Vector( sinf( frame*.3f )*10,0,0 ) );
+		world->render( 1 );
+	}
+	t=benchTime()-t;
+
+	printf( "%6i alpha sprites: %8.3fms per frame, %6.1fns per sprite, %i tris\n",
+		n,t*1000/FRAMES,t*1e9/FRAMES/n,gx_stats.tris/FRAMES );
+
+	for( int k=0;k<sprites.size();++k ) delete sprites[k];
+	delete cam;
+	delete world;
+}
+
+int main(){
+
+	gxStubOpen();
+
+	bench( 1000 );
+	bench( 10000 );
+	bench( 100000 );
+
+	gxStubClose();
+	return 0;
+}
@@ -1,14 +1,48 @@
-
 #include "std.h"
 #include "animation.h"
 
+#include <algorithm>
+
 struct Animation::Rep{
 
 	int ref_cnt;
 
-	typedef map<int,Quat> KeyList;
+	//keys sorted by frame
+	template<class T> struct KeyList{
+		vector<int> frames;
+		vector<T> values;
+
+		int size()const{ return frames.size(); }
+
+		void setKey( int frame,const T &value ){
+			if( !frames.size() || frame>frames.back() ){
+				frames.push_back( frame );
+				values.push_back( value );
+				return;
+			}
+			vector<int>::iterator it=lower_bound( frames.begin(),frames.end(),frame );
+			int n=it-frames.begin();
+			if( *it==frame ){
+				values[n]=value;
+				return;
+			}
+			frames.insert( it,frame );
+			values.insert( values.begin()+n,value );
+		}
 
-	KeyList scale_anim,rot_anim,pos_anim;
+		//returns index of first key after frame, trying cursor and the key after it first
+		int findNext( int frame,int &cursor )const{
+			int n=frames.size();
+			for( int k=cursor;k<=cursor+1 && k<=n;++k ){
+				if( k>0 && frames[k-1]>frame ) break;
+				if( k==n || frames[k]>frame ) return cursor=k;
+			}
+			return cursor=upper_bound( frames.begin(),frames.end(),frame )-frames.begin();
+		}
+	};
+
+	KeyList<Vector> scale_anim,pos_anim;
+	KeyList<Quat> rot_anim;
 
 	Rep():
 	ref_cnt(1){
@@ -16,39 +50,37 @@ struct Animation::Rep{
 
 	Rep( const Rep &t ):
 	ref_cnt(1),
-	scale_anim(t.scale_anim),rot_anim(t.rot_anim),pos_anim(t.pos_anim){
+	scale_anim(t.scale_anim),pos_anim(t.pos_anim),rot_anim(t.rot_anim){
 	}
 
-	Vector getLinearValue( const KeyList &keys,float time )const{
-		KeyList::const_iterator next,curr;
+	Vector getLinearValue( const KeyList<Vector> &keys,float time,int &cursor )const{
+		int next=keys.findNext( (int)time,cursor );
 
-		//for( next=keys.begin();next!=keys.end() && time>=next->first;++next ){}
-		next=keys.upper_bound( (int)time );
+		if( next==0 ) return keys.values[0];
+		int curr=next-1;
+		if( next==keys.size() ) return keys.values[curr];
 
-		if( next==keys.begin() ) return next->second.v;
-		curr=next;--curr;
-		if( next==keys.end() ) return curr->second.v;
-
-		float delta=( time-curr->first )/( next->first-curr->first );
-		return ( next->second.v-curr->second.v )*delta+curr->second.v;
+		float delta=( time-keys.frames[curr] )/( keys.frames[next]-keys.frames[curr] );
+		return ( keys.values[next]-keys.values[curr] )*delta+keys.values[curr];
 	}
-	
-	Quat getSlerpValue( const KeyList &keys,float time )const{
-		KeyList::const_iterator next,curr;
 
-		//for( next=keys.begin();next!=keys.end() && time>=next->first;++next ){}
-		next=keys.upper_bound( (int)time );
+	Quat getSlerpValue( const KeyList<Quat> &keys,float time,int &cursor )const{
+		int next=keys.findNext( (int)time,cursor );
 
-		if( next==keys.begin() ) return next->second;
-		curr=next;--curr;
-		if( next==keys.end() ) return curr->second;
+		if( next==0 ) return keys.values[0];
+		int curr=next-1;
+		if( next==keys.size() ) return keys.values[curr];
 
-		float delta=( time-curr->first )/( next->first-curr->first );
-		return curr->second.slerpTo( next->second,delta );
+		float delta=( time-keys.frames[curr] )/( keys.frames[next]-keys.frames[curr] );
+		return keys.values[curr].slerpTo( keys.values[next],delta );
 	}
 
-	void setKey( KeyList &keys,int time,const Quat &value ){
-		keys[time]=value;
+	template<class T> static void extract( const KeyList<T> &src,KeyList<T> &dest,int first,int last ){
+		for( int k=0;k<src.size();++k ){
+			int frame=src.frames[k];
+			if( frame<first || frame>last ) continue;
+			dest.setKey( frame-first,src.values[k] );
+		}
 	}
 };
 
@@ -63,19 +95,9 @@ rep( t.rep ){
 
 Animation::Animation( const Animation &t,int first,int last ):
 rep( new Rep() ){
-	Rep::KeyList::const_iterator it;
-	for( it=t.rep->pos_anim.begin();it!=t.rep->pos_anim.end();++it ){
-		if( it->first<first || it->first>last ) continue;
-		rep->setKey( rep->pos_anim,it->first-first,it->second );
-	}
-	for( it=t.rep->scale_anim.begin();it!=t.rep->scale_anim.end();++it ){
-		if( it->first<first || it->first>last ) continue;
-		rep->setKey( rep->scale_anim,it->first-first,it->second );
-	}
-	for( it=t.rep->rot_anim.begin();it!=t.rep->rot_anim.end();++it ){
-		if( it->first<first || it->first>last ) continue;
-		rep->setKey( rep->rot_anim,it->first-first,it->second );
-	}
+	Rep::extract( t.rep->pos_anim,rep->pos_anim,first,last );
+	Rep::extract( t.rep->scale_anim,rep->scale_anim,first,last );
+	Rep::extract( t.rep->rot_anim,rep->rot_anim,first,last );
 }
 
 Animation::~Animation(){
@@ -99,17 +121,17 @@ Animation::Rep *Animation::write(){
 
 void Animation::setScaleKey( int time,const Vector &q ){
 	write();
-	rep->setKey( rep->scale_anim,time,Quat( 0,q ) );
+	rep->scale_anim.setKey( time,q );
 }
 
 void Animation::setPositionKey( int time,const Vector &q ){
 	write();
-	rep->setKey( rep->pos_anim,time,Quat( 0,q ) );
+	rep->pos_anim.setKey( time,q );
 }
 
 void Animation::setRotationKey( int time,const Quat &q ){
 	write();
-	rep->setKey( rep->rot_anim,time,q );
+	rep->rot_anim.setKey( time,q );
 }
 
 int Animation::numScaleKeys()const{
@@ -124,19 +146,49 @@ int Animation::numPositionKeys()const{
 	return rep->pos_anim.size();
 }
 
+int Animation::getScaleKey( int n,Vector *q )const{
+	*q=rep->scale_anim.values[n];
+	return rep->scale_anim.frames[n];
+}
+
+int Animation::getPositionKey( int n,Vector *p )const{
+	*p=rep->pos_anim.values[n];
+	return rep->pos_anim.frames[n];
+}
+
+int Animation::getRotationKey( int n,Quat *q )const{
+	*q=rep->rot_anim.values[n];
+	return rep->rot_anim.frames[n];
+}
+
 Vector Animation::getScale( float time )const{
-	if( !rep->scale_anim.size() ) return Vector(1,1,1);
-	return rep->getLinearValue( rep->scale_anim,time );
+	int cursor=0;
+	return getScale( time,cursor );
 }
 
 Vector Animation::getPosition( float time )const{
-	if( !rep->pos_anim.size() ) return Vector(0,0,0);
-	return rep->getLinearValue( rep->pos_anim,time );
+	int cursor=0;
+	return getPosition( time,cursor );
 }
 
 Quat Animation::getRotation( float time )const{
+	int cursor=0;
+	return getRotation( time,cursor );
+}
+
+Vector Animation::getScale( float time,int &cursor )const{
+	if( !rep->scale_anim.size() ) return Vector(1,1,1);
+	return rep->getLinearValue( rep->scale_anim,time,cursor );
+}
+
+Vector Animation::getPosition( float time,int &cursor )const{
+	if( !rep->pos_anim.size() ) return Vector(0,0,0);
+	return rep->getLinearValue( rep->pos_anim,time,cursor );
+}
+
+Quat Animation::getRotation( float time,int &cursor )const{
 	if( !rep->rot_anim.size() ) return Quat();
-	return rep->getSlerpValue( rep->rot_anim,time );
+	return rep->getSlerpValue( rep->rot_anim,time,cursor );
 }
 
 /*
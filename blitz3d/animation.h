@@ -23,10 +23,20 @@ public:
 	int numRotationKeys()const;
 	int numPositionKeys()const;
 
+	//nth key in frame order, returns its frame
+	int getScaleKey( int n,Vector *q )const;
+	int getPositionKey( int n,Vector *p )const;
+	int getRotationKey( int n,Quat *q )const;
+
 	Vector getScale( float time )const;
 	Vector getPosition( float time )const;
 	Quat getRotation( float time )const;
 
+	//as above, but cursor caches the last key found so sequential sampling is fast
+	Vector getScale( float time,int &cursor )const;
+	Vector getPosition( float time,int &cursor )const;
+	Quat getRotation( float time,int &cursor )const;
+
 private:
 	struct Rep;
 	Rep *rep;
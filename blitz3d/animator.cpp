@@ -31,6 +31,7 @@ Animator::Animator( const vector<Object*> &objs,int frames ):_objs(objs){
 
 void Animator::reset(){
 	_seq=_mode=_seq_len=_time=_speed=_trans_time=_trans_speed=0;
+	_committed=false;
 }
 
 void Animator::addObjs( Object *obj ){
@@ -79,38 +80,60 @@ void Animator::extractSeq( int first,int last,int seq ){
 	}
 }
 
-void Animator::updateAnim(){
+void Animator::sampleAnim(){
+
+	_pose.resize( _objs.size() );
 
 	for( int k=0;k<_objs.size();++k ){
 
-		Object *obj=_objs[k];
-		const Animation &keys=_anims[k].keys[_seq];
+		Anim &anim=_anims[k];
+		Pose &pose=_pose[k];
+		const Animation &keys=anim.keys[_seq];
 
-		if( keys.numPositionKeys() ){
-			obj->setLocalPosition( keys.getPosition( _time ) );
+		if( pose.has_pos=!!keys.numPositionKeys() ){
+			pose.pos=keys.getPosition( _time,anim.pos_key );
 		}
-		if( keys.numScaleKeys() ){
-			obj->setLocalScale( keys.getScale( _time ) );
+		if( pose.has_scl=!!keys.numScaleKeys() ){
+			pose.scl=keys.getScale( _time,anim.scl_key );
 		}
-		if( keys.numRotationKeys() ){
-			obj->setLocalRotation( keys.getRotation( _time ) );
+		if( pose.has_rot=!!keys.numRotationKeys() ){
+			pose.rot=keys.getRotation( _time,anim.rot_key );
 		}
 	}
 }
 
-void Animator::updateTrans(){
+void Animator::sampleTrans(){
+
+	_pose.resize( _objs.size() );
 
 	for( int k=0;k<_objs.size();++k ){
 
-		Object *obj=_objs[k];
 		const Anim &anim=_anims[k];
+		Pose &pose=_pose[k];
+
+		if( pose.has_pos=anim.pos ) pose.pos=(anim.dest_pos-anim.src_pos)*_trans_time+anim.src_pos;
+		if( pose.has_scl=anim.scl ) pose.scl=(anim.dest_scl-anim.src_scl)*_trans_time+anim.src_scl;
+		if( pose.has_rot=anim.rot ) pose.rot=anim.src_rot.slerpTo( anim.dest_rot,_trans_time );
+	}
+}
+
+void Animator::setPose(){
 
-		if( anim.pos ) obj->setLocalPosition( (anim.dest_pos-anim.src_pos)*_trans_time+anim.src_pos );
-		if( anim.scl ) obj->setLocalScale( (anim.dest_scl-anim.src_scl)*_trans_time+anim.src_scl );
-		if( anim.rot ) obj->setLocalRotation( anim.src_rot.slerpTo( anim.dest_rot,_trans_time ) );
+	for( int k=0;k<_objs.size();++k ){
+		const Pose &pose=_pose[k];
+		if( !pose.has_pos && !pose.has_scl && !pose.has_rot ) continue;
+		_objs[k]->setLocalPose(
+			pose.has_pos ? &pose.pos : 0,
+			pose.has_scl ? &pose.scl : 0,
+			pose.has_rot ? &pose.rot : 0 );
 	}
 }
 
+void Animator::updateAnim(){
+	sampleAnim();
+	setPose();
+}
+
 void Animator::beginTrans(){
 
 	for( int k=0;k<_objs.size();++k ){
@@ -121,15 +144,15 @@ void Animator::beginTrans(){
 
 		if( anim.pos=!!keys.numPositionKeys() ){
 			anim.src_pos=obj->getLocalPosition();
-			anim.dest_pos=keys.getPosition( _time );
+			anim.dest_pos=keys.getPosition( _time,anim.pos_key );
 		}
 		if( anim.scl=!!keys.numScaleKeys() ){
 			anim.src_scl=obj->getLocalScale();
-			anim.dest_scl=keys.getScale( _time );
+			anim.dest_scl=keys.getScale( _time,anim.scl_key );
 		}
 		if( anim.rot=!!keys.numRotationKeys() ){
 			anim.src_rot=obj->getLocalRotation();
-			anim.dest_rot=keys.getRotation( _time );
+			anim.dest_rot=keys.getRotation( _time,anim.rot_key );
 		}
 	}
 }
@@ -178,19 +201,29 @@ void Animator::animate( int mode,float speed,int seq,float trans ){
 
 void Animator::update( float elapsed ){
 
-	if( !_mode ) return;
+	if( _committed ){
+		_committed=false;
+		return;
+	}
+
+	if( evaluate( elapsed ) ) setPose();
+}
+
+bool Animator::evaluate( float elapsed ){
+
+	if( !_mode ) return false;
 
 	if( _mode&0x8000 ){
 		_trans_time+=_trans_speed*elapsed;
 		if( _trans_time<1 ){
-			updateTrans();
-			return;
+			sampleTrans();
+			return true;
 		}
 		_mode&=0x7fff;
 		if( !_mode || !_speed ){
-			updateAnim();
+			sampleAnim();
 			_mode=0;
-			return;
+			return true;
 		}
 	}
 
@@ -213,6 +246,11 @@ void Animator::update( float elapsed ){
 		break;
 	}
 
-	updateAnim();
+	sampleAnim();
+	return true;
 }
 
+void Animator::commit(){
+	setPose();
+	_committed=true;
+}
@@ -32,6 +32,12 @@ public:
 
 	void update( float elapsed );
 
+	//frame level animation pass, see World::update...
+	//advance animation and sample pose without touching objects - safe to call for different animators in parallel
+	bool evaluate( float elapsed );
+	//write evaluated pose to objects - the next update() call then does nothing
+	void commit();
+
 	int animSeq()const{ return _seq; }
 	int animLen()const{ return _seq_len; }
 	float animTime()const{ return _time; }
@@ -39,6 +45,9 @@ public:
 
 	int numSeqs()const{ return _seqs.size(); }
 	const vector<Object*> &getObjects()const{ return _objs; }
+	//length of a sequence, and the keys of getObjects()[obj] for it
+	int seqFrames( int seq )const{ return _seqs[seq].frames; }
+	const Animation &getKeys( int obj,int seq )const{ return _anims[obj].keys[seq]; }
 
 private:
 	struct Seq{
@@ -53,10 +62,21 @@ private:
 		Vector src_pos,dest_pos;
 		Vector src_scl,dest_scl;
 		Quat src_rot,dest_rot;
-		Anim():pos(false),scl(false),rot(false){}
+		//key cursors
+		int pos_key,scl_key,rot_key;
+		Anim():pos(false),scl(false),rot(false),pos_key(0),scl_key(0),rot_key(0){}
+	};
+
+	//sampled local transforms of objects
+	struct Pose{
+		Vector pos,scl;
+		Quat rot;
+		bool has_pos,has_scl,has_rot;
 	};
 
 	vector<Seq> _seqs;
+	vector<Pose> _pose;
+	bool _committed;
 
 	vector<Anim> _anims;
 	vector<Object*> _objs;
@@ -67,8 +87,10 @@ private:
 	void reset();
 	void addObjs( Object *obj );
 	void updateAnim();
+	void sampleAnim();
+	void sampleTrans();
+	void setPose();
 	void beginTrans();
-	void updateTrans();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,119 @@
+
+#include "std.h"
+#include "asyncload.h"
+#include "cachedtexture.h"
+#include "meshcache.h"
+
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//loads mostly wait on the disk, so a couple of threads is plenty
+static const int LOADER_THREADS=2;
+
+static vector<std::thread> loaders;
+
+static std::mutex load_mutex;
+static std::condition_variable queue_cv,ready_cv;
+static std::deque<AsyncLoad*> queue;
+static bool quit;
+
+AsyncLoad::AsyncLoad( int type,const string &file,int flags ):
+type(type),file(file),flags(flags),state(STATE_QUEUED),prog(0),staged(0){
+
+	std::lock_guard<std::mutex> lock( load_mutex );
+
+	//only b3d meshes do anything in the background, and cached meshes are quicker to load when finished
+	if( type==LOAD_MESH ){
+		int n=file.rfind( "." );
+		if( n==string::npos || tolower( file.substr( n+1 ) )!="b3d" || MeshCache::fresh( file,flags ) ){
+			state=STATE_READY;
+			prog=1;
+			return;
+		}
+	}
+
+	if( !loaders.size() ){
+		quit=false;
+		for( int k=0;k<LOADER_THREADS;++k ) loaders.push_back( std::thread( loaderProc ) );
+	}
+	queue.push_back( this );
+	queue_cv.notify_one();
+}
+
+AsyncLoad::~AsyncLoad(){
+	{
+		std::unique_lock<std::mutex> lock( load_mutex );
+		if( state==STATE_QUEUED ){
+			queue.erase( std::find( queue.begin(),queue.end(),this ) );
+		}else{
+			ready_cv.wait( lock,[this]{ return state==STATE_READY; } );
+		}
+	}
+	if( staged ) Loader_B3D::freeStaged( staged );
+	if( preloaded.size() ) gxGraphics::discardImage( preloaded );
+}
+
+bool AsyncLoad::ready()const{
+	std::lock_guard<std::mutex> lock( load_mutex );
+	return state==STATE_READY;
+}
+
+float AsyncLoad::progress()const{
+	return prog;
+}
+
+void AsyncLoad::wait(){
+	std::unique_lock<std::mutex> lock( load_mutex );
+	if( state==STATE_QUEUED ){
+		//do it now rather than wait for the loaders to get to it
+		queue.erase( std::find( queue.begin(),queue.end(),this ) );
+		state=STATE_LOADING;
+		lock.unlock();
+		run();
+		lock.lock();
+		state=STATE_READY;
+		return;
+	}
+	ready_cv.wait( lock,[this]{ return state==STATE_READY; } );
+}
+
+void AsyncLoad::run(){
+	switch( type ){
+	case LOAD_MESH:
+		staged=Loader_B3D::parse( file,true,&prog );
+		break;
+	case LOAD_TEXTURE:
+		preloaded=CachedTexture::preload( file,"" );
+		break;
+	}
+	prog=1;
+}
+
+void AsyncLoad::loaderProc(){
+	std::unique_lock<std::mutex> lock( load_mutex );
+	for(;;){
+		queue_cv.wait( lock,[]{ return quit || queue.size(); } );
+		if( quit ) return;
+		AsyncLoad *load=queue.front();
+		queue.pop_front();
+		load->state=STATE_LOADING;
+		lock.unlock();
+		load->run();
+		lock.lock();
+		load->state=STATE_READY;
+		ready_cv.notify_all();
+	}
+}
+
+void AsyncLoad::shutdown(){
+	{
+		std::lock_guard<std::mutex> lock( load_mutex );
+		quit=true;
+	}
+	queue_cv.notify_all();
+	for( int k=0;k<loaders.size();++k ) loaders[k].join();
+	loaders.clear();
+}
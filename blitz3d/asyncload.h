@@ -0,0 +1,66 @@
+
+#ifndef ASYNCLOAD_H
+#define ASYNCLOAD_H
+
+#include "loader_b3d.h"
+
+#include <atomic>
+
+//
+// A mesh or texture loaded in the background.
+//
+// Loads are queued, and run in turn on loader threads which read, parse and decode files
+// into staging data without touching any entities or graphics objects. Once a load is
+// ready, the entity or texture is created from its staging data on the main thread.
+//
+// Only .b3d meshes are staged - other meshes, and meshes with an up to date cache file, have
+// nothing done in the background and are loaded as usual when finished.
+//
+class AsyncLoad{
+public:
+	enum{
+		LOAD_MESH,LOAD_TEXTURE
+	};
+
+	//flags are kept for finishing the load - the mesh loader hint, or texture flags
+	AsyncLoad( int type,const string &file,int flags );
+	//waits for the load if a loader thread is running it
+	~AsyncLoad();
+
+	//true once the loader threads are done with it
+	bool ready()const;
+	//0...1
+	float progress()const;
+	//wait until ready
+	void wait();
+
+	int getType()const{ return type; }
+	const string &getFile()const{ return file; }
+	int getFlags()const{ return flags; }
+
+	//parsed mesh if any, still owned by the load - only valid once ready
+	Loader_B3D::Staged *getStaged()const{ return staged; }
+
+	//stop the loader threads - pending loads stay queued
+	static void shutdown();
+
+private:
+	enum{
+		STATE_QUEUED,STATE_LOADING,STATE_READY
+	};
+
+	int type;
+	string file;
+	int flags,state;
+	std::atomic<float> prog;
+
+	Loader_B3D::Staged *staged;
+	//image decoded for a texture
+	string preloaded;
+
+	void run();
+
+	static void loaderProc();
+};
+
+#endif
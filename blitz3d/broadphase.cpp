@@ -0,0 +1,378 @@
+
+#include "std.h"
+#include "broadphase.h"
+#include "collision.h"
+
+#include <algorithm>
+
+//how much to 'fatten' boxes by, relative to their size
+static const float FAT_SCALE=.25f;
+
+static float boxArea( const Box &b ){
+	float w=b.width(),h=b.height(),d=b.depth();
+	return w*h+h*d+d*w;
+}
+
+static Box boxUnion( const Box &p,const Box &q ){
+	Box t=p;
+	t.update( q );
+	return t;
+}
+
+static bool boxContains( const Box &p,const Box &q ){
+	return
+	p.a.x<=q.a.x && p.a.y<=q.a.y && p.a.z<=q.a.z &&
+	p.b.x>=q.b.x && p.b.y>=q.b.y && p.b.z>=q.b.z;
+}
+
+static bool rayHits( const Line &l,const Vector &inv_d,float radius,const Box &b ){
+	float t0=0,t1=1;
+	for( int k=0;k<3;++k ){
+		float ta=(b.a[k]-radius-l.o[k])*inv_d[k],tb=(b.b[k]+radius-l.o[k])*inv_d[k];
+		if( ta>tb ) std::swap( ta,tb );
+		if( ta>t0 ) t0=ta;
+		if( tb<t1 ) t1=tb;
+		if( t0>t1 ) return false;
+	}
+	return true;
+}
+
+//false for infinite or NaN boxes
+static bool boxBounded( const Box &b ){
+	return
+	fabs(b.a.x)<INFINITY && fabs(b.a.y)<INFINITY && fabs(b.a.z)<INFINITY &&
+	fabs(b.b.x)<INFINITY && fabs(b.b.y)<INFINITY && fabs(b.b.z)<INFINITY;
+}
+
+static Box fatBox( const Box &b ){
+	float n=b.width();
+	if( b.height()>n ) n=b.height();
+	if( b.depth()>n ) n=b.depth();
+	Box t=b;
+	t.expand( n*FAT_SCALE+COLLISION_EPSILON );
+	return t;
+}
+
+Broadphase::Broadphase():
+root(-1),free_node(-1),frame(0){
+}
+
+int Broadphase::allocNode(){
+	int n;
+	if( free_node!=-1 ){
+		n=free_node;
+		free_node=nodes[n].parent;
+	}else{
+		n=nodes.size();
+		nodes.push_back( Node() );
+	}
+	Node &t=nodes[n];
+	t.obj=0;
+	t.parent=t.left=t.right=-1;
+	t.unbounded=false;
+	return n;
+}
+
+void Broadphase::freeNode( int n ){
+	nodes[n].obj=0;
+	nodes[n].parent=free_node;
+	free_node=n;
+}
+
+void Broadphase::fixUpwards( int n ){
+	while( n!=-1 ){
+		rotate( n );
+		Node &t=nodes[n];
+		const Node &l=nodes[t.left],&r=nodes[t.right];
+		t.box=boxUnion( l.box,r.box );
+		n=t.parent;
+	}
+}
+
+void Broadphase::insertLeaf( int leaf ){
+
+	if( root==-1 ){
+		root=leaf;
+		nodes[leaf].parent=-1;
+		return;
+	}
+
+	//find best sibling
+	const Box leaf_box=nodes[leaf].box;
+	int n=root;
+	while( nodes[n].left!=-1 ){
+		const Node &t=nodes[n];
+		float area=boxArea( t.box );
+		float comb_area=boxArea( boxUnion( t.box,leaf_box ) );
+
+		//cost of creating a new parent for this node and the new leaf
+		float cost=comb_area*2;
+
+		//minimum cost of pushing the leaf further down the tree
+		float inherit=(comb_area-area)*2;
+
+		float costs[2];
+		for( int k=0;k<2;++k ){
+			const Node &c=nodes[k ? t.right : t.left];
+			costs[k]=boxArea( boxUnion( leaf_box,c.box ) )+inherit;
+			if( c.left!=-1 ) costs[k]-=boxArea( c.box );
+		}
+
+		if( cost<costs[0] && cost<costs[1] ) break;
+
+		n=costs[0]<costs[1] ? t.left : t.right;
+	}
+
+	//create new parent
+	int sibling=n;
+	int old_parent=nodes[sibling].parent;
+	int new_parent=allocNode();
+
+	Node &p=nodes[new_parent];
+	p.parent=old_parent;
+	p.box=boxUnion( leaf_box,nodes[sibling].box );
+	p.left=sibling;
+	p.right=leaf;
+
+	if( old_parent!=-1 ){
+		Node &op=nodes[old_parent];
+		if( op.left==sibling ) op.left=new_parent;
+		else op.right=new_parent;
+	}else{
+		root=new_parent;
+	}
+	nodes[sibling].parent=new_parent;
+	nodes[leaf].parent=new_parent;
+
+	fixUpwards( new_parent );
+}
+
+void Broadphase::removeLeaf( int leaf ){
+
+	if( leaf==root ){
+		root=-1;
+		return;
+	}
+
+	int parent=nodes[leaf].parent;
+	int grand_parent=nodes[parent].parent;
+	int sibling=nodes[parent].left==leaf ? nodes[parent].right : nodes[parent].left;
+
+	if( grand_parent!=-1 ){
+		Node &gp=nodes[grand_parent];
+		if( gp.left==parent ) gp.left=sibling;
+		else gp.right=sibling;
+		nodes[sibling].parent=grand_parent;
+		freeNode( parent );
+		fixUpwards( grand_parent );
+	}else{
+		root=sibling;
+		nodes[sibling].parent=-1;
+		freeNode( parent );
+	}
+}
+
+//swap child c of a with grandchild g (a child of a's other child p), and refit p
+void Broadphase::swapNodes( int ia,int ic,int ip,int ig ){
+	Node &a=nodes[ia],&c=nodes[ic],&p=nodes[ip],&g=nodes[ig];
+	if( a.left==ic ) a.left=ig;
+	else a.right=ig;
+	if( p.left==ig ) p.left=ic;
+	else p.right=ic;
+	c.parent=ip;
+	g.parent=ia;
+	const Node &l=nodes[p.left],&r=nodes[p.right];
+	p.box=boxUnion( l.box,r.box );
+}
+
+//
+// Swap a child of n with a grandchild, if that shrinks the surface area of n's internal child.
+//
+// AVL style rotations on height keep the tree shallower, but pair up nodes that are far apart
+// and leave internal boxes loose, so queries end up visiting more of the tree.
+//
+void Broadphase::rotate( int n ){
+
+	const Node &a=nodes[n];
+	if( a.left==-1 ) return;
+
+	int ib=a.left,ic=a.right;
+	const Node &b=nodes[ib],&c=nodes[ic];
+
+	//best swap so far: child, its new parent, and the grandchild it's swapped with
+	float best=0;
+	int sc=-1,sp=-1,sg=-1;
+
+	//b with a child of c
+	if( c.left!=-1 ){
+		float area=boxArea( c.box );
+		for( int k=0;k<2;++k ){
+			int ig=k ? c.right : c.left,io=k ? c.left : c.right;
+			float t=area-boxArea( boxUnion( b.box,nodes[io].box ) );
+			if( t>best ){ best=t;sc=ib;sp=ic;sg=ig; }
+		}
+	}
+
+	//c with a child of b
+	if( b.left!=-1 ){
+		float area=boxArea( b.box );
+		for( int k=0;k<2;++k ){
+			int ig=k ? b.right : b.left,io=k ? b.left : b.right;
+			float t=area-boxArea( boxUnion( c.box,nodes[io].box ) );
+			if( t>best ){ best=t;sc=ic;sp=ib;sg=ig; }
+		}
+	}
+
+	if( sc!=-1 ) swapNodes( n,sc,sp,sg );
+}
+
+//add a leaf to the tree, or the unbounded list
+void Broadphase::insertProxy( int leaf,const Box &box ){
+	Node &t=nodes[leaf];
+	t.unbounded=!boxBounded( box );
+	if( t.unbounded ){
+		t.box=box;
+		unbounded.push_back( leaf );
+		return;
+	}
+	t.box=fatBox( box );
+	insertLeaf( leaf );
+}
+
+void Broadphase::removeProxy( int leaf ){
+	if( nodes[leaf].unbounded ){
+		unbounded.erase( std::find( unbounded.begin(),unbounded.end(),leaf ) );
+		return;
+	}
+	removeLeaf( leaf );
+}
+
+//reinsert a leaf if its box has moved out of its fat box
+void Broadphase::moveProxy( int leaf,const Box &box ){
+	const Node &t=nodes[leaf];
+	if( t.unbounded ? !boxBounded( box ) : boxContains( t.box,box ) ) return;
+	removeProxy( leaf );
+	insertProxy( leaf,box );
+}
+
+void Broadphase::begin(){
+	++frame;
+}
+
+void Broadphase::update( Object *obj,const Box &box,int order ){
+
+	map<Object*,int>::iterator it=proxies.find( obj );
+
+	if( it==proxies.end() ){
+		int leaf=allocNode();
+		Node &t=nodes[leaf];
+		t.obj=obj;
+		t.order=order;
+		t.frame=frame;
+		insertProxy( leaf,box );
+		proxies.insert( make_pair( obj,leaf ) );
+		return;
+	}
+
+	int leaf=it->second;
+	Node &t=nodes[leaf];
+	t.order=order;
+	t.frame=frame;
+
+	moveProxy( leaf,box );
+}
+
+void Broadphase::refit( Object *obj,const Box &box ){
+	map<Object*,int>::iterator it=proxies.find( obj );
+	if( it!=proxies.end() ) moveProxy( it->second,box );
+}
+
+void Broadphase::end(){
+	map<Object*,int>::iterator it=proxies.begin();
+	while( it!=proxies.end() ){
+		int leaf=it->second;
+		if( nodes[leaf].frame==frame ){
+			++it;
+			continue;
+		}
+		removeProxy( leaf );
+		freeNode( leaf );
+		proxies.erase( it++ );
+	}
+}
+
+void Broadphase::query( const Box &box,vector<Object*> &out )const{
+
+	static thread_local vector<int> stack;
+	static thread_local vector<pair<int,Object*> > hits;
+
+	out.clear();
+	if( root==-1 && !unbounded.size() ) return;
+
+	hits.clear();
+	for( int k=0;k<unbounded.size();++k ){
+		const Node &t=nodes[unbounded[k]];
+		hits.push_back( make_pair( t.order,t.obj ) );
+	}
+
+	stack.clear();
+	if( root!=-1 ) stack.push_back( root );
+	while( stack.size() ){
+		int n=stack.back();
+		stack.pop_back();
+		const Node &t=nodes[n];
+		if( !t.box.overlaps( box ) ) continue;
+		if( t.left==-1 ){
+			hits.push_back( make_pair( t.order,t.obj ) );
+		}else{
+			stack.push_back( t.left );
+			stack.push_back( t.right );
+		}
+	}
+
+	sort( hits.begin(),hits.end() );
+
+	for( int k=0;k<hits.size();++k ) out.push_back( hits[k].second );
+}
+
+void Broadphase::queryRay( const Line &line,float radius,vector<Object*> &out )const{
+
+	static thread_local vector<int> stack;
+	static thread_local vector<pair<int,Object*> > hits;
+
+	out.clear();
+	if( root==-1 && !unbounded.size() ) return;
+
+	Vector inv_d;
+	for( int k=0;k<3;++k ){
+		float t=line.d[k];
+		if( fabs(t)<1e-20f ) t=t<0 ? -1e-20f : 1e-20f;
+		inv_d[k]=1/t;
+	}
+	radius+=COLLISION_EPSILON;
+
+	hits.clear();
+	for( int k=0;k<unbounded.size();++k ){
+		const Node &t=nodes[unbounded[k]];
+		hits.push_back( make_pair( t.order,t.obj ) );
+	}
+
+	stack.clear();
+	if( root!=-1 ) stack.push_back( root );
+	while( stack.size() ){
+		int n=stack.back();
+		stack.pop_back();
+		const Node &t=nodes[n];
+		if( !rayHits( line,inv_d,radius,t.box ) ) continue;
+		if( t.left==-1 ){
+			hits.push_back( make_pair( t.order,t.obj ) );
+		}else{
+			stack.push_back( t.left );
+			stack.push_back( t.right );
+		}
+	}
+
+	sort( hits.begin(),hits.end() );
+
+	for( int k=0;k<hits.size();++k ) out.push_back( hits[k].second );
+}
@@ -0,0 +1,63 @@
+
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include "geom.h"
+
+class Object;
+
+//
+// Dynamic AABB tree of collision objects.
+//
+// Boxes are stored 'fat' so objects that only move a little don't need to be reinserted.
+// Objects not updated between begin() and end() are removed from the tree.
+//
+// Objects with unbounded boxes, such as planes, would wreck the tree's surface area costs, so
+// they're kept in a list instead and returned by every query.
+//
+class Broadphase{
+public:
+	Broadphase();
+
+	void begin();
+	void update( Object *obj,const Box &box,int order );
+	void end();
+
+	//refit an object already in the tree after it moves, outside of begin()/end() - does nothing if it isn't
+	void refit( Object *obj,const Box &box );
+
+	//returns objects whose boxes overlap box, sorted by update order - safe to call from multiple threads
+	void query( const Box &box,vector<Object*> &out )const;
+
+	//returns objects whose boxes are hit by line swept by radius, sorted by update order
+	void queryRay( const Line &line,float radius,vector<Object*> &out )const;
+
+	int size()const{ return proxies.size(); }
+
+private:
+	struct Node{
+		Box box;
+		Object *obj;
+		int order,frame;
+		int parent,left,right;
+		bool unbounded;
+	};
+
+	vector<Node> nodes;
+	map<Object*,int> proxies;
+	vector<int> unbounded;
+	int root,free_node,frame;
+
+	int allocNode();
+	void freeNode( int n );
+	void insertLeaf( int leaf );
+	void removeLeaf( int leaf );
+	void insertProxy( int leaf,const Box &box );
+	void removeProxy( int leaf );
+	void moveProxy( int leaf,const Box &box );
+	void swapNodes( int a,int c,int p,int g );
+	void rotate( int n );
+	void fixUpwards( int n );
+};
+
+#endif
@@ -187,6 +187,10 @@ int Brush::getBlend()const{
 	return rs.blend=gxScene::BLEND_REPLACE;
 }
 
+int Brush::getBlendMode()const{
+	return rep->blend;
+}
+
 int Brush::getFX()const{
 	return rep->rs.fx;
 }
@@ -207,5 +211,6 @@ const gxScene::RenderState &Brush::getRenderState()const{
 }
 
 bool Brush::operator<( const Brush &t )const{
+	if( rep==t.rep ) return false;
 	return memcmp( &getRenderState(),&t.getRenderState(),sizeof(gxScene::RenderState) )<0;
 }
@@ -25,6 +25,8 @@ public:
 	float getAlpha()const;
 	float getShininess()const;
 	int getBlend()const;
+	//blend as set, 0 if getBlend picks it
+	int getBlendMode()const;
 	int getFX()const;
 	Texture getTexture( int index )const;
 
@@ -2,23 +2,77 @@
 #include "std.h"
 #include "cachedtexture.h"
 
+#include <list>
+#include <unordered_map>
+
 int active_texs;
 
 extern gxRuntime *gx_runtime;
 extern gxGraphics *gx_graphics;
 
-set<CachedTexture::Rep*> CachedTexture::rep_set;
-
 static string path;
 
+//file names are lower case by now, so just make separators agree
+static string keyFile( const string &f ){
+	string t=f;
+	for( int k=0;k<t.size();++k ) if( t[k]=='/' ) t[k]='\\';
+	return t;
+}
+
+//
+// Cache index key - texture file and the arguments it was loaded with.
+//
+struct CachedTexture::Key{
+	string file;
+	int flags,w,h,first,cnt;
+
+	bool operator==( const Key &t )const{
+		return file==t.file && flags==t.flags && w==t.w && h==t.h && first==t.first && cnt==t.cnt;
+	}
+
+	struct Hash{
+		size_t operator()( const Key &k )const{
+			size_t h=std::hash<string>()( k.file );
+			h=h*31+k.flags;h=h*31+k.w;h=h*31+k.h;h=h*31+k.first;h=h*31+k.cnt;
+			return h;
+		}
+	};
+};
+
+//
+// Textures loaded from files, and those of them no longer referenced, most recently used first.
+//
+struct CachedTexture::Cache{
+	unordered_map<Key,Rep*,Key::Hash> index;
+	list<Rep*> unused;
+	int budget,loaded_bytes,unused_bytes;
+	int hits,misses,evictions;
+
+	Cache():budget(0),loaded_bytes(0),unused_bytes(0),hits(0),misses(0),evictions(0){
+	}
+
+	//free least recently used textures until no more than limit bytes are loaded
+	void trim( int limit );
+};
+
+CachedTexture::Cache CachedTexture::cache;
+
 struct CachedTexture::Rep{
 	int ref_cnt;
 	string file;
 	int flags,w,h,first;
 	vector<gxCanvas*> frames;
 
+	//index key and estimated size, valid while indexed - unused while in the unused list
+	Key key;
+	bool indexed,unused;
+	list<Rep*>::iterator unused_it;
+	int bytes;
+	//frames' modify counts once loaded
+	vector<int> load_mods;
+
 	Rep( int w,int h,int flags,int cnt ):
-	ref_cnt(1),flags(flags),w(w),h(h),first(0){
+	ref_cnt(1),flags(flags),w(w),h(h),first(0),indexed(false),unused(false),bytes(0){
 		++active_texs;
 		while( cnt-->0 ){
 			if( gxCanvas *t=gx_graphics->createCanvas( w,h,flags ) ){
@@ -28,7 +82,7 @@ struct CachedTexture::Rep{
 	}
 
 	Rep( const string &f,int flags,int w,int h,int first,int cnt ):
-	ref_cnt(1),file(f),flags(flags),w(w),h(h),first(first){
+	ref_cnt(1),file(f),flags(flags),w(w),h(h),first(first),indexed(false),unused(false),bytes(0){
 		++active_texs;
 		if( !(flags & gxCanvas::CANVAS_TEX_CUBE) ){
 			if( w<=0 || h<=0 || first<0 || cnt<=0 ){
@@ -91,17 +145,83 @@ struct CachedTexture::Rep{
 		--active_texs;
 		for( int k=0;k<frames.size();++k ) gx_graphics->freeCanvas( frames[k] );
 	}
+
+	//true if frames have been drawn to since loading
+	bool modified()const{
+		for( int k=0;k<frames.size();++k ){
+			if( frames[k]->getModify()!=load_mods[k] ) return true;
+		}
+		return false;
+	}
 };
 
+void CachedTexture::Cache::trim( int limit ){
+	while( loaded_bytes>limit && unused.size() ){
+		Rep *t=unused.back();
+		unused.pop_back();
+		unused_bytes-=t->bytes;
+		loaded_bytes-=t->bytes;
+		index.erase( t->key );
+		++evictions;
+		delete t;
+	}
+}
+
 CachedTexture::Rep *CachedTexture::findRep( const string &f,int flags,int w,int h,int first,int cnt ){
-	set<Rep*>::const_iterator it;
-	for( it=rep_set.begin();it!=rep_set.end();++it ){
-		Rep *rep=*it;
-		if( rep->file==f && rep->flags==flags && rep->w==w && rep->h==h && rep->first==first && rep->frames.size()==cnt ){
-			++rep->ref_cnt;return rep;
-		}
+	Key key={ keyFile( f ),flags,w,h,first,cnt };
+	unordered_map<Key,Rep*,Key::Hash>::const_iterator it=cache.index.find( key );
+	if( it==cache.index.end() ) return 0;
+	Rep *rep=it->second;
+	if( rep->unused ){
+		cache.unused.erase( rep->unused_it );
+		cache.unused_bytes-=rep->bytes;
+		rep->unused=false;
 	}
-	return 0;
+	++rep->ref_cnt;
+	++cache.hits;
+	return rep;
+}
+
+//estimate of the texture memory used by a rep's frames
+static int texBytes( const vector<gxCanvas*> &frames,int flags ){
+	int n=0;
+	for( int k=0;k<frames.size();++k ){
+		gxCanvas *t=frames[k];
+		n+=t->getWidth()*t->getHeight()*(t->getDepth()/8);
+	}
+	if( flags & gxCanvas::CANVAS_TEX_CUBE ) n*=6;
+	if( flags & gxCanvas::CANVAS_TEX_MIPMAP ) n+=n/3;
+	return n;
+}
+
+void CachedTexture::insertRep( Rep *rep ){
+	++cache.misses;
+	Key key={ keyFile( rep->file ),rep->flags,rep->w,rep->h,rep->first,(int)rep->frames.size() };
+	//failed loads may repeat a key - leave them out of the index
+	if( !cache.index.insert( make_pair( key,rep ) ).second ) return;
+	rep->key=key;
+	rep->indexed=true;
+	rep->bytes=texBytes( rep->frames,rep->flags );
+	for( int k=0;k<rep->frames.size();++k ) rep->load_mods.push_back( rep->frames[k]->getModify() );
+	cache.loaded_bytes+=rep->bytes;
+	cache.trim( cache.budget );
+}
+
+void CachedTexture::releaseRep( Rep *rep ){
+	if( --rep->ref_cnt ) return;
+	//textures drawn to no longer match their files, so aren't kept
+	if( rep->indexed && rep->frames.size() && cache.budget && cache.loaded_bytes<=cache.budget && !rep->modified() ){
+		cache.unused.push_front( rep );
+		rep->unused_it=cache.unused.begin();
+		rep->unused=true;
+		cache.unused_bytes+=rep->bytes;
+		return;
+	}
+	if( rep->indexed ){
+		cache.index.erase( rep->key );
+		cache.loaded_bytes-=rep->bytes;
+	}
+	delete rep;
 }
 
 CachedTexture::CachedTexture( int w,int h,int flags,int cnt ):
@@ -116,7 +236,7 @@ CachedTexture::CachedTexture( const string &f_,int flags,int w,int h,int first,i
 		if( rep=findRep( t,flags,w,h,first,cnt ) ) return;
 		rep=d_new Rep( t,flags,w,h,first,cnt );
 		if( rep->frames.size() ){
-			rep_set.insert( rep );
+			insertRep( rep );
 			return;
 		}
 		delete rep;
@@ -124,7 +244,7 @@ CachedTexture::CachedTexture( const string &f_,int flags,int w,int h,int first,i
 	string t=tolower( fullfilename( f ) );
 	if( rep=findRep( t,flags,w,h,first,cnt ) ) return;
 	rep=d_new Rep( t,flags,w,h,first,cnt );
-	rep_set.insert( rep );
+	insertRep( rep );
 }
 
 CachedTexture::CachedTexture( const CachedTexture &t ):
@@ -133,18 +253,12 @@ rep(t.rep){
 }
 
 CachedTexture::~CachedTexture(){
-	if( !--rep->ref_cnt ){
-		rep_set.erase( rep );
-		delete rep;
-	}
+	releaseRep( rep );
 }
 
 CachedTexture &CachedTexture::operator=( const CachedTexture &t ){
 	++t.rep->ref_cnt;
-	if( !--rep->ref_cnt ){
-		rep_set.erase( rep );
-		delete rep;
-	}
+	releaseRep( rep );
 	rep=t.rep;
 	return *this;
 }
@@ -153,13 +267,53 @@ string CachedTexture::getName()const{
 	return rep->file;
 }
 
+int CachedTexture::getFlags()const{
+	return rep->flags;
+}
+
 const vector<gxCanvas*> &CachedTexture::getFrames()const{
 	return rep->frames;
 }
 
+static string fixPath( const string &t ){
+	string p=tolower(t);
+	if( int sz=p.size() ){
+		if( p[sz-1]!='/' && p[sz-1]!='\\' ) p+='\\';
+	}
+	return p;
+}
+
 void CachedTexture::setPath( const string &t ){
-	path=tolower(t);
-	if( int sz=path.size() ){
-		if( path[sz-1]!='/' && path[sz-1]!='\\' ) path+='\\';
+	path=fixPath( t );
+}
+
+string CachedTexture::preload( const string &f_,const string &dir ){
+	string f=f_;
+	if( f.substr(0,2)==".\\" ) f=f.substr(2);
+	string p=fixPath( dir );
+	if( p.size() ){
+		string t=p+tolower( filenamefile( f ) );
+		if( gxGraphics::preloadImage( t ) ) return t;
+	}
+	string t=tolower( fullfilename( f ) );
+	return gxGraphics::preloadImage( t ) ? t : "";
+}
+void CachedTexture::setBudget( int bytes ){
+	cache.budget=bytes>0 ? bytes : 0;
+	cache.trim( cache.budget );
+}
+
+void CachedTexture::flush(){
+	cache.trim( -1 );
+}
+
+int CachedTexture::getStat( int n ){
+	switch( n ){
+	case 0:return cache.hits;
+	case 1:return cache.misses;
+	case 2:return cache.evictions;
+	case 3:return cache.loaded_bytes;
+	case 4:return cache.unused_bytes;
 	}
-}
\ No newline at end of file
+	return 0;
+}
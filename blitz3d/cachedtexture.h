@@ -14,6 +14,7 @@ public:
 	CachedTexture &operator=( const CachedTexture &t );
 
 	string getName()const;
+	int getFlags()const;
 
 	const vector<gxCanvas*> &getFrames()const;
 
@@ -21,13 +22,32 @@ public:
 
 	static void setPath( const string &t );
 
+	//decode the image file a texture of f would be loaded from, with path as for setPath.
+	//Safe to call from any thread - returns the file decoded, or "" if none.
+	static string preload( const string &f,const string &path );
+
+	//bytes of texture memory loaded textures may use before unused ones are evicted. Textures no
+	//longer referenced are kept for reuse while within budget, unless they've been drawn to - 0
+	//frees them at once.
+	static void setBudget( int bytes );
+
+	//free all textures kept for reuse
+	static void flush();
+
+	//0=cache hits, 1=misses, 2=evictions, 3=bytes loaded, 4=bytes kept for reuse
+	static int getStat( int n );
+
 private:
 	struct Rep;
+	struct Key;
+	struct Cache;
 	Rep *rep;
 
-	Rep *findRep( const string &f,int flags,int w,int h,int first,int cnt );
+	static Rep *findRep( const string &f,int flags,int w,int h,int first,int cnt );
+	static void insertRep( Rep *rep );
+	static void releaseRep( Rep *rep );
 
-	static set<Rep*> rep_set;
+	static Cache cache;
 };
 
 #endif
@@ -1,10 +1,58 @@
 
 #include "std.h"
 #include "entity.h"
+#include "object.h"
+
+#include <algorithm>
 
 //#include "stats.h"
 
 Entity *Entity::_orphans,*Entity::_last_orphan;
+int Entity::_hierarchy_changes;
+long long Entity::_tform_changes,Entity::_flushed_changes;
+
+//
+// Enabled/visible object lists.
+//
+// Orphans created while a list is valid are appended when the list is next used, as new orphans go
+// at the end of the hierarchy. Destroyed objects are zeroed out and compacted later. Anything else
+// that changes the hierarchy or visibility invalidates the list.
+//
+struct Entity::ObjList{
+	vector<Object*> objs;
+	vector<Entity*> created;
+	int dead;
+	bool valid;
+};
+
+Entity::ObjList Entity::_lists[2];
+int Entity::_walks_avoided;
+
+vector<Entity*> Entity::_dirty,Entity::_moved;
+
+//
+// World transforms come from a pool, allocated a page at a time and recycled through a free list,
+// so entities don't each allocate one. They are not kept in hierarchy order.
+//
+static const int TFORM_PAGE=1024;
+static vector<Transform*> tform_pages;
+static vector<Transform*> free_tforms;
+
+static Transform *allocTform(){
+	if( !free_tforms.size() ){
+		Transform *page=d_new Transform[TFORM_PAGE];
+		tform_pages.push_back( page );
+		for( int k=TFORM_PAGE-1;k>=0;--k ) free_tforms.push_back( page+k );
+	}
+	Transform *t=free_tforms.back();
+	free_tforms.pop_back();
+	*t=Transform();
+	return t;
+}
+
+static void freeTform( Transform *t ){
+	free_tforms.push_back( t );
+}
 
 enum{
 	INVALID_LOCALTFORM=1,
@@ -21,6 +69,7 @@ void Entity::remove(){
 	}
 	if( _succ ) _succ->_pred=_pred;
 	if( _pred ) _pred->_succ=_succ;
+	++_hierarchy_changes;
 }
 
 void Entity::insert(){
@@ -34,14 +83,17 @@ void Entity::insert(){
 		else _orphans=this;
 		_last_orphan=this;
 	}
+	++_hierarchy_changes;
 }
 
 Entity::Entity():
 _succ(0),_pred(0),_parent(0),_children(0),_last_child(0),
 _visible(true),_enabled(true),
 local_scl(1,1,1),
-invalid(0){
+invalid(0),_dirty_index(-1),_depth(0),_moved_index(-1),
+_world_computed(0),_world_checked(-1),_world_tform( allocTform() ){
 	insert();
+	created();
 }
 
 Entity::Entity( const Entity &e ):
@@ -50,23 +102,206 @@ _name(e._name),_visible(e._visible),_enabled(e._enabled),
 local_pos(e.local_pos),
 local_scl(e.local_scl),
 local_rot(e.local_rot),
-invalid( INVALID_LOCALTFORM|INVALID_WORLDTFORM ){
+invalid( INVALID_LOCALTFORM ),_dirty_index(-1),_depth(0),_moved_index(-1),
+_world_computed(0),_world_checked(-1),_world_tform( allocTform() ){
 	insert();
+	created();
+	invalidateWorld();
 }
 
 Entity::~Entity(){
 	while( children() ) delete children();
+	destroyed();
 	remove();
+	if( _dirty_index>=0 ) _dirty[_dirty_index]=0;
+	if( _moved_index>=0 ) _moved[_moved_index]=0;
+	freeTform( _world_tform );
+}
+
+void Entity::created(){
+	for( int n=0;n<2;++n ){
+		_list_index[n]=-1;
+		ObjList &l=_lists[n];
+		if( l.valid ) l.created.push_back( this );
+	}
+}
+
+void Entity::destroyed(){
+	for( int n=0;n<2;++n ){
+		ObjList &l=_lists[n];
+		if( !l.valid ) continue;
+		int i=_list_index[n];
+		if( i>=0 && i<l.objs.size() && (Entity*)l.objs[i]==this ){
+			l.objs[i]=0;
+			++l.dead;
+			continue;
+		}
+		vector<Entity*>::iterator it=std::find( l.created.begin(),l.created.end(),this );
+		if( it!=l.created.end() ) l.created.erase( it );
+	}
+}
+
+void Entity::enumList( int n,vector<Object*> &out ){
+	if( !(n==LIST_ENABLED ? _enabled : _visible) ) return;
+	if( Object *o=getObject() ){
+		_list_index[n]=out.size();
+		out.push_back( o );
+	}
+	for( Entity *e=_children;e;e=e->_succ ){
+		e->enumList( n,out );
+	}
+}
+
+void Entity::invalidateList( int n ){
+	ObjList &l=_lists[n];
+	l.valid=false;
+	l.created.clear();
+}
+
+const vector<Object*> &Entity::validateList( int n ){
+	ObjList &l=_lists[n];
+
+	if( !l.valid ){
+		l.objs.clear();
+		for( Entity *e=_orphans;e;e=e->_succ ){
+			e->enumList( n,l.objs );
+		}
+		l.dead=0;
+		l.valid=true;
+		return l.objs;
+	}
+
+	++_walks_avoided;
+
+	if( l.dead ){
+		int j=0;
+		for( int k=0;k<l.objs.size();++k ){
+			Object *o=l.objs[k];
+			if( !o ) continue;
+			o->_list_index[n]=j;
+			l.objs[j++]=o;
+		}
+		l.objs.resize( j );
+		l.dead=0;
+	}
+
+	for( int k=0;k<l.created.size();++k ){
+		l.created[k]->enumList( n,l.objs );
+	}
+	l.created.clear();
+
+	return l.objs;
+}
+
+const vector<Object*> &Entity::enabledObjects(){
+	return validateList( LIST_ENABLED );
+}
+
+const vector<Object*> &Entity::visibleObjects(){
+	return validateList( LIST_VISIBLE );
 }
 
+//
+// World transforms are brought up to date lazily.
+//
+// Setters only flag the entity and put it on the dirty list. A world transform is stale if its
+// entity is flagged, or if the parent's was computed after it was, so reading one checks parents
+// first. Entities already checked since the last change are skipped, so reading a whole tree after
+// a change checks each entity once.
+//
+// After a flush every world transform is valid until the next change, so reads check nothing and
+// are safe on worker threads.
+//
 void Entity::invalidateWorld(){
-	if( invalid & INVALID_WORLDTFORM ) return;
+	++_tform_changes;
 	invalid|=INVALID_WORLDTFORM;
+	if( _dirty_index>=0 ) return;
+	_dirty_index=_dirty.size();
+	_dirty.push_back( this );
+}
+
+bool Entity::staleWorld()const{
+	return (invalid & INVALID_WORLDTFORM) || (_parent && _parent->_world_computed>_world_computed);
+}
+
+void Entity::computeWorld()const{
+	worldTform()=_parent ? _parent->worldTform() * getLocalTform() : getLocalTform();
+	invalid&=~INVALID_WORLDTFORM;
+	_world_computed=_tform_changes;
+}
+
+//
+// Parents are checked upwards without recursing, as usually none of them are stale. Anything
+// below the topmost stale entity found is stale too, so that part of the path is recomputed.
+//
+void Entity::validateWorld()const{
+	const Entity *top=0,*e;
+	for( e=this;e && e->_world_checked!=_tform_changes;e=e->_parent ){
+		if( e->staleWorld() ) top=e;
+	}
+	for( e=top ? top->_parent : this;e && e->_world_checked!=_tform_changes;e=e->_parent ){
+		e->_world_checked=_tform_changes;
+	}
+	if( top ) computePath( top );
+}
+
+void Entity::computePath( const Entity *top )const{
+	if( this!=top ) _parent->computePath( top );
+	computeWorld();
+	_world_checked=_tform_changes;
+}
+
+//reading a world transform may have updated some of the subtree already, so all of it is walked
+void Entity::updateWorld(){
+	if( staleWorld() ) computeWorld();
+	_world_checked=_tform_changes;
+	_dirty_index=-1;
+	if( _moved_index<0 ){
+		_moved_index=_moved.size();
+		_moved.push_back( this );
+	}
 	for( Entity *e=_children;e;e=e->_succ ){
-		e->invalidateWorld();
+		e->updateWorld();
 	}
 }
 
+void Entity::setDepth( int depth ){
+	_depth=depth;
+	for( Entity *e=_children;e;e=e->_succ ){
+		e->setDepth( depth+1 );
+	}
+}
+
+//
+// Dirty entities are updated parents first, so each subtree is only walked once.
+//
+void Entity::flushTransforms(){
+
+	static vector<pair<int,Entity*> > order;
+
+	order.clear();
+	for( int k=0;k<_dirty.size();++k ){
+		if( Entity *e=_dirty[k] ) order.push_back( make_pair( e->_depth,e ) );
+	}
+	_dirty.clear();
+
+	sort( order.begin(),order.end() );
+
+	for( int k=0;k<order.size();++k ){
+		Entity *e=order[k].second;
+		if( e->_dirty_index>=0 ) e->updateWorld();
+	}
+
+	_flushed_changes=_tform_changes;
+}
+
+void Entity::clearMoved(){
+	for( int k=0;k<_moved.size();++k ){
+		if( Entity *e=_moved[k] ) e->_moved_index=-1;
+	}
+	_moved.clear();
+}
+
 void Entity::invalidateLocal(){
 	invalid|=INVALID_LOCALTFORM;
 	invalidateWorld();
@@ -85,11 +320,8 @@ const Transform &Entity::getLocalTform()const{
 }
 
 const Transform &Entity::getWorldTform()const{
-	if( invalid&INVALID_WORLDTFORM ){
-		world_tform=_parent ? _parent->getWorldTform() * getLocalTform() : getLocalTform();
-		invalid&=~INVALID_WORLDTFORM;
-	}
-	return world_tform;
+	if( _tform_changes!=_flushed_changes ) validateWorld();
+	return worldTform();
 }
 
 void Entity::setParent( Entity *p ){
@@ -101,6 +333,11 @@ void Entity::setParent( Entity *p ){
 
 	insert();
 
+	setDepth( p ? p->_depth+1 : 0 );
+
+	invalidateList( LIST_ENABLED );
+	invalidateList( LIST_VISIBLE );
+
 	invalidateWorld();
 }
 
@@ -109,11 +346,16 @@ void Entity::setName( const string &t ){
 }
 
 void Entity::setVisible( bool visible ){
+	if( _visible==visible ) return;
 	_visible=visible;
+	invalidateList( LIST_VISIBLE );
 }
 
 void Entity::setEnabled( bool enabled ){
+	if( _enabled==enabled ) return;
 	_enabled=enabled;
+	++_hierarchy_changes;
+	invalidateList( LIST_ENABLED );
 }
 
 void Entity::enumVisible( vector<Object*> &out ){
@@ -154,6 +396,13 @@ void Entity::setLocalTform( const Transform &t ){
 	invalidateLocal();
 }
 
+void Entity::setLocalPose( const Vector *pos,const Vector *scl,const Quat *rot ){
+	if( pos ) local_pos=*pos;
+	if( scl ) local_scl=*scl;
+	if( rot ) local_rot=rot->normalized();
+	invalidateLocal();
+}
+
 void Entity::setWorldPosition( const Vector &v ){
 	setLocalPosition( _parent ? -_parent->getWorldTform() * v : v );
 }
@@ -56,6 +56,9 @@ public:
 	void setLocalRotation( const Quat &q );
 	void setLocalTform( const Transform &t );
 
+	//set any of local position, scale and rotation in one go
+	void setLocalPose( const Vector *pos,const Vector *scl,const Quat *rot );
+
 	void setWorldPosition( const Vector &v );
 	void setWorldScale( const Vector &v );
 	void setWorldRotation( const Quat &q );
@@ -73,10 +76,54 @@ public:
 
 	static Entity *orphans(){ return _orphans; }
 
+	//bumped whenever an entity is created, destroyed, reparented or enabled/disabled
+	static int hierarchyChanges(){ return _hierarchy_changes; }
+
+	//bumped whenever any entity's local transform or parent changes
+	static int tformChanges(){ return (int)_tform_changes; }
+
+	//enabled/visible objects in hierarchy order, kept up to date so the hierarchy needn't be walked
+	static const vector<Object*> &enabledObjects();
+	static const vector<Object*> &visibleObjects();
+
+	//number of times the lists above were returned without walking the hierarchy
+	static int walksAvoided(){ return _walks_avoided; }
+
+	//update world transforms of everything moved since the last flush - reading a world transform
+	//updates it on demand, but World flushes up front so worker threads never have to
+	static void flushTransforms();
+
+	//entities updated by flushTransforms since clearMoved, 0 for any since deleted - only these
+	//can have new world transforms
+	static const vector<Entity*> &movedEntities(){ return _moved; }
+	static void clearMoved();
+
 private:
+	enum{
+		LIST_ENABLED=0,LIST_VISIBLE=1
+	};
+	struct ObjList;
+
 	Entity *_succ,*_pred,*_parent,*_children,*_last_child;
 
 	static Entity *_orphans,*_last_orphan;
+	static int _hierarchy_changes;
+
+	static ObjList _lists[2];
+	static int _walks_avoided;
+	int _list_index[2];
+
+	//moved entities whose world transforms, and those of their children, need updating
+	static vector<Entity*> _dirty;
+	int _dirty_index;	//-1 if not in _dirty
+	int _depth;			//number of ancestors, so _dirty can be flushed parents first
+
+	static vector<Entity*> _moved;
+	int _moved_index;	//-1 if not in _moved
+
+	//_tform_changes when the world transform was last computed, and last checked against parents
+	mutable long long _world_computed,_world_checked;
+	static long long _tform_changes,_flushed_changes;
 
 	bool _visible,_enabled;
 
@@ -90,12 +137,24 @@ private:
 
 	mutable Quat world_rot;
 	mutable Vector world_pos,world_scl;
-	mutable Transform world_tform;
+	Transform *_world_tform;	//from a pool of world transforms, see entity.cpp
 
 	void insert();
 	void remove();
+	void created();
+	void destroyed();
+	void enumList( int n,vector<Object*> &out );
+	static void invalidateList( int n );
+	static const vector<Object*> &validateList( int n );
 	void invalidateLocal();
 	void invalidateWorld();
+	bool staleWorld()const;
+	void computeWorld()const;
+	void validateWorld()const;
+	void computePath( const Entity *top )const;
+	void updateWorld();
+	void setDepth( int depth );
+	Transform &worldTform()const{ return *_world_tform; }
 };
 
 #endif
@@ -2,6 +2,20 @@
 #include "std.h"
 #include "frustum.h"
 
+#include <xmmintrin.h>
+
+//
+// Boxes are tested in centre/extent form: a box is behind a plane if its centre is
+// further behind than the extent projected onto the plane normal.
+//
+static inline float planeDist( const Plane &p,const Vector &c ){
+	return p.n.x*c.x+p.n.y*c.y+p.n.z*c.z+p.d;
+}
+
+static inline float planeRadius( const Plane &p,const Vector &e ){
+	return fabs(p.n.x)*e.x+fabs(p.n.y)*e.y+fabs(p.n.z)*e.z;
+}
+
 Frustum::Frustum(){
 }
 
@@ -36,9 +50,82 @@ bool Frustum::cull( const Vector v[],int cnt )const{
 }
 
 bool Frustum::cull( const Box &b )const{
-	Vector v[8];
-	for( int k=0;k<8;++k ) v[k]=b.corner(k);
-	return cull( v,8 );
+	Vector c=(b.a+b.b)*.5f,e=(b.b-b.a)*.5f;
+	for( int n=0;n<6;++n ){
+		if( planeDist( planes[n],c )+planeRadius( planes[n],e )<0 ) return false;
+	}
+	return true;
+}
+
+bool Frustum::cull( const Box &b,const Transform &tf )const{
+	int last_plane=0;
+	return cull( b,tf,last_plane );
+}
+
+bool Frustum::cull( const Box &b,const Transform &tf,int &last_plane )const{
+	Vector c=(b.a+b.b)*.5f,e=(b.b-b.a)*.5f;
+	for( int k=0;k<6;++k ){
+		int n=k ? (k==last_plane ? 0 : k) : last_plane;
+		//plane in local space
+		const Plane &p=planes[n];
+		Plane t( Vector( tf.m.i.dot( p.n ),tf.m.j.dot( p.n ),tf.m.k.dot( p.n ) ),p.n.dot( tf.v )+p.d );
+		if( planeDist( t,c )+planeRadius( t,e )<0 ){
+			last_plane=n;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Frustum::cull( const Box &b,int &clip )const{
+	Vector c=(b.a+b.b)*.5f,e=(b.b-b.a)*.5f;
+	for( int n=0;n<6;++n ){
+		int mask=1<<n;
+		if( !(clip & mask) ) continue;
+		float d=planeDist( planes[n],c ),r=planeRadius( planes[n],e );
+		if( d+r<0 ) return false;
+		if( d-r>=0 ) clip&=~mask;
+	}
+	return true;
+}
+
+void Frustum::cull( const Box boxes[],int cnt,char vis[] )const{
+	__m128 nx[6],ny[6],nz[6],nd[6],ax[6],ay[6],az[6];
+	int n;
+	for( n=0;n<6;++n ){
+		const Plane &p=planes[n];
+		nx[n]=_mm_set1_ps( p.n.x );ny[n]=_mm_set1_ps( p.n.y );nz[n]=_mm_set1_ps( p.n.z );
+		nd[n]=_mm_set1_ps( p.d );
+		ax[n]=_mm_set1_ps( fabs(p.n.x) );ay[n]=_mm_set1_ps( fabs(p.n.y) );az[n]=_mm_set1_ps( fabs(p.n.z) );
+	}
+	const __m128 half=_mm_set1_ps( .5f ),zero=_mm_setzero_ps();
+
+	int k=0;
+	for( ;k+4<=cnt;k+=4 ){
+		const Box *b=boxes+k;
+		__m128 lx=_mm_setr_ps( b[0].a.x,b[1].a.x,b[2].a.x,b[3].a.x );
+		__m128 ly=_mm_setr_ps( b[0].a.y,b[1].a.y,b[2].a.y,b[3].a.y );
+		__m128 lz=_mm_setr_ps( b[0].a.z,b[1].a.z,b[2].a.z,b[3].a.z );
+		__m128 hx=_mm_setr_ps( b[0].b.x,b[1].b.x,b[2].b.x,b[3].b.x );
+		__m128 hy=_mm_setr_ps( b[0].b.y,b[1].b.y,b[2].b.y,b[3].b.y );
+		__m128 hz=_mm_setr_ps( b[0].b.z,b[1].b.z,b[2].b.z,b[3].b.z );
+		__m128 cx=_mm_mul_ps( _mm_add_ps( lx,hx ),half ),ex=_mm_mul_ps( _mm_sub_ps( hx,lx ),half );
+		__m128 cy=_mm_mul_ps( _mm_add_ps( ly,hy ),half ),ey=_mm_mul_ps( _mm_sub_ps( hy,ly ),half );
+		__m128 cz=_mm_mul_ps( _mm_add_ps( lz,hz ),half ),ez=_mm_mul_ps( _mm_sub_ps( hz,lz ),half );
+
+		__m128 out=zero;
+		for( n=0;n<6;++n ){
+			__m128 d=_mm_add_ps( _mm_add_ps( _mm_mul_ps( cx,nx[n] ),_mm_mul_ps( cy,ny[n] ) ),_mm_add_ps( _mm_mul_ps( cz,nz[n] ),nd[n] ) );
+			__m128 r=_mm_add_ps( _mm_add_ps( _mm_mul_ps( ex,ax[n] ),_mm_mul_ps( ey,ay[n] ) ),_mm_mul_ps( ez,az[n] ) );
+			out=_mm_or_ps( out,_mm_cmplt_ps( _mm_add_ps( d,r ),zero ) );
+		}
+		int mask=_mm_movemask_ps( out );
+		vis[k]=!(mask&1);
+		vis[k+1]=!(mask&2);
+		vis[k+2]=!(mask&4);
+		vis[k+3]=!(mask&8);
+	}
+	for( ;k<cnt;++k ) vis[k]=cull( boxes[k] );
 }
 
 void Frustum::makePlanes(){
@@ -20,6 +20,19 @@ public:
 	bool cull( const Box &box )const;
 	bool cull( const Vector vecs[],int cnt )const;
 
+	//cull box in the local space of tf, without building a transformed frustum
+	bool cull( const Box &box,const Transform &tf )const;
+
+	//as above, but plane last_plane is tried first, and updated to the plane that rejects the box
+	bool cull( const Box &box,const Transform &tf,int &last_plane )const;
+
+	//only test planes in clip mask - planes box is fully inside are removed from the mask,
+	//so they can be skipped for anything inside box
+	bool cull( const Box &box,int &clip )const;
+
+	//cull many boxes, 4 at a time - vis[k] is set to 1 if boxes[k] is visible
+	void cull( const Box boxes[],int cnt,char vis[] )const;
+
 	const Plane &getPlane( int n )const{ return planes[n]; }
 	const Vector &getVertex( int n )const{ return verts[n]; }
 
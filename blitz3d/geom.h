@@ -101,6 +101,9 @@ public:
 	float distance( const Vector &q )const{
 		float dx=x-q.x,dy=y-q.y,dz=z-q.z;return sqrtf(dx*dx+dy*dy+dz*dz);
 	}
+	float distanceSq( const Vector &q )const{
+		float dx=x-q.x,dy=y-q.y,dz=z-q.z;return dx*dx+dy*dy+dz*dz;
+	}
 	Vector normalized()const{
 		float l=length();return Vector( x/l,y/l,z/l );
 	}
@@ -253,8 +256,9 @@ struct Quat{
 };
 
 class Matrix{
-	static Matrix tmps[64];
-	static Matrix &alloc_tmp(){ static int tmp=0;return tmps[tmp++&63];	}
+	//temporaries are per thread so geometry can be used by worker threads
+	static thread_local Matrix tmps[64];
+	static Matrix &alloc_tmp(){ static thread_local int tmp=0;return tmps[tmp++&63];	}
 	friend class Transform;
 public:
 	Vector i,j,k;
@@ -395,8 +399,8 @@ public:
 };
 
 class Transform{
-	static Transform tmps[64];
-	static Transform &alloc_tmp(){ static int tmp=0;return tmps[tmp++&63]; }
+	static thread_local Transform tmps[64];
+	static Transform &alloc_tmp(){ static thread_local int tmp=0;return tmps[tmp++&63]; }
 public:
 	Matrix m;
 	Vector v;
@@ -4,310 +4,508 @@
 #include "meshmodel.h"
 #include "pivot.h"
 #include "meshutil.h"
+#include "cachedtexture.h"
 
-//#define SHOW_BONES
-
-static FILE *in;
-static vector<int> chunk_stack;
-static vector<Texture> textures;
-static vector<Brush> brushes;
-static vector<Object*> bones;
+#include <algorithm>
 
-static bool collapse;
-static bool animonly;
+//#define SHOW_BONES
 
 static int swap_endian( int n ){
 	return ((n&0xff)<<24)|((n&0xff00)<<8)|((n&0xff0000)>>8)|((n&0xff000000)>>24);
 }
 
-static void clear(){
-	bones.clear();
-	brushes.clear();
-	textures.clear();
-	chunk_stack.clear();
-}
+//
+// What parse() reads - plain data, turned into textures, brushes and entities by build().
+//
+struct StagedTexture{
+	string name;
+	int flags,blend;
+	float pos[2],scl[2],rot;
+};
+
+struct StagedBrush{
+	float col[4],shi;
+	int blend,fx;
+	int tex_id[8];
+};
+
+//triangles drawn with one brush, and the vertices they use
+struct StagedSurface{
+	int brush;
+	vector<Surface::Vertex> verts;
+	vector<Surface::Triangle> tris;
+};
+
+struct StagedNode{
+	enum{
+		NODE_MODEL,NODE_MESH,NODE_BONE
+	};
+
+	int type;
+	string name;
+	float pos[3],scl[3],rot[4];
+	Animation keys;
+	int anim_len;
 
-static int readChunk(){
-	int header[2];
-	if( fread( header,8,1,in )<1 ) return 0;
-	chunk_stack.push_back( ftell( in )+header[1] );
-	return swap_endian( header[0] );
-}
+	int mesh_brush,mesh_flags;
+	vector<StagedSurface> surfs;
+	//bones animated by this mesh
+	vector<StagedNode*> bones;
 
-static void exitChunk(){
-	fseek( in,chunk_stack.back(),SEEK_SET );
-	chunk_stack.pop_back();
-}
+	//while parsing a mesh - vertices, and triangles by brush
+	vector<Surface::Vertex> verts;
+	map<int,vector<int> > tris;
 
-static int chunkSize(){
-	return chunk_stack.back()-ftell( in );
-}
+	vector<StagedNode*> kids;
 
-static void read( void *buf,int n ){
-	fread( buf,n,1,in );
-}
+	//entity built from this node
+	Object *obj;
 
-static void skip( int n ){
-	fseek( in,n,SEEK_CUR );
-}
+	StagedNode():type(NODE_MODEL),anim_len(0),mesh_brush(-1),mesh_flags(0),obj(0){
+	}
 
-static int readInt(){
-	int n;
-	read( &n,4 );
-	return n;
-}
+	~StagedNode(){
+		for( int k=0;k<kids.size();++k ) delete kids[k];
+	}
+};
 
-static void readIntArray( int t[],int n ){
-	read( t,n*4 );
-}
+struct Loader_B3D::Staged{
+	vector<StagedTexture> textures;
+	vector<StagedBrush> brushes;
+	StagedNode *root;
 
-static float readFloat(){
-	float n;
-	read( &n,4 );
-	return n;
-}
+	//images decoded for textures
+	vector<string> preloaded;
 
-static void readFloatArray( float t[],int n ){
-	read( t,n*4 );
-}
+	Staged():root(0){
+	}
 
-static void readColor( unsigned *t ){
-	float r=readFloat();if(r<0) r=0;else if(r>1) r=1;
-	float g=readFloat();if(g<0) g=0;else if(g>1) g=1;
-	float b=readFloat();if(b<0) b=0;else if(b>1) b=1;
-	float a=readFloat();if(a<0) a=0;else if(a>1) a=1;
-	*t=(int(a*255)<<24)|(int(r*255)<<16)|(int(g*255)<<8)|int(b*255);
-}
+	~Staged(){
+		delete root;
+		for( int k=0;k<preloaded.size();++k ) gxGraphics::discardImage( preloaded[k] );
+	}
+};
+
+//
+// State of one parse.
+//
+// The whole file is read into memory up front and chunks are parsed in place, so
+// loads don't share anything and fields don't each cost a trip through the CRT.
+// Reads never go past the end of the current chunk - short chunks read as zeros.
+//
+struct B3DReader{
+	vector<char> data;
+	const char *cur,*end;
+	vector<const char*> chunk_stack;
+
+	Loader_B3D::Staged *staged;
+	string tex_path;
+	bool preload;
+	std::atomic<float> *progress;
+
+	//first brush the same as each brush, so they share surfaces
+	vector<int> brush_ids;
+
+	//bones since the last mesh, and the meshes being read
+	vector<StagedNode*> bones;
+	vector<StagedNode*> meshes;
+
+	bool open( const string &f ){
+		FILE *in=fopen( f.c_str(),"rb" );
+		if( !in ) return false;
+		fseek( in,0,SEEK_END );
+		long sz=ftell( in );
+		fseek( in,0,SEEK_SET );
+		if( sz>0 ){
+			data.resize( sz );
+			if( fread( &data[0],sz,1,in )<1 ) data.clear();
+		}
+		fclose( in );
+		cur=data.size() ? &data[0] : 0;
+		end=cur+data.size();
+		return true;
+	}
 
-static string readString(){
-	string t;
-	for(;;){
-		char c;
-		read( &c,1 );
-		if( !c ) return t;
-		t+=c;
+	const char *chunkEnd()const{
+		return chunk_stack.size() ? chunk_stack.back() : end;
 	}
-}
 
-static void readTextures(){
-	while( chunkSize() ){
-		string name=readString();
-		int flags=readInt();
-		int blend=readInt();
-		float pos[2],scl[2];
-		readFloatArray( pos,2 );
-		readFloatArray( scl,2 );
-		float rot=readFloat();
+	int chunkSize()const{
+		return chunkEnd()-cur;
+	}
 
-		//create texture
-		Texture tex( name,flags & 0xffff );
+	int readChunk(){
+		if( progress && data.size() ) *progress=float( cur-&data[0] )/data.size();
+		const char *parent=chunkEnd();
+		if( parent-cur<8 ){
+			cur=parent;
+			chunk_stack.push_back( parent );
+			return 0;
+		}
+		int header[2];
+		memcpy( header,cur,8 );
+		cur+=8;
+		chunk_stack.push_back( header[1]>=0 && header[1]<=parent-cur ? cur+header[1] : parent );
+		return swap_endian( header[0] );
+	}
 
-		tex.setBlend( blend );
-		if( flags & 0x10000 ) tex.setFlags( gxScene::TEX_COORDS2 );
+	void exitChunk(){
+		cur=chunk_stack.back();
+		chunk_stack.pop_back();
+	}
 
-		if( pos[0]!=0 || pos[1]!=0 ) tex.setPosition( pos[0],pos[1] );
-		if( scl[0]!=1 || scl[1]!=1 ) tex.setScale( scl[0],scl[1] );
-		if( rot!=0 ) tex.setRotation( rot );
+	void read( void *buf,int n ){
+		int sz=chunkSize();
+		if( n>sz ){
+			memset( (char*)buf+sz,0,n-sz );
+			n=sz;
+		}
+		memcpy( buf,cur,n );
+		cur+=n;
+	}
 
-		textures.push_back( tex );
+	int readInt(){
+		int n;
+		read( &n,4 );
+		return n;
 	}
-}
 
-static void readBrushes(){
-	int n_texs=readInt();
+	void readIntArray( int t[],int n ){
+		read( t,n*4 );
+	}
 
-	int tex_id[8]={-1,-1,-1,-1,-1,-1,-1,-1};
+	float readFloat(){
+		float n;
+		read( &n,4 );
+		return n;
+	}
 
-	while( chunkSize() ){
-		string name=readString();
-		float col[4];
-		readFloatArray( col,4 );
-		float shi=readFloat();
-		int blend=readInt();
-		int fx=readInt();
-		readIntArray( tex_id,n_texs );
+	void readFloatArray( float t[],int n ){
+		read( t,n*4 );
+	}
 
-		Brush bru;
+	static unsigned toColor( const float c[4] ){
+		float r=c[0];if(r<0) r=0;else if(r>1) r=1;
+		float g=c[1];if(g<0) g=0;else if(g>1) g=1;
+		float b=c[2];if(b<0) b=0;else if(b>1) b=1;
+		float a=c[3];if(a<0) a=0;else if(a>1) a=1;
+		return (int(a*255)<<24)|(int(r*255)<<16)|(int(g*255)<<8)|int(b*255);
+	}
 
-		bru.setColor( Vector( col[0],col[1],col[2] ) );
-		bru.setAlpha( col[3] );
-		bru.setShininess( shi );
-		bru.setBlend( blend );
-		bru.setFX( fx );
+	string readString(){
+		const char *e=chunkEnd();
+		const char *t=(const char*)memchr( cur,0,e-cur );
+		string str( cur,t ? t : e );
+		cur=t ? t+1 : e;
+		return str;
+	}
 
-		for( int k=0;k<8;++k ){
-			if( tex_id[k]<0 ) continue;
-			bru.setTexture( k,textures[tex_id[k]],0 );
+	void readTextures(){
+		while( chunkSize() ){
+			StagedTexture tex;
+			tex.name=readString();
+			tex.flags=readInt();
+			tex.blend=readInt();
+			readFloatArray( tex.pos,2 );
+			readFloatArray( tex.scl,2 );
+			tex.rot=readFloat();
+
+			if( preload ){
+				string t=CachedTexture::preload( tex.name,tex_path );
+				if( t.size() ) staged->preloaded.push_back( t );
+			}
+
+			staged->textures.push_back( tex );
 		}
-
-		brushes.push_back( bru );
 	}
-}
 
-static int readVertices(){
-
-	int flags=readInt();
-	int tc_sets=readInt();
-	int tc_size=readInt();
+	void readBrushes(){
+		int n_texs=readInt();
+		if( n_texs<0 ) n_texs=0;
+
+		int tex_id[8]={-1,-1,-1,-1,-1,-1,-1,-1};
+
+		while( chunkSize() ){
+			string name=readString();
+			StagedBrush bru;
+			readFloatArray( bru.col,4 );
+			bru.shi=readFloat();
+			bru.blend=readInt();
+			bru.fx=readInt();
+			readIntArray( tex_id,n_texs<8 ? n_texs : 8 );
+			for( int k=8;k<n_texs;++k ) readInt();
+
+			for( int k=0;k<8;++k ){
+				bru.tex_id[k]=tex_id[k]<(int)staged->textures.size() ? tex_id[k] : -1;
+			}
+
+			int id=staged->brushes.size();
+			for( int k=0;k<staged->brushes.size();++k ){
+				if( !memcmp( &staged->brushes[k],&bru,sizeof(bru) ) ){
+					id=brush_ids[k];
+					break;
+				}
+			}
+			brush_ids.push_back( id );
+
+			staged->brushes.push_back( bru );
+		}
+	}
 
-	float tc[4]={0};
+	int readVertices( StagedNode *mesh ){
 
-	Surface::Vertex t;
-	while( chunkSize() ){
-		readFloatArray( t.coords,3 );
-		if( flags&1 ){
-			readFloatArray( t.normal,3 );
-		}
-		if( flags&2 ){
-			readColor( &t.color );
-		}
-		for( int k=0;k<tc_sets;++k ){
-			readFloatArray( tc,tc_size );
-			if( k<2 ) memcpy( t.tex_coords[k],tc,8 );
+		int flags=readInt();
+		int tc_sets=readInt();
+		int tc_size=readInt();
+		if( tc_sets<0 || tc_sets>8 || tc_size<0 || tc_size>4 ) return flags;
+
+		//decode straight into the mesh's vertices
+		int stride=12+(flags&1 ? 12 : 0)+(flags&2 ? 16 : 0)+tc_sets*tc_size*4;
+		int n=chunkSize()/stride;
+		int first=mesh->verts.size();
+		mesh->verts.resize( first+n );
+		Surface::Vertex *v=n ? &mesh->verts[first] : 0;
+
+		const char *p=cur;
+		for( int k=0;k<n;++k,++v ){
+			memcpy( &v->coords,p,12 );p+=12;
+			if( flags&1 ){
+				memcpy( &v->normal,p,12 );p+=12;
+			}
+			if( flags&2 ){
+				float col[4];
+				memcpy( col,p,16 );p+=16;
+				v->color=toColor( col );
+			}
+			for( int j=0;j<tc_sets;++j ){
+				if( j<2 ) memcpy( v->tex_coords[j],p,(tc_size<2 ? tc_size : 2)*4 );
+				p+=tc_size*4;
+			}
 		}
-		MeshLoader::addVertex( t );
-	}
+		cur=p;
 
-	return flags;
-}
+		return flags;
+	}
 
-static void readTriangles(){
-	int brush_id=readInt();
-	Brush b=brush_id>=0 ? brushes[brush_id] : Brush();
-	while( chunkSize() ){
-		int verts[3];
-		readIntArray( verts,3 );
-		MeshLoader::addTriangle( verts,b );
+	void readTriangles( StagedNode *mesh ){
+		int brush_id=readInt();
+		brush_id=brush_id>=0 && brush_id<brush_ids.size() ? brush_ids[brush_id] : -1;
+		int n=chunkSize()/12;
+		if( !n ) return;
+
+		vector<int> &tris=mesh->tris[brush_id];
+		int first=tris.size();
+		tris.resize( first+n*3 );
+		memcpy( &tris[first],cur,n*12 );
+		cur+=n*12;
 	}
-}
 
-static int readMesh(){
-	int flags=0;
-	while( chunkSize() ){
-		switch( readChunk() ){
-		case 'VRTS':
-			flags=readVertices();
-			break;
-		case 'TRIS':
-			readTriangles();
-			break;
+	int readMesh( StagedNode *mesh ){
+		int flags=0;
+		while( chunkSize() ){
+			switch( readChunk() ){
+			case 'VRTS':
+				flags=readVertices( mesh );
+				break;
+			case 'TRIS':
+				readTriangles( mesh );
+				break;
+			}
+			exitChunk();
 		}
-		exitChunk();
+		return flags;
 	}
-	return flags;
-}
 
-static Object *readBone(){
+	//split a mesh into surfaces by brush
+	void endMesh( StagedNode *mesh ){
+		MeshLoader::normalizeBones( mesh->verts );
+
+		vector<int> vert_map( mesh->verts.size(),-1 );
+		map<int,vector<int> >::const_iterator it;
+		for( it=mesh->tris.begin();it!=mesh->tris.end();++it ){
+			mesh->surfs.push_back( StagedSurface() );
+			StagedSurface &surf=mesh->surfs.back();
+			surf.brush=it->first;
+			const vector<int> &tris=it->second;
+			MeshLoader::remapTriangles( mesh->verts,&tris[0],tris.size()/3,0,surf.verts,surf.tris,vert_map );
+		}
 
-#ifdef SHOW_BONES
-	Brush b;
-	b.setColor( Vector( 1,0,0 ) );
-	b.setAlpha( .75f );
-	MeshModel *bone=MeshUtil::createSphere( b,16 );
-	Transform t;
-	t.m.i.x=.1f;
-	t.m.j.y=.1f;
-	t.m.k.z=.1f;
-	bone->transform( t );
-#else
-	Pivot *bone=d_new Pivot();
-#endif
+		vector<Surface::Vertex>().swap( mesh->verts );
+		mesh->tris.clear();
+	}
 
-	bones.push_back( bone );
+	void readBone( StagedNode *bone ){
 
-	while( chunkSize() ){
-		int vert=readInt();
-		float weight=readFloat();
-		MeshLoader::addBone( vert,weight,bones.size() );
+		if( bone->type!=StagedNode::NODE_MESH ) bone->type=StagedNode::NODE_BONE;
+		bones.push_back( bone );
+
+		StagedNode *mesh=meshes.size() ? meshes.back() : 0;
+		int n_verts=mesh ? mesh->verts.size() : 0;
+		while( chunkSize() ){
+			int vert=readInt();
+			float weight=readFloat();
+			if( vert>=0 && vert<n_verts ) MeshLoader::addBone( mesh->verts[vert],weight,bones.size() );
+		}
 	}
-	return bone;
-}
 
-static void readKeys( Animation &anim ){
-	int flags=readInt();
-	while( chunkSize() ){
-		int frame=readInt();
-		if( flags&1 ){
-			float pos[3];
-			readFloatArray( pos,3 );
-			anim.setPositionKey( frame,Vector(pos[0],pos[1],pos[2]) );
+	void readKeys( Animation &anim ){
+		int flags=readInt();
+		while( chunkSize() ){
+			int frame=readInt();
+			if( flags&1 ){
+				float pos[3];
+				readFloatArray( pos,3 );
+				anim.setPositionKey( frame,Vector(pos[0],pos[1],pos[2]) );
+			}
+			if( flags&2 ){
+				float scl[3];
+				readFloatArray( scl,3 );
+				anim.setScaleKey( frame,Vector(scl[0],scl[1],scl[2]) );
+			}
+			if( flags&4 ){
+				float rot[4];
+				readFloatArray( rot,4 );
+				anim.setRotationKey( frame,Quat(rot[0],Vector(rot[1],rot[2],rot[3])) );
+			}
 		}
-		if( flags&2 ){
-			float scl[3];
-			readFloatArray( scl,3 );
-			anim.setScaleKey( frame,Vector(scl[0],scl[1],scl[2]) );
+	}
+
+	StagedNode *readObject(){
+
+		StagedNode *node=d_new StagedNode();
+
+		node->name=readString();
+		readFloatArray( node->pos,3 );
+		readFloatArray( node->scl,3 );
+		readFloatArray( node->rot,4 );
+
+		while( chunkSize() ){
+			switch( readChunk() ){
+			case 'MESH':
+				if( node->type!=StagedNode::NODE_MESH ){
+					node->type=StagedNode::NODE_MESH;
+					meshes.push_back( node );
+				}
+				node->mesh_brush=readInt();
+				if( node->mesh_brush>=(int)staged->brushes.size() ) node->mesh_brush=-1;
+				node->mesh_flags=readMesh( node );
+				break;
+			case 'BONE':
+				readBone( node );
+				break;
+			case 'KEYS':
+				readKeys( node->keys );
+				break;
+			case 'ANIM':
+				readInt();
+				node->anim_len=readInt();
+				readFloat();
+				break;
+			case 'NODE':
+				node->kids.push_back( readObject() );
+				break;
+			}
+			exitChunk();
 		}
-		if( flags&4 ){
-			float rot[4];
-			readFloatArray( rot,4 );
-			anim.setRotationKey( frame,Quat(rot[0],Vector(rot[1],rot[2],rot[3])) );
+
+		if( node->type==StagedNode::NODE_MESH ){
+			endMesh( node );
+			meshes.pop_back();
+			node->bones.swap( bones );
 		}
+
+		return node;
 	}
-}
+};
 
-static Object *readObject( Object *parent ){
+typedef pair<Brush,const StagedSurface*> BrushSurface;
 
-	Object *obj=0;
+static bool brushLess( const BrushSurface &a,const BrushSurface &b ){
+	return a.first<b.first;
+}
 
-	string name=readString();
-	float pos[3],scl[3],rot[4];
-	readFloatArray( pos,3 );
-	readFloatArray( scl,3 );
-	readFloatArray( rot,4 );
+//
+// Build entities for a node and its children.
+//
+static Object *buildObject( StagedNode *node,Object *parent,const vector<Brush> &brushes ){
 
-	Animation keys;
-	int anim_len=0;
+	Object *obj;
 	MeshModel *mesh=0;
-	int mesh_flags,mesh_brush;
-
-	while( chunkSize() ){
-		switch( readChunk() ){
-		case 'MESH':
-			MeshLoader::beginMesh();
-			obj=mesh=d_new MeshModel();
-			mesh_brush=readInt();
-			mesh_flags=readMesh();
-			break;
-		case 'BONE':
-			obj=readBone();
-			break;
-		case 'KEYS':
-			readKeys( keys );
-			break;
-		case 'ANIM':
-			readInt();
-			anim_len=readInt();
-			readFloat();
-			break;
-		case 'NODE':
-			if( !obj ) obj=d_new MeshModel();
-			readObject( obj );
-			break;
-		}
-		exitChunk();
+
+	if( node->type==StagedNode::NODE_BONE ){
+#ifdef SHOW_BONES
+		Brush b;
+		b.setColor( Vector( 1,0,0 ) );
+		b.setAlpha( .75f );
+		MeshModel *bone=MeshUtil::createSphere( b,16 );
+		Transform t;
+		t.m.i.x=.1f;
+		t.m.j.y=.1f;
+		t.m.k.z=.1f;
+		bone->transform( t );
+		obj=bone;
+#else
+		obj=d_new Pivot();
+#endif
+	}else{
+		obj=mesh=d_new MeshModel();
+		if( node->type!=StagedNode::NODE_MESH ) mesh=0;
 	}
+	node->obj=obj;
 
-	if( !obj ) obj=d_new MeshModel();
+	for( int k=0;k<node->kids.size();++k ){
+		buildObject( node->kids[k],obj,brushes );
+	}
 
-	obj->setName( name );
-	obj->setLocalPosition( Vector( pos[0],pos[1],pos[2] ) );
-	obj->setLocalScale( Vector( scl[0],scl[1],scl[2] ) );
-	obj->setLocalRotation( Quat( rot[0],Vector( rot[1],rot[2],rot[3] ) ) );
-	obj->setAnimation( keys );
+	obj->setName( node->name );
+	obj->setLocalPosition( Vector( node->pos[0],node->pos[1],node->pos[2] ) );
+	obj->setLocalScale( Vector( node->scl[0],node->scl[1],node->scl[2] ) );
+	obj->setLocalRotation( Quat( node->rot[0],Vector( node->rot[1],node->rot[2],node->rot[3] ) ) );
+	obj->setAnimation( node->keys );
 
 	if( mesh ){
-		MeshLoader::endMesh( mesh );
-		if( !(mesh_flags&1) ) mesh->updateNormals();
-		if( mesh_brush!=-1 ) mesh->setBrush( brushes[mesh_brush] );
+		//create surfaces in brush order, as MeshLoader does
+		vector<BrushSurface> surfs;
+		int k;
+		for( k=0;k<node->surfs.size();++k ){
+			const StagedSurface &t=node->surfs[k];
+			surfs.push_back( BrushSurface( t.brush>=0 ? brushes[t.brush] : Brush(),&t ) );
+		}
+		std::stable_sort( surfs.begin(),surfs.end(),brushLess );
+
+		vector<Surface::Triangle> tris;
+		for( k=0;k<surfs.size();++k ){
+			const Brush &b=surfs[k].first;
+			const StagedSurface &t=*surfs[k].second;
+			Surface *surf=mesh->findSurface( b );
+			if( !surf ) surf=mesh->createSurface( b );
+			int base=surf->numVertices();
+			surf->addVertices( t.verts );
+			if( !base ){
+				surf->addTriangles( t.tris );
+				continue;
+			}
+			//the default brush may match one from the file
+			tris=t.tris;
+			for( int j=0;j<tris.size();++j ){
+				tris[j].verts[0]+=base;
+				tris[j].verts[1]+=base;
+				tris[j].verts[2]+=base;
+			}
+			surf->addTriangles( tris );
+		}
+		if( !(node->mesh_flags&1) ) mesh->updateNormals();
+		if( node->mesh_brush!=-1 ) mesh->setBrush( brushes[node->mesh_brush] );
 	}
 
-	if( mesh && bones.size() ){
-		bones.insert( bones.begin(),mesh );
-		mesh->setAnimator( d_new Animator( bones,anim_len ) );
+	if( mesh && node->bones.size() ){
+		vector<Object*> bones;
+		bones.push_back( mesh );
+		for( int k=0;k<node->bones.size();++k ) bones.push_back( node->bones[k]->obj );
+		mesh->setAnimator( d_new Animator( bones,node->anim_len ) );
 		mesh->createBones();
-		bones.clear();
-	}else if( anim_len ){
-		obj->setAnimator( d_new Animator( obj,anim_len ) );
+	}else if( node->anim_len ){
+		obj->setAnimator( d_new Animator( obj,node->anim_len ) );
 	}
 
 	if( parent ) obj->setParent( parent );
@@ -315,46 +513,103 @@ static Object *readObject( Object *parent ){
 	return obj;
 }
 
-MeshModel *Loader_B3D::load( const string &f,const Transform &conv,int hint ){
+Loader_B3D::Staged *Loader_B3D::parse( const string &f,bool preload,std::atomic<float> *progress ){
 
-	collapse=!!(hint&MeshLoader::HINT_COLLAPSE);
-	animonly=!!(hint&MeshLoader::HINT_ANIMONLY);
+	B3DReader in;
 
-	in=fopen( f.c_str(),"rb" );
-	if( !in ) return 0;
+	if( !in.open( f ) ) return 0;
 
-	::clear();
-
-	int tag=readChunk();
-	if( tag!='BB3D' ){
-		fclose( in );
-		return 0;
-	}
+	Staged *staged=d_new Staged();
+	in.staged=staged;
+	in.tex_path=filenamepath( f );
+	in.preload=preload;
+	in.progress=progress;
 
-	int version=readInt();
-	if( version>1 ){
-		fclose( in );
+	int tag=in.readChunk();
+	int version=in.readInt();
+	if( tag!='BB3D' || version>1 ){
+		delete staged;
 		return 0;
 	}
 
-	Object *obj=0;
-	while( chunkSize() ){
-		switch( readChunk() ){
+	while( in.chunkSize() ){
+		switch( in.readChunk() ){
 		case 'TEXS':
-			readTextures();
+			in.readTextures();
 			break;
 		case 'BRUS':
-			readBrushes();
+			in.readBrushes();
 			break;
 		case 'NODE':
-			obj=readObject( 0 );
+			delete staged->root;
+			staged->root=in.readObject();
 			break;
 		}
-		exitChunk();
+		in.exitChunk();
+	}
+
+	if( progress ) *progress=1;
+
+	return staged;
+}
+
+MeshModel *Loader_B3D::build( Staged *staged ){
+
+	if( !staged || !staged->root ) return 0;
+
+	vector<Texture> textures;
+	int k;
+	for( k=0;k<staged->textures.size();++k ){
+		const StagedTexture &t=staged->textures[k];
+
+		Texture tex( t.name,t.flags & 0xffff );
+
+		tex.setBlend( t.blend );
+		if( t.flags & 0x10000 ) tex.setFlags( gxScene::TEX_COORDS2 );
+
+		if( t.pos[0]!=0 || t.pos[1]!=0 ) tex.setPosition( t.pos[0],t.pos[1] );
+		if( t.scl[0]!=1 || t.scl[1]!=1 ) tex.setScale( t.scl[0],t.scl[1] );
+		if( t.rot!=0 ) tex.setRotation( t.rot );
+
+		textures.push_back( tex );
+	}
+
+	vector<Brush> brushes;
+	for( k=0;k<staged->brushes.size();++k ){
+		const StagedBrush &t=staged->brushes[k];
+
+		Brush bru;
+
+		bru.setColor( Vector( t.col[0],t.col[1],t.col[2] ) );
+		bru.setAlpha( t.col[3] );
+		bru.setShininess( t.shi );
+		bru.setBlend( t.blend );
+		bru.setFX( t.fx );
+
+		for( int j=0;j<8;++j ){
+			if( t.tex_id[j]<0 ) continue;
+			bru.setTexture( j,textures[t.tex_id[j]],0 );
+		}
+
+		brushes.push_back( bru );
 	}
-	fclose( in );
 
-	::clear();
+	Object *obj=buildObject( staged->root,0,brushes );
+
+	Model *model=obj->getModel();
+	return model ? model->getMeshModel() : 0;
+}
+
+void Loader_B3D::freeStaged( Staged *staged ){
+	delete staged;
+}
+
+MeshModel *Loader_B3D::load( const string &f,const Transform &conv,int hint ){
+
+	Staged *staged=parse( f,false,0 );
+	if( !staged ) return 0;
 
-	return obj ? obj->getModel()->getMeshModel() : 0;
+	MeshModel *mesh=build( staged );
+	freeStaged( staged );
+	return mesh;
 }
@@ -4,9 +4,24 @@
 
 #include "meshloader.h"
 
+#include <atomic>
+
 class Loader_B3D : public MeshLoader{
 public:
 	MeshModel *load( const string &f,const Transform &conv,int hint );
+
+	//a file parsed into memory, with no entities or textures created yet
+	struct Staged;
+
+	//read and parse f, decoding its textures' images if preload is set. Safe to call from any thread,
+	//and progress is set to how far through the file it is.
+	static Staged *parse( const string &f,bool preload,std::atomic<float> *progress );
+
+	//create the entities - must be called from the main thread, with the texture path set
+	static MeshModel *build( Staged *staged );
+
+	//also discards any preloaded images build didn't use
+	static void freeStaged( Staged *staged );
 };
 
 #endif
@@ -107,10 +107,12 @@ void MD2Model::animate( float e ){
 	render_t=anim_time-render_a;
 }
 
+bool MD2Model::inView( const RenderContext &rc )const{
+	return rc.getWorldFrustum().cull( rep->getBox(),getRenderTform() );
+}
+
 bool MD2Model::render( const RenderContext &rc ){
-	static Frustum f;
-	new( &f ) Frustum( rc.getWorldFrustum(),-getRenderTform() );
-	if( !f.cull( rep->getBox() ) ) return false;
+	if( !rc.isCulled() && !inView( rc ) ) return false;
 
 	if( anim_mode & 0x8000 ){
 		rep->render( this,trans_verts,anim_time,trans_time );
@@ -20,6 +20,7 @@ public:
 
 	//Model interface
 	bool render( const RenderContext &rc );
+	bool inView( const RenderContext &rc )const;
 
 	//MD2 interface
 	void startMD2Anim( int first,int last,int mode,float speed,float trans );
@@ -0,0 +1,639 @@
+
+#include "std.h"
+#include "meshcache.h"
+#include "meshmodel.h"
+#include "meshcollider.h"
+#include "pivot.h"
+
+static const int CACHE_MAGIC='BBMC';
+//bump whenever a record changes
+static const int CACHE_VERSION=1;
+
+static string cache_dir;
+
+//
+// File layout - a header, then records. Everything is 4 byte aligned, and ranges are byte
+// offsets from the start of the file with a count of records.
+//
+struct CRange{
+	int offset,count;
+};
+
+struct CHeader{
+	int magic,version,vertex_size,file_size;
+	//key
+	int hint;
+	unsigned src_size,src_time[2];
+	float conv[12];
+	CRange src_file;
+	//records
+	CRange textures,brushes,nodes,animators;
+};
+
+struct CTexture{
+	CRange file;
+	int flags,blend,tex_flags,transformed;
+	float u_scale,v_scale,u_pos,v_pos,rot;
+};
+
+struct CBrush{
+	float color[3],alpha,shininess;
+	int blend,fx;
+	int texs[gxScene::MAX_TEXTURES],frames[gxScene::MAX_TEXTURES];
+};
+
+struct CVectorKey{
+	int frame;
+	float v[3];
+};
+
+struct CQuatKey{
+	int frame;
+	float w,v[3];
+};
+
+struct CKeys{
+	CRange pos,scl,rot;
+};
+
+struct CSurface{
+	int brush;
+	CRange verts,tris;
+};
+
+//nodes are in depth first order, so parents come before their children
+struct CNode{
+	enum{
+		NODE_PIVOT,NODE_MESH
+	};
+	int type,parent;
+	CRange name;
+	float pos[3],scl[3],rot[4];
+	CKeys keys;
+	//meshes only
+	int brush,boned;
+	CRange surfs,coll_tris,coll_nodes;
+};
+
+//animated objects are all in node's subtree
+struct CAnimator{
+	int node;
+	//node of each object, frames of each seq, and keys of each object for each seq
+	CRange objs,seqs,keys;
+};
+
+static void convFloats( const Transform &t,float *f ){
+	const Vector *v[]={ &t.m.i,&t.m.j,&t.m.k,&t.v };
+	for( int k=0;k<4;++k ){
+		f[k*3]=v[k]->x;f[k*3+1]=v[k]->y;f[k*3+2]=v[k]->z;
+	}
+}
+
+static bool sourceStamp( const string &f,unsigned *size,unsigned time[2] ){
+	WIN32_FILE_ATTRIBUTE_DATA t;
+	if( !GetFileAttributesEx( f.c_str(),GetFileExInfoStandard,&t ) ) return false;
+	*size=t.nFileSizeLow;
+	time[0]=t.ftLastWriteTime.dwLowDateTime;
+	time[1]=t.ftLastWriteTime.dwHighDateTime;
+	return true;
+}
+
+static string cacheFile( const string &f,int hint ){
+	//FNV-1a of path and hint, so files with the same name don't collide
+	unsigned h=2166136261u;
+	for( int k=0;k<f.size();++k ) h=( h^(unsigned char)f[k] )*16777619u;
+	h=( h^hint )*16777619u;
+	char buf[16];
+	sprintf( buf,"%08x",h );
+	return cache_dir+filenamefile( f )+"."+buf+".bmc";
+}
+
+//////////////
+// Reading. //
+//////////////
+struct MappedFile{
+	HANDLE file,mapping;
+	const char *data;
+	int size;
+
+	MappedFile( const string &f ):file(INVALID_HANDLE_VALUE),mapping(0),data(0),size(0){
+		file=CreateFile( f.c_str(),GENERIC_READ,FILE_SHARE_READ,0,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,0 );
+		if( file==INVALID_HANDLE_VALUE ) return;
+		DWORD sz=GetFileSize( file,0 );
+		if( sz<sizeof(CHeader) || sz>0x7fffffff ) return;
+		if( !(mapping=CreateFileMapping( file,0,PAGE_READONLY,0,0,0 )) ) return;
+		if( data=(const char*)MapViewOfFile( mapping,FILE_MAP_READ,0,0,0 ) ) size=sz;
+	}
+
+	~MappedFile(){
+		if( data ) UnmapViewOfFile( data );
+		if( mapping ) CloseHandle( mapping );
+		if( file!=INVALID_HANDLE_VALUE ) CloseHandle( file );
+	}
+
+	const CHeader *header()const{
+		return (const CHeader*)data;
+	}
+
+	//records in r, or 0 if r isn't inside the file
+	template<class T> const T *get( const CRange &r )const{
+		if( r.offset<0 || (r.offset&3) || r.offset>size || r.count<0 || r.count>(size-r.offset)/(int)sizeof(T) ) return 0;
+		return (const T*)( data+r.offset );
+	}
+
+	string getString( const CRange &r )const{
+		const char *p=get<char>( r );
+		return p ? string( p,r.count ) : "";
+	}
+
+	bool checkKeys( const CKeys &k )const{
+		return get<CVectorKey>( k.pos ) && get<CVectorKey>( k.scl ) && get<CQuatKey>( k.rot );
+	}
+};
+
+//true if in is the cache of f, and f hasn't changed since. Loader matrix is only checked if conv is set.
+static bool checkHeader( const MappedFile &in,const string &f,int hint,const Transform *conv ){
+	if( !in.data ) return false;
+
+	const CHeader *h=in.header();
+	if( h->magic!=CACHE_MAGIC || h->version!=CACHE_VERSION || h->vertex_size!=sizeof(Surface::Vertex) ) return false;
+	if( h->file_size!=in.size || h->hint!=hint || !in.get<char>( h->src_file ) || in.getString( h->src_file )!=f ) return false;
+
+	unsigned size,time[2];
+	if( !sourceStamp( f,&size,time ) || size!=h->src_size || time[0]!=h->src_time[0] || time[1]!=h->src_time[1] ) return false;
+
+	if( conv ){
+		float m[12];
+		convFloats( *conv,m );
+		if( memcmp( m,h->conv,sizeof(m) ) ) return false;
+	}
+	return true;
+}
+
+//check every range and index, so a damaged file can't create broken entities
+static bool checkRecords( const MappedFile &in ){
+	const CHeader *h=in.header();
+
+	const CTexture *texs=in.get<CTexture>( h->textures );
+	const CBrush *brushes=in.get<CBrush>( h->brushes );
+	const CNode *nodes=in.get<CNode>( h->nodes );
+	const CAnimator *anims=in.get<CAnimator>( h->animators );
+	if( !texs || !brushes || !nodes || !anims || !h->nodes.count ) return false;
+
+	int k,j;
+	for( k=0;k<h->textures.count;++k ){
+		if( !in.get<char>( texs[k].file ) ) return false;
+	}
+	for( k=0;k<h->brushes.count;++k ){
+		for( j=0;j<gxScene::MAX_TEXTURES;++j ){
+			if( brushes[k].texs[j]<-1 || brushes[k].texs[j]>=h->textures.count ) return false;
+		}
+	}
+
+	//animator objects of each node, for the boned mesh check
+	vector<int> anim_objs( h->nodes.count );
+	for( k=0;k<h->animators.count;++k ){
+		const CAnimator &a=anims[k];
+		if( a.node<0 || a.node>=h->nodes.count ) return false;
+		const int *objs=in.get<int>( a.objs );
+		const CKeys *keys=in.get<CKeys>( a.keys );
+		if( !objs || !in.get<int>( a.seqs ) || !a.seqs.count || !keys || a.keys.count!=a.objs.count*a.seqs.count ) return false;
+		for( j=0;j<a.objs.count;++j ){
+			if( objs[j]<a.node || objs[j]>=h->nodes.count ) return false;
+		}
+		for( j=0;j<a.keys.count;++j ){
+			if( !in.checkKeys( keys[j] ) ) return false;
+		}
+		anim_objs[a.node]=a.objs.count;
+	}
+
+	for( k=0;k<h->nodes.count;++k ){
+		const CNode &n=nodes[k];
+		if( n.parent<(k ? 0 : -1) || n.parent>=k || !in.get<char>( n.name ) || !in.checkKeys( n.keys ) ) return false;
+		if( n.type==CNode::NODE_PIVOT ) continue;
+		if( n.type!=CNode::NODE_MESH || n.brush<-1 || n.brush>=h->brushes.count ) return false;
+		if( n.boned && !anim_objs[k] ) return false;
+
+		const CSurface *surfs=in.get<CSurface>( n.surfs );
+		if( !surfs || !in.get<MeshCollider::FlatTri>( n.coll_tris ) || !in.get<MeshCollider::FlatNode>( n.coll_nodes ) ) return false;
+		for( j=0;j<n.surfs.count;++j ){
+			const CSurface &s=surfs[j];
+			const Surface::Vertex *verts=in.get<Surface::Vertex>( s.verts );
+			const Surface::Triangle *tris=in.get<Surface::Triangle>( s.tris );
+			if( s.brush<-1 || s.brush>=h->brushes.count || !verts || !tris ) return false;
+			for( int i=0;i<s.tris.count;++i ){
+				const unsigned short *t=tris[i].verts;
+				if( t[0]>=s.verts.count || t[1]>=s.verts.count || t[2]>=s.verts.count ) return false;
+			}
+			if( !n.boned ) continue;
+			for( int i=0;i<s.verts.count;++i ){
+				const unsigned char *b=verts[i].bone_bones;
+				for( int w=0;w<MAX_SURFACE_BONES && b[w]!=255;++w ){
+					if( b[w]>=anim_objs[k] ) return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static Animation readKeys( const MappedFile &in,const CKeys &k ){
+	Animation anim;
+	const CVectorKey *pos=in.get<CVectorKey>( k.pos );
+	const CVectorKey *scl=in.get<CVectorKey>( k.scl );
+	const CQuatKey *rot=in.get<CQuatKey>( k.rot );
+	int n;
+	for( n=0;n<k.pos.count;++n ) anim.setPositionKey( pos[n].frame,Vector( pos[n].v[0],pos[n].v[1],pos[n].v[2] ) );
+	for( n=0;n<k.scl.count;++n ) anim.setScaleKey( scl[n].frame,Vector( scl[n].v[0],scl[n].v[1],scl[n].v[2] ) );
+	for( n=0;n<k.rot.count;++n ) anim.setRotationKey( rot[n].frame,Quat( rot[n].w,Vector( rot[n].v[0],rot[n].v[1],rot[n].v[2] ) ) );
+	return anim;
+}
+
+static Entity *readEntities( const MappedFile &in ){
+	const CHeader *h=in.header();
+	const CTexture *ctexs=in.get<CTexture>( h->textures );
+	const CBrush *cbrushes=in.get<CBrush>( h->brushes );
+	const CNode *cnodes=in.get<CNode>( h->nodes );
+	const CAnimator *canims=in.get<CAnimator>( h->animators );
+
+	int k,j;
+	vector<Texture> texs;
+	for( k=0;k<h->textures.count;++k ){
+		const CTexture &c=ctexs[k];
+		Texture t( in.getString( c.file ),c.flags );
+		t.setBlend( c.blend );
+		t.setFlags( c.tex_flags );
+		if( c.transformed ){
+			t.setScale( c.u_scale,c.v_scale );
+			t.setPosition( c.u_pos,c.v_pos );
+			t.setRotation( c.rot );
+		}
+		texs.push_back( t );
+	}
+
+	vector<Brush> brushes;
+	for( k=0;k<h->brushes.count;++k ){
+		const CBrush &c=cbrushes[k];
+		Brush b;
+		b.setColor( Vector( c.color[0],c.color[1],c.color[2] ) );
+		b.setAlpha( c.alpha );
+		b.setShininess( c.shininess );
+		b.setBlend( c.blend );
+		b.setFX( c.fx );
+		for( j=0;j<gxScene::MAX_TEXTURES;++j ){
+			if( c.texs[j]>=0 ) b.setTexture( j,texs[c.texs[j]],c.frames[j] );
+		}
+		brushes.push_back( b );
+	}
+
+	vector<Object*> objs;
+	for( k=0;k<h->nodes.count;++k ){
+		const CNode &c=cnodes[k];
+
+		Object *obj;
+		MeshModel *mesh=0;
+		if( c.type==CNode::NODE_MESH ) obj=mesh=d_new MeshModel();
+		else obj=d_new Pivot();
+		objs.push_back( obj );
+
+		obj->setName( in.getString( c.name ) );
+		obj->setLocalPosition( Vector( c.pos[0],c.pos[1],c.pos[2] ) );
+		obj->setLocalScale( Vector( c.scl[0],c.scl[1],c.scl[2] ) );
+		obj->setLocalRotation( Quat( c.rot[0],Vector( c.rot[1],c.rot[2],c.rot[3] ) ) );
+		obj->setAnimation( readKeys( in,c.keys ) );
+
+		if( !mesh ) continue;
+
+		const CSurface *surfs=in.get<CSurface>( c.surfs );
+		vector<void*> coll_surfs;
+		for( j=0;j<c.surfs.count;++j ){
+			const CSurface &s=surfs[j];
+			Surface *surf=mesh->createSurface( s.brush>=0 ? brushes[s.brush] : Brush() );
+			surf->addVertices( in.get<Surface::Vertex>( s.verts ),s.verts.count );
+			surf->addTriangles( in.get<Surface::Triangle>( s.tris ),s.tris.count );
+			coll_surfs.push_back( surf );
+		}
+		if( c.brush>=0 ) mesh->setBrush( brushes[c.brush] );
+
+		//collider is rebuilt when needed if it's missing or bad
+		if( c.coll_nodes.count ){
+			if( MeshCollider *coll=MeshCollider::unflatten( coll_surfs,
+				in.get<MeshCollider::FlatTri>( c.coll_tris ),c.coll_tris.count,
+				in.get<MeshCollider::FlatNode>( c.coll_nodes ),c.coll_nodes.count ) ){
+				mesh->setCollider( coll );
+			}
+		}
+	}
+
+	vector<vector<int> > kids( h->nodes.count );
+	for( k=1;k<h->nodes.count;++k ) kids[cnodes[k].parent].push_back( k );
+
+	//finish children before parents, as the loaders do, so bones are bound relative to their mesh
+	for( k=h->nodes.count-1;k>=0;--k ){
+		const CNode &c=cnodes[k];
+		Object *obj=objs[k];
+
+		for( j=0;j<kids[k].size();++j ) objs[kids[k][j]]->setParent( obj );
+
+		for( j=0;j<h->animators.count;++j ){
+			const CAnimator &a=canims[j];
+			if( a.node!=k ) continue;
+			const int *ids=in.get<int>( a.objs );
+			const int *seqs=in.get<int>( a.seqs );
+			const CKeys *keys=in.get<CKeys>( a.keys );
+
+			vector<Object*> anim_objs;
+			int n;
+			for( n=0;n<a.objs.count;++n ) anim_objs.push_back( objs[ids[n]] );
+
+			//animators take their keys from their objects
+			Animator *anim=0;
+			for( int seq=0;seq<a.seqs.count;++seq ){
+				for( n=0;n<a.objs.count;++n ){
+					anim_objs[n]->setAnimation( readKeys( in,keys[seq*a.objs.count+n] ) );
+				}
+				if( !anim ) anim=d_new Animator( anim_objs,seqs[seq] );
+				else anim->addSeq( seqs[seq] );
+			}
+			obj->setAnimator( anim );
+		}
+
+		if( c.boned ) obj->getModel()->getMeshModel()->createBones();
+	}
+
+	return objs[0];
+}
+
+//////////////
+// Writing. //
+//////////////
+struct CacheWriter{
+	vector<char> data;
+
+	vector<Entity*> ents;
+	map<Entity*,int> ids;
+	//one past the last node in each node's subtree
+	vector<int> ends;
+
+	vector<CTexture> texs;
+	vector<string> tex_files;
+
+	vector<CBrush> brushes;
+
+	vector<CNode> nodes;
+	vector<CAnimator> anims;
+
+	template<class T> CRange add( const T *p,int n ){
+		CRange r={ (int)data.size(),n };
+		int sz=n*sizeof(T);
+		data.resize( data.size()+( (sz+3)&~3 ) );
+		if( sz ) memcpy( &data[r.offset],p,sz );
+		return r;
+	}
+
+	template<class T> CRange add( const vector<T> &t ){
+		return add( t.size() ? &t[0] : (const T*)0,t.size() );
+	}
+
+	CRange add( const string &t ){
+		return add( t.data(),t.size() );
+	}
+
+	//false if e's hierarchy has anything a loader wouldn't create
+	bool collect( Entity *e ){
+		if( e->getCamera() || e->getLight() || e->getMirror() || e->getListener() || !e->getObject() ) return false;
+		if( e->getModel() && !e->getModel()->getMeshModel() ) return false;
+
+		int id=ents.size();
+		ids[e]=id;
+		ents.push_back( e );
+		ends.push_back( 0 );
+		for( Entity *p=e->children();p;p=p->successor() ){
+			if( !collect( p ) ) return false;
+		}
+		ends[id]=ents.size();
+		return true;
+	}
+
+	//-1 if t can't be cached - created or animated textures can't be reloaded by name
+	int addTexture( const Texture &t ){
+		CachedTexture *ct=t.getCachedTexture();
+		string file=ct->getName();
+		if( !file.size() || ct->getFrames().size()>1 ) return -1;
+
+		CTexture c;
+		memset( &c,0,sizeof(c) );
+		c.flags=ct->getFlags();
+		c.blend=t.getBlend();
+		c.tex_flags=t.getFlags();
+		c.transformed=t.getTransform( &c.u_scale,&c.v_scale,&c.u_pos,&c.v_pos,&c.rot );
+
+		for( int k=0;k<texs.size();++k ){
+			CTexture q=texs[k];
+			q.file=c.file;
+			if( tex_files[k]==file && !memcmp( &q,&c,sizeof(c) ) ) return k;
+		}
+		c.file=add( file );
+		texs.push_back( c );
+		tex_files.push_back( file );
+		return texs.size()-1;
+	}
+
+	//-2 if b can't be cached
+	int addBrush( const Brush &b ){
+		CBrush c;
+		memset( &c,0,sizeof(c) );
+		const Vector &color=b.getColor();
+		c.color[0]=color.x;c.color[1]=color.y;c.color[2]=color.z;
+		c.alpha=b.getAlpha();
+		c.shininess=b.getShininess();
+		c.blend=b.getBlendMode();
+		c.fx=b.getFX();
+
+		const gxScene::RenderState &rs=b.getRenderState();
+		for( int k=0;k<gxScene::MAX_TEXTURES;++k ){
+			Texture t=b.getTexture( k );
+			c.texs[k]=-1;
+			if( !t.getCachedTexture() ) continue;
+			if( (c.texs[k]=addTexture( t ))<0 ) return -2;
+			const vector<gxCanvas*> &frames=t.getCachedTexture()->getFrames();
+			for( int j=0;j<frames.size();++j ){
+				if( frames[j]==rs.tex_states[k].canvas ) c.frames[k]=j;
+			}
+		}
+
+		for( int k=0;k<brushes.size();++k ){
+			if( !memcmp( &brushes[k],&c,sizeof(c) ) ) return k;
+		}
+		brushes.push_back( c );
+		return brushes.size()-1;
+	}
+
+	CKeys addKeys( const Animation &anim ){
+		CKeys c;
+		int k;
+		Vector v;
+		Quat q;
+
+		vector<CVectorKey> pos( anim.numPositionKeys() );
+		for( k=0;k<pos.size();++k ){
+			pos[k].frame=anim.getPositionKey( k,&v );
+			pos[k].v[0]=v.x;pos[k].v[1]=v.y;pos[k].v[2]=v.z;
+		}
+		c.pos=add( pos );
+
+		vector<CVectorKey> scl( anim.numScaleKeys() );
+		for( k=0;k<scl.size();++k ){
+			scl[k].frame=anim.getScaleKey( k,&v );
+			scl[k].v[0]=v.x;scl[k].v[1]=v.y;scl[k].v[2]=v.z;
+		}
+		c.scl=add( scl );
+
+		vector<CQuatKey> rot( anim.numRotationKeys() );
+		for( k=0;k<rot.size();++k ){
+			rot[k].frame=anim.getRotationKey( k,&q );
+			rot[k].w=q.w;rot[k].v[0]=q.v.x;rot[k].v[1]=q.v.y;rot[k].v[2]=q.v.z;
+		}
+		c.rot=add( rot );
+
+		return c;
+	}
+
+	bool addMesh( MeshModel *mesh,CNode &c ){
+		const MeshModel::SurfaceList &surfs=mesh->getSurfaces();
+		vector<CSurface> csurfs;
+		vector<void*> coll_surfs;
+		for( int k=0;k<surfs.size();++k ){
+			Surface *s=surfs[k];
+			CSurface q;
+			if( (q.brush=addBrush( s->getBrush() ))<0 ) return false;
+			q.verts=add( s->numVertices() ? &s->getVertex( 0 ) : 0,s->numVertices() );
+			q.tris=add( s->numTriangles() ? &s->getTriangle( 0 ) : 0,s->numTriangles() );
+			csurfs.push_back( q );
+			coll_surfs.push_back( s );
+		}
+		c.surfs=add( csurfs );
+		if( (c.brush=addBrush( mesh->getBrush() ))<0 ) return false;
+		c.boned=mesh->boned();
+
+		vector<MeshCollider::FlatTri> coll_tris;
+		vector<MeshCollider::FlatNode> coll_nodes;
+		mesh->getCollider()->flatten( coll_surfs,coll_tris,coll_nodes );
+		c.coll_tris=add( coll_tris );
+		c.coll_nodes=add( coll_nodes );
+		return true;
+	}
+
+	bool addAnimator( Animator *anim,int node ){
+		const vector<Object*> &objs=anim->getObjects();
+		vector<int> obj_ids;
+		int k;
+		for( k=0;k<objs.size();++k ){
+			map<Entity*,int>::iterator it=ids.find( objs[k] );
+			if( it==ids.end() || it->second<node || it->second>=ends[node] ) return false;
+			obj_ids.push_back( it->second );
+		}
+		vector<int> seqs;
+		vector<CKeys> keys;
+		for( int seq=0;seq<anim->numSeqs();++seq ){
+			seqs.push_back( anim->seqFrames( seq ) );
+			for( k=0;k<objs.size();++k ) keys.push_back( addKeys( anim->getKeys( k,seq ) ) );
+		}
+		CAnimator c;
+		c.node=node;
+		c.objs=add( obj_ids );
+		c.seqs=add( seqs );
+		c.keys=add( keys );
+		anims.push_back( c );
+		return true;
+	}
+
+	bool addNode( int id ){
+		Entity *e=ents[id];
+		Object *obj=e->getObject();
+
+		CNode c;
+		memset( &c,0,sizeof(c) );
+		c.type=CNode::NODE_PIVOT;
+		c.parent=e->getParent() && id ? ids[e->getParent()] : -1;
+		c.name=add( e->getName() );
+
+		const Vector &pos=e->getLocalPosition(),&scl=e->getLocalScale();
+		const Quat &rot=e->getLocalRotation();
+		c.pos[0]=pos.x;c.pos[1]=pos.y;c.pos[2]=pos.z;
+		c.scl[0]=scl.x;c.scl[1]=scl.y;c.scl[2]=scl.z;
+		c.rot[0]=rot.w;c.rot[1]=rot.v.x;c.rot[2]=rot.v.y;c.rot[3]=rot.v.z;
+		c.keys=addKeys( obj->getAnimation() );
+
+		if( MeshModel *mesh=e->getModel() ? e->getModel()->getMeshModel() : 0 ){
+			c.type=CNode::NODE_MESH;
+			if( !addMesh( mesh,c ) ) return false;
+		}
+		if( Animator *anim=obj->getAnimator() ){
+			if( !addAnimator( anim,id ) ) return false;
+		}
+		nodes.push_back( c );
+		return true;
+	}
+};
+
+void MeshCache::setDir( const string &dir ){
+	cache_dir=dir;
+	if( !cache_dir.size() ) return;
+	char c=cache_dir[cache_dir.size()-1];
+	if( c!='\\' && c!='/' ) cache_dir+='\\';
+}
+
+const string &MeshCache::getDir(){
+	return cache_dir;
+}
+
+bool MeshCache::fresh( const string &f,int hint ){
+	if( !cache_dir.size() ) return false;
+	MappedFile in( cacheFile( f,hint ) );
+	return checkHeader( in,f,hint,0 );
+}
+
+Entity *MeshCache::load( const string &f,const Transform &conv,int hint ){
+	if( !cache_dir.size() ) return 0;
+	MappedFile in( cacheFile( f,hint ) );
+	if( !checkHeader( in,f,hint,&conv ) || !checkRecords( in ) ) return 0;
+	return readEntities( in );
+}
+
+bool MeshCache::save( Entity *e,const string &f,const Transform &conv,int hint ){
+	if( !cache_dir.size() ) return false;
+
+	CHeader h;
+	memset( &h,0,sizeof(h) );
+	if( !sourceStamp( f,&h.src_size,h.src_time ) ) return false;
+
+	CacheWriter out;
+	out.data.resize( sizeof(CHeader) );
+	if( !out.collect( e ) ) return false;
+	for( int k=0;k<out.ents.size();++k ){
+		if( !out.addNode( k ) ) return false;
+	}
+
+	h.magic=CACHE_MAGIC;
+	h.version=CACHE_VERSION;
+	h.vertex_size=sizeof(Surface::Vertex);
+	h.hint=hint;
+	convFloats( conv,h.conv );
+	h.src_file=out.add( f );
+	h.textures=out.add( out.texs );
+	h.brushes=out.add( out.brushes );
+	h.nodes=out.add( out.nodes );
+	h.animators=out.add( out.anims );
+	h.file_size=out.data.size();
+	memcpy( &out.data[0],&h,sizeof(h) );
+
+	CreateDirectory( cache_dir.c_str(),0 );
+	string file=cacheFile( f,hint );
+	FILE *fp=fopen( file.c_str(),"wb" );
+	if( !fp ) return false;
+	bool ok=fwrite( &out.data[0],out.data.size(),1,fp )==1;
+	if( fclose( fp ) ) ok=false;
+	if( !ok ) remove( file.c_str() );
+	return ok;
+}
@@ -0,0 +1,35 @@
+
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include "entity.h"
+
+//
+// Binary cache of loaded meshes.
+//
+// A cache file holds the entities a mesh file loads as, in their final form - surface vertex and
+// triangle arrays, brushes, animation keys and collision trees - so loading one is little more than
+// copying arrays out of the mapped file. Records refer to each other by file offset, so the only
+// fix-ups needed are collision triangles' surface pointers. Textures are stored by file name, and
+// loaded as usual.
+//
+// Cache files are keyed by the source file's path and the loader hint, and go stale when the source
+// changes size or modification time, or is loaded with a different loader matrix.
+//
+class MeshCache{
+public:
+	//directory cache files are kept in, "" to disable the cache
+	static void setDir( const string &dir );
+	static const string &getDir();
+
+	//true if f has an up to date cache file, ignoring the loader matrix
+	static bool fresh( const string &f,int hint );
+
+	//create the entities cached for f, or return 0 if there's no up to date cache file
+	static Entity *load( const string &f,const Transform &conv,int hint );
+
+	//write e as the cache for f - returns false if e can't be cached, or the file can't be written
+	static bool save( Entity *e,const string &f,const Transform &conv,int hint );
+};
+
+#endif
@@ -2,10 +2,21 @@
 #include "std.h"
 #include "meshcollider.h"
 
+#include <atomic>
+#include <algorithm>
+
+//max tris in a leaf
 static const int MAX_COLL_TRIS=16;
-static vector<Vector> tri_centres;
 
-extern float stats3d[10];
+//number of bins used to find best split
+static const int SPLIT_BINS=16;
+
+//beyond this depth nodes are split in half, so the traversal stack can't overflow
+static const int MAX_SAH_DEPTH=40;
+static const int STACK_SIZE=64;
+
+//tris compared for collision, may be bumped by collision threads
+static std::atomic<int> tris_tested;
 
 extern gxRuntime *gx_runtime;
 
@@ -32,165 +43,401 @@ static bool trisIntersect( const Vector a[3],const Vector b[3] ){
 	return triTest( a,b ) || triTest( b,a );
 }
 
-MeshCollider::MeshCollider( const vector<Vertex> &verts,const vector<Triangle> &tris ):
-vertices(verts),triangles(tris){
-	vector<int> ts;
-	tri_centres.clear();
+struct MeshCollider::BuildTri{
+	Box box;
+	Vector centre;
+	int index;
+};
+
+static float boxArea( const Box &b ){
+	if( b.empty() ) return 0;
+	float w=b.width(),h=b.height(),d=b.depth();
+	return w*h+h*d+d*w;
+}
+
+MeshCollider::MeshCollider( const vector<Vertex> &verts,const vector<Triangle> &triangles ){
+
+	vector<BuildTri> build( triangles.size() );
 	for( int k=0;k<triangles.size();++k ){
-		const MeshCollider::Triangle &t=triangles[k];
-		const Vector &v0=vertices[t.verts[0]].coords;
-		const Vector &v1=vertices[t.verts[1]].coords;
-		const Vector &v2=vertices[t.verts[2]].coords;
-		tri_centres.push_back( (v0+v1+v2)/3 );
-		ts.push_back( k );
-	}
-	tree=createNode( ts );
+		const Triangle &t=triangles[k];
+		BuildTri &b=build[k];
+		b.box=Box( verts[t.verts[0]].coords );
+		b.box.update( verts[t.verts[1]].coords );
+		b.box.update( verts[t.verts[2]].coords );
+		b.centre=b.box.centre();
+		b.index=k;
+	}
+
+	nodes.reserve( triangles.size()/4+1 );
+	createNode( build.size() ? &build[0] : 0,0,build.size(),0 );
+
+	//copy tris in leaf order
+	tris.resize( build.size() );
+	for( int k=0;k<build.size();++k ){
+		const Triangle &t=triangles[build[k].index];
+		Tri &q=tris[k];
+		for( int j=0;j<3;++j ) q.verts[j]=verts[t.verts[j]].coords;
+		q.surface=t.surface;
+		q.index=t.index;
+	}
 }
 
 MeshCollider::~MeshCollider(){
-	delete tree;
 }
 
-bool MeshCollider::collide( const Line &line,float radius,Collision *curr_coll,const Transform &t ){
+void MeshCollider::flatten( const vector<void*> &surfs,vector<FlatTri> &out_tris,vector<FlatNode> &out_nodes )const{
+	map<void*,int> surf_ids;
+	for( int k=0;k<surfs.size();++k ) surf_ids[surfs[k]]=k;
 
-	if( !tree ) return false;
+	out_tris.resize( tris.size() );
+	for( int k=0;k<tris.size();++k ){
+		const Tri &t=tris[k];
+		FlatTri &q=out_tris[k];
+		for( int j=0;j<3;++j ){
+			q.verts[j*3]=t.verts[j].x;
+			q.verts[j*3+1]=t.verts[j].y;
+			q.verts[j*3+2]=t.verts[j].z;
+		}
+		q.surface=surf_ids[t.surface];
+		q.index=t.index;
+	}
+	out_nodes.resize( nodes.size() );
+	for( int k=0;k<nodes.size();++k ){
+		const Node &p=nodes[k];
+		FlatNode &q=out_nodes[k];
+		q.box[0]=p.box.a.x;q.box[1]=p.box.a.y;q.box[2]=p.box.a.z;
+		q.box[3]=p.box.b.x;q.box[4]=p.box.b.y;q.box[5]=p.box.b.z;
+		q.right=p.right;
+		q.first=p.first;
+		q.count=p.count;
+	}
+}
 
-	//create local box
-	Box box( line );
-	box.expand( radius );
-	Box local_box=-t * box;
+MeshCollider *MeshCollider::unflatten( const vector<void*> &surfs,const FlatTri *in_tris,int n_tris,const FlatNode *in_nodes,int n_nodes ){
+	if( n_nodes<1 || n_tris<0 ) return 0;
 
-	return collide( local_box,line,radius,t,curr_coll,tree );
-}
+	//check every index, and that traversal can't overflow its stack
+	vector<int> depth( n_nodes );
+	int k;
+	for( k=0;k<n_tris;++k ){
+		if( in_tris[k].surface<0 || in_tris[k].surface>=surfs.size() ) return 0;
+	}
+	for( k=0;k<n_nodes && n_tris;++k ){
+		const FlatNode &p=in_nodes[k];
+		if( depth[k]>=STACK_SIZE ) return 0;
+		if( p.count ){
+			if( p.count<0 || p.first<0 || p.first>n_tris-p.count ) return 0;
+			continue;
+		}
+		if( k+1>=n_nodes || p.right<=k+1 || p.right>=n_nodes ) return 0;
+		depth[k+1]=depth[p.right]=depth[k]+1;
+	}
 
-bool MeshCollider::collide( const Box &line_box,const Line &line,float radius,const Transform &tform,Collision *curr_coll,MeshCollider::Node *node ){
-	if( !line_box.overlaps( node->box ) ){
-		return false;
+	MeshCollider *c=d_new MeshCollider();
+	c->tris.resize( n_tris );
+	for( k=0;k<n_tris;++k ){
+		const FlatTri &t=in_tris[k];
+		Tri &q=c->tris[k];
+		for( int j=0;j<3;++j ) q.verts[j]=Vector( t.verts[j*3],t.verts[j*3+1],t.verts[j*3+2] );
+		q.surface=surfs[t.surface];
+		q.index=t.index;
+	}
+	c->nodes.resize( n_nodes );
+	for( k=0;k<n_nodes;++k ){
+		const FlatNode &p=in_nodes[k];
+		Node &q=c->nodes[k];
+		q.box.a=Vector( p.box[0],p.box[1],p.box[2] );
+		q.box.b=Vector( p.box[3],p.box[4],p.box[5] );
+		q.right=p.right;
+		q.first=p.first;
+		q.count=p.count;
+		//leaves were added as they were created, so in node order
+		if( q.count ) c->leaves.push_back( k );
 	}
+	return c;
+}
+
+int MeshCollider::trisTested(){
+	return tris_tested.exchange( 0 );
+}
+
+bool MeshCollider::collide( const Line &line,float radius,Collision *curr_coll,const Transform &tform ){
+
+	if( !tris.size() ) return false;
+
+	if( !radius ) return rayCollide( line,curr_coll,tform );
+
+	//create local box
+	Box box( line );
+	box.expand( radius );
+	const Box line_box=-tform * box;
 
 	bool hit=false;
-	if( !node->triangles.size() ){
-		if( node->left ) hit|=collide( line_box,line,radius,tform,curr_coll,node->left );
-		if( node->right ) hit|=collide( line_box,line,radius,tform,curr_coll,node->right );
-		return hit;
-	}
+	int stack[STACK_SIZE],sp=0,tested=0;
+
+	const Node *p=&nodes[0];
+	for(;;){
+		if( line_box.overlaps( p->box ) ){
+			if( !p->count ){
+				stack[sp++]=p->right;
+				++p;
+				continue;
+			}
 
-	stats3d[0]+=node->triangles.size();
+			tested+=p->count;
 
-	for( int k=0;k<node->triangles.size();++k ){
+			const Tri *t=&tris[p->first],*end=t+p->count;
+			for( ;t!=end;++t ){
 
-		const Triangle &tri=triangles[node->triangles[k]];
-		const Vector &t_v0=vertices[ tri.verts[0] ].coords;
-		const Vector &t_v1=vertices[ tri.verts[1] ].coords;
-		const Vector &t_v2=vertices[ tri.verts[2] ].coords;
+				//tri box
+				Box tri_box( t->verts[0] );
+				tri_box.update( t->verts[1] );
+				tri_box.update( t->verts[2] );
+				if( !tri_box.overlaps( line_box ) ) continue;
 
-		//tri box
-		Box tri_box( t_v0 );
-		tri_box.update( t_v1 );
-		tri_box.update( t_v2 );
-		if( !tri_box.overlaps( line_box ) ) continue;
+				if( !curr_coll->triangleCollide( line,radius,tform*t->verts[0],tform*t->verts[1],tform*t->verts[2] ) ) continue;
 
-		if( !curr_coll->triangleCollide( line,radius,tform*t_v0,tform*t_v1,tform*t_v2 ) ) continue;
+				curr_coll->surface=t->surface;
+				curr_coll->index=t->index;
 
-		curr_coll->surface=tri.surface;
-		curr_coll->index=tri.index;
-		
-		hit=true;
+				hit=true;
+			}
+		}
+		if( !sp ) break;
+		p=&nodes[stack[--sp]];
 	}
+
+	tris_tested+=tested;
 	return hit;
 }
 
-Box MeshCollider::nodeBox( const vector<int> &tris ){
-	Box box;
-	for( int k=0;k<tris.size();++k ){
-		const Triangle &t=triangles[ tris[k] ];
-		for( int j=0;j<3;++j ) box.update( vertices[t.verts[j]].coords );
+static bool rayBox( const Vector &o,const Vector &inv_d,float t0,float t1,const Box &b ){
+	for( int k=0;k<3;++k ){
+		float ta=(b.a[k]-o[k])*inv_d[k],tb=(b.b[k]-o[k])*inv_d[k];
+		if( ta>tb ) std::swap( ta,tb );
+		if( ta>t0 ) t0=ta;
+		if( tb<t1 ) t1=tb;
+		if( t0>t1 ) return false;
 	}
-	return box;
+	return true;
 }
 
-MeshCollider::Node *MeshCollider::createLeaf( const vector<int> &tris ){
+//
+// Radius 0 version of collide.
+//
+// Tests the ray against the untransformed tris using Moller-Trumbore, so tris don't have to be
+// transformed to world space. Line parameters are the same in both spaces, and the world normal
+// is only calculated for hits.
+//
+bool MeshCollider::rayCollide( const Line &line,Collision *curr_coll,const Transform &tform ){
 
-	Node *c=d_new Node;
-	c->box=nodeBox( tris );
-	c->triangles=tris;
-	leaves.push_back( c );
-	return c;
+	const Line l=-tform * line;
+	const Matrix co=tform.m.cofactor();
+
+	//tris flip if tform is mirrored
+	const float facing=tform.m.determinant()<0 ? -1 : 1;
+
+	Vector inv_d;
+	for( int k=0;k<3;++k ){
+		float t=l.d[k];
+		if( fabs(t)<1e-20f ) t=t<0 ? -1e-20f : 1e-20f;
+		inv_d[k]=1/t;
+	}
+
+	//allow for hits just behind the ray start, as Collision::update does
+	float len=line.d.length();
+	if( !len ) return false;
+	const float t0=-COLLISION_EPSILON/len;
+
+	bool hit=false;
+	int stack[STACK_SIZE],sp=0,tested=0;
+
+	const Node *p=&nodes[0];
+	for(;;){
+		if( rayBox( l.o,inv_d,t0,curr_coll->time,p->box ) ){
+			if( !p->count ){
+				stack[sp++]=p->right;
+				++p;
+				continue;
+			}
+
+			tested+=p->count;
+
+			const Tri *t=&tris[p->first],*end=t+p->count;
+			for( ;t!=end;++t ){
+
+				Vector e1=t->verts[1]-t->verts[0],e2=t->verts[2]-t->verts[0];
+				Vector pv=l.d.cross( e2 );
+
+				//back facing or parallel?
+				float det=e1.dot( pv );
+				if( det*facing<=0 ) continue;
+				float inv_det=1/det;
+
+				Vector s=l.o-t->verts[0];
+				float u=s.dot( pv )*inv_det;
+				if( u<0 || u>1 ) continue;
+
+				Vector q=s.cross( e1 );
+				float v=l.d.dot( q )*inv_det;
+				if( v<0 || u+v>1 ) continue;
+
+				float time=e2.dot( q )*inv_det;
+				if( time>curr_coll->time ) continue;
+
+				if( !curr_coll->update( line,time,(co*e1.cross( e2 )).normalized() ) ) continue;
+
+				curr_coll->surface=t->surface;
+				curr_coll->index=t->index;
+
+				hit=true;
+			}
+		}
+		if( !sp ) break;
+		p=&nodes[stack[--sp]];
+	}
+
+	tris_tested+=tested;
+	return hit;
 }
 
-MeshCollider::Node *MeshCollider::createNode( const vector<int> &tris ){
+//
+// Builds nodes for build[first]...build[first+count-1] using binned surface area heuristic.
+//
+// Reorders the build tris so each leaf references a contiguous range.
+//
+int MeshCollider::createNode( BuildTri *build,int first,int count,int depth ){
 
-	if( tris.size()<=MAX_COLL_TRIS ) return createLeaf( tris );
+	int n=nodes.size();
+	nodes.push_back( Node() );
 
-	Node *c=d_new Node;
-	c->box=nodeBox( tris );
+	Box box,centres;
+	for( int k=first;k<first+count;++k ){
+		box.update( build[k].box );
+		centres.update( build[k].centre );
+	}
+	nodes[n].box=box;
 
-	//find longest axis
-	//
-	float max=c->box.width();
-	if( c->box.height()>max ) max=c->box.height();
-	if( c->box.depth()>max ) max=c->box.depth();
-	int axis=0;
-	if( max==c->box.height() ) axis=1;
-	else if( max==c->box.depth() ) axis=2;
+	if( count<=2 ){
+		nodes[n].first=first;
+		nodes[n].count=count;
+		if( count ) leaves.push_back( n );
+		return n;
+	}
 
-	//sort by axis
-	//
-	int k;
-	multimap<float,int> axis_map;
-	for( k=0;k<tris.size();++k ){
-		pair<float,int> p( tri_centres[tris[k]][axis],tris[k] );
-		axis_map.insert( p );
+	//find best split plane - cheaper than a leaf, or any split at all if too many tris for a leaf
+	int best_axis=-1,best_bin=0;
+	float best_cost=count<=MAX_COLL_TRIS ? count : INFINITY;
+
+	if( depth<MAX_SAH_DEPTH ){
+		for( int axis=0;axis<3;++axis ){
+			float lo=centres.a[axis],ext=centres.b[axis]-lo;
+			if( ext<=0 ) continue;
+			float scale=SPLIT_BINS/ext;
+
+			Box bin_box[SPLIT_BINS];
+			int bin_cnt[SPLIT_BINS]={0};
+			for( int k=first;k<first+count;++k ){
+				int i=(build[k].centre[axis]-lo)*scale;
+				if( i>=SPLIT_BINS ) i=SPLIT_BINS-1;
+				bin_box[i].update( build[k].box );
+				++bin_cnt[i];
+			}
+
+			//sweep from right to get area and count to the right of each plane
+			float right_area[SPLIT_BINS];
+			int right_cnt[SPLIT_BINS];
+			Box t;
+			int c=0;
+			for( int i=SPLIT_BINS-1;i>0;--i ){
+				t.update( bin_box[i] );
+				c+=bin_cnt[i];
+				right_area[i]=boxArea( t );
+				right_cnt[i]=c;
+			}
+
+			//sweep from left, cost relative to the leaf cost of this node
+			float inv_area=1/boxArea( box );
+			t.clear();
+			c=0;
+			for( int i=1;i<SPLIT_BINS;++i ){
+				t.update( bin_box[i-1] );
+				c+=bin_cnt[i-1];
+				if( !c || !right_cnt[i] ) continue;
+				float cost=1+( boxArea( t )*c+right_area[i]*right_cnt[i] )*inv_area;
+				if( cost<best_cost ){
+					best_cost=cost;
+					best_axis=axis;
+					best_bin=i;
+				}
+			}
+		}
 	}
 
-	//generate left node
-	//
-	vector<int> new_tris;
-	multimap<float,int>::iterator it=axis_map.begin();
-	for( k=axis_map.size()/2;k--;++it ){
-		new_tris.push_back( it->second );
+	if( best_axis==-1 && count<=MAX_COLL_TRIS ){
+		nodes[n].first=first;
+		nodes[n].count=count;
+		leaves.push_back( n );
+		return n;
 	}
-	c->left=createNode( new_tris );
 
-	//generate right node
-	//
-	new_tris.clear();
-	for( ;it!=axis_map.end();++it ){
-		new_tris.push_back( it->second );
+	int mid=first;
+	if( best_axis!=-1 ){
+		float lo=centres.a[best_axis],scale=SPLIT_BINS/(centres.b[best_axis]-lo);
+		BuildTri *p=std::partition( build+first,build+first+count,[=]( const BuildTri &t ){
+			int i=(t.centre[best_axis]-lo)*scale;
+			return i<best_bin;
+		} );
+		mid=p-build;
+	}
+	if( mid==first || mid==first+count ){
+		//too many tris for a leaf but no useful split, so halve along longest axis
+		int axis=0;
+		if( centres.height()>centres.width() ) axis=1;
+		if( centres.depth()>(axis ? centres.height() : centres.width()) ) axis=2;
+		mid=first+count/2;
+		std::nth_element( build+first,build+mid,build+first+count,[=]( const BuildTri &a,const BuildTri &b ){
+			return a.centre[axis]<b.centre[axis];
+		} );
 	}
-	c->right=createNode( new_tris );
 
-	return c;
+	nodes[n].count=0;
+	createNode( build,first,mid-first,depth+1 );
+	nodes[n].right=nodes.size();
+	createNode( build,mid,first+count-mid,depth+1 );
+	return n;
 }
 
 bool MeshCollider::intersects( const MeshCollider &c,const Transform &t )const{
 
-	static Vector a[MAX_COLL_TRIS][3],b[3];
-	
-	if( !(t * tree->box).overlaps( c.tree->box ) ) return false;
+	Vector a[MAX_COLL_TRIS][3],b[3];
+
+	if( !tris.size() || !c.tris.size() ) return false;
+
+	if( !(t * nodes[0].box).overlaps( c.nodes[0].box ) ) return false;
 	for( int k=0;k<leaves.size();++k ){
-		Node *p=leaves[k];
-		Box box=t*p->box;
+		const Node &p=nodes[leaves[k]];
+		Box box=t*p.box;
 		bool tformed=false;
 		for( int j=0;j<c.leaves.size();++j ){
-			Node *q=c.leaves[j];
-			if( !box.overlaps( q->box ) ) continue;
+			const Node &q=c.nodes[c.leaves[j]];
+			if( !box.overlaps( q.box ) ) continue;
 			if( !tformed ){
-				for( int n=0;n<p->triangles.size();++n ){
-					const Triangle &tri=triangles[p->triangles[n]];
-					a[n][0]=t * vertices[tri.verts[0]].coords;
-					a[n][1]=t * vertices[tri.verts[1]].coords;
-					a[n][2]=t * vertices[tri.verts[2]].coords;
+				for( int n=0;n<p.count;++n ){
+					const Tri &tri=tris[p.first+n];
+					a[n][0]=t * tri.verts[0];
+					a[n][1]=t * tri.verts[1];
+					a[n][2]=t * tri.verts[2];
 				}
 				tformed=true;
 			}
-			for( int n=0;n<q->triangles.size();++n ){
-				const Triangle &tri=c.triangles[q->triangles[n]];
-				b[0]=c.vertices[tri.verts[0]].coords;
-				b[1]=c.vertices[tri.verts[1]].coords;
-				b[2]=c.vertices[tri.verts[2]].coords;
-				for( int t=0;t<p->triangles.size();++t ){
-					if( trisIntersect( a[t],b ) ) return true;
+			for( int n=0;n<q.count;++n ){
+				const Tri &tri=c.tris[q.first+n];
+				b[0]=tri.verts[0];
+				b[1]=tri.verts[1];
+				b[2]=tri.verts[2];
+				for( int i=0;i<p.count;++i ){
+					if( trisIntersect( a[i],b ) ) return true;
 				}
 			}
 		}
@@ -21,25 +21,51 @@ public:
 
 	bool intersects( const MeshCollider &c,const Transform &t )const;
 
+	const Box &getBox()const{ return nodes[0].box; }
+
+	//returns and resets number of tris compared for collision
+	static int trisTested();
+
+	//
+	// The tree as flat arrays, for the mesh cache - triangle surfaces are stored as indices into surfs.
+	//
+	// unflatten returns 0 if the arrays don't make a valid tree.
+	//
+	struct FlatTri{
+		float verts[9];
+		int surface,index;
+	};
+	struct FlatNode{
+		float box[6];
+		int right,first,count;
+	};
+	void flatten( const vector<void*> &surfs,vector<FlatTri> &tris,vector<FlatNode> &nodes )const;
+	static MeshCollider *unflatten( const vector<void*> &surfs,const FlatTri *tris,int n_tris,const FlatNode *nodes,int n_nodes );
+
 private:
-	vector<Vertex> vertices;
-	vector<Triangle> triangles;
+	//triangle with its vertices copied in, stored in leaf order
+	struct Tri{
+		Vector verts[3];
+		void *surface;
+		int index;
+	};
 
+	//nodes are stored depth first, so the left child of an interior node is the next node
 	struct Node{
 		Box box;
-		Node *left,*right;
-		vector<int> triangles;
-		Node():left(0),right(0){}
-		~Node(){ delete left;delete right; }
+		int right;			//interior node: index of right child
+		int first,count;	//leaf: range of tris, count is 0 for interior nodes
 	};
 
-	Node *tree;
-	vector<Node*> leaves;
+	vector<Tri> tris;
+	vector<Node> nodes;
+	vector<int> leaves;
+
+	struct BuildTri;
+	MeshCollider(){}
+	int createNode( BuildTri *build,int first,int count,int depth );
 
-	Box nodeBox( const vector<int> &tris );
-	Node *createLeaf( const vector<int> &tris );
-	Node *createNode( const vector<int> &tris );
-	bool collide( const Box &box,const Line &line,float radius,const Transform &tform,Collision *curr_coll,Node *node );
+	bool rayCollide( const Line &line,Collision *curr_coll,const Transform &tform );
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -26,8 +26,9 @@ struct MLMesh{
 	}
 };
 
-static MLMesh *ml_mesh;
-static vector<MLMesh*> mesh_stack;
+//per thread, so meshes can be loaded on more than one thread at once
+static thread_local MLMesh *ml_mesh;
+static thread_local vector<MLMesh*> mesh_stack;
 
 void MeshLoader::beginMesh(){
 	mesh_stack.push_back( ml_mesh );
@@ -47,7 +48,10 @@ void MeshLoader::addTriangle( const int verts[3],const Brush &b ){
 }
 
 void MeshLoader::addBone( int n,float w,int b ){
-	Surface::Vertex &v=ml_mesh->verts[n];
+	addBone( ml_mesh->verts[n],w,b );
+}
+
+void MeshLoader::addBone( Surface::Vertex &v,float w,int b ){
 	int i;
 	for( i=0;i<MAX_SURFACE_BONES;++i ){
 		if( v.bone_bones[i]==255 || w>v.bone_weights[i] ) break;
@@ -65,63 +69,84 @@ Surface::Vertex &MeshLoader::refVertex( int n ){
 	return ml_mesh->verts[n];
 }
 
-void MeshLoader::addTriangle( int v0,int v1,int v2,const Brush &b ){
-	//find surface
-	Surf *surf;
+static Surf *findSurf( const Brush &b ){
 	map<Brush,Surf*>::const_iterator it=ml_mesh->brush_map.find( b );
-	if( it!=ml_mesh->brush_map.end() ) surf=it->second;
-	else{
-		surf=d_new Surf;
-		ml_mesh->brush_map.insert( make_pair( b,surf ) );
-	}
+	if( it!=ml_mesh->brush_map.end() ) return it->second;
+	Surf *surf=d_new Surf;
+	ml_mesh->brush_map.insert( make_pair( b,surf ) );
+	return surf;
+}
 
+void MeshLoader::addTriangle( int v0,int v1,int v2,const Brush &b ){
 	Tri tri;
 	tri.verts[0]=v0;tri.verts[1]=v1;tri.verts[2]=v2;
-	surf->tris.push_back( tri );
+	findSurf( b )->tris.push_back( tri );
 }
 
-void MeshLoader::endMesh( MeshModel *mesh ){
-	if( mesh ){
-		//fix bone weights
-		int k,max_bones=0;
-		for( k=0;k<ml_mesh->verts.size();++k ){
-			Surface::Vertex &v=ml_mesh->verts[k];
-			if( v.bone_bones[0]==255 ) continue;
-			int j;
-			float t=0;
-			for( j=0;j<MAX_SURFACE_BONES;++j ){
-				if( v.bone_bones[j]==255 ) break;
-				t+=v.bone_weights[j];
-			}
-			if( j>max_bones ) max_bones=j;
-			t=1.0f/t;
-			for( j=0;j<MAX_SURFACE_BONES;++j ){
-				v.bone_weights[j]*=t;
+void MeshLoader::normalizeBones( vector<Surface::Vertex> &verts ){
+	for( int k=0;k<verts.size();++k ){
+		Surface::Vertex &v=verts[k];
+		if( v.bone_bones[0]==255 ) continue;
+		int j;
+		float t=0;
+		for( j=0;j<MAX_SURFACE_BONES;++j ){
+			if( v.bone_bones[j]==255 ) break;
+			t+=v.bone_weights[j];
+		}
+		t=1.0f/t;
+		for( j=0;j<MAX_SURFACE_BONES;++j ){
+			v.bone_weights[j]*=t;
+		}
+	}
+}
+
+void MeshLoader::remapTriangles( const vector<Surface::Vertex> &verts,const int *tris,int n_tris,int base,
+	vector<Surface::Vertex> &out_verts,vector<Surface::Triangle> &out_tris,vector<int> &vert_map ){
+
+	unsigned n_verts=verts.size();
+	int first_vert=out_verts.size();
+	out_tris.reserve( out_tris.size()+n_tris );
+
+	int k;
+	for( k=0;k<n_tris;++k ){
+		const int *src=tris+k*3;
+		if( (unsigned)src[0]>=n_verts || (unsigned)src[1]>=n_verts || (unsigned)src[2]>=n_verts ) continue;
+		Surface::Triangle tri;
+		for( int j=0;j<3;++j ){
+			int n=src[j];
+			if( vert_map[n]==-1 ){
+				vert_map[n]=base+out_verts.size()-first_vert;
+				out_verts.push_back( verts[n] );
 			}
+			tri.verts[j]=vert_map[n];
 		}
-		map<int,int> vert_map;
+		out_tris.push_back( tri );
+	}
+
+	//reset the map for next time
+	for( k=0;k<n_tris*3;++k ){
+		if( (unsigned)tris[k]<n_verts ) vert_map[tris[k]]=-1;
+	}
+}
+
+void MeshLoader::endMesh( MeshModel *mesh ){
+	if( mesh ){
+		normalizeBones( ml_mesh->verts );
+
+		vector<int> vert_map( ml_mesh->verts.size(),-1 );
+		vector<Surface::Vertex> surf_verts;
+		vector<Surface::Triangle> surf_tris;
 		map<Brush,Surf*>::iterator it;
 		for( it=ml_mesh->brush_map.begin();it!=ml_mesh->brush_map.end();++it ){
-			vert_map.clear();
 			Brush b=it->first;
 			Surf *t=it->second;
 			Surface *surf=mesh->findSurface( b );
 			if( !surf ) surf=mesh->createSurface( b );
-			for( int k=0;k<t->tris.size();++k ){
-				Surface::Triangle tri;
-				for( int j=0;j<3;++j ){
-					int n=t->tris[k].verts[j],id;
-					map<int,int>::const_iterator it=vert_map.find( n );
-					if( it!=vert_map.end() ) id=it->second;
-					else{
-						id=surf->numVertices();
-						surf->addVertex( ml_mesh->verts[n] );
-						vert_map.insert( make_pair( n,id ) );
-					}
-					tri.verts[j]=id;
-				}
-				surf->addTriangle( tri );
-			}
+			surf_verts.clear();
+			surf_tris.clear();
+			remapTriangles( ml_mesh->verts,t->tris[0].verts,t->tris.size(),surf->numVertices(),surf_verts,surf_tris,vert_map );
+			surf->addVertices( surf_verts );
+			surf->addTriangles( surf_tris );
 		}
 	}
 	delete ml_mesh;
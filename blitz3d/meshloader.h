@@ -37,6 +37,19 @@ public:
 
 	//finally, update the mesh...
 	static void endMesh( MeshModel *mesh );
+
+	//the following don't touch the current mesh, so can be used from any thread
+
+	//add a bone weight to a vertex, keeping the heaviest
+	static void addBone( Surface::Vertex &v,float weight,int bone );
+
+	//scale each vertex's bone weights to add up to 1
+	static void normalizeBones( vector<Surface::Vertex> &verts );
+
+	//append vertices of verts used by tris to out_verts in order of first use, and tris renumbered from base to
+	//out_tris. vert_map must hold verts.size() -1s, and is left that way. Triangles with bad indices are dropped.
+	static void remapTriangles( const vector<Surface::Vertex> &verts,const int *tris,int n_tris,int base,
+		vector<Surface::Vertex> &out_verts,vector<Surface::Triangle> &out_tris,vector<int> &vert_map );
 };
 
 #endif
\ No newline at end of file
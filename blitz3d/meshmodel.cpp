@@ -2,21 +2,26 @@
 #include "std.h"
 #include "meshmodel.h"
 #include "meshcollider.h"
+#include "staticmodel.h"
+#include "threadpool.h"
 
 extern gxGraphics *gx_graphics;
+extern gxScene *gx_scene;
 
 struct MeshModel::Rep : public Surface::Monitor{
 
 	int ref_cnt;
 	mutable Box box,cullBox;
 	mutable MeshCollider *collider;
-	mutable int box_valid,coll_valid,norms_valid;
+	mutable int box_valid,coll_valid,norms_valid,centers_valid;
+	mutable float norms_angle;
+	mutable vector<Vector> centers;
 
 	SurfaceList surfaces;
 	vector<Transform> bone_tforms;
 
 	Rep():
-	ref_cnt(1),collider(0),box_valid(-1),coll_valid(-1),norms_valid(-1){
+	ref_cnt(1),collider(0),box_valid(-1),coll_valid(-1),norms_valid(-1),centers_valid(-1),norms_angle(0){
 		geom_changes=brush_changes=0;
 	}
 
@@ -102,13 +107,13 @@ struct MeshModel::Rep : public Surface::Monitor{
 		cullBox=t;
 	}
 
-	void updateNormals(){
-		if( norms_valid!=geom_changes ){
-			for( int k=0;k<surfaces.size();++k ){
-				Surface *s=surfaces[k];
-				s->updateNormals();
-			}
+	void updateNormals( float max_angle ){
+		if( norms_valid!=geom_changes || norms_angle!=max_angle ){
+			ThreadPool::run( surfaces.size(),[this,max_angle]( int k ){
+				surfaces[k]->updateNormals( max_angle );
+			} );
 			norms_valid=geom_changes;
+			norms_angle=max_angle;
 		}
 	}
 
@@ -126,6 +131,22 @@ struct MeshModel::Rep : public Surface::Monitor{
 		return box;
 	}
 
+	const Vector &getCenter( int n )const{
+		if( centers_valid!=geom_changes ){
+			centers.resize( surfaces.size() );
+			for( int k=0;k<surfaces.size();++k ){
+				Surface *s=surfaces[k];
+				Box t;
+				for( int j=0;j<s->numVertices();++j ){
+					t.update( s->getVertex(j).coords );
+				}
+				centers[k]=t.empty() ? Vector() : t.centre();
+			}
+			centers_valid=geom_changes;
+		}
+		return centers[n];
+	}
+
 	const Box &getCullBox()const{
 		return cullBox.empty() ? getBox() : cullBox;
 	}
@@ -161,11 +182,11 @@ struct MeshModel::Rep : public Surface::Monitor{
 };
 
 MeshModel::MeshModel():
-rep( d_new Rep() ),brush_changes(0){
+rep( d_new Rep() ),brush_changes(0),opaque(false),baked(false),cull_plane(0),skinned(false),skin_id(0){
 }
 
 MeshModel::MeshModel( const MeshModel &t ):Model( t ),
-rep( t.rep ),brush_changes( rep->brush_changes-1 ){
+rep( t.rep ),brush_changes( rep->brush_changes-1 ),opaque(false),baked(false),cull_plane(0),skinned(false),skin_id(0){
 	++rep->ref_cnt;
 	surf_bones.resize( t.surf_bones.size() );
 	/*
@@ -179,11 +200,12 @@ rep( t.rep ),brush_changes( rep->brush_changes-1 ){
 }
 
 MeshModel::~MeshModel(){
+	if( baked ) StaticModel::meshDeleted( this );
 	if( !--rep->ref_cnt ) delete rep;
 }
 
-void MeshModel::updateNormals(){
-	rep->updateNormals();
+void MeshModel::updateNormals( float max_angle ){
+	rep->updateNormals( max_angle );
 }
 
 void MeshModel::setCullBox( const Box &box ){
@@ -208,50 +230,123 @@ void MeshModel::createBones(){
 	}
 }
 
-bool MeshModel::render( const RenderContext &rc ){
+void MeshModel::updateBones(){
+	const vector<Object*> &bones=getAnimator()->getObjects();
+
+	for( int k=0;k<bones.size();++k ){
+		Transform t=
+		bones[k]->getRenderTform() * rep->bone_tforms[k];
+		surf_bones[k].coord_tform=t;
+		surf_bones[k].normal_tform=t.m.cofactor();
+	}
+}
+
+bool MeshModel::beginSkin(){
+	if( !surf_bones.size() ) return false;
+
+	updateBones();
+
+	skin_verts.resize( rep->surfaces.size() );
+	for( int k=0;k<rep->surfaces.size();++k ){
+		Surface *s=rep->surfaces[k];
+		s->validateSkin();
+		skin_verts[k].resize( s->numVertices()*SKIN_VERTEX_FLOATS );
+	}
+	//copies of a mesh share its surfaces, so ids must be unique across models
+	static int skin_ids;
+	if( !++skin_ids ) ++skin_ids;
+	skin_id=skin_ids;
+	skinned=true;
+	return true;
+}
+
+void MeshModel::skin( int surf,int first,int count ){
+	rep->surfaces[surf]->skin( surf_bones,skin_verts[surf].data(),first,count );
+}
+
+void MeshModel::endSkin(){
+	skinned=false;
+}
+
+void MeshModel::validateBrushes(){
+	if( brush_changes==rep->brush_changes ) return;
+	brushes.clear();
+	opaque=true;
+	for( int k=0;k<rep->surfaces.size();++k ){
+		Surface *s=rep->surfaces[k];
+		brushes.push_back( Brush( s->getBrush(),render_brush ) );
+		if( brushes.back().getBlend()!=gxScene::BLEND_REPLACE ) opaque=false;
+	}
+	brush_changes=rep->brush_changes;
+}
 
+bool MeshModel::instanceable(){
+	if( rep->ref_cnt<2 || surf_bones.size() || getRenderSpace()!=RENDER_SPACE_LOCAL ) return false;
+	validateBrushes();
+	return opaque;
+}
+
+bool MeshModel::cull( const RenderContext &rc ){
 	const Box &b=rep->getCullBox();
 	if( b.empty() ) return false;
 
-	static Frustum model_frustum;
-	new( &model_frustum ) Frustum( rc.getWorldFrustum(),-getRenderTform() );
-	if( !model_frustum.cull( b ) ) return false;
+	return rc.getWorldFrustum().cull( b,getRenderTform(),cull_plane );
+}
 
-	if( brush_changes!=rep->brush_changes ){
-		brushes.clear();
-		for( int k=0;k<rep->surfaces.size();++k ){
-			Surface *s=rep->surfaces[k];
-			brushes.push_back( Brush( s->getBrush(),render_brush ) );
+bool MeshModel::inView( const RenderContext &rc )const{
+	const Box &b=rep->getCullBox();
+	return !b.empty() && rc.getWorldFrustum().cull( b,getRenderTform() );
+}
+
+void MeshModel::renderInstances( MeshModel *const *models,int count ){
+
+	static vector<gxScene::Matrix> tforms;
+
+	tforms.resize( count );
+	for( int k=0;k<count;++k ){
+		tforms[k]=*(const gxScene::Matrix*)&models[k]->getRenderTform();
+	}
+
+	const MeshModel *m=models[0];
+	for( int k=0;k<m->rep->surfaces.size();++k ){
+		Surface *s=m->rep->surfaces[k];
+		if( gxMesh *mesh=s->getMesh() ){
+			gx_scene->setRenderState( m->brushes[k].getRenderState() );
+			gx_scene->renderInstances( mesh,0,s->numVertices(),0,s->numTriangles(),&tforms[0],count );
 		}
-		brush_changes=rep->brush_changes;
 	}
+}
+
+bool MeshModel::render( const RenderContext &rc ){
+
+	if( !rc.isCulled() && !cull( rc ) ) return false;
+
+	validateBrushes();
 
 	if( !surf_bones.size() ){
+		bool sort=Model::sortTransparent();
 		for( int k=0;k<rep->surfaces.size();++k ){
 			Surface *s=rep->surfaces[k];
 			if( gxMesh *mesh=s->getMesh() ){
-				enqueue( mesh,0,s->numVertices(),0,s->numTriangles(),brushes[k] );
+				if( sort && brushes[k].getBlend()!=gxScene::BLEND_REPLACE ){
+					float d=rc.getCameraTform().v.distanceSq( getRenderTform()*rep->getCenter( k ) );
+					enqueue( mesh,0,s->numVertices(),0,s->numTriangles(),brushes[k],d );
+				}else{
+					enqueue( mesh,0,s->numVertices(),0,s->numTriangles(),brushes[k] );
+				}
 			}
 		}
 		return false;
 	}
 
 	//OK, its boned!
-	const vector<Object*> &bones=getAnimator()->getObjects();
-
-	int k;
-	for( k=0;k<bones.size();++k ){
-		Transform t=
-		bones[k]->getRenderTform() * rep->bone_tforms[k];
-		surf_bones[k].coord_tform=t;
-		surf_bones[k].normal_tform=t.m.cofactor();
-	}
+	if( !skinned ) updateBones();
 
 	bool trans=false;
-	for( k=0;k<rep->surfaces.size();++k ){
+	for( int k=0;k<rep->surfaces.size();++k ){
 		Surface *s=rep->surfaces[k];
 		if( brushes[k].getBlend()==gxScene::BLEND_REPLACE ){
-			if( gxMesh *mesh=s->getMesh( surf_bones ) ){
+			if( gxMesh *mesh=skinned ? s->getMesh( skin_verts[k].data(),skin_id ) : s->getMesh( surf_bones ) ){
 				enqueue( mesh,0,s->numVertices(),0,s->numTriangles(),brushes[k] );
 			}
 		}else{
@@ -266,7 +361,7 @@ void MeshModel::renderQueue( int type ){
 		for( int k=0;k<rep->surfaces.size();++k ){
 			Surface *s=rep->surfaces[k];
 			if( brushes[k].getBlend()!=gxScene::BLEND_REPLACE ){
-				if( gxMesh *mesh=s->getMesh( surf_bones ) ){
+				if( gxMesh *mesh=skinned ? s->getMesh( skin_verts[k].data(),skin_id ) : s->getMesh( surf_bones ) ){
 					enqueue( mesh,0,s->numVertices(),0,s->numTriangles(),brushes[k] );
 				}
 			}
@@ -308,6 +403,12 @@ MeshCollider *MeshModel::getCollider()const{
 	return rep->getCollider();
 }
 
+void MeshModel::setCollider( MeshCollider *c ){
+	delete rep->collider;
+	rep->collider=c;
+	rep->coll_valid=rep->geom_changes;
+}
+
 Surface *MeshModel::findSurface( const Brush &b )const{
 	return rep->findSurface( b );
 }
@@ -316,6 +417,14 @@ bool MeshModel::collide( const Line &line,float radius,Collision *curr_coll,cons
 	return getCollider()->collide( line,radius,curr_coll,t );
 }
 
+Box MeshModel::getCollisionBounds()const{
+	return rep->getBox();
+}
+
+void MeshModel::validateCollider(){
+	getCollider();
+}
+
 bool MeshModel::intersects( const MeshModel &m )const{
 	return getCollider()->intersects( *m.getCollider(),-m.getWorldTform()*getWorldTform() );
 }
@@ -21,19 +21,43 @@ public:
 
 	//Object interface
 	virtual bool collide( const Line &line,float radius,Collision *curr_coll,const Transform &t );
+	virtual Box getCollisionBounds()const;
+	virtual void validateCollider();
 
 	//Model interface
 	virtual void setRenderBrush( const Brush &b );
 	virtual bool render( const RenderContext &rc );
+	virtual bool inView( const RenderContext &rc )const;
 	virtual void renderQueue( int type );
+	virtual bool queueSortable()const{ return !surf_bones.size(); }
+
+	//true if this is an opaque, unboned copy that can be drawn by renderInstances
+	bool instanceable();
+	//true if merged into a StaticModel
+	void setBaked( bool t ){ baked=t; }
+	bool isBaked()const{ return baked; }
+
+	//frustum cull against rc
+	bool cull( const RenderContext &rc );
+	//copies with the same key share geometry
+	const void *getInstanceKey()const{ return rep; }
+
+	//draw models sharing a key and render brush, one call per surface
+	static void renderInstances( MeshModel *const *models,int count );
 
 	//boned mesh!
 	void createBones();
 
+	//skin boned mesh ahead of render - returns false if not boned
+	bool beginSkin();
+	//safe to call from multiple threads between beginSkin and endSkin
+	void skin( int surf,int first,int count );
+	void endSkin();
+
 	//MeshModel interface
 	Surface *createSurface( const Brush &b );
 	void setCullBox( const Box &box );
-	void updateNormals();
+	void updateNormals( float max_angle=0 );
 	void flipTriangles();
 	void transform( const Transform &t );
 	void paint( const Brush &b );
@@ -45,6 +69,10 @@ public:
 	Surface *findSurface( const Brush &b )const;
 	bool intersects( const MeshModel &m )const;
 	MeshCollider *getCollider()const;
+	//use c as the collider for the current geometry, eg: one read from the mesh cache - the mesh takes ownership
+	void setCollider( MeshCollider *c );
+	//true once createBones has been called
+	bool boned()const{ return surf_bones.size()>0; }
 	const Box &getBox()const;
 
 private:
@@ -54,8 +82,18 @@ private:
 	int brush_changes;
 	Brush render_brush;
 	vector<Brush> brushes;
+	bool opaque,baked;
+	//plane that last culled model
+	int cull_plane;
 
 	vector<Surface::Bone> surf_bones;
+	vector<vector<float> > skin_verts;
+	bool skinned;
+	//unique id of the current skin_verts
+	int skin_id;
+
+	void updateBones();
+	void validateBrushes();
 
 	MeshModel &operator=(const MeshModel &);
 };
@@ -2,6 +2,8 @@
 #include "std.h"
 #include "model.h"
 
+#include <algorithm>
+
 extern gxScene *gx_scene;
 
 class Model::MeshQueue{
@@ -10,6 +12,7 @@ class Model::MeshQueue{
 		MeshQueue *next;
 	};
 	int fv,vc,ft,tc;
+	float depth;
 	Brush brush;
 	int q_type;
 //	bool opaque;
@@ -19,8 +22,8 @@ class Model::MeshQueue{
 public:
 	MeshQueue(){}
 
-	MeshQueue( gxMesh *m,int fv,int vc,int ft,int tc,const Brush &b ):
-	mesh(m),fv(fv),vc(vc),ft(ft),tc(tc),brush(b){
+	MeshQueue( gxMesh *m,int fv,int vc,int ft,int tc,const Brush &b,float d ):
+	mesh(m),fv(fv),vc(vc),ft(ft),tc(tc),depth(d),brush(b){
 		int n=brush.getBlend();
 		q_type=(n==gxScene::BLEND_REPLACE) ? QUEUE_OPAQUE : QUEUE_TRANSPARENT;
 	}
@@ -28,6 +31,13 @@ public:
 	int getQueueType()const{
 		return q_type;
 	}
+	const Brush &getBrush()const{
+		return brush;
+	}
+	//queues are rendered from the back, so farthest goes last
+	static bool depthLess( MeshQueue *a,MeshQueue *b ){
+		return a->depth<b->depth;
+	}
 	void render(){
 		gx_scene->setRenderState( brush.getRenderState() );
 		gx_scene->render( mesh,fv,vc,ft,tc );
@@ -52,6 +62,8 @@ public:
 
 Model::MeshQueue *Model::MeshQueue::pool;
 
+bool Model::sort_transparent;
+
 Model::Model():
 space( RENDER_SPACE_LOCAL ),
 auto_fade(false),
@@ -81,6 +93,10 @@ bool Model::beginRender( float t ){
 	return tweened_alpha>0;
 }
 
+bool Model::fadedOut( const Vector &eye )const{
+	return auto_fade && eye.distance( getRenderTform().v )>=auto_fade_fr;
+}
+
 bool Model::doAutoFade( const Vector &eye ){
 	float alpha=tweened_alpha;
 	if( auto_fade ){
@@ -112,15 +128,60 @@ void Model::enqueue( MeshQueue *q ){
 }
 
 void Model::enqueue( gxMesh *mesh,int fv,int vc,int ft,int tc ){
-	enqueue( new MeshQueue( mesh,fv,vc,ft,tc,render_brush ) );
+	enqueue( new MeshQueue( mesh,fv,vc,ft,tc,render_brush,0 ) );
 }
 
 void Model::enqueue( gxMesh *mesh,int fv,int vc,int ft,int tc,const Brush &brush ){
-	enqueue( new MeshQueue( mesh,fv,vc,ft,tc,brush ) );
+	enqueue( new MeshQueue( mesh,fv,vc,ft,tc,brush,0 ) );
+}
+
+void Model::enqueue( gxMesh *mesh,int fv,int vc,int ft,int tc,const Brush &brush,float depth ){
+	enqueue( new MeshQueue( mesh,fv,vc,ft,tc,brush,depth ) );
+}
+
+//
+// Sort key, most significant first: blend, texture set, fx, depth.
+//
+static unsigned long long drawKey( const gxScene::RenderState &rs,float depth ){
+
+	unsigned tex=0;
+	for( int k=0;k<gxScene::MAX_TEXTURES;++k ){
+		tex=tex*31+(unsigned)rs.tex_states[k].canvas;
+	}
+	tex=(tex^(tex>>24))&0xffffff;
+
+	//positive floats sort the same as their bits
+	unsigned bits;
+	if( depth<0 ) depth=0;
+	memcpy( &bits,&depth,4 );
+
+	return
+	((unsigned long long)(rs.blend&0xf)<<60)|
+	((unsigned long long)tex<<36)|
+	((unsigned long long)(rs.fx&0xffff)<<20)|
+	((bits>>11)&0xfffff);
+}
+
+void Model::gatherQueue( vector<DrawItem> &items,float depth ){
+	vector<MeshQueue*> *que=&queues[QUEUE_OPAQUE];
+	for( int k=0;k<que->size();++k ){
+		MeshQueue *q=(*que)[k];
+		DrawItem item={ drawKey( q->getBrush().getRenderState(),depth ),(int)items.size(),this,q };
+		items.push_back( item );
+	}
+	que->clear();
+}
+
+void Model::renderItem( const DrawItem &item ){
+	item.queue->render();
+	delete item.queue;
 }
 
 void Model::renderQueue( int type ){
 	vector<MeshQueue*> *que=&queues[type];
+	if( type==QUEUE_TRANSPARENT && sort_transparent && que->size()>1 ){
+		std::stable_sort( que->begin(),que->end(),MeshQueue::depthLess );
+	}
 	for( ;que->size();que->pop_back() ){
 		MeshQueue *q=que->back();
 		q->render();
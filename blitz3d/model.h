@@ -10,8 +10,10 @@ class Sprite;
 class Terrain;
 class PlaneModel;
 class Q3BSPModel;
+class StaticModel;
 
 class Model : public Object{
+	class MeshQueue;
 public:
 	enum{
 		RENDER_SPACE_LOCAL=0,
@@ -41,6 +43,8 @@ public:
 	//Model interface
 	virtual void setRenderBrush( const Brush &b ){}
 	virtual bool render( const RenderContext &rc ){ return false; }
+	//conservative visibility test, safe to call from worker threads
+	virtual bool inView( const RenderContext &rc )const{ return true; }
 	virtual void renderQueue( int type );
 
 	virtual Sprite *getSprite(){ return 0; }
@@ -49,6 +53,7 @@ public:
 	virtual MeshModel *getMeshModel(){ return 0; }
 	virtual MD2Model *getMD2Model(){ return 0; }
 	virtual Q3BSPModel *getBSPModel(){ return 0; }
+	virtual StaticModel *getStaticModel(){ return 0; }
 
 	virtual void setBrush( const Brush &b ){ brush=b;w_brush=true; }
 	virtual void setColor( const Vector &c ){ brush.setColor(c);w_brush=true; }
@@ -60,21 +65,49 @@ public:
 
 	const Brush &getBrush()const{ return brush; }
 
+	//brush after alpha tweening and autofade, valid after doAutoFade
+	const Brush &getRenderBrush()const{ return render_brush; }
+
 	void setRenderSpace( int n ){ space=n; }
 	int getRenderSpace()const{ return space; }
 
 	void setAutoFade( float nr,float fr ){ auto_fade_nr=nr;auto_fade_fr=fr;auto_fade=true; }
 
 	bool doAutoFade( const Vector &eye );
+	//true if doAutoFade would fail because of distance - doesn't change the render brush
+	bool fadedOut( const Vector &eye )const;
 
 	void enqueue( gxMesh *mesh,int first_vert,int vert_cnt,int first_tri,int tri_cnt );
 	void enqueue( gxMesh *mesh,int first_vert,int vert_cnt,int first_tri,int tri_cnt,const Brush &b );
+	void enqueue( gxMesh *mesh,int first_vert,int vert_cnt,int first_tri,int tri_cnt,const Brush &b,float depth );
+
+	//sort transparent meshes within a model far to near by the depth they were enqueued with
+	static void setSortTransparent( bool enable ){ sort_transparent=enable; }
+	static bool sortTransparent(){ return sort_transparent; }
 
 	int queueSize( int type )const{ return queues[type].size(); }
 
-private:
-	class MeshQueue;
+	//opaque draw gathered from many models so it can be sorted, see World::render
+	struct DrawItem{
+		unsigned long long key;
+		int order;
+		Model *model;
+		MeshQueue *queue;
+		bool operator<( const DrawItem &t )const{
+			return key!=t.key ? key<t.key : order<t.order;
+		}
+	};
 
+	//true if queued meshes stay the same until the end of the render, so can be drawn later
+	virtual bool queueSortable()const{ return false; }
+
+	//move opaque queue into items, with depth used to order items with the same state
+	void gatherQueue( vector<DrawItem> &items,float depth );
+
+	//render and free a gathered item
+	static void renderItem( const DrawItem &item );
+
+private:
 	int space;
 	Brush brush,render_brush;
 
@@ -86,6 +119,8 @@ private:
 
 	vector<MeshQueue*> queues[2];
 
+	static bool sort_transparent;
+
 	void enqueue( MeshQueue *q );
 };
 
@@ -4,6 +4,8 @@
 
 extern gxRuntime *gx_runtime;
 
+int Object::_pick_changes;
+
 Object::Object():
 order(0),animator(0),last_copy(0),
 coll_type(0),coll_radii(Vector(1,1,1)),coll_box(Box(Vector(-1,-1,-1),Vector(1,1,1))),
@@ -47,10 +49,12 @@ void Object::setCollisionType( int type ){
 
 void Object::setCollisionRadii( const Vector &radii ){
 	coll_radii=radii;
+	++_pick_changes;
 }
 
 void Object::setCollisionBox( const Box &box ){
 	coll_box=box;
+	++_pick_changes;
 }
 
 void Object::setAnimator( Animator *t ){
@@ -72,6 +76,10 @@ void Object::addCollision( const ObjCollision *c ){
 	colls.push_back( c );
 }
 
+void Object::clearCollisions(){
+	colls.clear();
+}
+
 void Object::endUpdate(){
 	velocity=(getWorldTform().v-prev_tform.v)/elapsed;
 	prev_tform=getWorldTform();
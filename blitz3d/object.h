@@ -41,7 +41,7 @@ public:
 	void setCollisionRadii( const Vector &radii );
 	void setCollisionBox( const Box &box );
 	void setOrder( int n ){ order=n; }
-	void setPickGeometry( int n ){ pick_geom=n; }
+	void setPickGeometry( int n ){ pick_geom=n;++_pick_changes; }
 	void setObscurer( bool t ){ obscurer=t; }
 	void setAnimation( const Animation &t ){ anim=t; }
 	void setAnimator( Animator *t );
@@ -54,6 +54,9 @@ public:
 
 	//overridables!
 	virtual bool collide( const Line &line,float radius,::Collision *curr_coll,const Transform &t ){ return false; }
+	virtual Box getCollisionBounds()const{ return Box(); }
+	//build any lazily created collision data, so collide() can be called from worker threads
+	virtual void validateCollider(){}
 	virtual void capture();
 	virtual void animate( float e );
 	virtual bool beginRender( float tween );
@@ -62,6 +65,7 @@ public:
 	//for use by world
 	void beginUpdate( float elapsed );
 	void addCollision( const ObjCollision *c );
+	void clearCollisions();
 	void endUpdate();
 
 	//accessors
@@ -79,6 +83,9 @@ public:
 	Animator *getAnimator()const{ return animator; }
 	Object *getLastCopy()const{ return last_copy; }
 
+	//bumped whenever any object's pick geometry, collision radii or collision box changes
+	static int pickChanges(){ return _pick_changes; }
+
 private:
 	int coll_type;
 	int order;
@@ -107,6 +114,8 @@ private:
 	Animation anim;
 	Animator *animator;
 
+	static int _pick_changes;
+
 	void updateSounds();
 };
 
@@ -112,6 +112,11 @@ PlaneModel::~PlaneModel(){
 	if( !--rep->ref_cnt ) delete rep;
 }
 
+Box PlaneModel::getCollisionBounds()const{
+	//infinite!
+	return Box( Vector( -INFINITY,-INFINITY,-INFINITY ),Vector( INFINITY,INFINITY,INFINITY ) );
+}
+
 Plane PlaneModel::getRenderPlane()const{
 	return Plane( getRenderTform().v,getRenderTform().m.j.normalized() );
 }
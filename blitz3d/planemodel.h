@@ -17,6 +17,7 @@ public:
 
 	//object interface
 	bool collide( const Line &line,float radius,Collision *curr_coll,const Transform &tf );
+	Box getCollisionBounds()const;
 
 	Plane getRenderPlane()const;
 
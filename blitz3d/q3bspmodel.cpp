@@ -28,6 +28,10 @@ bool Q3BSPModel::collide( const Line &line,float radius,Collision *curr_coll,con
 	return rep->collide( line,radius,curr_coll,t );
 }
 
+Box Q3BSPModel::getCollisionBounds()const{
+	return rep->getBox();
+}
+
 bool Q3BSPModel::render( const RenderContext &rc ){
 	rep->render( this,rc );
 	return false;
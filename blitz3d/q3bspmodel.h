@@ -15,6 +15,7 @@ public:
 
 	//Object interface
 	virtual bool collide( const Line &line,float radius,Collision *curr_coll,const Transform &t );
+	virtual Box getCollisionBounds()const;
 
 	//Model interface
 	Q3BSPModel *getBSPModel(){ return this; }
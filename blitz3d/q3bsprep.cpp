@@ -2,6 +2,8 @@
 #include "std.h"
 #include "q3bsprep.h"
 
+#include <chrono>
+
 /* Quake3 File format types */
 
 #pragma pack(push,1)
@@ -130,6 +132,8 @@ struct Q3BSPLeaf{
 	int cluster;
 	Box box;
 	vector<Q3BSPFace*> faces;
+	Q3BSPNode *parent;
+	int vis_frame;
 };
 
 struct Q3BSPNode{
@@ -137,6 +141,8 @@ struct Q3BSPNode{
 	Plane plane;
 	Q3BSPNode *nodes[2];
 	Q3BSPLeaf *leafs[2];
+	Q3BSPNode *parent;
+	int vis_frame;
 
 	~Q3BSPNode(){ delete nodes[0];delete nodes[1];delete leafs[0];delete leafs[1]; }
 };
@@ -159,6 +165,7 @@ static map<int,Q3BSPFace*> q3face_map;
 extern gxScene *gx_scene;
 extern gxRuntime *gx_runtime;
 extern gxGraphics *gx_graphics;
+extern float stats3d[32];
 
 //#define SWAPTRIS
 Vector static tf( const Vector &v ){
@@ -487,6 +494,9 @@ Q3BSPLeaf *Q3BSPRep::createLeaf( int n ){
 	Q3BSPLeaf *leaf=d_new Q3BSPLeaf;
 
 	leaf->cluster=q3leaf->cluster;
+	leaf->parent=0;
+	leaf->vis_frame=0;
+	leafs.push_back( leaf );
 
 	Vector mins( q3leaf->mins[0],q3leaf->mins[1],q3leaf->mins[2] );
 	Vector maxs( q3leaf->maxs[0],q3leaf->maxs[1],q3leaf->maxs[2] );
@@ -556,13 +566,17 @@ Q3BSPNode *Q3BSPRep::createNode( int n ){
 	node->box.update( tf(maxs) );
 	node->plane.n=tf(q3plane->normal);
 	node->plane.d=-q3plane->distance;
+	node->parent=0;
+	node->vis_frame=0;
 
 	for( int k=0;k<2;++k ){
 		if( q3node->children[k]>=0 ){
 			node->nodes[k]=createNode( q3node->children[k] );
+			node->nodes[k]->parent=node;
 			node->leafs[k]=0;
 		}else{
 			node->leafs[k]=createLeaf( -q3node->children[k]-1 );
+			node->leafs[k]->parent=node;
 			node->nodes[k]=0;
 		}
 	}
@@ -570,7 +584,8 @@ Q3BSPNode *Q3BSPRep::createNode( int n ){
 	return node;
 }
 
-Q3BSPRep::Q3BSPRep( const string &f,float gam ):root_node(0),vis_sz(0),vis_data(0),use_lmap(true){
+Q3BSPRep::Q3BSPRep( const string &f,float gam ):root_node(0),vis_sz(0),vis_data(0),use_lmap(true),
+vis_cluster(-2),vis_frame(0){
 
 	gamma_adj=1-gam;
 
@@ -640,29 +655,33 @@ void Q3BSPRep::vis( Q3BSPNode *n ){
 	else r_cluster=n->leafs[i]->cluster;
 }
 
-static bool cull( const Box &b,int *clip ){
-	for( int n=0;n<6;++n ){
-		int mask=1<<n;
-		if( !(*clip & mask) ) continue;
-		const Plane &p=r_frustum.getPlane( n );
-		int q=
-			(p.distance(b.corner(0))>=0)+(p.distance(b.corner(1))>=0)+
-			(p.distance(b.corner(2))>=0)+(p.distance(b.corner(3))>=0)+
-			(p.distance(b.corner(4))>=0)+(p.distance(b.corner(5))>=0)+
-			(p.distance(b.corner(6))>=0)+(p.distance(b.corner(7))>=0);
-		if( !q ) return false;
-		if( q==8 ) *clip&=~mask;
+//
+// Mark leaves visible from r_cluster, and the nodes above them, with a new vis_frame.
+// Only done when the camera moves into another cluster.
+//
+void Q3BSPRep::markVis(){
+	++vis_frame;
+	for( int k=0;k<leafs.size();++k ){
+		Q3BSPLeaf *l=leafs[k];
+		int cluster=l->cluster;
+		if( cluster<0 ) continue;
+		if( r_cluster>=0 ){
+			if( !( vis_data[cluster*vis_sz+r_cluster/8] & (1<<(r_cluster&7))) ) continue;
+		}
+		l->vis_frame=vis_frame;
+		for( Q3BSPNode *n=l->parent;n && n->vis_frame!=vis_frame;n=n->parent ){
+			n->vis_frame=vis_frame;
+		}
 	}
-	return true;
+	vis_cluster=r_cluster;
 }
 
-void Q3BSPRep::render( Q3BSPLeaf *l,int clip ){
-	int cluster=l->cluster;
-	if( cluster<0 ) return;
+static bool cull( const Box &b,int *clip ){
+	return r_frustum.cull( b,*clip );
+}
 
-	if( r_cluster>=0 ){
-		if( !( vis_data[cluster*vis_sz+r_cluster/8] & (1<<(r_cluster&7))) ) return;
-	}
+void Q3BSPRep::render( Q3BSPLeaf *l,int clip ){
+	if( l->vis_frame!=vis_frame ) return;
 
 	if( clip && !cull( l->box,&clip ) ) return;
 
@@ -677,6 +696,8 @@ void Q3BSPRep::render( Q3BSPLeaf *l,int clip ){
 }
 
 void Q3BSPRep::render( Q3BSPNode *n,int clip ){
+	if( n->vis_frame!=vis_frame ) return;
+
 	if( clip && !cull( n->box,&clip ) ) return;
 
 	//draw front to back...
@@ -688,38 +709,71 @@ void Q3BSPRep::render( Q3BSPNode *n,int clip ){
 	else render( n->leafs[i],clip );
 }
 
+static float msecs( const std::chrono::high_resolution_clock::time_point &t0,const std::chrono::high_resolution_clock::time_point &t1 ){
+	return std::chrono::duration<float,std::milli>( t1-t0 ).count();
+}
+
+//
+// Traversal and submission msecs are added to stats3d[9] and [10], draw calls to [11].
+//
 void Q3BSPRep::render( Model *model,const RenderContext &rc ){
+	std::chrono::high_resolution_clock::time_point t0=std::chrono::high_resolution_clock::now();
+
 	r_eye=-model->getRenderTform() * rc.getCameraTform().v;
 	new( &r_frustum ) Frustum( rc.getWorldFrustum(),-model->getRenderTform() );
 
 	vis( root_node );
 	if( r_cluster==-1 ) log( "No cluster!" );
+	if( r_cluster!=vis_cluster ) markVis();
 	render( root_node,0x3f );
 
+	std::chrono::high_resolution_clock::time_point t1=std::chrono::high_resolution_clock::now();
+	stats3d[9]+=msecs( t0,t1 );
+
 	if( !r_surfs.size() ) return;
 
 	gx_scene->setAmbient2( &ambient.x );
 	gx_scene->setWorldMatrix( (gxScene::Matrix*)&model->getRenderTform() );
 
-	int k;
+	int k,draws=0;
 	for( k=0;k<r_surfs.size();++k ){
 		Q3BSPSurf *s=r_surfs[k];
 		gx_scene->setRenderState( s->brush.getRenderState() );
-		int j;
-		for( j=0;j<s->r_faces.size();++j ){
-			Q3BSPFace *f=s->r_faces[j];
-			gx_scene->render( s->mesh,f->vert,f->n_verts,f->tri,f->n_tris );
+
+		//faces are in front to back traversal order - merge runs that are also contiguous in the mesh
+		vector<Q3BSPFace*> &fs=s->r_faces;
+		int j=0;
+		while( j<fs.size() ){
+			Q3BSPFace *f=fs[j];
+			int vert=f->vert,end_vert=f->vert+f->n_verts;
+			int tri=f->tri,end_tri=f->tri+f->n_tris;
 			f->surf=s;
+			for( ++j;j<fs.size() && fs[j]->tri==end_tri;++j ){
+				f=fs[j];
+				if( f->vert<vert ) vert=f->vert;
+				if( f->vert+f->n_verts>end_vert ) end_vert=f->vert+f->n_verts;
+				end_tri+=f->n_tris;
+				f->surf=s;
+			}
+			gx_scene->render( s->mesh,vert,end_vert-vert,tri,end_tri-tri );
+			++draws;
 		}
-		s->r_faces.clear();
+		fs.clear();
 	}
 	r_surfs.clear();
+
+	stats3d[10]+=msecs( t1,std::chrono::high_resolution_clock::now() );
+	stats3d[11]+=draws;
 }
 
 bool Q3BSPRep::collide( const Line &line,float radius,Collision *curr_coll,const Transform &t ){
 	return collider->collide( line,radius,curr_coll,t );
 }
 
+Box Q3BSPRep::getBox()const{
+	return collider->getBox();
+}
+
 void Q3BSPRep::setAmbient( const Vector &t ){
 	ambient=t;
 }
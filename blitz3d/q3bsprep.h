@@ -18,6 +18,7 @@ public:
 
 	void render( Model *model,const RenderContext &rc );
 	bool collide( const Line &line,float radius,Collision *curr_coll,const Transform &t );
+	Box getBox()const;
 
 	void setAmbient( const Vector &t );
 	void setLighting( bool use_lmap );
@@ -30,6 +31,7 @@ private:
 	Vector ambient;
 
 	vector<Q3BSPFace*> faces;
+	vector<Q3BSPLeaf*> leafs;
 	vector<Q3BSPSurf*> surfs,r_surfs;
 	vector<Texture> textures,light_maps;
 
@@ -37,6 +39,9 @@ private:
 	char *vis_data;
 	bool use_lmap;
 
+	//cluster the current vis_frame marks were made from
+	int vis_cluster,vis_frame;
+
 	MeshCollider *collider;
 
 	void createVis();
@@ -49,6 +54,7 @@ private:
 	Q3BSPNode *createNode( int n );
 
 	void vis( Q3BSPNode *node );
+	void markVis();
 	void render( Q3BSPLeaf *l,int clip );
 	void render( Q3BSPNode *n,int clip );
 };
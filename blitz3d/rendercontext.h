@@ -6,12 +6,14 @@
 
 class RenderContext{
 public:
-	RenderContext( const Transform &t,const Frustum &f,bool r ):
-	camera_tform( t ),camera_frustum(f),ref(r){
+	RenderContext( const Transform &t,const Frustum &f,bool r,bool c=false ):
+	camera_tform( t ),camera_frustum(f),ref(r),culled(c){
 		new( &world_frustum ) Frustum( f,t );
 	}
 
 	bool isReflected()const{ return ref; }
+	//models rendered with this context have already passed Model::inView
+	bool isCulled()const{ return culled; }
 	const Transform &getCameraTform()const{ return camera_tform; }
 	const Frustum &getWorldFrustum()const{ return world_frustum; }
 	const Frustum &getCameraFrustum()const{ return camera_frustum; }
@@ -19,7 +21,7 @@ public:
 private:
 	Transform camera_tform;
 	Frustum world_frustum,camera_frustum;
-	bool ref;
+	bool ref,culled;
 };
 
 #endif
\ No newline at end of file
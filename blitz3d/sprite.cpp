@@ -13,30 +13,90 @@ static float tex_coords3[2][2]={ {0,1},{0,1} };
 
 extern gxRuntime *gx_runtime;
 extern gxGraphics *gx_graphics;
+extern gxScene *gx_scene;
 
+//16 bit indices
+static const int MAX_BATCH=16384;
+
+//shared vertex buffer, used as a ring - written with discard when it wraps
 static gxMesh *mesh;
-static int mesh_size;
-static vector<int> mesh_indices;
-
-static int allocIndex(){
-	if( !mesh_indices.size() ){
-		if( mesh_size ) gx_graphics->freeMesh( mesh );
-		for( int k=0;k<256;++k ){
-			mesh_indices.push_back( mesh_size++ );
-		}
+static int mesh_size,mesh_next,reserve_size=1024,sprite_cnt;
+
+static void freeMesh(){
+	if( !mesh ) return;
+	gx_graphics->freeMesh( mesh );
+	mesh=0;
+	mesh_size=mesh_next=0;
+}
+
+static bool sameState( Sprite *a,Sprite *b ){
+	return !memcmp(
+		&a->getRenderBrush().getRenderState(),
+		&b->getRenderBrush().getRenderState(),
+		sizeof(gxScene::RenderState) );
+}
+
+void Sprite::reserveBatch( int n ){
+	if( n>MAX_BATCH ) n=MAX_BATCH;
+	if( n<=reserve_size ) return;
+	reserve_size=n;
+	//grown when next drawn
+	if( mesh && mesh_size<n ) freeMesh();
+}
+
+void Sprite::renderBatch( Sprite *const *sprites,int count,bool reflected ){
+
+	if( !mesh ){
+		mesh_size=reserve_size;
 		mesh=gx_graphics->createMesh( mesh_size*4,mesh_size*2,0 );
+		mesh_next=0;
 	}
-	int n=mesh_indices.back();
-	mesh_indices.pop_back();
-	return n;
-}
 
-static void freeIndex( int n ){
-	mesh_indices.push_back( n );
-	if( mesh_indices.size()!=mesh_size ) return;
-	gx_graphics->freeMesh( mesh );
-	mesh_indices.clear();
-	mesh_size=0;
+	int k=0;
+	while( k<count ){
+		//find run with same render state
+		int end=k+1;
+		while( end<count && sameState( sprites[k],sprites[end] ) ) ++end;
+
+		const gxScene::RenderState &rs=sprites[k]->getRenderBrush().getRenderState();
+
+		while( k<end ){
+			bool discard=false;
+			if( mesh_next==mesh_size ){
+				mesh_next=0;
+				discard=true;
+			}
+			int n=end-k;
+			if( n>mesh_size-mesh_next ) n=mesh_size-mesh_next;
+
+			mesh->lock( discard );
+			int fv=mesh_next*4,ft=mesh_next*2;
+			for( int j=0;j<n;++j ){
+				const Vector *v=sprites[k+j]->r_verts;
+				int i=fv+j*4;
+				mesh->setVertex( i+0,&v[0].x,null,tex_coords0 );
+				mesh->setVertex( i+1,&v[1].x,null,tex_coords1 );
+				mesh->setVertex( i+2,&v[2].x,null,tex_coords2 );
+				mesh->setVertex( i+3,&v[3].x,null,tex_coords3 );
+				//indices are relative to fv, and in system memory so can be rewritten each draw
+				int t=ft+j*2;
+				if( reflected ){
+					mesh->setTriangle( t+0,j*4,j*4+2,j*4+1 );
+					mesh->setTriangle( t+1,j*4,j*4+3,j*4+2 );
+				}else{
+					mesh->setTriangle( t+0,j*4,j*4+1,j*4+2 );
+					mesh->setTriangle( t+1,j*4,j*4+2,j*4+3 );
+				}
+			}
+			mesh->unlock();
+
+			gx_scene->setRenderState( rs );
+			gx_scene->render( mesh,fv,n*4,ft,n*2 );
+
+			mesh_next+=n;
+			k+=n;
+		}
+	}
 }
 
 Sprite::Sprite():
@@ -44,7 +104,7 @@ view_mode(VIEW_MODE_FREE),
 xhandle(0),yhandle(0),
 rot(0),xscale(1),yscale(1),captured(false){
 	setRenderSpace( RENDER_SPACE_WORLD );
-	mesh_index=allocIndex();
+	++sprite_cnt;
 }
 
 Sprite::Sprite( const Sprite &t ):
@@ -52,11 +112,11 @@ Model(t),
 view_mode(t.view_mode),
 xhandle(t.xhandle),yhandle(t.yhandle),
 rot(t.rot),xscale(t.xscale),yscale(t.yscale),captured(false){
-	mesh_index=allocIndex();
+	++sprite_cnt;
 }
 
 Sprite::~Sprite(){
-	freeIndex( mesh_index );
+	if( !--sprite_cnt ) freeMesh();
 }
 
 void Sprite::setRotation( float angle ){
@@ -111,29 +171,11 @@ bool Sprite::render( const RenderContext &rc ){
 
 	t.m=t.m * rollMatrix( r_rot ) * scaleMatrix( r_xscale,r_yscale,1 );
 
-	static Vector verts[4];
+	Vector *verts=r_verts;
 	verts[0]=t * Vector( -1-xhandle, 1-yhandle,0 );
 	verts[1]=t * Vector(  1-xhandle, 1-yhandle,0 );
 	verts[2]=t * Vector(  1-xhandle,-1-yhandle,0 );
 	verts[3]=t * Vector( -1-xhandle,-1-yhandle,0 );
 
-	if( !rc.getWorldFrustum().cull( verts,4 ) ) return false;
-
-	mesh->lock( false );
-	int fv=mesh_index*4,ft=mesh_index*2;
-	mesh->setVertex( fv+0,&verts[0].x,null,tex_coords0 );
-	mesh->setVertex( fv+1,&verts[1].x,null,tex_coords1 );
-	mesh->setVertex( fv+2,&verts[2].x,null,tex_coords2 );
-	mesh->setVertex( fv+3,&verts[3].x,null,tex_coords3 );
-	if( rc.isReflected() ){
-		mesh->setTriangle( ft+0,0,2,1 );
-		mesh->setTriangle( ft+1,0,3,2 );
-	}else{
-		mesh->setTriangle( ft+0,0,1,2 );
-		mesh->setTriangle( ft+1,0,2,3 );
-	}
-	mesh->unlock();
-
-	enqueue( mesh,fv,4,ft,2 );
-	return false;
+	return rc.getWorldFrustum().cull( verts,4 );
 }
@@ -31,14 +31,22 @@ public:
 	void setHandle( float x,float y );
 	void setViewmode( int mode );
 
+	//billboard for rc - returns false if culled, otherwise sprite is drawn by renderBatch
 	bool render( const RenderContext &rc );
 
+	//size of the shared sprite vertex buffer, so it isn't recreated mid frame
+	static void reserveBatch( int n_sprites );
+
+	//draw billboarded sprites, one draw per run of sprites with the same render state
+	static void renderBatch( Sprite *const *sprites,int count,bool reflected );
+
 private:
 	float xhandle,yhandle;
 	float rot,xscale,yscale;
 	float r_rot,r_xscale,r_yscale;
-	int view_mode,mesh_index;
+	int view_mode;
 	bool captured;
+	Vector r_verts[4];
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,271 @@
+
+#include "std.h"
+#include "staticmodel.h"
+#include "meshmodel.h"
+#include "frustum.h"
+
+#include <algorithm>
+
+//max vertices per merged surface, for 16 bit indices
+static const int MAX_SEG_VERTS=65535;
+
+struct StaticModel::Rep : public Surface::Monitor{
+
+	//triangles of one chunk in a merged surface - verts used are 0...vert_cnt-1
+	struct Range{
+		int chunk,seg;
+		int vert_cnt,first_tri,tri_cnt;
+	};
+
+	int ref_cnt;
+
+	//merged surfaces, and the brush each is drawn with
+	vector<Surface*> segs;
+	vector<Brush> seg_brushes;
+
+	vector<Box> chunks;
+	vector<Range> ranges;
+	vector<char> chunk_vis;
+
+	//top level meshes that were hidden, and all baked meshes
+	vector<MeshModel*> hidden,meshes;
+
+	//which rep a mesh is baked into
+	static map<MeshModel*,Rep*> baked;
+
+	Rep( Entity *root,float chunk_size ):
+	ref_cnt(1){
+		geom_changes=brush_changes=0;
+		collect( root );
+		build( chunk_size );
+		for( int k=0;k<hidden.size();++k ) hidden[k]->setVisible( false );
+	}
+
+	~Rep(){
+		unbake();
+	}
+
+	static bool bakeable( MeshModel *m ){
+		if( m->isBaked() || !m->queueSortable() || m->getOrder() ) return false;
+		const MeshModel::SurfaceList &surfs=m->getSurfaces();
+		for( int k=0;k<surfs.size();++k ){
+			if( Brush( surfs[k]->getBrush(),m->getBrush() ).getBlend()!=gxScene::BLEND_REPLACE ) return false;
+		}
+		return true;
+	}
+
+	//true if e and all its children can be baked, and so hidden
+	static bool bakeableTree( Entity *e ){
+		Model *mod=e->getModel();
+		MeshModel *m=mod ? mod->getMeshModel() : 0;
+		if( !m || !m->visible() || m->getObject()->getAnimator() || !bakeable( m ) ) return false;
+		for( Entity *p=e->children();p;p=p->successor() ){
+			if( !bakeableTree( p ) ) return false;
+		}
+		return true;
+	}
+
+	void addTree( Entity *e ){
+		MeshModel *m=e->getModel()->getMeshModel();
+		meshes.push_back( m );
+		baked[m]=this;
+		m->setBaked( true );
+		for( Entity *p=e->children();p;p=p->successor() ) addTree( p );
+	}
+
+	void collect( Entity *e ){
+		if( !e->visible() ) return;
+		//animated hierarchies move
+		if( e->getObject() && e->getObject()->getAnimator() ) return;
+		if( bakeableTree( e ) ){
+			hidden.push_back( e->getModel()->getMeshModel() );
+			addTree( e );
+			return;
+		}
+		for( Entity *p=e->children();p;p=p->successor() ) collect( p );
+	}
+
+	struct Item{
+		int batch,chunk;
+		MeshModel *model;
+		Surface *surf;
+		bool operator<( const Item &t )const{
+			return batch!=t.batch ? batch<t.batch : chunk<t.chunk;
+		}
+	};
+
+	void build( float chunk_size ){
+		if( chunk_size<=0 ) chunk_size=1;
+
+		map<Brush,int> batch_map;
+		map<pair<int,pair<int,int> >,int> chunk_map;
+		vector<Brush> batch_brushes;
+		vector<Item> items;
+
+		//sort surfaces into batches by brush, and chunks by grid cell
+		for( int k=0;k<meshes.size();++k ){
+			MeshModel *m=meshes[k];
+			Vector c=(m->getWorldTform() * m->getBox()).centre();
+			pair<int,pair<int,int> > cell(
+				(int)floor( c.x/chunk_size ),
+				make_pair( (int)floor( c.y/chunk_size ),(int)floor( c.z/chunk_size ) ) );
+
+			map<pair<int,pair<int,int> >,int>::iterator chunk_it=chunk_map.find( cell );
+			if( chunk_it==chunk_map.end() ){
+				chunk_it=chunk_map.insert( make_pair( cell,(int)chunks.size() ) ).first;
+				chunks.push_back( Box() );
+			}
+
+			const MeshModel::SurfaceList &surfs=m->getSurfaces();
+			for( int j=0;j<surfs.size();++j ){
+				Surface *s=surfs[j];
+				if( !s->numTriangles() ) continue;
+				Brush b( s->getBrush(),m->getBrush() );
+				map<Brush,int>::iterator batch_it=batch_map.find( b );
+				if( batch_it==batch_map.end() ){
+					batch_it=batch_map.insert( make_pair( b,(int)batch_brushes.size() ) ).first;
+					batch_brushes.push_back( b );
+				}
+				Item item={ batch_it->second,chunk_it->second,m,s };
+				items.push_back( item );
+			}
+		}
+
+		std::stable_sort( items.begin(),items.end() );
+
+		//merge batches chunk by chunk, so each chunk is a contiguous range
+		int batch=-1;
+		for( int k=0;k<items.size();++k ){
+			const Item &item=items[k];
+			Surface *src=item.surf;
+
+			Surface *dest=segs.size() ? segs.back() : 0;
+			if( item.batch!=batch || dest->numVertices()+src->numVertices()>MAX_SEG_VERTS ){
+				dest=d_new Surface( this );
+				dest->setBrush( batch_brushes[item.batch] );
+				segs.push_back( dest );
+				seg_brushes.push_back( batch_brushes[item.batch] );
+				batch=item.batch;
+			}
+			int seg=segs.size()-1;
+
+			if( !ranges.size() || ranges.back().seg!=seg || ranges.back().chunk!=item.chunk ){
+				Range r={ item.chunk,seg,0,dest->numTriangles(),0 };
+				ranges.push_back( r );
+			}
+
+			const Transform &tf=item.model->getWorldTform();
+			Matrix co=tf.m.cofactor();
+			Box &box=chunks[item.chunk];
+
+			int base=dest->numVertices();
+			int j;
+			for( j=0;j<src->numVertices();++j ){
+				Surface::Vertex v=src->getVertex( j );
+				v.coords=tf * v.coords;
+				v.normal=(co * v.normal).normalized();
+				box.update( v.coords );
+				dest->addVertex( v );
+			}
+			for( j=0;j<src->numTriangles();++j ){
+				Surface::Triangle t=src->getTriangle( j );
+				t.verts[0]+=base;
+				t.verts[1]+=base;
+				t.verts[2]+=base;
+				dest->addTriangle( t );
+			}
+
+			Range &r=ranges.back();
+			r.vert_cnt=dest->numVertices();
+			r.tri_cnt=dest->numTriangles()-r.first_tri;
+		}
+		chunk_vis.resize( chunks.size() );
+	}
+
+	void render( Model *model,const RenderContext &rc ){
+		if( !chunks.size() ) return;
+		rc.getWorldFrustum().cull( &chunks[0],chunks.size(),&chunk_vis[0] );
+
+		//ranges of visible chunks that follow each other in a surface are drawn together
+		Range cur;
+		bool have=false;
+		for( int k=0;k<ranges.size();++k ){
+			const Range &r=ranges[k];
+			if( !chunk_vis[r.chunk] ) continue;
+			if( have && r.seg==cur.seg && r.first_tri==cur.first_tri+cur.tri_cnt ){
+				cur.vert_cnt=r.vert_cnt;
+				cur.tri_cnt+=r.tri_cnt;
+				continue;
+			}
+			if( have ) draw( model,cur );
+			cur=r;
+			have=true;
+		}
+		if( have ) draw( model,cur );
+	}
+
+	void draw( Model *model,const Range &r ){
+		if( gxMesh *mesh=segs[r.seg]->getMesh() ){
+			model->enqueue( mesh,0,r.vert_cnt,r.first_tri,r.tri_cnt,seg_brushes[r.seg] );
+		}
+	}
+
+	void remove( MeshModel *m ){
+		meshes.erase( std::find( meshes.begin(),meshes.end(),m ) );
+		vector<MeshModel*>::iterator it=std::find( hidden.begin(),hidden.end(),m );
+		if( it!=hidden.end() ) hidden.erase( it );
+		baked.erase( m );
+	}
+
+	void unbake(){
+		int k;
+		for( k=0;k<meshes.size();++k ){
+			meshes[k]->setBaked( false );
+			baked.erase( meshes[k] );
+		}
+		for( k=0;k<hidden.size();++k ) hidden[k]->setVisible( true );
+		for( k=0;k<segs.size();++k ) delete segs[k];
+		meshes.clear();
+		hidden.clear();
+		segs.clear();
+		seg_brushes.clear();
+		chunks.clear();
+		ranges.clear();
+		chunk_vis.clear();
+	}
+};
+
+map<MeshModel*,StaticModel::Rep*> StaticModel::Rep::baked;
+
+StaticModel::StaticModel( Entity *root,float chunk_size ):
+rep( d_new Rep( root,chunk_size ) ){
+	setRenderSpace( RENDER_SPACE_WORLD );
+}
+
+StaticModel::StaticModel( const StaticModel &t ):
+Model(t),
+rep( t.rep ){
+	++rep->ref_cnt;
+}
+
+StaticModel::~StaticModel(){
+	if( !--rep->ref_cnt ) delete rep;
+}
+
+bool StaticModel::render( const RenderContext &rc ){
+	rep->render( this,rc );
+	return false;
+}
+
+void StaticModel::unbake(){
+	rep->unbake();
+}
+
+void StaticModel::meshDeleted( MeshModel *m ){
+	map<MeshModel*,Rep*>::iterator it=Rep::baked.find( m );
+	if( it!=Rep::baked.end() ) it->second->remove( m );
+}
+
+int StaticModel::numMeshes()const{
+	return rep->meshes.size();
+}
@@ -0,0 +1,46 @@
+
+#ifndef STATICMODEL_H
+#define STATICMODEL_H
+
+#include "model.h"
+
+class MeshModel;
+
+//
+// Never-moving meshes merged by brush into world space chunks.
+//
+// The baked meshes are hidden but stay enabled, so they still collide and pick.
+// Each chunk is culled by its box, then its ranges of the merged surfaces are drawn.
+// Baked meshes stay in the merged geometry until unbake, even if deleted.
+//
+class StaticModel : public Model{
+public:
+	//bake opaque, unboned, unanimated meshes in root's hierarchy
+	StaticModel( Entity *root,float chunk_size );
+	StaticModel( const StaticModel &t );
+	~StaticModel();
+
+	Entity *clone(){ return d_new StaticModel( *this ); }
+
+	//model interface
+	bool render( const RenderContext &rc );
+	bool queueSortable()const{ return true; }
+
+	StaticModel *getStaticModel(){ return this; }
+
+	//show the baked meshes again, and drop the merged geometry
+	void unbake();
+
+	//called when a baked mesh is deleted
+	static void meshDeleted( MeshModel *m );
+
+	//number of meshes still baked
+	int numMeshes()const;
+
+private:
+	struct Rep;
+
+	Rep *rep;
+};
+
+#endif
@@ -1,17 +1,22 @@
 
 #include "std.h"
 #include "surface.h"
+#include "threadpool.h"
+
+#include <emmintrin.h>
 
 extern gxGraphics *gx_graphics;
 
 static Surface::Monitor nop_mon;
 
+int Surface::all_geom_changes;
+
 Surface::Surface():
-mesh(0),mesh_vs(0),mesh_ts(0),valid_vs(0),valid_ts(0),mon( &nop_mon ){
+mesh(0),mesh_vs(0),mesh_ts(0),valid_vs(0),valid_ts(0),mon( &nop_mon ),skin_vs(0),mesh_skin(0){
 }
 
 Surface::Surface( Monitor *m ):
-mesh(0),mesh_vs(0),mesh_ts(0),valid_vs(0),valid_ts(0),mon(m){
+mesh(0),mesh_vs(0),mesh_ts(0),valid_vs(0),valid_ts(0),mon(m),skin_vs(0),mesh_skin(0){
 }
 
 Surface::~Surface(){
@@ -28,14 +33,19 @@ void Surface::setName( const string &n ){
 }
 
 void Surface::clear( bool verts,bool tris ){
-	if( verts ){ vertices.clear();valid_vs=0; }
+	if( verts ){ vertices.clear();valid_vs=skin_vs=0; }
 	if( tris ){ triangles.clear();valid_ts=0; }
-	++mon->geom_changes;
+	geomChanged();
 }
 
 void Surface::addVertices( const vector<Vertex> &verts ){
 	vertices.insert( vertices.end(),verts.begin(),verts.end() );
-	++mon->geom_changes;
+	geomChanged();
+}
+
+void Surface::addVertices( const Vertex *verts,int n ){
+	vertices.insert( vertices.end(),verts,verts+n );
+	geomChanged();
 }
 
 void Surface::setColor( int n,const Vector &v ){
@@ -46,7 +56,7 @@ void Surface::setColor( int n,const Vector &v ){
 	unsigned argb=0xff000000|(r<<16)|(g<<8)|b;
 
 	vertices[n].color=argb;
-	if( n<valid_vs ) valid_vs=n;
+	invalidate( n );
 }
 
 Vector Surface::getColor( int n )const{
@@ -60,25 +70,185 @@ void Surface::addTriangles( const vector<Triangle> &tris ){
 	triangles.insert( triangles.end(),tris.begin(),tris.end() );
 }
 
-void Surface::updateNormals(){
-	int k;
-	map<Vector,Vector> norm_map;
-	for( k=0;k<triangles.size();++k ){
+void Surface::addTriangles( const Triangle *tris,int n ){
+	triangles.insert( triangles.end(),tris,tris+n );
+}
+
+//
+// Vertex welding for updateNormals.
+//
+// Groups vertices with the same position (within EPSILON, as Vector::operator== has it) using a hash
+// grid of cells a good deal bigger than EPSILON, so only vertices near a cell boundary need to look in
+// the neighbouring cell. group[k] is set to the group of vertex k, and the number of groups returned.
+//
+static const int WELD_RES=256;
+
+static int weldCell( double t ){
+	if( t>=0 && t<WELD_RES ) return (int)t;
+	return t>=WELD_RES ? WELD_RES : 0;
+}
+
+static int weldVertices( const vector<Surface::Vertex> &verts,vector<int> &group ){
+	int k,n=verts.size();
+	group.resize( n );
+
+	Box box;
+	for( k=0;k<n;++k ) box.update( verts[k].coords );
+	float ext=box.width();
+	if( box.height()>ext ) ext=box.height();
+	if( box.depth()>ext ) ext=box.depth();
+	double cell=ext/WELD_RES;
+	if( !(cell>=EPSILON*8) ) cell=EPSILON*8;
+	double inv=1/cell,margin=EPSILON*inv;
+
+	int sz=64;
+	while( sz<n*2 ) sz+=sz;
+	vector<int> heads( sz,-1 ),next( n );
+
+	int cnt=0;
+	for( k=0;k<n;++k ){
+		const Vector &v=verts[k].coords;
+		double t[3]={ (v.x-(double)box.a.x)*inv,(v.y-(double)box.a.y)*inv,(v.z-(double)box.a.z)*inv };
+		int c[3],lo[3],hi[3];
+		for( int i=0;i<3;++i ){
+			c[i]=weldCell( t[i] );
+			lo[i]=weldCell( t[i]-margin )-c[i];
+			hi[i]=weldCell( t[i]+margin )-c[i];
+		}
+		int found=-1,home=0;
+		for( int x=lo[0];x<=hi[0] && found<0;++x ){
+			for( int y=lo[1];y<=hi[1] && found<0;++y ){
+				for( int z=lo[2];z<=hi[2] && found<0;++z ){
+					int h=((unsigned)(c[0]+x)*73856093u^(unsigned)(c[1]+y)*19349663u^(unsigned)(c[2]+z)*83492791u)&(sz-1);
+					if( !x && !y && !z ) home=h;
+					for( int r=heads[h];r>=0;r=next[r] ){
+						if( verts[r].coords==v ){ found=r;break; }
+					}
+				}
+			}
+		}
+		if( found>=0 ){
+			group[k]=group[found];
+			continue;
+		}
+		group[k]=cnt++;
+		next[k]=heads[home];
+		heads[home]=k;
+	}
+	return cnt;
+}
+
+//
+// Normals of triangles first...first+count-1 into norms - 0 for degenerate triangles.
+//
+static void faceNormals( const vector<Surface::Vertex> &verts,const vector<Surface::Triangle> &tris,Vector *norms,int first,int count ){
+	const __m128 eps=_mm_set1_ps( EPSILON );
+
+	int last=first+count;
+	for( int k=first;k<last;k+=4 ){
+		const Vector *v[3][4];
+		for( int j=0;j<4;++j ){
+			const Surface::Triangle &t=tris[k+j<last ? k+j : last-1];
+			for( int i=0;i<3;++i ) v[i][j]=&verts[t.verts[i]].coords;
+		}
+
+#define GATHER(i,e) _mm_setr_ps( v[i][0]->e,v[i][1]->e,v[i][2]->e,v[i][3]->e )
+		__m128 x0=GATHER(0,x),y0=GATHER(0,y),z0=GATHER(0,z);
+		__m128 ax=_mm_sub_ps( GATHER(1,x),x0 ),ay=_mm_sub_ps( GATHER(1,y),y0 ),az=_mm_sub_ps( GATHER(1,z),z0 );
+		__m128 bx=_mm_sub_ps( GATHER(2,x),x0 ),by=_mm_sub_ps( GATHER(2,y),y0 ),bz=_mm_sub_ps( GATHER(2,z),z0 );
+#undef GATHER
+
+		__m128 nx=_mm_sub_ps( _mm_mul_ps( ay,bz ),_mm_mul_ps( az,by ) );
+		__m128 ny=_mm_sub_ps( _mm_mul_ps( az,bx ),_mm_mul_ps( ax,bz ) );
+		__m128 nz=_mm_sub_ps( _mm_mul_ps( ax,by ),_mm_mul_ps( ay,bx ) );
+		__m128 len=_mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx,nx ),_mm_mul_ps( ny,ny ) ),_mm_mul_ps( nz,nz ) ) );
+		__m128 mask=_mm_cmpgt_ps( len,eps );
+		nx=_mm_and_ps( _mm_div_ps( nx,len ),mask );
+		ny=_mm_and_ps( _mm_div_ps( ny,len ),mask );
+		nz=_mm_and_ps( _mm_div_ps( nz,len ),mask );
+
+		float tx[4],ty[4],tz[4];
+		_mm_storeu_ps( tx,nx );_mm_storeu_ps( ty,ny );_mm_storeu_ps( tz,nz );
+		for( int j=0;j<4 && k+j<last;++j ) norms[k+j]=Vector( tx[j],ty[j],tz[j] );
+	}
+}
+
+//surfaces with at least this many triangles use the thread pool
+static const int NORMALS_BLOCK=4096;
+
+//call func( first,count ) for blocks of n items, in parallel for large n
+static void normalsJob( int n,const std::function<void(int,int)> &func ){
+	int blocks=(n+NORMALS_BLOCK-1)/NORMALS_BLOCK;
+	ThreadPool::run( blocks,[&]( int k ){
+		int first=k*NORMALS_BLOCK;
+		func( first,n-first<NORMALS_BLOCK ? n-first : NORMALS_BLOCK );
+	} );
+}
+
+//
+// Vertex normals are the sum of the normals of the triangles around each vertex position, so
+// vertices split at the same position get the same normal. With max_angle>0, only triangles within
+// max_angle (radians) of the triangles using a vertex itself are summed, which keeps hard edges
+// where a mesh's vertices are split.
+//
+void Surface::updateNormals( float max_angle ){
+	int k,n_verts=vertices.size(),n_tris=triangles.size();
+
+	vector<int> group;
+	int n_groups=weldVertices( vertices,group );
+
+	vector<Vector> face_norms( n_tris );
+	normalsJob( n_tris,[&]( int first,int count ){
+		faceNormals( vertices,triangles,face_norms.data(),first,count );
+	} );
+
+	if( max_angle<=0 ){
+		vector<Vector> norms( n_groups );
+		for( k=0;k<n_tris;++k ){
+			const Triangle &t=triangles[k];
+			const Vector &n=face_norms[k];
+			norms[group[t.verts[0]]]+=n;
+			norms[group[t.verts[1]]]+=n;
+			norms[group[t.verts[2]]]+=n;
+		}
+		normalsJob( n_verts,[&]( int first,int count ){
+			for( int k=first;k<first+count;++k ) vertices[k].normal=norms[group[k]].normalized();
+		} );
+		valid_vs=skin_vs=0;
+		return;
+	}
+
+	//triangles around each group, and the normal of each vertex's own triangles
+	vector<int> group_tris( n_groups+1 ),tri_list( n_tris*3 );
+	vector<Vector> own( n_verts );
+	for( k=0;k<n_tris;++k ){
 		const Triangle &t=triangles[k];
-		const Vector &v0=vertices[t.verts[0]].coords;
-		const Vector &v1=vertices[t.verts[1]].coords;
-		const Vector &v2=vertices[t.verts[2]].coords;
-		Vector n=(v1-v0).cross(v2-v0);
-		if( n.length()<=EPSILON ) continue;
-		n.normalize();
-		norm_map[v0]+=n;
-		norm_map[v1]+=n;
-		norm_map[v2]+=n;
+		for( int i=0;i<3;++i ){
+			++group_tris[group[t.verts[i]]+1];
+			own[t.verts[i]]+=face_norms[k];
+		}
 	}
-	for( k=0;k<vertices.size();++k ){
-		Vertex *v=&vertices[k];
-		v->normal=norm_map[v->coords].normalized();
+	for( k=0;k<n_groups;++k ) group_tris[k+1]+=group_tris[k];
+	vector<int> fill( group_tris.begin(),group_tris.end()-1 );
+	for( k=0;k<n_tris;++k ){
+		const Triangle &t=triangles[k];
+		for( int i=0;i<3;++i ) tri_list[fill[group[t.verts[i]]]++]=k;
 	}
+
+	float min_dot=cosf( max_angle );
+	normalsJob( n_verts,[&]( int first,int count ){
+		for( int k=first;k<first+count;++k ){
+			int g=group[k];
+			bool all=own[k].length()<=EPSILON;
+			Vector d=all ? Vector() : own[k].normalized(),n;
+			for( int i=group_tris[g];i<group_tris[g+1];++i ){
+				const Vector &t=face_norms[tri_list[i]];
+				if( all || t.dot( d )>=min_dot ) n+=t;
+			}
+			vertices[k].normal=n.normalized();
+		}
+	} );
+	valid_vs=skin_vs=0;
 }
 
 gxMesh *Surface::getMesh(){
@@ -87,6 +257,7 @@ gxMesh *Surface::getMesh(){
 	if( valid_vs==vertices.size() && valid_ts==triangles.size() ) return mesh;
 
 	valid_vs=valid_ts=0;
+	mesh_skin=0;
 
 	if( mesh_vs<vertices.size() || mesh_ts<triangles.size() ){
 		if( mesh ){
@@ -112,49 +283,189 @@ gxMesh *Surface::getMesh(){
 	return mesh;
 }
 
-gxMesh *Surface::getMesh( const vector<Bone> &bones ){
-
-	valid_vs=valid_ts=0;
+//
+// Make sure mesh is big enough and lock it for skinned vertices.
+//
+bool Surface::lockSkinned(){
+	if( !vertices.size() ) return false;
 
 	if( mesh_vs<vertices.size() || mesh_ts<triangles.size() ){
 		if( mesh ) gx_graphics->freeMesh( mesh );
 		mesh_vs=vertices.size();
 		mesh_ts=triangles.size();
 		mesh=gx_graphics->createMesh( mesh_vs,mesh_ts,0 );
+		valid_ts=0;
 	}
 
+	//every vertex gets overwritten, but triangles only need setting once
+	valid_vs=0;
+	mesh_skin=0;
+
 	mesh->lock( true );
-	for( ;valid_vs<vertices.size();++valid_vs ){
-		const Vertex &v=vertices[valid_vs];
-		if( v.bone_bones[0]==255 ){
-			//no bone!
-			const Bone &bone=bones[0];
-			mesh->setVertex( valid_vs,bone.coord_tform * v.coords,bone.normal_tform * v.normal,v.color,v.tex_coords );
-		}else if( v.bone_bones[1]==255 ){
-			//one bone only
-			const Bone &bone=bones[v.bone_bones[0]];
-			mesh->setVertex( valid_vs,bone.coord_tform * v.coords,bone.normal_tform * v.normal,v.color,v.tex_coords );
-		}else{
-			const Vertex &v=vertices[valid_vs];
-			//two or more bones
-			Vector tv,tn;
-			for( int n=0;n<MAX_SURFACE_BONES;++n ){
-				if( v.bone_bones[n]==255 ) break;
-				const Bone &bone=bones[v.bone_bones[n]];
-				tv+=bone.coord_tform * v.coords * v.bone_weights[n];
-				tn+=bone.normal_tform * v.normal * v.bone_weights[n];
-			}
-			mesh->setVertex( valid_vs,tv,tn.normalized(),v.color,v.tex_coords );
-		}
-	}
 	for( ;valid_ts<triangles.size();++valid_ts ){
 		const Triangle &t=triangles[valid_ts];
 		mesh->setTriangle( valid_ts,t.verts[0],t.verts[1],t.verts[2] );
 	}
+	return true;
+}
+
+gxMesh *Surface::getMesh( const vector<Bone> &bones ){
+	validateSkin();
+	if( !lockSkinned() ) return 0;
+	skin( bones,mesh->lockedVertex( 0 ),0,vertices.size() );
+	mesh->unlock();
+	return mesh;
+}
+
+gxMesh *Surface::getMesh( const float *skinned,int skin_id ){
+	//already uploaded for an earlier camera or mirror?
+	if( skin_id && skin_id==mesh_skin && !mesh->dirty() ) return mesh;
+	if( !lockSkinned() ) return 0;
+	mesh->setVertices( 0,skinned,vertices.size() );
 	mesh->unlock();
+	mesh_skin=skin_id;
 	return mesh;
 }
 
+//
+// Rebuild SIMD friendly copy of the bind pose.
+//
+void Surface::validateSkin(){
+	if( skin_vs==vertices.size() ) return;
+
+	skin_blocks.resize( (vertices.size()+3)/4 );
+
+	for( int k=skin_vs/4;k<skin_blocks.size();++k ){
+		SkinBlock &b=skin_blocks[k];
+		memset( &b,0,sizeof(b) );
+		b.n_bones=1;
+		for( int j=0;j<4;++j ){
+			int n=k*4+j;
+			if( n>=vertices.size() ) break;
+			const Vertex &v=vertices[n];
+			for( int c=0;c<3;++c ){
+				b.coords[c][j]=v.coords[c];
+				b.normal[c][j]=v.normal[c];
+			}
+			if( v.bone_bones[0]==255 ){
+				//no bone! use bone 0
+				b.weights[0][j]=1;
+			}else if( v.bone_bones[1]==255 ){
+				//one bone only, weight ignored
+				b.bones[0][j]=v.bone_bones[0];
+				b.weights[0][j]=1;
+			}else{
+				//two or more bones, normal needs normalizing
+				int i;
+				for( i=0;i<MAX_SURFACE_BONES && v.bone_bones[i]!=255;++i ){
+					b.bones[i][j]=v.bone_bones[i];
+					b.weights[i][j]=v.bone_weights[i];
+				}
+				if( i>b.n_bones ) b.n_bones=i;
+				b.normalize[j]=1;
+				b.any_normalize=1;
+			}
+		}
+	}
+	skin_vs=vertices.size();
+}
+
+//
+// Skin 4 vertices at a time.
+//
+// Bone matrices are stored as 3x4 coord rows followed by 3x3 normal rows, and gathered
+// per vertex lane unless all 4 vertices use the same bone.
+//
+void Surface::skin( const vector<Bone> &bones,float *dest,int first,int count )const{
+
+	static const int MAT_FLOATS=24;
+
+	static thread_local vector<float> mats;
+	mats.resize( bones.size()*MAT_FLOATS );
+
+	int k;
+	for( k=0;k<bones.size();++k ){
+		const Transform &t=bones[k].coord_tform;
+		const Matrix &n=bones[k].normal_tform;
+		float *m=&mats[k*MAT_FLOATS];
+		for( int r=0;r<3;++r ){
+			m[r*4]=t.m.i[r];m[r*4+1]=t.m.j[r];m[r*4+2]=t.m.k[r];m[r*4+3]=t.v[r];
+			m[12+r*3]=n.i[r];m[13+r*3]=n.j[r];m[14+r*3]=n.k[r];
+		}
+	}
+
+	const __m128 zero=_mm_setzero_ps();
+
+	int last=first+count;
+	for( k=first/4;k*4<last;++k ){
+		const SkinBlock &b=skin_blocks[k];
+
+		__m128 x=_mm_loadu_ps( b.coords[0] ),y=_mm_loadu_ps( b.coords[1] ),z=_mm_loadu_ps( b.coords[2] );
+		__m128 nx=_mm_loadu_ps( b.normal[0] ),ny=_mm_loadu_ps( b.normal[1] ),nz=_mm_loadu_ps( b.normal[2] );
+
+		__m128 tx=zero,ty=zero,tz=zero,tnx=zero,tny=zero,tnz=zero;
+
+		for( int i=0;i<b.n_bones;++i ){
+			const int *bs=b.bones[i];
+			const float *m0=&mats[bs[0]*MAT_FLOATS],*m1=&mats[bs[1]*MAT_FLOATS];
+			const float *m2=&mats[bs[2]*MAT_FLOATS],*m3=&mats[bs[3]*MAT_FLOATS];
+			bool uniform=m0==m1 && m0==m2 && m0==m3;
+
+#define ELEM(e) (uniform ? _mm_set1_ps( m0[e] ) : _mm_set_ps( m3[e],m2[e],m1[e],m0[e] ))
+#define COORD(r) _mm_add_ps( _mm_add_ps( _mm_mul_ps( ELEM(r*4),x ),_mm_mul_ps( ELEM(r*4+1),y ) ),_mm_add_ps( _mm_mul_ps( ELEM(r*4+2),z ),ELEM(r*4+3) ) )
+#define NORMAL(r) _mm_add_ps( _mm_add_ps( _mm_mul_ps( ELEM(12+r*3),nx ),_mm_mul_ps( ELEM(13+r*3),ny ) ),_mm_mul_ps( ELEM(14+r*3),nz ) )
+
+			__m128 w=_mm_loadu_ps( b.weights[i] );
+			tx=_mm_add_ps( tx,_mm_mul_ps( COORD(0),w ) );
+			ty=_mm_add_ps( ty,_mm_mul_ps( COORD(1),w ) );
+			tz=_mm_add_ps( tz,_mm_mul_ps( COORD(2),w ) );
+			tnx=_mm_add_ps( tnx,_mm_mul_ps( NORMAL(0),w ) );
+			tny=_mm_add_ps( tny,_mm_mul_ps( NORMAL(1),w ) );
+			tnz=_mm_add_ps( tnz,_mm_mul_ps( NORMAL(2),w ) );
+
+#undef NORMAL
+#undef COORD
+#undef ELEM
+		}
+
+		if( b.any_normalize ){
+			__m128 mask=_mm_cmpgt_ps( _mm_loadu_ps( b.normalize ),zero );
+			__m128 len=_mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( tnx,tnx ),_mm_mul_ps( tny,tny ) ),_mm_mul_ps( tnz,tnz ) ) );
+			__m128 s=_mm_or_ps( _mm_and_ps( mask,_mm_div_ps( _mm_set1_ps( 1 ),len ) ),_mm_andnot_ps( mask,_mm_set1_ps( 1 ) ) );
+			tnx=_mm_mul_ps( tnx,s );
+			tny=_mm_mul_ps( tny,s );
+			tnz=_mm_mul_ps( tnz,s );
+		}
+
+		//back to vertex format - last block may need a temp
+		float tmp[4*SKIN_VERTEX_FLOATS];
+		int n=k*4,cnt=last-n<4 ? last-n : 4;
+		float *out=cnt==4 ? dest+n*SKIN_VERTEX_FLOATS : tmp;
+
+		_MM_TRANSPOSE4_PS( tx,ty,tz,tnx );
+		__m128 lo=_mm_unpacklo_ps( tny,tnz ),hi=_mm_unpackhi_ps( tny,tnz );
+
+		_mm_storeu_ps( out,tx );
+		_mm_storel_pi( (__m64*)(out+4),lo );
+		_mm_storeu_ps( out+SKIN_VERTEX_FLOATS,ty );
+		_mm_storeh_pi( (__m64*)(out+SKIN_VERTEX_FLOATS+4),lo );
+		_mm_storeu_ps( out+SKIN_VERTEX_FLOATS*2,tz );
+		_mm_storel_pi( (__m64*)(out+SKIN_VERTEX_FLOATS*2+4),hi );
+		_mm_storeu_ps( out+SKIN_VERTEX_FLOATS*3,tnx );
+		_mm_storeh_pi( (__m64*)(out+SKIN_VERTEX_FLOATS*3+4),hi );
+
+		for( int j=0;j<cnt;++j ){
+			//color and tex coords
+			const Vertex &v=vertices[n+j];
+			float *t=out+j*SKIN_VERTEX_FLOATS;
+			memcpy( t+6,&v.color,4 );
+			memcpy( t+7,v.tex_coords,16 );
+		}
+
+		if( out==tmp ) memcpy( dest+n*SKIN_VERTEX_FLOATS,tmp,cnt*SKIN_VERTEX_FLOATS*4 );
+	}
+}
+
 /*
 gxMesh *Surface::getMesh(){
 	if( mesh && mesh->dirty() ) valid_vs=0;
@@ -6,6 +6,9 @@
 
 #define MAX_SURFACE_BONES 4
 
+//floats per skinned vertex - same layout as gxMesh vertices
+#define SKIN_VERTEX_FLOATS 11
+
 class Surface{
 public:
 	struct Vertex{
@@ -50,51 +53,64 @@ public:
 
 	void addVertex( const Vertex &v ){
 		vertices.push_back(v);
-		++mon->geom_changes;
+		geomChanged();
 	}
 	void setVertex( int n,const Vertex &v ){
 		vertices[n]=v;
-		if( n<valid_vs ) valid_vs=n;
-		++mon->geom_changes;
+		invalidate( n );
+		geomChanged();
 	}
 	void setCoords( int n,const Vector &v ){
 		vertices[n].coords=v;
-		if( n<valid_vs ) valid_vs=n;
-		++mon->geom_changes;
+		invalidate( n );
+		geomChanged();
 	}
 	void setNormal( int n,const Vector &v ){
 		vertices[n].normal=v;
-		if( n<valid_vs ) valid_vs=n;
+		invalidate( n );
 	}
 	void setColor( int n,unsigned argb ){
 		vertices[n].color=argb;
-		if( n<valid_vs ) valid_vs=n;
+		invalidate( n );
 	}
 	void setTexCoords( int n,const Vector &v,int i ){
 		vertices[n].tex_coords[i][0]=v.x;
 		vertices[n].tex_coords[i][1]=v.y;
-		if( n<valid_vs ) valid_vs=n;
+		invalidate( n );
 	}
 	void addTriangle( const Triangle &t ){
 		triangles.push_back(t);
-		++mon->geom_changes;
+		geomChanged();
 	}
 	void setTriangle( int n,const Triangle &t ){
 		triangles[n]=t;
 		if( n<valid_ts ) valid_ts=n;
-		++mon->geom_changes;
+		geomChanged();
 	}
 
 	Vector getColor( int index )const;
 	void setColor( int index,const Vector &v );
 	void addVertices( const vector<Vertex> &verts );
 	void addTriangles( const vector<Triangle> &tris );
+	void addVertices( const Vertex *verts,int n );
+	void addTriangles( const Triangle *tris,int n );
 
-	void updateNormals();
+	//max_angle>0 only smooths between triangles within max_angle radians of each other
+	void updateNormals( float max_angle=0 );
 
 	gxMesh *getMesh();
 	gxMesh *getMesh( const vector<Bone> &bones );
 
+	//upload vertices previously skinned with skin(). skin_id identifies the skinned vertices, and
+	//the upload is skipped if the mesh already holds them - 0 always uploads.
+	gxMesh *getMesh( const float *skinned,int skin_id );
+
+	//skin vertices first...first+count-1 into dest, first must be a multiple of 4.
+	//dest needs room for numVertices()*SKIN_VERTEX_FLOATS floats.
+	//Safe to call from multiple threads after validateSkin().
+	void validateSkin();
+	void skin( const vector<Bone> &bones,float *dest,int first,int count )const;
+
 	string getName()const{ return name; }
 	const Brush &getBrush()const{ return brush; }
 	int numVertices()const{ return vertices.size(); }
@@ -102,6 +118,9 @@ public:
 	const Vertex &getVertex( int n )const{ return vertices[n]; }
 	const Triangle &getTriangle( int n )const{ return triangles[n]; }
 
+	//bumped whenever the geometry of any surface changes
+	static int geomChanges(){ return all_geom_changes; }
+
 private:
 	Brush brush;
 	string name;
@@ -111,6 +130,33 @@ private:
 	int mesh_vs,mesh_ts;
 	int valid_vs,valid_ts;
 	Monitor *mon;
+
+	//bind pose vertices in blocks of 4, for SIMD skinning
+	struct SkinBlock{
+		float coords[3][4],normal[3][4];
+		float weights[MAX_SURFACE_BONES][4];
+		int bones[MAX_SURFACE_BONES][4];
+		float normalize[4];
+		int n_bones,any_normalize;
+	};
+	vector<SkinBlock> skin_blocks;
+	int skin_vs;
+	//skin_id of vertices in mesh, 0 if none
+	int mesh_skin;
+
+	static int all_geom_changes;
+
+	void invalidate( int n ){
+		if( n<valid_vs ) valid_vs=n;
+		if( n<skin_vs ) skin_vs=n;
+	}
+
+	bool lockSkinned();
+
+	void geomChanged(){
+		++mon->geom_changes;
+		++all_geom_changes;
+	}
 };
 
 #endif
\ No newline at end of file
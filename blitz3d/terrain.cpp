@@ -4,7 +4,11 @@
 #include "terrainrep.h"
 
 Terrain::Terrain( int size_shift ):
-rep( d_new TerrainRep( size_shift ) ){
+rep( d_new TerrainRep( size_shift ) ),prepared(false){
+}
+
+Terrain::Terrain( int size_shift,TerrainPager *pager ):
+rep( d_new TerrainRep( size_shift,pager ) ),prepared(false){
 }
 
 Terrain::~Terrain(){
@@ -19,6 +23,10 @@ void Terrain::setShading( bool t ){
 	rep->setShading( t );
 }
 
+void Terrain::setMode( int mode ){
+	rep->setMode( mode );
+}
+
 void Terrain::setHeight( int x,int z,float h,bool realtime ){
 	if( x>=0 && z>=0 && x<=rep->getSize() && z<=rep->getSize() ) rep->setHeight( x,z,h,realtime );
 }
@@ -31,11 +39,26 @@ float Terrain::getHeight( int x,int z )const{
 	return (x>=0 && z>=0 && x<=rep->getSize() && z<=rep->getSize() ) ? rep->getHeight( x,z ) : 0;
 }
 
+void Terrain::prepare( const RenderContext &rc ){
+	rep->refine( this,rc );
+	prepared=true;
+}
+
 bool Terrain::render( const RenderContext &rc ){
-	rep->render( this,rc );
+	if( !prepared ) rep->refine( this,rc );
+	rep->render( this );
+	prepared=false;
 	return false;
 }
 
 bool Terrain::collide( const Line &line,float radius,Collision *curr_coll,const Transform &tf ){
 	return rep->collide( line,radius,curr_coll,tf );
 }
+
+Box Terrain::getCollisionBounds()const{
+	return Box( Vector(),Vector( rep->getSize(),1,rep->getSize() ) );
+}
+
+void Terrain::validateCollider(){
+	rep->validateCollider();
+}
@@ -5,10 +5,13 @@
 #include "model.h"
 
 struct TerrainRep;
+class TerrainPager;
 
 class Terrain : public Model{
 public:
 	Terrain( int size_shift );
+	//heights are streamed by pager, which the terrain takes ownership of
+	Terrain( int size_shift,TerrainPager *pager );
 	~Terrain();
 
 	Terrain *getTerrain(){ return this; }
@@ -16,18 +19,26 @@ public:
 	void setDetail( int n,bool morph );
 	void setHeight( int x,int z,float h,bool realtime );
 	void setShading( bool shading );
+	//0 for ROAM, 1 for fixed chunks with per chunk LOD
+	void setMode( int mode );
 
 	int getSize()const;
 	float getHeight( int x,int z )const;
 
+	//refine tessellation for rc ahead of render - may be called from a worker thread
+	void prepare( const RenderContext &rc );
+
 	//model interface
 	bool render( const RenderContext &rc );
 
 	//object interface
 	bool collide( const Line &line,float radius,Collision *curr_coll,const Transform &tf );
+	Box getCollisionBounds()const;
+	void validateCollider();
 	
 private:
 	TerrainRep *rep;
+	bool prepared;
 };
 
 #endif
\ No newline at end of file
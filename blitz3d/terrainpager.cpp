@@ -0,0 +1,325 @@
+
+#include "std.h"
+#include "terrainpager.h"
+
+#include <algorithm>
+
+//tiles update() loads at most
+static const int LOADS_PER_UPDATE=2;
+
+TerrainPager::TerrainPager( const string &f,int n,int t,int max ):
+file(0),cell_shift(n),cell_size(1<<n),cell_mask((1<<n)-1),
+max_tiles(max>1 ? max : 1),loaded(0),failed(0){
+
+	if( t>n ) t=n;
+	tile_shift=t;
+	tile_size=1<<t;
+	tile_mask=tile_size-1;
+	tiles_across=cell_size>>t;
+
+	file=fopen( f.c_str(),"rb" );
+	if( !file ) return;
+	//offsets need 64 bits - a 32768x32768 file is 2GB
+	_fseeki64( file,0,SEEK_END );
+	if( _ftelli64( file )<(__int64)cell_size*cell_size*2 ){
+		fclose( file );
+		file=0;
+		return;
+	}
+
+	//heights at tile corners
+	int k,n_corners=tiles_across+1;
+	corners.resize( n_corners*n_corners );
+	for( int j=0;j<n_corners;++j ){
+		for( int i=0;i<n_corners;++i ){
+			unsigned short h=0;
+			_fseeki64( file,( (__int64)((j<<t)&cell_mask)*cell_size+((i<<t)&cell_mask) )*2,SEEK_SET );
+			if( fread( &h,2,1,file )!=1 ){
+				fclose( file );
+				file=0;
+				return;
+			}
+			corners[j*n_corners+i]=h;
+		}
+	}
+
+	//nodes at half_depth cover half a tile
+	half_depth=(n-t)*2;
+	first_half=1<<(half_depth+1);
+	end_coarse_id=first_half*2;
+	coarse_errs.resize( end_coarse_id );
+	halves.resize( first_half );
+
+	tiles.resize( tiles_across*tiles_across );
+	for( k=0;k<tiles.size();++k ){
+		Tile &tile=tiles[k];
+		tile.x=(k%tiles_across)<<t;
+		tile.z=(k/tiles_across)<<t;
+		tile.dist=0;
+		tile.pinned=tile.failed=false;
+		tile.half_ids[0]=tile.half_ids[1]=0;
+	}
+	findHalves( 2,0,cell_size,0,cell_size,cell_size,0,0 );
+	findHalves( 3,0,0,cell_size,0,0,cell_size,cell_size );
+
+	//errors of tile halves, keeping the first tiles loaded
+	for( k=0;k<tiles.size();++k ) loadTile( k,k );
+
+	coarseErr( 2,0,cell_size,0,cell_size,cell_size,0,0 );
+	coarseErr( 3,0,0,cell_size,0,0,cell_size,cell_size );
+}
+
+TerrainPager::~TerrainPager(){
+	if( file ) fclose( file );
+}
+
+void TerrainPager::findHalves( int id,int depth,int x0,int z0,int x1,int z1,int x2,int z2 ){
+	if( depth==half_depth ){
+		int x=std::min( x0,std::min( x1,x2 ) ),z=std::min( z0,std::min( z1,z2 ) );
+		int n=(z>>tile_shift)*tiles_across+(x>>tile_shift);
+		Tile &tile=tiles[n];
+		Half &h=halves[id-first_half];
+		h.tile=n;
+		h.half=tile.half_ids[0] ? 1 : 0;
+		h.x0=x0;h.z0=z0;h.x1=x1;h.z1=z1;h.x2=x2;h.z2=z2;
+		tile.half_ids[h.half]=id;
+		return;
+	}
+	int tx=(x1+x2)/2,tz=(z1+z2)/2;
+	findHalves( id*2,depth+1,tx,tz,x2,z2,x0,z0 );
+	findHalves( id*2+1,depth+1,tx,tz,x0,z0,x1,z1 );
+}
+
+float TerrainPager::cornerHeight( int x,int z )const{
+	return corners[(z>>tile_shift)*(tiles_across+1)+(x>>tile_shift)]/65535.0f;
+}
+
+bool TerrainPager::readTile( Tile &t ){
+	int n=tile_size+1;
+	t.heights.resize( n*n );
+	bool ok=true;
+	for( int j=0;j<n;++j ){
+		unsigned short *row=&t.heights[j*n];
+		__int64 z=(t.z+j)&cell_mask;
+		//last column of the terrain wraps around
+		int cnt=t.x+n>cell_size ? n-1 : n;
+		_fseeki64( file,(z*cell_size+t.x)*2,SEEK_SET );
+		if( fread( row,2,cnt,file )!=cnt ) ok=false;
+		if( cnt<n ){
+			_fseeki64( file,z*cell_size*2,SEEK_SET );
+			if( fread( row+cnt,2,1,file )!=1 ) ok=false;
+		}
+	}
+	return ok;
+}
+
+//heights of a tile that couldn't be read - blend its corners, which are always in memory
+void TerrainPager::flattenTile( Tile &t ){
+	int n=tile_size+1,across=tiles_across+1;
+	int c=(t.z>>tile_shift)*across+(t.x>>tile_shift);
+	float h00=corners[c],h10=corners[c+1],h01=corners[c+across],h11=corners[c+across+1];
+	t.heights.resize( n*n );
+	for( int j=0;j<n;++j ){
+		float v=(float)j/tile_size;
+		float h0=h00+(h01-h00)*v,h1=h10+(h11-h10)*v;
+		for( int i=0;i<n;++i ){
+			t.heights[j*n+i]=(unsigned short)( h0+(h1-h0)*i/tile_size+.5f );
+		}
+	}
+}
+
+TerrainRep::Error TerrainPager::tileErr( Tile &t,int half,int local,int leg_shift,int x0,int z0,int x1,int z1,int x2,int z2 ){
+	int n=tile_size+1;
+	const unsigned short *hs=&t.heights[0];
+	float y0=hs[(z0-t.z)*n+x0-t.x]/65535.0f;
+	float y1=hs[(z1-t.z)*n+x1-t.x]/65535.0f;
+	float y2=hs[(z2-t.z)*n+x2-t.x]/65535.0f;
+
+	TerrainRep::Error et;
+	et.error=0;
+	et.bound=TerrainRep::quantiseBound( std::max( y0,std::max( y1,y2 ) ) );
+
+	//past the last level of the bintree
+	if( leg_shift<1 ) return et;
+
+	int tx=(x1+x2)/2,tz=(z1+z2)/2;
+	float e=fabs( hs[(tz-t.z)*n+tx-t.x]/65535.0f-(y1+y2)/2 );
+	et.error=TerrainRep::quantiseError( e );
+
+	TerrainRep::Error el=tileErr( t,half,local*2,leg_shift-1,tx,tz,x2,z2,x0,z0 );
+	TerrainRep::Error er=tileErr( t,half,local*2+1,leg_shift-1,tx,tz,x0,z0,x1,z1 );
+
+	et.error=std::max( et.error,std::max( el.error,er.error ) );
+	et.bound=std::max( et.bound,std::max( el.bound,er.bound ) );
+
+	return t.errors[half][local]=et;
+}
+
+TerrainRep::Error TerrainPager::coarseErr( int id,int depth,int x0,int z0,int x1,int z1,int x2,int z2 ){
+	if( depth==half_depth ) return coarse_errs[id];
+
+	float y0=cornerHeight( x0,z0 ),y1=cornerHeight( x1,z1 ),y2=cornerHeight( x2,z2 );
+
+	TerrainRep::Error et;
+	et.bound=TerrainRep::quantiseBound( std::max( y0,std::max( y1,y2 ) ) );
+
+	int tx=(x1+x2)/2,tz=(z1+z2)/2;
+	et.error=TerrainRep::quantiseError( fabs( cornerHeight( tx,tz )-(y1+y2)/2 ) );
+
+	TerrainRep::Error el=coarseErr( id*2,depth+1,tx,tz,x2,z2,x0,z0 );
+	TerrainRep::Error er=coarseErr( id*2+1,depth+1,tx,tz,x0,z0,x1,z1 );
+
+	et.error=std::max( et.error,std::max( el.error,er.error ) );
+	et.bound=std::max( et.bound,std::max( el.bound,er.bound ) );
+
+	return coarse_errs[id]=et;
+}
+
+//read tile n and work out its errors - tile keep won't be evicted to make room
+void TerrainPager::loadTile( int n,int keep ){
+	Tile &t=tiles[n];
+	if( t.failed || !readTile( t ) ){
+		if( !t.failed ){
+			t.failed=true;
+			++failed;
+		}
+		flattenTile( t );
+	}
+
+	int local_cnt=tile_size*tile_size;
+	int leg_shift=tile_shift*2;
+	for( int k=0;k<2;++k ){
+		const Half &h=halves[t.half_ids[k]-first_half];
+		t.errors[k].resize( local_cnt );
+		coarse_errs[t.half_ids[k]]=tileErr( t,k,1,leg_shift,h.x0,h.z0,h.x1,h.z1,h.x2,h.z2 );
+	}
+	++loaded;
+	evictFurthest( keep );
+}
+
+void TerrainPager::evictTile( Tile &t ){
+	vector<unsigned short>().swap( t.heights );
+	vector<TerrainRep::Error>().swap( t.errors[0] );
+	vector<TerrainRep::Error>().swap( t.errors[1] );
+	--loaded;
+}
+
+void TerrainPager::evictFurthest( int keep ){
+	while( loaded>max_tiles ){
+		int far=-1;
+		for( int k=0;k<tiles.size();++k ){
+			const Tile &t=tiles[k];
+			if( k==keep || t.pinned || !t.heights.size() ) continue;
+			if( far==-1 || t.dist>tiles[far].dist ) far=k;
+		}
+		if( far==-1 ) return;
+		evictTile( tiles[far] );
+	}
+}
+
+TerrainPager::Tile *TerrainPager::tileAt( int x,int z,bool load ){
+	int n=(z>>tile_shift)*tiles_across+(x>>tile_shift);
+	Tile *t=&tiles[n];
+	if( !t->heights.size() ){
+		if( !load ) return 0;
+		loadTile( n,n );
+	}
+	return t;
+}
+
+float TerrainPager::getHeight( int x,int z ){
+	if( !(x&tile_mask) && !(z&tile_mask) ) return cornerHeight( x,z );
+	std::lock_guard<std::mutex> lock( mutex );
+	Tile *t=tileAt( x,z,true );
+	return t->heights[(z-t->z)*(tile_size+1)+x-t->x]/65535.0f;
+}
+
+void TerrainPager::setHeight( int x,int z,int h ){
+	std::lock_guard<std::mutex> lock( mutex );
+
+	//tiles on an edge share it with their neighbours, and the terrain wraps
+	int is[2]={ x>>tile_shift,-1 },js[2]={ z>>tile_shift,-1 };
+	if( !(x&tile_mask) ) is[1]=(is[0]+tiles_across-1)%tiles_across;
+	if( !(z&tile_mask) ) js[1]=(js[0]+tiles_across-1)%tiles_across;
+
+	for( int j=0;j<2;++j ){
+		if( js[j]<0 ) continue;
+		for( int i=0;i<2;++i ){
+			if( is[i]<0 ) continue;
+			int n=js[j]*tiles_across+is[i];
+			Tile &t=tiles[n];
+			if( !t.heights.size() ) loadTile( n,n );
+			t.pinned=true;
+			int lx=i ? tile_size : x-t.x,lz=j ? tile_size : z-t.z;
+			t.heights[lz*(tile_size+1)+lx]=h;
+			if( !(x&tile_mask) && !(z&tile_mask) ){
+				corners[((t.z+lz)>>tile_shift)*(tiles_across+1)+((t.x+lx)>>tile_shift)]=h;
+			}
+		}
+	}
+}
+
+TerrainRep::Error TerrainPager::getError( int id,bool load ){
+	std::lock_guard<std::mutex> lock( mutex );
+	if( id<end_coarse_id ) return coarse_errs[id];
+
+	int depth=half_depth;
+	while( id>>(depth+2) ) ++depth;
+	int rel=depth-half_depth,root=id>>rel;
+
+	const Half &h=halves[root-first_half];
+	Tile &t=tiles[h.tile];
+	if( !t.heights.size() ){
+		if( !load ){
+			TerrainRep::Error e;
+			e.error=0;
+			e.bound=coarse_errs[root].bound;
+			return e;
+		}
+		loadTile( h.tile,h.tile );
+	}
+	return t.errors[h.half][(1<<rel)|(id&((1<<rel)-1))];
+}
+
+void TerrainPager::setError( int id,const TerrainRep::Error &e ){
+	std::lock_guard<std::mutex> lock( mutex );
+	if( id<end_coarse_id ){
+		coarse_errs[id]=e;
+		return;
+	}
+
+	int depth=half_depth;
+	while( id>>(depth+2) ) ++depth;
+	int rel=depth-half_depth,root=id>>rel;
+
+	const Half &h=halves[root-first_half];
+	Tile &t=tiles[h.tile];
+	if( !t.heights.size() ) loadTile( h.tile,h.tile );
+	t.errors[h.half][(1<<rel)|(id&((1<<rel)-1))]=e;
+}
+
+void TerrainPager::update( const Vector &eye ){
+	std::lock_guard<std::mutex> lock( mutex );
+
+	static thread_local vector<pair<float,int> > order;
+	order.clear();
+
+	for( int k=0;k<tiles.size();++k ){
+		Tile &t=tiles[k];
+		float dx=eye.x<t.x ? t.x-eye.x : ( eye.x>t.x+tile_size ? eye.x-t.x-tile_size : 0 );
+		float dz=eye.z<t.z ? t.z-eye.z : ( eye.z>t.z+tile_size ? eye.z-t.z-tile_size : 0 );
+		t.dist=dx*dx+dz*dz;
+		order.push_back( make_pair( t.dist,k ) );
+	}
+
+	int n=std::min( (int)order.size(),max_tiles );
+	std::partial_sort( order.begin(),order.begin()+n,order.end() );
+
+	int loads=0;
+	for( int k=0;k<n && loads<LOADS_PER_UPDATE;++k ){
+		int i=order[k].second;
+		if( tiles[i].heights.size() ) continue;
+		loadTile( i,i );
+		++loads;
+	}
+}
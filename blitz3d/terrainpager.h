@@ -0,0 +1,81 @@
+
+#ifndef TERRAINPAGER_H
+#define TERRAINPAGER_H
+
+#include "terrainrep.h"
+
+#include <mutex>
+
+//
+// Heights and errors of a big terrain, streamed in square tiles from a raw file of
+// 16 bit little endian heights, one row of cells after another.
+//
+// Heights on tile corners and errors of bintree nodes bigger than a tile are always in
+// memory - everything else is loaded with its tile. Tiles nearest the eye are loaded a
+// few at a time by update(), and the furthest are evicted to keep within max_tiles.
+// Tiles with modified heights stay loaded. Safe to call from multiple threads.
+//
+class TerrainPager{
+public:
+	TerrainPager( const string &file,int cell_shift,int tile_shift,int max_tiles );
+	~TerrainPager();
+
+	//false if the file couldn't be read
+	bool valid()const{ return file!=0; }
+
+	//loads the tile containing x,z if needed
+	float getHeight( int x,int z );
+	void setHeight( int x,int z,int h );
+
+	//if load is false, nodes in unloaded tiles have no error
+	TerrainRep::Error getError( int id,bool load );
+	void setError( int id,const TerrainRep::Error &e );
+
+	//load tiles nearest to eye, and evict the furthest
+	void update( const Vector &eye );
+
+	int tilesLoaded()const{ return loaded; }
+	//tiles that couldn't be read, and are flat between their corners instead
+	int tilesFailed()const{ return failed; }
+
+private:
+	struct Tile{
+		int x,z,half_ids[2];
+		float dist;
+		bool pinned,failed;
+		//(tile_size+1)^2 heights, and errors of each half
+		vector<unsigned short> heights;
+		vector<TerrainRep::Error> errors[2];
+	};
+
+	//bintree node covering half a tile
+	struct Half{
+		int tile,half;
+		int x0,z0,x1,z1,x2,z2;
+	};
+
+	FILE *file;
+	int cell_shift,cell_size,cell_mask;
+	int tile_shift,tile_size,tile_mask,tiles_across,max_tiles;
+	int half_depth,first_half,end_coarse_id;
+	int loaded,failed;
+
+	vector<unsigned short> corners;
+	vector<TerrainRep::Error> coarse_errs;
+	vector<Half> halves;
+	vector<Tile> tiles;
+	std::mutex mutex;
+
+	bool readTile( Tile &t );
+	void flattenTile( Tile &t );
+	void loadTile( int n,int keep );
+	void evictTile( Tile &t );
+	void evictFurthest( int keep );
+	Tile *tileAt( int x,int z,bool load );
+	void findHalves( int id,int depth,int x0,int z0,int x1,int z1,int x2,int z2 );
+	TerrainRep::Error tileErr( Tile &t,int half,int local,int leg_shift,int x0,int z0,int x1,int z1,int x2,int z2 );
+	TerrainRep::Error coarseErr( int id,int depth,int x0,int z0,int x1,int z1,int x2,int z2 );
+	float cornerHeight( int x,int z )const;
+};
+
+#endif
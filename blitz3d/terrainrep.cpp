@@ -1,115 +1,123 @@
-
 #include "std.h"
 #include "terrainrep.h"
-#include <queue>
+#include "terrainpager.h"
+
+#include <algorithm>
 
 extern gxRuntime *gx_runtime;
 extern gxGraphics *gx_graphics;
-extern float stats3d[10];
+extern float stats3d[32];
 
-static Vector eye_vec;
-static Plane eye_plane;
 static const Vector up_normal( 0,1,0 );
-static TerrainRep::Tri *tri_pool;
-static const TerrainRep *curr;
-static Frustum frustum;
-static int out_cnt,proc_cnt,clip_cnt;
+static thread_local const TerrainRep *curr;
 
 static float proj_epsilon=EPSILON;	//.01f;
 
+//fraction of height a new vertex morphs each refine
+static const float MORPH_STEP=.25f;
+
+//triangles allocated at a time
+static const int TRI_BLOCK=256;
+
+//cells across a chunk in chunked mode
+static const int CHUNK_SHIFT=5;
+
+//largest vertex and triangle counts drawn, for stats
+static int max_verts_drawn,max_tris_drawn;
+
 struct TerrainRep::Cell{
-	unsigned char height;
+	unsigned short height;
 };
 
-struct TerrainRep::Error{
-	unsigned char error,bound;
-};
+//error q is 2^((q-255)/16), so 1...255 covers 1/65535...1
+static struct ErrTable{
+	float values[256];
+	ErrTable(){
+		values[0]=0;
+		for( int k=1;k<256;++k ) values[k]=pow( 2.0f,(k-255)/16.0f );
+	}
+}err_table;
+
+unsigned char TerrainRep::quantiseError( float e ){
+	if( e<.5f/65535.0f ) return 0;
+	if( e>=1 ) return 255;
+	int q=ceil( 255+16*log( e )/log( 2.0f ) );
+	if( q<1 ) q=1;
+	while( q<255 && err_table.values[q]<e ) ++q;
+	return q;
+}
+
+unsigned char TerrainRep::quantiseBound( float y ){
+	return y>=1 ? 255 : ( y<=0 ? 0 : ceil( y*255.0f ) );
+}
+
+float TerrainRep::errorValue( unsigned char q ){
+	return err_table.values[q];
+}
 
 int TerrainRep::getSize()const{
 	return cell_size;
 }
 
 float TerrainRep::getHeight( int x,int z )const{
-	return cells[((z&cell_mask)<<cell_shift)|(x&cell_mask)].height/255.0f;
+	if( pager ) return pager->getHeight( x&cell_mask,z&cell_mask );
+	return cells[((z&cell_mask)<<cell_shift)|(x&cell_mask)].height/65535.0f;
+}
+
+TerrainRep::Error TerrainRep::getErr( int id,bool load )const{
+	return pager ? pager->getError( id,load ) : errors[id];
+}
+
+void TerrainRep::setErr( int id,const Error &e )const{
+	if( pager ) pager->setError( id,e );
+	else errors[id]=e;
 }
 
 struct TerrainRep::Vert{
 	short x,z;
 	Vector v;
-	float src_y;
+	float src_y,morph;
 
 	Vert(){
 	}
-	Vert( int x,int z ):x(x),z(z),v( x,curr->getHeight(x,z),z){
+	Vert( int x,int z ):x(x),z(z),v( x,curr->getHeight(x,z),z),morph(1){
 		src_y=v.y;
 	}
-	Vert( int x,int z,float sy ):x(x),z(z),v( x,curr->getHeight(x,z),z ),src_y(sy){
+	Vert( int x,int z,float sy ):x(x),z(z),v( x,curr->getHeight(x,z),z ),src_y(sy),morph(1){
 	}
 };
 
-static int vert_cnt,max_verts;
-static TerrainRep::Vert *verts,*next_vert;
-
+//
+// Node of the triangle bintree. Children of id are id*2 and id*2+1.
+//
+// e0, e1 and e2 are the neighbours across v2-v0, v0-v1 and the base v1-v2. Only leaves
+// keep e0 and e1 up to date - an internal node's e2 is the partner it was split with.
+//
 struct TerrainRep::Tri{
-	int id;
-	short clip,v0,v1,v2;
+	int id,clip;
+	int v0,v1,v2;
 	Tri *e0,*e1,*e2;
-	float proj_err;
+	Tri *parent,*kids[2];
+	float pri;
+	unsigned gen;
 
-	Tri(){
+	bool leaf()const{
+		return !kids[0];
 	}
-	Tri( int id,int clip,int v0,int v1,int v2,Tri *e0=0,Tri *e1=0,Tri *e2=0 ):
-	id(id),clip(clip),
-	v0(v0),v1(v1),v2(v2),
-	e0(e0),e1(e1),e2(e2),proj_err(0){
+	void replace( Tri *from,Tri *to ){
+		if( e0==from ) e0=to;
+		else if( e1==from ) e1=to;
+		else e2=to;
 	}
-
-	void *operator new( size_t sz ){
-		static const int GROW=64;
-		if( !tri_pool ){
-			tri_pool=new Tri[GROW];
-			for( int k=0;k<GROW-1;++k ) tri_pool[k].e0=&tri_pool[k+1];
-			tri_pool[GROW-1].e0=0;
-		}
-		Tri *t=tri_pool;
-		tri_pool=t->e0;
-		return t;
-	}
-	void operator delete( void *q ){
-		Tri *t=(Tri*)q;
-		t->e0=tri_pool;
-		tri_pool=t;
-	}
-	void unlink(){
-		if( e0 ){
-			if( e0->e0==this ) e0->e0=0;
-			else if( e0->e1==this ) e0->e1=0;
-			else e0->e2=0;
-		}
-		if( e1 ){
-			if( e1->e0==this ) e1->e0=0;
-			else if( e1->e1==this ) e1->e1=0;
-			else e1->e2=0;
-		}
-		if( e2 ){
-			if( e2->e0==this ) e2->e0=0;
-			else if( e2->e1==this ) e2->e1=0;
-			else e2->e2=0;
-		}
-	}
-};
-
-struct TriComp{
-	bool operator()( TerrainRep::Tri *a,TerrainRep::Tri *b )const{ return a->proj_err<b->proj_err; }
 };
 
-struct TriQue : public priority_queue<TerrainRep::Tri*,vector<TerrainRep::Tri*>,TriComp>{
-	vector<TerrainRep::Tri*> &getVector(){ return c; }
-	const vector<TerrainRep::Tri*> &getVector()const{ return c; }
-};
+static bool splitLess( const TerrainRep::QueItem &a,const TerrainRep::QueItem &b ){
+	return a.pri<b.pri;
+}
 
-static TriQue tri_que;
-static vector<TerrainRep::Tri*> tris;
+static bool mergeLess( const TerrainRep::QueItem &a,const TerrainRep::QueItem &b ){
+	return a.pri>b.pri;
+}
 
 static bool clip( const Line &l,const Box &box ){
 	static const Vector normals[]={
@@ -135,26 +143,54 @@ static bool clip( const Line &l,const Box &box ){
 	return true;
 }
 
-TerrainRep::TerrainRep( int n ):
+TerrainRep::TerrainRep( int n,TerrainPager *pager ):
 cell_shift(n),cell_size(1<<n),cell_mask((1<<n)-1),
 end_tri_id( (1<<n)*(1<<n)*2 ),
-shading(false),mesh(0),detail(0),morph(true){
-	cells=d_new Cell[cell_size*cell_size];
-	errors=d_new Error[end_tri_id];
+cells(0),errors(0),pager(pager),
+shading(false),mesh(0),detail(0),morph(true),heights_changed(false),
+free_tris(0),leaf_cnt(2),mode(LOD_ROAM){
 	setDetail( 2000,false );
-	clear();
+	if( pager ){
+		//errors come from the pager
+		errs_valid=true;
+	}else{
+		cells=d_new Cell[cell_size*cell_size];
+		errors=d_new Error[end_tri_id];
+		clear();
+	}
+
+	verts.resize( 4 );
+	static const int corners[4][2]={ {0,0},{1,0},{1,1},{0,1} };
+	for( int k=0;k<4;++k ){
+		Vert &v=verts[k];
+		v.x=corners[k][0]*cell_size;
+		v.z=corners[k][1]*cell_size;
+		v.v=Vector( v.x,getHeight( v.x,v.z ),v.z );
+		v.src_y=v.v.y;
+		v.morph=1;
+	}
+	roots[0]=allocTri( 2,0,1,2,0 );
+	roots[1]=allocTri( 3,0,3,0,2 );
+	roots[0]->e2=roots[1];
+	roots[1]->e2=roots[0];
 }
 
 TerrainRep::~TerrainRep(){
+	freeChunks();
 	if( mesh ) gx_graphics->freeMesh( mesh );
+	for( int k=0;k<tri_blocks.size();++k ) delete[] tri_blocks[k];
+	delete pager;
 	delete[] errors;
 	delete[] cells;
 }
 
 void TerrainRep::clear(){
+	if( pager ) return;
 	memset( cells,0,cell_size*cell_size*sizeof(Cell) );
 	memset( errors,0,end_tri_id*sizeof(Error) );
 	errs_valid=true;
+	heights_changed=true;
+	for( int k=0;k<chunks.size();++k ) chunks[k].errs_dirty=chunks[k].mesh_dirty=true;
 }
 
 void TerrainRep::setDetail( int n,bool m ){
@@ -163,11 +199,6 @@ void TerrainRep::setDetail( int n,bool m ){
 	detail=n;
 
 	n+=32;
-	if( n>max_verts ){
-		delete[] verts;
-		max_verts=n;
-		verts=new Vert[max_verts];
-	}
 	if( mesh ) gx_graphics->freeMesh( mesh );
 	mesh_verts=mesh_tris=n;
 	mesh=gx_graphics->createMesh( mesh_verts,mesh_tris,0 );
@@ -175,12 +206,26 @@ void TerrainRep::setDetail( int n,bool m ){
 
 void TerrainRep::setShading( bool t ){
 	shading=t;
+	for( int k=0;k<chunks.size();++k ) chunks[k].mesh_dirty=true;
+}
+
+void TerrainRep::setMode( int n ){
+	//paged terrains are too big for a mesh per chunk
+	if( n==mode || pager ) return;
+	mode=n;
+	if( mode==LOD_ROAM ) freeChunks();
 }
 
 void TerrainRep::setHeight( int x,int z,float h,bool realtime ){
-	cells[((z&cell_mask)<<cell_shift)|(x&cell_mask)].height=h*255.0f;
+	int t=h<=0 ? 0 : ( h>=1 ? 65535 : h*65535.0f+.5f );
+	if( pager ) pager->setHeight( x&cell_mask,z&cell_mask,t );
+	else cells[((z&cell_mask)<<cell_shift)|(x&cell_mask)].height=t;
+	heights_changed=true;
+	dirtyChunks( x,z );
 	if( !errs_valid ) return;
-	if( realtime ){
+	//a paged terrain can't revalidate all its errors, so always update the path to x,z
+	if( realtime || pager ){
+		curr=this;
 		Vert v0(0,0),v1(cell_size,0),v2(cell_size,cell_size),v3(0,cell_size);
 		calcErr( 2,x,z,v1,v2,v0 );
 		calcErr( 3,x,z,v3,v0,v2 );
@@ -203,130 +248,608 @@ Vector TerrainRep::getNormal( int x,int z )const{
 		Plane( vt,v0,v3 ).n ).normalized();
 }
 
-void TerrainRep::insert( Tri *t ){
-	++proc_cnt;
-
-	//quicker clip check for 'thin' triangles...
-	if( t->id>=end_tri_id || !errors[t->id].error ){
-		if( t->clip & 63 ){
-			++clip_cnt;
-			Vector e0( verts[t->v0].v ),e1( verts[t->v1].v ),e2( verts[t->v2].v );
-			for( int n=0;n<6;++n ){
-				if( !( t->clip & (1<<n) ) ) continue;
-				const Plane &p=frustum.getPlane( n );
-				if( p.distance(e0)<0 && p.distance(e1)<0 && p.distance(e2)<0 ){
-					t->unlink();
-					delete t;
-					++out_cnt;
-					return;
-				}
-			}
+TerrainRep::Tri *TerrainRep::allocTri( int id,Tri *parent,int v0,int v1,int v2 ){
+	if( !free_tris ){
+		Tri *block=new Tri[TRI_BLOCK];
+		for( int k=0;k<TRI_BLOCK;++k ){
+			block[k].gen=0;
+			block[k].e0=k<TRI_BLOCK-1 ? &block[k+1] : 0;
 		}
-		t->clip|=128;
-		tris.push_back( t );
-		++out_cnt;
-		return;
+		tri_blocks.push_back( block );
+		free_tris=block;
 	}
+	Tri *t=free_tris;
+	free_tris=t->e0;
+	t->id=id;
+	t->clip=parent ? parent->clip : 0x3f;
+	t->v0=v0;t->v1=v1;t->v2=v2;
+	t->e0=t->e1=t->e2=0;
+	t->parent=parent;
+	t->kids[0]=t->kids[1]=0;
+	t->pri=0;
+	return t;
+}
+
+void TerrainRep::freeTri( Tri *t ){
+	++t->gen;
+	t->e0=free_tris;
+	free_tris=t;
+}
+
+//new vertex halfway along v1-v2, that morphs from there to the terrain
+int TerrainRep::allocVert( int v1,int v2 ){
+	int n;
+	if( free_verts.size() ){
+		n=free_verts.back();
+		free_verts.pop_back();
+	}else{
+		n=verts.size();
+		verts.push_back( Vert() );
+	}
+	const Vert &a=verts[v1],&b=verts[v2];
+	Vert &v=verts[n];
+	v.x=(a.x+b.x)/2;
+	v.z=(a.z+b.z)/2;
+	v.src_y=(a.v.y+b.v.y)/2;
+	v.v=Vector( v.x,getHeight( v.x,v.z ),v.z );
+	if( morph ){
+		v.v.y=v.src_y;
+		v.morph=0;
+	}else{
+		v.morph=1;
+	}
+	return n;
+}
 
-	//clip?
-	if( t->id<end_tri_id/2 && (t->clip & 63) ){
-		++clip_cnt;
-		Vector e0( verts[t->v0].v ),e1( verts[t->v1].v ),e2( verts[t->v2].v );
-		Vector e3(e0),e4(e1),e5(e2);
-		e0.y=e1.y=e2.y=0;
-		e3.y=e4.y=e5.y=errors[t->id].bound/255.0f;
+void TerrainRep::freeVert( int n ){
+	free_verts.push_back( n );
+}
+
+//
+// Returns clip with the planes t is fully inside removed, or 128 if t is outside.
+//
+int TerrainRep::clipTri( const Tri *t,int clip )const{
+	if( (clip & 128) || !(clip & 63) ) return clip;
+
+	Vector e0( verts[t->v0].v ),e1( verts[t->v1].v ),e2( verts[t->v2].v );
+
+	//quicker clip check for 'thin' triangles...
+	Error err=t->id<end_tri_id ? getErr( t->id ) : Error();
+	if( t->id>=end_tri_id || !err.error ){
 		for( int n=0;n<6;++n ){
-			int mask=1<<n;
-			if( !(t->clip & mask) ) continue;
+			if( !( clip & (1<<n) ) ) continue;
 			const Plane &p=frustum.getPlane( n );
-			int q=
-			(p.distance( e0 )>=0)+(p.distance( e1 )>=0)+(p.distance( e2 )>=0)+
-			(p.distance( e3 )>=0)+(p.distance( e4 )>=0)+(p.distance( e5 )>=0);
-			if( !q ){
-				t->unlink();
-				delete t;
-				++out_cnt;
-				return;
-			}
-			if( q==6 ) t->clip&=~mask;
+			if( p.distance(e0)<0 && p.distance(e1)<0 && p.distance(e2)<0 ) return 128;
 		}
+		return clip;
 	}
 
-	if( t->clip & 128 ){
-		t->clip|=128;
-		tris.push_back( t );
-	}else{
-		Vector v=Vector( verts[t->v1].v+verts[t->v2].v )/2;
-//		float d=eye_plane.distance( v );
-		float d=eye_vec.distance( v );
-		if( d<EPSILON ) d=EPSILON;
-		t->proj_err=errors[t->id].error/d;
-		if( t->proj_err>proj_epsilon ){
-			tri_que.push( t );
-		}else{
-			t->clip|=128;
-			tris.push_back( t );
+	Vector e3(e0),e4(e1),e5(e2);
+	e0.y=e1.y=e2.y=0;
+	e3.y=e4.y=e5.y=err.bound/255.0f;
+	for( int n=0;n<6;++n ){
+		int mask=1<<n;
+		if( !(clip & mask) ) continue;
+		const Plane &p=frustum.getPlane( n );
+		int q=
+		(p.distance( e0 )>=0)+(p.distance( e1 )>=0)+(p.distance( e2 )>=0)+
+		(p.distance( e3 )>=0)+(p.distance( e4 )>=0)+(p.distance( e5 )>=0);
+		if( !q ) return 128;
+		if( q==6 ) clip&=~mask;
+	}
+	return clip;
+}
+
+float TerrainRep::priority( const Tri *t )const{
+	if( (t->clip & 128) || t->id>=end_tri_id ) return 0;
+	Error err=getErr( t->id );
+	if( !err.error ) return 0;
+	Vector v=Vector( verts[t->v1].v+verts[t->v2].v )/2;
+	float d=eye_vec.distance( v );
+	if( d<EPSILON ) d=EPSILON;
+	//in 1/255ths of the height range, as with 8 bit errors
+	return errorValue( err.error )*255.0f/d;
+}
+
+//true if t and its partner are split, and their children aren't
+bool TerrainRep::mergeable( const Tri *t )const{
+	if( t->leaf() || !t->kids[0]->leaf() || !t->kids[1]->leaf() ) return false;
+	const Tri *b=t->e2;
+	return !b || ( !b->leaf() && b->kids[0]->leaf() && b->kids[1]->leaf() );
+}
+
+void TerrainRep::queueSplit( Tri *t ){
+	if( t->pri<=proj_epsilon ) return;
+	QueItem item={ t->pri,t,t->gen };
+	split_que.push_back( item );
+	std::push_heap( split_que.begin(),split_que.end(),splitLess );
+}
+
+void TerrainRep::queueMerge( Tri *t ){
+	if( !t || !mergeable( t ) ) return;
+	if( t->e2 && t->e2<t ) t=t->e2;
+	float pri=t->pri;
+	if( t->e2 && t->e2->pri>pri ) pri=t->e2->pri;
+	QueItem item={ pri,t,t->gen };
+	merge_que.push_back( item );
+	std::push_heap( merge_que.begin(),merge_que.end(),mergeLess );
+}
+
+//
+// Update clip flags and priorities of the whole tree for a new view, and collect leaves
+// to split and diamonds to merge. Outside subtrees are still walked so they can be merged.
+//
+void TerrainRep::gather( Tri *t,int clip ){
+	t->clip=clipTri( t,clip );
+	t->pri=priority( t );
+	if( t->leaf() ){
+		if( t->pri>proj_epsilon ){
+			QueItem item={ t->pri,t,t->gen };
+			split_que.push_back( item );
 		}
+		return;
+	}
+	gather( t->kids[0],t->clip );
+	gather( t->kids[1],t->clip );
+	if( mergeable( t ) && ( !t->e2 || t<t->e2 ) ){
+		//partner priority is filled in once the whole tree has been walked
+		QueItem item={ t->pri,t,t->gen };
+		merge_que.push_back( item );
 	}
-	++out_cnt;
+}
+
+//collect visible leaves
+void TerrainRep::output( Tri *t,int clip ){
+	clip=clipTri( t,clip );
+	if( clip & 128 ) return;
+	if( t->leaf() ){
+		out_tris.push_back( t );
+		return;
+	}
+	output( t->kids[0],clip );
+	output( t->kids[1],clip );
 }
 
 void TerrainRep::split( Tri *t ){
 
+	//make sure base neighbour is a partner
 	if( t->e2 && t->e2->e2!=t ) split( t->e2 );
 
-	int tv=vert_cnt++;
-	if( tv>=max_verts ){
-		max_verts+=max_verts/2+32;
-		Vert *t=verts;
-		verts=d_new Vert[max_verts];
-		memcpy( verts,t,sizeof(Vert)*tv );
-		next_vert=verts+tv;
-	}
-	Vert *vert=next_vert++;
-	vert->v.x=vert->x=(verts[t->v1].x+verts[t->v2].x)/2;
-	vert->v.z=vert->z=(verts[t->v1].z+verts[t->v2].z)/2;
-	vert->src_y=(verts[t->v1].v.y+verts[t->v2].v.y)/2;
-	vert->v.y=getHeight( vert->x,vert->z );
-
-	Tri *tl=new Tri( t->id*2,t->clip,tv,t->v2,t->v0,0,0,t->e0 );
-	if( Tri *p=tl->e2 ){
-		if( p->e0==t ) p->e0=tl;
-		else if( p->e1==t ) p->e1=tl;
-		else p->e2=tl;
-	}
-	Tri *tr=new Tri( t->id*2+1,t->clip,tv,t->v0,t->v1,0,tl,t->e1 );
+	Tri *b=t->e2;
+	int tv=allocVert( t->v1,t->v2 );
+
+	Tri *tl=allocTri( t->id*2,t,tv,t->v2,t->v0 );
+	Tri *tr=allocTri( t->id*2+1,t,tv,t->v0,t->v1 );
+	if( (tl->e2=t->e0) ) tl->e2->replace( t,tl );
+	if( (tr->e2=t->e1) ) tr->e2->replace( t,tr );
 	tl->e0=tr;
-	if( Tri *p=tr->e2 ){
-		if( p->e0==t ) p->e0=tr;
-		else if( p->e1==t ) p->e1=tr;
-		else p->e2=tr;
+	tr->e1=tl;
+	t->kids[0]=tl;
+	t->kids[1]=tr;
+	++t->gen;
+	++leaf_cnt;
+
+	if( b ){
+		Tri *br=allocTri( b->id*2,b,tv,b->v2,b->v0 );
+		Tri *bl=allocTri( b->id*2+1,b,tv,b->v0,b->v1 );
+		if( (br->e2=b->e0) ) br->e2->replace( b,br );
+		if( (bl->e2=b->e1) ) bl->e2->replace( b,bl );
+		br->e0=bl;
+		bl->e1=br;
+		tr->e0=br;
+		br->e1=tr;
+		tl->e1=bl;
+		bl->e0=tl;
+		b->kids[0]=br;
+		b->kids[1]=bl;
+		++b->gen;
+		++leaf_cnt;
 	}
 
-	if( Tri *b=t->e2 ){
-		Tri *br=new Tri( b->id*2,b->clip,tv,b->v2,b->v0,0,tr,b->e0 );
-		tr->e0=br;
-		if( Tri *p=br->e2 ){
-			if( p->e0==b ) p->e0=br;
-			else if( p->e1==b ) p->e1=br;
-			else p->e2=br;
+	for( int k=0;k<2;++k ){
+		for( Tri *p=t;p;p=(p==t ? b : 0) ){
+			Tri *c=p->kids[k];
+			c->clip=clipTri( c,p->clip );
+			c->pri=priority( c );
+			queueSplit( c );
 		}
-		Tri *bl=new Tri( b->id*2+1,b->clip,tv,b->v0,b->v1,tl,br,b->e1 );
-		tl->e1=br->e0=bl;
-		if( Tri *p=bl->e2 ){
-			if( p->e0==b ) p->e0=bl;
-			else if( p->e1==b ) p->e1=bl;
-			else p->e2=bl;
+	}
+	queueMerge( t );
+}
+
+void TerrainRep::merge( Tri *t ){
+
+	Tri *b=t->e2;
+	int tv=t->kids[0]->v0;
+
+	for( Tri *p=t;p;p=(p==t ? b : 0) ){
+		Tri *l=p->kids[0],*r=p->kids[1];
+		if( (p->e0=l->e2) ) p->e0->replace( l,p );
+		if( (p->e1=r->e2) ) p->e1->replace( r,p );
+		freeTri( l );
+		freeTri( r );
+		p->kids[0]=p->kids[1]=0;
+		++p->gen;
+		--leaf_cnt;
+	}
+	freeVert( tv );
+
+	queueSplit( t );
+	if( b ) queueSplit( b );
+	queueMerge( t->parent );
+	if( b ) queueMerge( b->parent );
+}
+
+void TerrainRep::refine( Model *model,const RenderContext &rc ){
+
+	curr=this;
+	validateErrs();
+
+	new( &frustum ) Frustum( rc.getWorldFrustum(),-model->getRenderTform() );
+	eye_vec=frustum.getVertex( Frustum::VERT_EYE );
+
+	if( pager ) pager->update( eye_vec );
+
+	if( mode==LOD_CHUNKED ){
+		refineChunks();
+		return;
+	}
+
+	//move vertices toward the terrain
+	int k;
+	for( k=0;k<verts.size();++k ){
+		Vert &v=verts[k];
+		if( v.morph>=1 && !heights_changed ) continue;
+		float y=getHeight( v.x,v.z );
+		if( morph && v.morph<1 ){
+			v.morph+=MORPH_STEP;
+			if( v.morph>1 ) v.morph=1;
+			v.v.y=v.src_y+(y-v.src_y)*v.morph;
+		}else{
+			v.morph=1;
+			v.v.y=y;
 		}
-		b->id=0;
-		--out_cnt;
-		insert( br );
-		insert( bl );
 	}
-	t->id=0;
-	--out_cnt;
-	insert( tl );
-	insert( tr );
+	heights_changed=false;
+
+	//rebuild queues for the new view
+	split_que.clear();
+	merge_que.clear();
+	gather( roots[0],0x3f );
+	gather( roots[1],0x3f );
+	for( k=0;k<merge_que.size();++k ){
+		QueItem &item=merge_que[k];
+		if( Tri *b=item.tri->e2 ){
+			if( b->pri>item.pri ) item.pri=b->pri;
+		}
+	}
+	std::make_heap( split_que.begin(),split_que.end(),splitLess );
+	std::make_heap( merge_que.begin(),merge_que.end(),mergeLess );
+
+	//
+	// Split the most important leaves and merge the least important diamonds until
+	// the triangle budget is used, or nothing worth splitting is left.
+	//
+	int ops=detail*2+256;
+	while( ops-- ){
+		while( split_que.size() ){
+			const QueItem &item=split_que.front();
+			if( item.tri->gen==item.gen && item.tri->leaf() ) break;
+			std::pop_heap( split_que.begin(),split_que.end(),splitLess );
+			split_que.pop_back();
+		}
+		while( merge_que.size() ){
+			const QueItem &item=merge_que.front();
+			if( item.tri->gen==item.gen && mergeable( item.tri ) ) break;
+			std::pop_heap( merge_que.begin(),merge_que.end(),mergeLess );
+			merge_que.pop_back();
+		}
+
+		Tri *t;
+		if( leaf_cnt>detail ){
+			if( !merge_que.size() ) break;
+			t=merge_que.front().tri;
+			std::pop_heap( merge_que.begin(),merge_que.end(),mergeLess );
+			merge_que.pop_back();
+			merge( t );
+			continue;
+		}
+
+		if( !split_que.size() ) break;
+		float pri=split_que.front().pri;
+
+		if( leaf_cnt+2>detail ){
+			if( !merge_que.size() || merge_que.front().pri>=pri ) break;
+			t=merge_que.front().tri;
+			std::pop_heap( merge_que.begin(),merge_que.end(),mergeLess );
+			merge_que.pop_back();
+			merge( t );
+			continue;
+		}
+
+		t=split_que.front().tri;
+		std::pop_heap( split_que.begin(),split_que.end(),splitLess );
+		split_que.pop_back();
+		split( t );
+	}
+
+	out_tris.clear();
+	output( roots[0],0x3f );
+	output( roots[1],0x3f );
+}
+
+void TerrainRep::render( Model *model ){
+
+	if( mode==LOD_CHUNKED ){
+		renderChunks( model );
+		return;
+	}
+
+	if( !mesh || !out_tris.size() ) return;
+
+	int vert_cnt=verts.size(),tri_cnt=out_tris.size();
+
+	if( vert_cnt>mesh_verts || tri_cnt>mesh_tris ){
+		int vc=vert_cnt+32;if( vc>mesh_verts ) mesh_verts=vc;
+		int tc=tri_cnt+32;if( tc>mesh_tris ) mesh_tris=tc;
+		if( mesh ) gx_graphics->freeMesh( mesh );
+		mesh=gx_graphics->createMesh( mesh_verts,mesh_tris,0 );
+	}
+
+	int k;
+	mesh->lock( true );
+	int tc=0,vc=0;
+	if( !shading ){
+		for( k=0;k<vert_cnt;++k ){
+			const Vert &t=verts[k];
+			const Vector &v=t.v;
+			float tex_coords[2][2]={ {v.x,cell_size-v.z},{v.x,cell_size-v.z} };
+			mesh->setVertex( vc++,&v.x,&up_normal.x,tex_coords );
+		}
+	}else{
+		for( k=0;k<vert_cnt;++k ){
+			const Vert &t=verts[k];
+			const Vector &v=t.v;
+			float tex_coords[2][2]={ {v.x,cell_size-v.z},{v.x,cell_size-v.z} };
+			Vector normal=getNormal( v.x,v.z );
+			mesh->setVertex( vc++,&v.x,&normal.x,tex_coords );
+		}
+	}
+	for( k=0;k<tri_cnt;++k ){
+		Tri *t=out_tris[k];
+		mesh->setTriangle( tc++,t->v0,t->v2,t->v1 );
+	}
+	mesh->unlock();
+
+	if( vc>max_verts_drawn ) max_verts_drawn=vc;
+	if( tc>max_tris_drawn ) max_tris_drawn=tc;
+	stats3d[1]=max_verts_drawn;
+	stats3d[2]=max_tris_drawn;
+
+	model->enqueue( mesh,0,vc,0,tc );
+}
+
+void TerrainRep::buildChunks(){
+	chunk_shift=cell_shift<CHUNK_SHIFT ? cell_shift : CHUNK_SHIFT;
+	chunk_size=1<<chunk_shift;
+	chunks_across=cell_size>>chunk_shift;
+
+	//vertex grid, plus a skirt below each edge to hide cracks between levels
+	int n=chunk_size+1;
+	int vert_cnt=n*n+n*4,tri_cnt=0;
+	for( int l=0;l<=chunk_shift;++l ){
+		int sq=chunk_size>>l;
+		tri_cnt+=sq*sq*2+sq*8;
+	}
+
+	chunks.resize( chunks_across*chunks_across );
+	for( int k=0;k<chunks.size();++k ){
+		Chunk &c=chunks[k];
+		c.x=(k%chunks_across)<<chunk_shift;
+		c.z=(k/chunks_across)<<chunk_shift;
+		c.mesh=gx_graphics->createMesh( vert_cnt,tri_cnt,0 );
+		c.vert_cnt=vert_cnt;
+		c.lod=0;
+		c.errs_dirty=c.mesh_dirty=true;
+	}
+}
+
+void TerrainRep::freeChunks(){
+	for( int k=0;k<chunks.size();++k ){
+		if( chunks[k].mesh ) gx_graphics->freeMesh( chunks[k].mesh );
+	}
+	chunks.clear();
+	vis_chunks.clear();
+}
+
+//heights at x,z change the chunks around it, and the normals of their neighbours
+void TerrainRep::dirtyChunks( int x,int z ){
+	if( !chunks.size() ) return;
+	for( int cz=z-1;cz<=z+1;++cz ){
+		if( cz<0 || cz>cell_size ) continue;
+		for( int cx=x-1;cx<=x+1;++cx ){
+			if( cx<0 || cx>cell_size ) continue;
+			int i=cx>>chunk_shift,j=cz>>chunk_shift;
+			for( int dj=-1;dj<=0;++dj ){
+				for( int di=-1;di<=0;++di ){
+					int ci=i+di,cj=j+dj;
+					if( ci<0 || cj<0 || ci>=chunks_across || cj>=chunks_across ) continue;
+					//only chunks whose edge is on cx,cz
+					if( di && (cx&(chunk_size-1)) ) continue;
+					if( dj && (cz&(chunk_size-1)) ) continue;
+					Chunk &c=chunks[cj*chunks_across+ci];
+					c.errs_dirty=c.mesh_dirty=true;
+				}
+			}
+		}
+	}
+}
+
+//
+// Max error of each level of c, from the bintree nodes inside it whose legs are 1<<level.
+//
+void TerrainRep::chunkErr( Chunk &c,int id,int leg_shift,int x0,int z0,int x1,int z1,int x2,int z2 ){
+	if( id>=end_tri_id || leg_shift<2 ) return;
+
+	int ax=x0<x1 ? x0 : x1;if( x2<ax ) ax=x2;
+	int bx=x0>x1 ? x0 : x1;if( x2>bx ) bx=x2;
+	int az=z0<z1 ? z0 : z1;if( z2<az ) az=z2;
+	int bz=z0>z1 ? z0 : z1;if( z2>bz ) bz=z2;
+	if( bx<=c.x || ax>=c.x+chunk_size || bz<=c.z || az>=c.z+chunk_size ) return;
+
+	int l=leg_shift/2;
+	if( !(leg_shift&1) && l<=chunk_shift ){
+		unsigned char e=getErr( id ).error;
+		if( e>c.errs[l] ) c.errs[l]=e;
+	}
+
+	int tx=(x1+x2)/2,tz=(z1+z2)/2;
+	chunkErr( c,id*2,leg_shift-1,tx,tz,x2,z2,x0,z0 );
+	chunkErr( c,id*2+1,leg_shift-1,tx,tz,x0,z0,x1,z1 );
+}
+
+void TerrainRep::validateChunk( Chunk &c ){
+	if( !c.errs_dirty ) return;
+
+	int l;
+	for( l=0;l<MAX_LODS;++l ) c.errs[l]=0;
+	chunkErr( c,2,cell_shift*2,cell_size,0,cell_size,cell_size,0,0 );
+	chunkErr( c,3,cell_shift*2,0,cell_size,0,0,cell_size,cell_size );
+
+	//a coarser level is never better than a finer one
+	for( l=1;l<=chunk_shift;++l ){
+		if( c.errs[l-1]>c.errs[l] ) c.errs[l]=c.errs[l-1];
+	}
+
+	float lo=1,hi=0;
+	for( int z=c.z;z<=c.z+chunk_size;++z ){
+		for( int x=c.x;x<=c.x+chunk_size;++x ){
+			float y=getHeight( x,z );
+			if( y<lo ) lo=y;
+			if( y>hi ) hi=y;
+		}
+	}
+	lo-=errorValue( c.errs[chunk_shift] )+1/255.0f;
+	c.box=Box( Vector( c.x,lo,c.z ),Vector( c.x+chunk_size,hi,c.z+chunk_size ) );
+	c.errs_dirty=false;
+}
+
+void TerrainRep::uploadChunk( Chunk &c ){
+	int n=chunk_size+1,skirt=n*n;
+	float drop=errorValue( c.errs[chunk_shift] )+1/255.0f;
+
+	c.mesh->lock( true );
+	int i,j,vc=0;
+	for( j=0;j<n;++j ){
+		for( i=0;i<n;++i ){
+			Vector v( c.x+i,getHeight( c.x+i,c.z+j ),c.z+j );
+			Vector normal=shading ? getNormal( v.x,v.z ) : up_normal;
+			float tex_coords[2][2]={ {v.x,cell_size-v.z},{v.x,cell_size-v.z} };
+			c.mesh->setVertex( vc++,&v.x,&normal.x,tex_coords );
+		}
+	}
+	//skirts along bottom, top, left and right edges
+	for( int e=0;e<4;++e ){
+		for( int k=0;k<n;++k ){
+			int x=e<2 ? k : (e==2 ? 0 : chunk_size);
+			int z=e<2 ? (e==0 ? 0 : chunk_size) : k;
+			Vector v( c.x+x,getHeight( c.x+x,c.z+z )-drop,c.z+z );
+			Vector normal=shading ? getNormal( v.x,v.z ) : up_normal;
+			float tex_coords[2][2]={ {v.x,cell_size-v.z},{v.x,cell_size-v.z} };
+			c.mesh->setVertex( vc++,&v.x,&normal.x,tex_coords );
+		}
+	}
+
+	//same winding as ROAM triangles, diagonals alternating as in the bintree
+	int tc=0;
+	for( int l=0;l<=chunk_shift;++l ){
+		int s=1<<l,sq=chunk_size>>l;
+		c.first_tri[l]=tc;
+		for( j=0;j<sq;++j ){
+			for( i=0;i<sq;++i ){
+				int a=j*s*n+i*s,b=a+s,d=a+s*n,cc=d+s;
+				if( ( (c.x>>l)+(c.z>>l)+i+j )&1 ){
+					c.mesh->setTriangle( tc++,a,d,b );
+					c.mesh->setTriangle( tc++,b,d,cc );
+				}else{
+					c.mesh->setTriangle( tc++,a,cc,b );
+					c.mesh->setTriangle( tc++,a,d,cc );
+				}
+			}
+		}
+		for( int e=0;e<4;++e ){
+			//bottom and right edges run forwards, top and left backwards, so skirts face out
+			bool rev=e==1 || e==2;
+			for( int k=0;k<chunk_size;k+=s ){
+				int k0=rev ? k+s : k,k1=rev ? k : k+s;
+				int t0,t1;
+				if( e<2 ){
+					int row=e==0 ? 0 : chunk_size*n;
+					t0=row+k0;t1=row+k1;
+				}else{
+					int col=e==2 ? 0 : chunk_size;
+					t0=k0*n+col;t1=k1*n+col;
+				}
+				int s0=skirt+e*n+k0,s1=skirt+e*n+k1;
+				c.mesh->setTriangle( tc++,t0,t1,s0 );
+				c.mesh->setTriangle( tc++,t1,s1,s0 );
+			}
+		}
+		c.tri_cnt[l]=tc-c.first_tri[l];
+	}
+	c.mesh->unlock();
+	c.mesh_dirty=false;
+}
+
+//
+// Pick a level for each visible chunk - the coarsest whose error projects to less than
+// 4/detail of half the view height, so the default detail of 2000 is about a pixel at 768 lines.
+//
+void TerrainRep::refineChunks(){
+	if( !chunks.size() ) buildChunks();
+
+	Vector tl=frustum.getVertex( Frustum::VERT_TLNEAR ),bl=frustum.getVertex( Frustum::VERT_BLNEAR );
+	Vector br=frustum.getVertex( Frustum::VERT_BRNEAR );
+	float half_h=tl.distance( bl )/2;
+	float proj=half_h>EPSILON ? eye_vec.distance( (tl+br)/2 )/half_h : 1;
+	float tol=detail>0 ? 4.0f/detail : 1;
+
+	vis_chunks.clear();
+	for( int k=0;k<chunks.size();++k ){
+		Chunk &c=chunks[k];
+		validateChunk( c );
+		if( !frustum.cull( c.box ) ) continue;
+
+		//distance from eye to box
+		Vector d;
+		for( int n=0;n<3;++n ){
+			float t=eye_vec[n];
+			d[n]=t<c.box.a[n] ? c.box.a[n]-t : ( t>c.box.b[n] ? t-c.box.b[n] : 0 );
+		}
+		float dist=d.length();
+		if( dist<EPSILON ) dist=EPSILON;
+
+		int l=chunk_shift;
+		while( l>0 && errorValue( c.errs[l] )*proj/dist>tol ) --l;
+		c.lod=l;
+		vis_chunks.push_back( &c );
+	}
+}
+
+void TerrainRep::renderChunks( Model *model ){
+	int vc=0,tc=0;
+	for( int k=0;k<vis_chunks.size();++k ){
+		Chunk &c=*vis_chunks[k];
+		if( !c.mesh ) continue;
+		if( c.mesh_dirty || c.mesh->dirty() ) uploadChunk( c );
+		model->enqueue( c.mesh,0,c.vert_cnt,c.first_tri[c.lod],c.tri_cnt[c.lod] );
+		vc+=c.vert_cnt;
+		tc+=c.tri_cnt[c.lod];
+	}
+	if( vc>max_verts_drawn ) max_verts_drawn=vc;
+	if( tc>max_tris_drawn ) max_tris_drawn=tc;
+	stats3d[1]=max_verts_drawn;
+	stats3d[2]=max_tris_drawn;
 }
 
 TerrainRep::Error TerrainRep::calcErr( int id,const Vert &v0,const Vert &v1,const Vert &v2 )const{
@@ -337,14 +860,14 @@ TerrainRep::Error TerrainRep::calcErr( int id,const Vert &v0,const Vert &v1,cons
 	if( v1.v.y>y ) y=v1.v.y;
 	if( v2.v.y>y ) y=v2.v.y;
 
-	et.error = 0;
-	et.bound = y>=1 ? 255 : ceil(y*255.0f);
+	et.error=0;
+	et.bound=quantiseBound( y );
 
 	if( id>=end_tri_id ) return et;
 
 	Vert tv( (v1.x+v2.x)/2,(v1.z+v2.z)/2 );
 	float e=fabs(tv.v.y-(v1.v.y+v2.v.y)/2);
-	et.error= e>=1 ? 255 : ceil( (e-EPSILON)*255.0f );
+	et.error=quantiseError( e );
 
 	Error el=calcErr( id*2,tv,v2,v0 );
 	Error er=calcErr( id*2+1,tv,v0,v1 );
@@ -355,7 +878,8 @@ TerrainRep::Error TerrainRep::calcErr( int id,const Vert &v0,const Vert &v1,cons
 	if( el.bound>et.bound ) et.bound=el.bound;
 	if( er.bound>et.bound ) et.bound=er.bound;
 
-	return errors[id]=et;
+	setErr( id,et );
+	return et;
 }
 
 TerrainRep::Error TerrainRep::calcErr( int id,int x,int z,const Vert &v0,const Vert &v1,const Vert &v2 )const{
@@ -366,23 +890,23 @@ TerrainRep::Error TerrainRep::calcErr( int id,int x,int z,const Vert &v0,const V
 	if( v1.v.y>y ) y=v1.v.y;
 	if( v2.v.y>y ) y=v2.v.y;
 
-	et.error = 0;
-	et.bound = y>=1 ? 255 : ceil(y*255.0f);
+	et.error=0;
+	et.bound=quantiseBound( y );
 
 	if( id>=end_tri_id ) return et;
 
 	//is x/z inside this triangle?
 	int dx,dz;
 	dx=-(v1.z-v0.z);dz=(v1.x-v0.x);
-	if( (x-v0.x)*dx+(z-v0.z)*dz<0 ) return errors[id];
+	if( (x-v0.x)*dx+(z-v0.z)*dz<0 ) return getErr( id,true );
 	dx=-(v2.z-v1.z);dz=(v2.x-v1.x);
-	if( (x-v1.x)*dx+(z-v1.z)*dz<0 ) return errors[id];
+	if( (x-v1.x)*dx+(z-v1.z)*dz<0 ) return getErr( id,true );
 	dx=-(v0.z-v2.z);dz=(v0.x-v2.x);
-	if( (x-v2.x)*dx+(z-v2.z)*dz<0 ) return errors[id];
+	if( (x-v2.x)*dx+(z-v2.z)*dz<0 ) return getErr( id,true );
 
 	Vert tv( (v1.x+v2.x)/2,(v1.z+v2.z)/2 );
 	float e=fabs(tv.v.y-(v1.v.y+v2.v.y)/2);
-	et.error= e>=1 ? 255 : ceil( (e-EPSILON)*255.0f );
+	et.error=quantiseError( e );
 
 	Error el=calcErr( id*2,x,z,tv,v2,v0 );
 	Error er=calcErr( id*2+1,x,z,tv,v0,v1 );
@@ -393,7 +917,8 @@ TerrainRep::Error TerrainRep::calcErr( int id,int x,int z,const Vert &v0,const V
 	if( el.bound>et.bound ) et.bound=el.bound;
 	if( er.bound>et.bound ) et.bound=er.bound;
 
-	return errors[id]=et;
+	setErr( id,et );
+	return et;
 }
 
 void TerrainRep::validateErrs()const{
@@ -404,125 +929,20 @@ void TerrainRep::validateErrs()const{
 	errs_valid=true;
 }
 
-void TerrainRep::render( Model *model,const RenderContext &rc ){
-
-	curr=this;
-	validateErrs();
-
-	new( &frustum ) Frustum( rc.getWorldFrustum(),-model->getRenderTform() );
-	eye_plane=frustum.getPlane( Frustum::PLANE_NEAR );
-	eye_vec=frustum.getVertex( Frustum::VERT_EYE );
-
-	vert_cnt=4;next_vert=verts;
-	out_cnt=proc_cnt=clip_cnt=0;
-	tri_que.getVector().clear();
-	tris.clear();
-
-	new(next_vert++) Vert(0,0);
-	new(next_vert++) Vert(cell_size,0);
-	new(next_vert++) Vert(cell_size,cell_size);
-	new(next_vert++) Vert(0,cell_size);
-
-	Tri *t0=new Tri( 2,0x3f,1,2,0 );
-	Tri *t1=new Tri( 3,0x3f,3,0,2 );
-	t0->e2=t1;t1->e2=t0;
-
-	insert( t0 );
-	insert( t1 );
-
-	while( tri_que.size() && out_cnt<detail ){
-
-		Tri *t=tri_que.top();
-		tri_que.pop();
-		if( t->id ) split( t );
-		delete t;
-	}
-
-	int k;
-	const vector<Tri*> &q_tris=tri_que.getVector();
-
-	if( !mesh ) out_cnt=0;
-
-	if( !out_cnt ){
-		for( k=0;k<tris.size();++k ) delete tris[k];
-		for( k=0;k<q_tris.size();++k ) delete q_tris[k];
-		return;
-	}
-
-	int err_cnt=0;
-	for( k=0;k<q_tris.size();++k ){
-		Tri *t=q_tris[k];
-		if( t->id ){ tris.push_back( t );++err_cnt; }
-		else delete t;
-	}
-
-	if( morph ){
-		if( int morph_cnt=err_cnt/4 ){
-			if( morph_cnt>vert_cnt ) morph_cnt=vert_cnt;
-			float t=0,morph_step=1.0f/morph_cnt;
-			for( int vn=vert_cnt-morph_cnt;vn<vert_cnt;++vn ){
-				verts[vn].v.y+=(verts[vn].src_y-verts[vn].v.y)*t;
-				t+=morph_step;
-			}
-		}
-	}
-
-	int tri_cnt=tris.size();
-
-	if( vert_cnt>mesh_verts || tri_cnt>mesh_tris ){
-		int vc=vert_cnt+32;if( vc>mesh_verts ) mesh_verts=vc;
-		int tc=tri_cnt+32;if( tc>mesh_tris ) mesh_tris=tc;
-		if( mesh ) gx_graphics->freeMesh( mesh );
-		mesh=gx_graphics->createMesh( mesh_verts,mesh_tris,0 );
-	}
-
-	mesh->lock( true );
-	int tc=0,vc=0;
-	if( !shading ){
-		for( k=0;k<vert_cnt;++k ){
-			const Vert &t=verts[k];
-			const Vector &v=t.v;
-			float tex_coords[2][2]={ {v.x,cell_size-v.z},{v.x,cell_size-v.z} };
-			mesh->setVertex( vc++,&v.x,&up_normal.x,tex_coords );
-		}
-	}else{
-		for( k=0;k<vert_cnt;++k ){
-			const Vert &t=verts[k];
-			const Vector &v=t.v;
-			float tex_coords[2][2]={ {v.x,cell_size-v.z},{v.x,cell_size-v.z} };
-			Vector normal=getNormal( v.x,v.z );
-			mesh->setVertex( vc++,&v.x,&normal.x,tex_coords );
-		}
-	}
-	for( k=0;k<tri_cnt;++k ){
-		Tri *t=tris[k];
-		if( t->id ) mesh->setTriangle( tc++,t->v0,t->v2,t->v1 );
-		delete t;
-	}
-	mesh->unlock();
-
-	static int mvc,mtc;
-	if( vc>mvc ) mvc=vc;
-	if( tc>mtc ) mtc=tc;
-	stats3d[1]=mvc;
-	stats3d[2]=mtc;
-
-	model->enqueue( mesh,0,vc,0,tc );
-}
-
 bool TerrainRep::collide( const Line &line,Collision *curr_coll,const Transform &tform,int id,const Vert &v0,const Vert &v1,const Vert &v2,const Line &l )const{
 	Box b( v0.v );
 	b.update( v1.v );
 	b.update( v2.v );
 
-	if( id>=end_tri_id || !errors[id].error ){
+	Error err=id<end_tri_id ? getErr( id,true ) : Error();
+	if( id>=end_tri_id || !err.error ){
 		return ::clip( l,b ) ? 
 		curr_coll->triangleCollide( line,0,tform*v0.v,tform*v2.v,tform*v1.v )
 		: false;
 	}
 
 	b.a.y=0;
-	b.b.y=errors[id].bound/255.0f;
+	b.b.y=err.bound/255.0f;
 	if( !::clip( l,b ) ) return false;
 
 	Vert tv( (v1.x+v2.x)/2,(v1.z+v2.z)/2 );
@@ -537,7 +957,8 @@ bool TerrainRep::collide( const Line &line,float radius,Collision *curr_coll,con
 	b.update( v1.v );
 	b.update( v2.v );
 
-	if( id>=end_tri_id || !errors[id].error ){
+	Error err=id<end_tri_id ? getErr( id,true ) : Error();
+	if( id>=end_tri_id || !err.error ){
 		if( v0.v==v1.v || v0.v==v2.v || v1.v==v2.v ){
 			gx_runtime->debugLog( "OUCH!" );
 		}
@@ -547,7 +968,7 @@ bool TerrainRep::collide( const Line &line,float radius,Collision *curr_coll,con
 	}
 
 	b.a.y=0;
-	b.b.y=errors[id].bound/255.0f;
+	b.b.y=err.bound/255.0f;
 	if( !b.overlaps( box ) ) return false;
 
 	Vert tv( (v1.x+v2.x)/2,(v1.z+v2.z)/2 );
@@ -556,6 +977,11 @@ bool TerrainRep::collide( const Line &line,float radius,Collision *curr_coll,con
 	collide( line,radius,curr_coll,tform,id*2+1,tv,v0,v1,box );
 }
 
+void TerrainRep::validateCollider()const{
+	curr=this;
+	validateErrs();
+}
+
 bool TerrainRep::collide( const Line &line,float radius,Collision *curr_coll,const Transform &tform )const{
 
 	curr=this;
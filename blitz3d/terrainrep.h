@@ -2,48 +2,138 @@
 #ifndef TERRAINREP_H
 #define TERRAINREP_H
 
-#include <queue>
-
 #include "model.h"
 
+class TerrainPager;
+
 struct TerrainRep{
 public:
-	TerrainRep( int cell_shift );
+	enum{
+		LOD_ROAM=0,LOD_CHUNKED=1
+	};
+
+	//heights are read from pager if it's non-null - the rep takes ownership
+	TerrainRep( int cell_shift,TerrainPager *pager=0 );
 	~TerrainRep();
-	
+
 	void clear();
 	void setShading( bool shading );
 	void setDetail( int n,bool morph );
 	void setHeight( int x,int z,float h,bool realtime );
 	void setTile( int x,int z,const Brush &brush );
-	void render( Model *model,const RenderContext &rc );
+	void setMode( int mode );
 
+	//update tessellation for rc - only touches this rep, so reps can be refined in parallel
+	void refine( Model *model,const RenderContext &rc );
+	//upload and enqueue the last refined tessellation
+	void render( Model *model );
+
+	int getMode()const{ return mode; }
 	int getSize()const;
 	float getHeight( int x,int z )const;
 	bool collide( const Line &line,float radius,Collision *curr_coll,const Transform &tform )const;
+	void validateCollider()const;
 
 	struct Tri;
 	struct Vert;
 
+	//queued split or merge, stale if the triangle has changed since
+	struct QueItem{
+		float pri;
+		Tri *tri;
+		unsigned gen;
+	};
+
+	//
+	// Max height error of a bintree node's subtree, and max height inside it.
+	//
+	// Errors are log scaled, so small errors in 16 bit heights keep their precision
+	// in a byte. Both round up, so they're never less than the real values.
+	//
+	struct Error{
+		unsigned char error,bound;
+	};
+	static unsigned char quantiseError( float e );
+	static unsigned char quantiseBound( float y );
+	static float errorValue( unsigned char q );
+
 private:
 	struct Cell;
-	struct Error;
 
 	friend struct Tri;
 	friend struct Vert;
 
 	Cell *cells;
 	Error *errors;
+	TerrainPager *pager;
 	gxMesh *mesh;
 
 	int cell_size,cell_shift,cell_mask;
 	int end_tri_id,detail,mesh_verts,mesh_tris;
-	bool morph,shading;
+	bool morph,shading,heights_changed;
 	mutable bool errs_valid;
 
-	void insert( Tri *t );
+	//tessellation, kept from frame to frame
+	Tri *roots[2];
+	vector<Vert> verts;
+	vector<int> free_verts;
+	vector<Tri*> tri_blocks;
+	Tri *free_tris;
+	int leaf_cnt;
+
+	//refinement state
+	Frustum frustum;
+	Vector eye_vec;
+	vector<QueItem> split_que,merge_que;
+	vector<Tri*> out_tris;
+
+	//
+	// Chunked mode - the terrain is cut into fixed size chunks, each with its own mesh
+	// holding the chunk's vertices and the triangles for every LOD level.
+	//
+	enum{ MAX_LODS=8 };
+
+	struct Chunk{
+		int x,z;
+		Box box;
+		gxMesh *mesh;
+		bool errs_dirty,mesh_dirty;
+		//max error of each level, and the triangles to draw it
+		unsigned char errs[MAX_LODS];
+		int first_tri[MAX_LODS],tri_cnt[MAX_LODS];
+		int vert_cnt,lod;
+	};
+
+	int mode,chunk_shift,chunk_size,chunks_across;
+	vector<Chunk> chunks;
+	vector<Chunk*> vis_chunks;
+
+	void buildChunks();
+	void freeChunks();
+	void dirtyChunks( int x,int z );
+	void validateChunk( Chunk &c );
+	void chunkErr( Chunk &c,int id,int leg_shift,int x0,int z0,int x1,int z1,int x2,int z2 );
+	void uploadChunk( Chunk &c );
+	void refineChunks();
+	void renderChunks( Model *model );
+
+	Tri *allocTri( int id,Tri *parent,int v0,int v1,int v2 );
+	void freeTri( Tri *t );
+	int allocVert( int v1,int v2 );
+	void freeVert( int n );
+
+	int clipTri( const Tri *t,int clip )const;
+	float priority( const Tri *t )const;
+	bool mergeable( const Tri *t )const;
+	void queueSplit( Tri *t );
+	void queueMerge( Tri *t );
+	void gather( Tri *t,int clip );
+	void output( Tri *t,int clip );
 	void split( Tri *t );
+	void merge( Tri *t );
 
+	Error getErr( int id,bool load=false )const;
+	void setErr( int id,const Error &e )const;
 	void validateErrs()const;
 	Vector getNormal( int x,int z )const;
 	Error calcErr( int id,const Vert &v0,const Vert &v1,const Vert &v2 )const;
@@ -52,4 +142,4 @@ private:
 	bool collide( const Line &line,float radius,Collision *curr_coll,const Transform &tform,int id,const Vert &v0,const Vert &v1,const Vert &v2,const Box &box )const;
 };
 
-#endif
\ No newline at end of file
+#endif
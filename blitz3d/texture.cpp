@@ -166,6 +166,14 @@ int Texture::getFlags()const{
 	return rep ? rep->tex_flags : 0;
 }
 
+bool Texture::getTransform( float *u_scale,float *v_scale,float *u_pos,float *v_pos,float *rot )const{
+	if( !rep || !rep->mat_used ) return false;
+	*u_scale=rep->sx;*v_scale=rep->sy;
+	*u_pos=rep->tx;*v_pos=rep->ty;
+	*rot=rep->rot;
+	return true;
+}
+
 const gxScene::Matrix *Texture::getMatrix()const{
 	if( !rep || !rep->mat_used ) return 0;
 	if( !rep->mat_valid ){
@@ -30,6 +30,8 @@ public:
 	const gxScene::Matrix *getMatrix()const;
 	int getBlend()const;
 	int getFlags()const;
+	//returns false if the texture has never been scaled, rotated or positioned
+	bool getTransform( float *u_scale,float *v_scale,float *u_pos,float *v_pos,float *rot )const;
 	CachedTexture *getCachedTexture()const;
 
 	bool isTransparent()const;
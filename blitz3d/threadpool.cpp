@@ -0,0 +1,91 @@
+
+#include "std.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+static vector<std::thread> workers;
+
+static std::mutex job_mutex;
+static std::condition_variable start_cv,done_cv;
+
+static const std::function<void(int)> *job;
+static int job_count,job_id,busy;
+static bool quit;
+static std::atomic<int> next_index;
+
+static thread_local bool in_job;
+
+static void work( const std::function<void(int)> &func,int count ){
+	in_job=true;
+	for(;;){
+		int k=next_index++;
+		if( k>=count ) break;
+		func( k );
+	}
+	in_job=false;
+}
+
+static void workerProc( int last_id ){
+	std::unique_lock<std::mutex> lock( job_mutex );
+	for(;;){
+		start_cv.wait( lock,[&]{ return quit || job_id!=last_id; } );
+		if( quit ) return;
+		last_id=job_id;
+		const std::function<void(int)> &func=*job;
+		int count=job_count;
+		lock.unlock();
+		work( func,count );
+		lock.lock();
+		if( !--busy ) done_cv.notify_one();
+	}
+}
+
+void ThreadPool::setThreads( int n ){
+	if( n<1 ) n=1;
+	if( n==workers.size()+1 ) return;
+
+	if( workers.size() ){
+		{
+			std::lock_guard<std::mutex> lock( job_mutex );
+			quit=true;
+		}
+		start_cv.notify_all();
+		for( int k=0;k<workers.size();++k ) workers[k].join();
+		workers.clear();
+		quit=false;
+	}
+
+	for( int k=1;k<n;++k ) workers.push_back( std::thread( workerProc,job_id ) );
+}
+
+int ThreadPool::threads(){
+	return workers.size()+1;
+}
+
+void ThreadPool::run( int count,const std::function<void(int)> &func ){
+
+	if( !workers.size() || count<2 || in_job ){
+		for( int k=0;k<count;++k ) func( k );
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( job_mutex );
+		job=&func;
+		job_count=count;
+		busy=workers.size();
+		next_index=0;
+		++job_id;
+	}
+	start_cv.notify_all();
+
+	work( func,count );
+
+	std::unique_lock<std::mutex> lock( job_mutex );
+	done_cv.wait( lock,[]{ return !busy; } );
+	job=0;
+}
@@ -0,0 +1,22 @@
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <functional>
+
+//
+// Pool of worker threads for running data parallel jobs.
+//
+// With 0 or 1 threads, or when called from inside a job, run() just calls func serially.
+//
+class ThreadPool{
+public:
+	//set number of threads, including the calling thread
+	static void setThreads( int n );
+	static int threads();
+
+	//call func( k ) for k=0...count-1 and wait for all calls to complete
+	static void run( int count,const std::function<void(int)> &func );
+};
+
+#endif
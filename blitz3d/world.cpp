@@ -1,35 +1,43 @@
 
 #include "std.h"
 #include <queue>
+#include <chrono>
+#include <algorithm>
 #include "world.h"
+#include "meshcollider.h"
+#include "threadpool.h"
+#include "surface.h"
+#include "meshmodel.h"
+#include "sprite.h"
+#include "terrain.h"
 
 //0=tris compared for collision
 //1=max proj err of terrain
-float stats3d[10];
+//3=objects tested for collision
+//4=hierarchy walks avoided by cached entity lists
+//5,6,7=animation collect, evaluate and commit msecs
+//8=mesh copies drawn as instances
+//9,10=BSP traversal and submission msecs
+//11=BSP draw calls
+float stats3d[32];
 
 extern gxScene *gx_scene;
 extern gxRuntime *gx_runtime;
 
-static vector<Object*> _enabled,_visible;
-
-static void enumEnabled(){
-	_enabled.clear();
-	for( Entity *e=Entity::orphans();e;e=e->successor() ){
-		e->enumEnabled( _enabled );
-	}
+static const vector<Object*> &enumEnabled(){
+	const vector<Object*> &t=Entity::enabledObjects();
+	stats3d[4]=Entity::walksAvoided();
+	return t;
 }
 
-static void enumVisible(){
-	_visible.clear();
-	for( Entity *e=Entity::orphans();e;e=e->successor() ){
-		e->enumVisible( _visible );
-	}
+static const vector<Object*> &enumVisible(){
+	const vector<Object*> &t=Entity::visibleObjects();
+	stats3d[4]=Entity::walksAvoided();
+	return t;
 }
 
 /******************************* Update *******************************/
 
-static vector<Object*> _objsByType[1000];
-
 static vector<ObjCollision*> free_colls,used_colls;
 
 static ObjCollision *allocObjColl( Object *with,const Vector &coords,const Collision &coll ){
@@ -61,6 +69,42 @@ static void collided( Object *src,Object *dest,const Line &line,const Collision
 	dest->addCollision( c );
 }
 
+//bounding radius of sphere and box geometry
+static float geomRadius( Object *o ){
+	float r=o->getCollisionRadii().x;
+	const Box &coll_box=o->getCollisionBox();
+	for( int k=0;k<8;++k ){
+		float t=coll_box.corner(k).length();
+		if( t>r ) r=t;
+	}
+	return r;
+}
+
+//bounds of all collision geometry
+static Box geomBox( Object *o,const Transform &tf,float r ){
+	Box box( tf.v );
+	box.expand( r );
+
+	//polygon geometry
+	Box b=o->getCollisionBounds();
+	if( !b.empty() ) box.update( b.width()>=INFINITY ? b : tf*b );
+
+	return box;
+}
+
+World::World():
+_pickHierarchy(-1),_pickModes(-1),_pickTforms(-1),_pickGeoms(-1){
+	for( int k=0;k<1000;++k ){
+		_collGroups[k]=0;
+	}
+}
+
+World::~World(){
+	for( int k=0;k<1000;++k ){
+		delete _collGroups[k];
+	}
+}
+
 void World::clearCollisions(){
 	for( int k=0;k<1000;++k ){
 		_collInfo[k].clear();
@@ -96,71 +140,169 @@ bool World::hitTest( const Line &line,float radius,Object *obj,const Transform &
 	return false;
 }
 
-bool World::checkLOS( Object *src,Object *dest ){
+void World::validatePicks(){
+
+	Entity::flushTransforms();
+
+	int hierarchy=Entity::hierarchyChanges(),modes=Object::pickChanges();
+	int tforms=Entity::tformChanges(),geoms=Surface::geomChanges();
+
+	if( hierarchy==_pickHierarchy && modes==_pickModes && tforms==_pickTforms && geoms==_pickGeoms ) return;
+
+	if( hierarchy!=_pickHierarchy || modes!=_pickModes ){
+		const vector<Object*> &enabled=enumEnabled();
+		_pickables.clear();
+		for( int k=0;k<enabled.size();++k ){
+			Object *o=enabled[k];
+			if( o->getPickGeometry() ) _pickables.push_back( o );
+		}
+	}
+
+	if( hierarchy!=_pickHierarchy || modes!=_pickModes || geoms!=_pickGeoms ){
+		//surfaces don't say which meshes they're in, so geometry changes refit everything
+		_pickTree.begin();
+		for( int k=0;k<_pickables.size();++k ){
+			Object *o=_pickables[k];
+			_pickTree.update( o,geomBox( o,o->getWorldTform(),geomRadius( o ) ),k );
+		}
+		_pickTree.end();
+	}else{
+		//only pickables that have moved since the last refit
+		const vector<Entity*> &moved=Entity::movedEntities();
+		for( int k=0;k<moved.size();++k ){
+			Object *o=moved[k] ? moved[k]->getObject() : 0;
+			if( o && o->getPickGeometry() ) _pickTree.refit( o,geomBox( o,o->getWorldTform(),geomRadius( o ) ) );
+		}
+	}
+	Entity::clearMoved();
+
+	_pickHierarchy=hierarchy;
+	_pickModes=modes;
+	_pickTforms=tforms;
+	_pickGeoms=geoms;
+}
+
+//
+// Doesn't modify anything, so may be used by worker threads after validatePicks.
+//
+Object *World::pick( const Line &line,float radius,Collision *curr_coll ){
 
-	enumEnabled();
+	static thread_local vector<Object*> candidates;
+
+	_pickTree.queryRay( line,radius,candidates );
 
 	Object *coll_obj=0;
+
+	vector<Object*>::const_iterator it;
+	for( it=candidates.begin();it!=candidates.end();++it ){
+		Object *obj=*it;
+
+		if( hitTest( line,radius,obj,obj->getWorldTform(),obj->getPickGeometry(),curr_coll ) ){
+			coll_obj=obj;
+		}
+	}
+	return coll_obj;
+}
+
+bool World::checkLOS( Object *src,Object *dest ){
+
+	static vector<Object*> candidates;
+
+	validatePicks();
+
 	Collision curr_coll;
 
 	Line line( src->getWorldPosition(),dest->getWorldPosition()-src->getWorldPosition() );
 
+	_pickTree.queryRay( line,0,candidates );
+
 	vector<Object*>::const_iterator it;
 
-	for( it=_enabled.begin();it!=_enabled.end();++it ){
+	for( it=candidates.begin();it!=candidates.end();++it ){
 		Object *obj=*it;
 
-		if( obj==src || obj==dest || !obj->getPickGeometry() || !obj->getObscurer() ) continue;
+		if( obj==src || obj==dest || !obj->getObscurer() ) continue;
 
 		if( hitTest( line,0,obj,obj->getWorldTform(),obj->getPickGeometry(),&curr_coll ) ){
+			stats3d[0]+=MeshCollider::trisTested();
 			return false;
 		}
 	}
+	stats3d[0]+=MeshCollider::trisTested();
 	return true;
 }
 
 Object *World::traceRay( const Line &line,float radius,ObjCollision *curr_coll ){
 
-	enumEnabled();
+	validatePicks();
 
-	Object *coll_obj=0;
+	Object *coll_obj=pick( line,radius,&curr_coll->collision );
 
-	vector<Object*>::const_iterator it;
-	for( it=_enabled.begin();it!=_enabled.end();++it ){
-		Object *obj=*it;
-
-		if( !obj->getPickGeometry() ) continue;
-
-		if( hitTest( line,radius,obj,obj->getWorldTform(),obj->getPickGeometry(),&curr_coll->collision ) ){
-			coll_obj=obj;
-		}
-	}
 	if( curr_coll->with=coll_obj ){
 		curr_coll->coords=line*curr_coll->collision.time-curr_coll->collision.normal*radius;
 	}
+	stats3d[0]+=MeshCollider::trisTested();
 	return coll_obj;
 }
 
+int World::traceRays( const Line *lines,int count,float radius,ObjCollision *results ){
+
+	validatePicks();
+
+	for( int k=0;k<_pickables.size();++k ){
+		Object *o=_pickables[k];
+		if( o->getPickGeometry()==COLLISION_METHOD_POLYGON ) o->validateCollider();
+	}
+
+	ThreadPool::run( count,[&]( int k ){
+		const Line &line=lines[k];
+		ObjCollision &c=results[k];
+		c.collision=Collision();
+		if( c.with=pick( line,radius,&c.collision ) ){
+			c.coords=line*c.collision.time-c.collision.normal*radius;
+		}
+	} );
+
+	int hits=0;
+	for( int k=0;k<count;++k ){
+		if( results[k].with ) ++hits;
+	}
+	stats3d[0]+=MeshCollider::trisTested();
+	return hits;
+}
+
 //
 // NEW VERSION
 //
-void World::collide( Object *src ){
+// Doesn't modify any objects, so may be run by worker threads - results are applied by commitCollisions.
+//
+void World::collide( CollResult &res ){
 
 	static const int MAX_HITS=10;
 
-	Vector dv=src->getWorldTform().v;
+	static thread_local vector<Object*> candidates;
+
+	Object *src=res.src;
+
+	res.hits.clear();
+	res.inv_y_scale=1;
+	res.moved=false;
+	res.tested=0;
+
+	Vector dv=res.dest;
 	Vector sv=src->getPrevWorldTform().v;
 
 	if( sv==dv ){
 		if( dv.x!=sv.x || dv.y!=sv.y || dv.z!=sv.z ){
-			src->setWorldPosition( sv );
+			res.moved=true;
+			res.pos=sv;
 		}
 		return;
 	}
 
 	Vector panic=sv;
 
-	static Transform y_tform;
+	Transform y_tform;
 
 	const Vector &radii=src->getCollisionRadii();
 
@@ -173,6 +315,7 @@ void World::collide( Object *src ){
 		sv.y*=y_scale;
 		dv.y*=y_scale;
 	}
+	res.inv_y_scale=inv_y_scale;
 
 	int n_hit=0;
 	Plane planes[2];
@@ -191,18 +334,37 @@ void World::collide( Object *src ){
 		Object *coll_obj=0;
 		vector<CollInfo>::const_iterator coll_it,coll_info;
 
+		//unscaled bounds of collision line
+		Line world_line( coll_line );
+		world_line.o.y*=inv_y_scale;
+		world_line.d.y*=inv_y_scale;
+		Box line_box( world_line );
+
 		for( coll_it=collinfos.begin();coll_it!=collinfos.end();++coll_it ){
 
+			CollGroup *group=_collGroups[coll_it->dst_type];
+			if( !group ) continue;
+
+			//y scaling doesn't stretch sphere/box geometry, so allow for it
+			float x_exp=radius+COLLISION_EPSILON,y_exp=radius*inv_y_scale+COLLISION_EPSILON;
+			if( inv_y_scale>1 ) y_exp+=group->max_radius*(inv_y_scale-1);
+
+			Box box( line_box );
+			box.a.x-=x_exp;box.a.y-=y_exp;box.a.z-=x_exp;
+			box.b.x+=x_exp;box.b.y+=y_exp;box.b.z+=x_exp;
+
+			group->objs.query( box,candidates );
+
 			vector<Object*>::const_iterator dst_it;
-			
-			const vector<Object*> &dst_objs=_objsByType[coll_it->dst_type];
 
-			for( dst_it=dst_objs.begin();dst_it!=dst_objs.end();++dst_it ){
+			for( dst_it=candidates.begin();dst_it!=candidates.end();++dst_it ){
 
 				Object *dst=*dst_it;
 
 				if( src==dst ) continue;
 
+				++res.tested;
+
 				const Transform &dst_tform=dst->getPrevWorldTform();
 
 				if( y_scale==1 ){
@@ -230,7 +392,8 @@ void World::collide( Object *src ){
 			break;
 		}
 
-		collided( src,coll_obj,coll_line,coll,inv_y_scale );
+		CollHit hit={ coll_obj,coll_line,coll };
+		res.hits.push_back( hit );
 
 		Plane coll_plane( coll_line*coll.time,coll.normal );
 
@@ -291,15 +454,28 @@ void World::collide( Object *src ){
 	}
 
 	if( hits ){
+		res.moved=true;
 		if( hits<MAX_HITS ){
 			dv.y*=inv_y_scale;
-			src->setWorldPosition( dv );
+			res.pos=dv;
 		}else{
-			src->setWorldPosition( panic );
+			res.pos=panic;
 		}
 	}
 }
 
+void World::commitCollisions( const CollResult &res ){
+
+	stats3d[3]+=res.tested;
+
+	for( int k=0;k<res.hits.size();++k ){
+		const CollHit &hit=res.hits[k];
+		collided( res.src,hit.with,hit.line,hit.coll,res.inv_y_scale );
+	}
+
+	if( res.moved ) res.src->setWorldPosition( res.pos );
+}
+
 /*
 //
 // OLD VERSION
@@ -463,43 +639,185 @@ void World::collide( Object *src ){
 }
 */
 
+void World::updateBroadphase( Object *o,int order ){
+
+	int type=o->getCollisionType();
+	CollGroup *group=_collGroups[type];
+	if( !group ){
+		group=_collGroups[type]=d_new CollGroup();
+		group->objs.begin();
+	}
+
+	float r=geomRadius( o );
+	if( r>group->max_radius ) group->max_radius=r;
+
+	//collisions are always with previous transform
+	group->objs.update( o,geomBox( o,o->getPrevWorldTform(),r ),order );
+}
+
 void World::update( float elapsed ){
 
+	Entity::flushTransforms();
+
 	stats3d[0]=0;
+	stats3d[3]=0;
 
 	for( ;used_colls.size();used_colls.pop_back() ){
 		free_colls.push_back( used_colls.back() );
 	}
 
-	enumEnabled();
-
-	vector<Object*>::const_iterator it;
-	for( it=_enabled.begin();it!=_enabled.end();++it ){
-		Object *o=*it;
+	const vector<Object*> &enabled=enumEnabled();
 
-		if( int n=o->getCollisionType() ){
-			_objsByType[n].push_back(o);
+	int k;
+	for( k=0;k<1000;++k ){
+		if( CollGroup *group=_collGroups[k] ){
+			group->objs.begin();
+			group->max_radius=0;
 		}
 	}
 
-	for( it=_enabled.begin();it!=_enabled.end();++it ){
-		Object *o=*it;
+	for( k=0;k<enabled.size();++k ){
+		Object *o=enabled[k];
+
+		if( o->getCollisionType() ) updateBroadphase( o,k );
+	}
+
+	for( k=0;k<1000;++k ){
+		if( CollGroup *group=_collGroups[k] ) group->objs.end();
+	}
+
+	animate( enabled,elapsed );
+
+	if( ThreadPool::threads()>1 ){
+		updateThreaded( elapsed );
+		stats3d[0]+=MeshCollider::trisTested();
+		return;
+	}
+
+	if( !_collResults.size() ) _collResults.resize( 1 );
+	CollResult &res=_collResults[0];
+
+	for( k=0;k<enabled.size();++k ){
+		Object *o=enabled[k];
 
 		o->beginUpdate( elapsed );
 
-		if( o->getCollisionType() ) collide( o );
+		if( o->getCollisionType() ){
+			res.src=o;
+			res.dest=o->getWorldTform().v;
+			collide( res );
+			commitCollisions( res );
+			o->endUpdate();
+			updateBroadphase( o,k );
+		}else{
+			o->endUpdate();
+		}
+	}
+	stats3d[0]+=MeshCollider::trisTested();
+}
+
+static float msecs( const std::chrono::high_resolution_clock::time_point &t0,const std::chrono::high_resolution_clock::time_point &t1 ){
+	return std::chrono::duration<float,std::milli>( t1-t0 ).count();
+}
+
+//
+// Evaluate all active animators in parallel, then commit their poses in one sweep.
+// Objects' own beginUpdate() then skips the animator. Phase times in msecs go in stats3d[5...7].
+//
+void World::animate( const vector<Object*> &objs,float elapsed ){
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	Clock::time_point t0=Clock::now();
 
-		o->endUpdate();
+	_animators.clear();
+	for( int k=0;k<objs.size();++k ){
+		Animator *a=objs[k]->getAnimator();
+		if( a && a->animating() ) _animators.push_back( a );
 	}
+	_animPosed.resize( _animators.size() );
 
-	for( int k=0;k<1000;++k ){
-		_objsByType[k].clear();
+	Clock::time_point t1=Clock::now();
+
+	ThreadPool::run( _animators.size(),[this,elapsed]( int k ){
+		_animPosed[k]=_animators[k]->evaluate( elapsed );
+	} );
+
+	Clock::time_point t2=Clock::now();
+
+	for( int k=0;k<_animators.size();++k ){
+		if( _animPosed[k] ) _animators[k]->commit();
+	}
+
+	Clock::time_point t3=Clock::now();
+
+	stats3d[5]=msecs( t0,t1 );
+	stats3d[6]=msecs( t1,t2 );
+	stats3d[7]=msecs( t2,t3 );
+}
+
+//
+// All objects are collided against the transforms they had at the start of the update, so unlike
+// the serial version an object doesn't see where earlier objects have moved to. Results are
+// committed in update order, so they don't depend on how the work was scheduled.
+//
+void World::updateThreaded( float elapsed ){
+
+	const vector<Object*> &enabled=enumEnabled();
+
+	int k,n=0;
+	bool poly_type[1000]={false};
+
+	for( k=0;k<1000;++k ){
+		for( int j=0;j<_collInfo[k].size();++j ){
+			const CollInfo &t=_collInfo[k][j];
+			if( t.method==COLLISION_METHOD_POLYGON ) poly_type[t.dst_type]=true;
+		}
+	}
+
+	for( k=0;k<enabled.size();++k ){
+		enabled[k]->beginUpdate( elapsed );
+	}
+
+	//everything the queries read must be valid before starting the workers
+	for( k=0;k<enabled.size();++k ){
+		Object *o=enabled[k];
+
+		int type=o->getCollisionType();
+		if( !type ) continue;
+
+		if( poly_type[type] ) o->validateCollider();
+
+		if( n==_collResults.size() ) _collResults.push_back( CollResult() );
+		CollResult &res=_collResults[n++];
+		res.src=o;
+		res.dest=o->getWorldTform().v;
+	}
+	Entity::flushTransforms();
+
+	ThreadPool::run( n,[this]( int k ){ collide( _collResults[k] ); } );
+
+	n=0;
+	for( k=0;k<enabled.size();++k ){
+		Object *o=enabled[k];
+
+		//collisions reported by earlier objects are dropped, as they are by beginUpdate in serial mode
+		o->clearCollisions();
+
+		if( o->getCollisionType() ){
+			commitCollisions( _collResults[n++] );
+			o->endUpdate();
+			updateBroadphase( o,k );
+		}else{
+			o->endUpdate();
+		}
 	}
 }
 
 /****************************** Render *********************************/
 
 static Transform cam_tform;		//current camera transform
+static bool reflected;			//rendering a mirror
 
 static vector<gxLight*> _lights;
 static vector<Mirror*> _mirrors;
@@ -511,12 +829,10 @@ struct OrderComp{
 	}
 };
 
-struct TransComp{
-	bool operator()( Model *a,Model *b )const{
-		return 
-		cam_tform.v.distance( a->getRenderTform().v )<
-		cam_tform.v.distance( b->getRenderTform().v );
-	}
+//transparent model, with key that sorts far to near
+struct TransItem{
+	unsigned key;
+	Model *model;
 };
 
 static vector<Model*> ord_mods,unord_mods;
@@ -525,33 +841,123 @@ static priority_queue<Model*,vector<Model*>,OrderComp> ord_que;
 
 static priority_queue<Camera*,vector<Camera*>,OrderComp> cam_que;
 
-static priority_queue<Model*,vector<Model*>,TransComp> transparents;
+static vector<TransItem> transparents,trans_tmp;
+
+//opaque draw items gathered across unordered models
+static vector<Model::DrawItem> draw_items;
+static bool gather_opaque;
+
+//billboarded sprites waiting to be batched
+static vector<Sprite*> opaque_sprites,sprite_run;
+
+//unordered mesh copies, drawn grouped by shared geometry
+static vector<MeshModel*> instances;
+
+//terrains refined in parallel before each camera pass
+static vector<Terrain*> terrains;
+
+//
+// A camera, or a camera's view of a mirror. With worker threads, all passes are culled
+// in parallel up front, and vis has a flag for each of ord_mods then unord_mods.
+//
+struct RenderPass{
+	Camera *cam;
+	Mirror *mirror;
+	vector<char> vis;
+};
+
+static vector<RenderPass> passes;
+static const RenderPass *curr_pass;
+
+static Transform passTform( Camera *cam,Mirror *mirror ){
+	if( !mirror ) return cam->getRenderTform();
+	const Transform &t=mirror->getRenderTform();
+	return t * Transform( scaleMatrix( 1,-1,1 ) ) * -t * cam->getRenderTform();
+}
+
+static void preparePass( RenderPass &pass ){
+	Transform tform=passTform( pass.cam,pass.mirror );
+	RenderContext rc( tform,pass.cam->getFrustum(),pass.mirror!=0 );
+	int n=ord_mods.size();
+	pass.vis.resize( n+unord_mods.size() );
+	for( int k=0;k<pass.vis.size();++k ){
+		Model *mod=k<n ? ord_mods[k] : unord_mods[k-n];
+		pass.vis[k]=!mod->fadedOut( tform.v ) && mod->inView( rc );
+	}
+}
+
+struct InstanceComp{
+	bool operator()( MeshModel *a,MeshModel *b )const{
+		if( a->getInstanceKey()!=b->getInstanceKey() ) return a->getInstanceKey()<b->getInstanceKey();
+		return a->getRenderBrush()<b->getRenderBrush();
+	}
+};
+
+struct SpriteComp{
+	bool operator()( Sprite *a,Sprite *b )const{
+		return a->getRenderBrush()<b->getRenderBrush();
+	}
+};
+
+//vertices per skinning job
+static const int SKIN_JOB_VERTS=1024;
+
+struct SkinJob{
+	MeshModel *model;
+	int surf,first,count;
+};
+
+static vector<MeshModel*> skinned;
+static vector<SkinJob> skin_jobs;
+
+//
+// Skin all boned models once up front, in parallel.
+//
+static void skinModels( const vector<Model*> &mods ){
+	for( int k=0;k<mods.size();++k ){
+		MeshModel *m=mods[k]->getMeshModel();
+		if( !m || !m->beginSkin() ) continue;
+		skinned.push_back( m );
+		const MeshModel::SurfaceList &surfs=m->getSurfaces();
+		for( int j=0;j<surfs.size();++j ){
+			int n=surfs[j]->numVertices();
+			for( int first=0;first<n;first+=SKIN_JOB_VERTS ){
+				SkinJob job={ m,j,first,n-first<SKIN_JOB_VERTS ? n-first : SKIN_JOB_VERTS };
+				skin_jobs.push_back( job );
+			}
+		}
+	}
+}
 
 void World::capture(){
 
-	enumVisible();
+	const vector<Object*> &visible=enumVisible();
 
 	vector<Object*>::const_iterator it;
-	for( it=_visible.begin();it!=_visible.end();++it ){
+	for( it=visible.begin();it!=visible.end();++it ){
 		(*it)->capture();
 	}
 }
 
 void World::render( float tween ){
 
+	Entity::flushTransforms();
+
 	//set render tweens, and build ordered and unordered model lists...
 	ord_mods.clear();
 	unord_mods.clear();
 
-	_visible.clear();
 	_lights.clear();
 	_mirrors.clear();
 	_listeners.clear();
+	terrains.clear();
 
-	enumVisible();
+	stats3d[9]=stats3d[10]=stats3d[11]=0;
+
+	const vector<Object*> &visible=enumVisible();
 
 	vector<Object*>::const_iterator it;
-	for( it=_visible.begin();it!=_visible.end();++it ){
+	for( it=visible.begin();it!=visible.end();++it ){
 		Object *o=*it;
 
 		if( !o->beginRender(tween) ) continue;
@@ -561,6 +967,7 @@ void World::render( float tween ){
 		else if( Mirror *t=o->getMirror() ) _mirrors.push_back(t);
 		else if( Listener *t=o->getListener() ) _listeners.push_back(t);
 		else if( Model *t=o->getModel() ){
+			if( Terrain *tr=t->getTerrain() ) terrains.push_back( tr );
 			if( t->getOrder() ) ord_que.push( t );
 			else unord_mods.push_back( t );
 		}
@@ -572,22 +979,71 @@ void World::render( float tween ){
 
 	if( !gx_scene->begin( _lights ) ) return;
 
-	for( ;cam_que.size();cam_que.pop() ){
+	//with worker threads, skin once here rather than per camera
+	if( ThreadPool::threads()>1 ){
+		skinModels( ord_mods );
+		skinModels( unord_mods );
+		ThreadPool::run( skin_jobs.size(),[]( int k ){
+			const SkinJob &job=skin_jobs[k];
+			job.model->skin( job.surf,job.first,job.count );
+		} );
+	}
 
+	//passes in camera order, mirrors first
+	passes.clear();
+	for( ;cam_que.size();cam_que.pop() ){
 		Camera *cam=cam_que.top();
+		if( !cam->getProjMode() ) continue;
+		RenderPass pass={ cam,0 };
+		for( int k=0;k<_mirrors.size();++k ){
+			pass.mirror=_mirrors[k];
+			passes.push_back( pass );
+		}
+		pass.mirror=0;
+		passes.push_back( pass );
+	}
 
-		if( !cam->beginRenderFrame() ) continue;
-
-		vector<Mirror*>::const_iterator mir_it;
-		for( mir_it=_mirrors.begin();mir_it!=_mirrors.end();++mir_it ){
-			render( cam,*mir_it );
+	//with worker threads, cull every pass in parallel, then submit in order
+	bool prepared=ThreadPool::threads()>1 && passes.size();
+	if( prepared ){
+		//lazily computed frustums, boxes and render transforms must be valid before threads read them
+		int k;
+		for( k=0;k<passes.size();++k ){
+			passes[k].cam->getFrustum();
+			passes[k].cam->getRenderTform();
+		}
+		for( k=0;k<_mirrors.size();++k ) _mirrors[k]->getRenderTform();
+		for( k=0;k<ord_mods.size();++k ){
+			ord_mods[k]->getRenderTform();
+			if( MeshModel *m=ord_mods[k]->getMeshModel() ) m->getBox();
+		}
+		for( k=0;k<unord_mods.size();++k ){
+			unord_mods[k]->getRenderTform();
+			if( MeshModel *m=unord_mods[k]->getMeshModel() ) m->getBox();
 		}
+		ThreadPool::run( passes.size(),[]( int k ){ preparePass( passes[k] ); } );
+	}
 
-		render( cam,0 );
+	Camera *cam=0;
+	bool cam_ok=false;
+	for( int k=0;k<passes.size();++k ){
+		const RenderPass &pass=passes[k];
+		if( pass.cam!=cam ){
+			cam=pass.cam;
+			cam_ok=cam->beginRenderFrame();
+		}
+		if( !cam_ok ) continue;
+		curr_pass=prepared ? &pass : 0;
+		render( cam,pass.mirror );
 	}
+	curr_pass=0;
 
 	gx_scene->end();
 
+	for( int k=0;k<skinned.size();++k ) skinned[k]->endSkin();
+	skinned.clear();
+	skin_jobs.clear();
+
 //	gx_runtime->debugLog( "End RenderWorld" );
 
 	vector<Listener*>::const_iterator lis_it;
@@ -598,43 +1054,52 @@ void World::render( float tween ){
 
 void World::render( Camera *cam,Mirror *mirror ){
 
-	if( mirror ){
-		const Transform &t=mirror->getRenderTform();
-		cam_tform=t * Transform( scaleMatrix( 1,-1,1 ) ) * -t * cam->getRenderTform();
-		gx_scene->setFlippedTris( true );
-	}else{
-		cam_tform=cam->getRenderTform();
-		gx_scene->setFlippedTris( false );
-	}
+	cam_tform=passTform( cam,mirror );
+	gx_scene->setFlippedTris( mirror!=0 );
 
 	//set camera matrix
 	gx_scene->setViewMatrix( (gxScene::Matrix*)&(-cam_tform) );
 
 	//initialize render context
-	RenderContext rc( cam_tform,cam->getFrustum(),mirror!=0 );
+	RenderContext rc( cam_tform,cam->getFrustum(),mirror!=0,curr_pass!=0 );
+	reflected=mirror!=0;
+
+	//models culled by preparePass
+	const char *vis=curr_pass && curr_pass->vis.size() ? &curr_pass->vis[0] : 0;
+	int n_ord=ord_mods.size();
+
+	//refine reads the terrain's render transform, which must be valid before threads do
+	for( int k=0;k<terrains.size();++k ) terrains[k]->getRenderTform();
+	ThreadPool::run( terrains.size(),[&rc]( int k ){ terrains[k]->prepare( rc ); } );
 
 	//draw everything in order
 	int ord=0;
 	gx_scene->setZMode( gxScene::ZMODE_DISABLE );
 	while( ord<ord_mods.size() && ord_mods[ord]->getOrder()>0 ){
 		Model *mod=ord_mods[ord++];
+		if( vis && !vis[ord-1] ) continue;
 		if( !mod->doAutoFade( cam_tform.v ) ) continue;
 		render( mod,rc );
 		flushTransparent();
 	}
 
 	gx_scene->setZMode( gxScene::ZMODE_NORMAL );
+	gather_opaque=true;
 	for( int k=0;k<unord_mods.size();++k ){
 		Model *mod=unord_mods[k];
+		if( vis && !vis[n_ord+k] ) continue;
 		if( !mod->doAutoFade( cam_tform.v ) ) continue;
 		render( mod,rc );
 	}
+	gather_opaque=false;
+	flushOpaque();
 	gx_scene->setZMode( gxScene::ZMODE_CMPONLY );
 	flushTransparent();
 
 	gx_scene->setZMode( gxScene::ZMODE_DISABLE );
 	while( ord<ord_mods.size() ){
 		Model *mod=ord_mods[ord++];
+		if( vis && !vis[ord-1] ) continue;
 		if( !mod->doAutoFade( cam_tform.v ) ) continue;
 		render( mod,rc );
 		flushTransparent();
@@ -643,9 +1108,36 @@ void World::render( Camera *cam,Mirror *mirror ){
 
 void World::render( Model *mod,const RenderContext &rc ){
 
+	if( Sprite *spr=mod->getSprite() ){
+		if( !spr->render( rc ) ) return;
+		if( spr->getRenderBrush().getBlend()!=gxScene::BLEND_REPLACE ){
+			float d=cam_tform.v.distanceSq( mod->getRenderTform().v );
+			unsigned bits;
+			memcpy( &bits,&d,4 );
+			TransItem item={ ~bits,mod };
+			transparents.push_back( item );
+		}else if( gather_opaque ){
+			opaque_sprites.push_back( spr );
+		}else{
+			gx_scene->setWorldMatrix( 0 );
+			Sprite::renderBatch( &spr,1,rc.isReflected() );
+		}
+		return;
+	}
+
+	if( gather_opaque ){
+		MeshModel *m=mod->getMeshModel();
+		if( m && m->instanceable() ){
+			if( rc.isCulled() || m->cull( rc ) ) instances.push_back( m );
+			return;
+		}
+	}
+
 	bool trans=mod->render( rc );
 
-	if( mod->queueSize( Model::QUEUE_OPAQUE ) ){
+	if( gather_opaque && mod->queueSortable() ){
+		mod->gatherQueue( draw_items,cam_tform.v.distance( mod->getRenderTform().v ) );
+	}else if( mod->queueSize( Model::QUEUE_OPAQUE ) ){
 		if( mod->getRenderSpace()==Model::RENDER_SPACE_LOCAL ){
 			gx_scene->setWorldMatrix( (gxScene::Matrix*)&mod->getRenderTform() );
 		}else{
@@ -655,16 +1147,117 @@ void World::render( Model *mod,const RenderContext &rc ){
 	}
 
 	if( trans || mod->queueSize( Model::QUEUE_TRANSPARENT ) ){
-		transparents.push( mod );
+		//positive floats sort the same as their bits, so flip them for far to near
+		float d=cam_tform.v.distanceSq( mod->getRenderTform().v );
+		unsigned bits;
+		memcpy( &bits,&d,4 );
+		TransItem item={ ~bits,mod };
+		transparents.push_back( item );
+	}
+}
+
+//
+// LSD radix sort by key, 8 bits at a time. Stable, and passes where every key has the same
+// byte are skipped.
+//
+static void radixSort( vector<TransItem> &items,vector<TransItem> &tmp ){
+
+	int n=items.size();
+	if( n<2 ) return;
+	tmp.resize( n );
+
+	TransItem *src=&items[0],*dst=&tmp[0];
+
+	for( int shift=0;shift<32;shift+=8 ){
+		int counts[256]={0};
+		int k;
+		for( k=0;k<n;++k ) ++counts[(src[k].key>>shift)&255];
+		if( counts[(src[0].key>>shift)&255]==n ) continue;
+		int sum=0;
+		for( k=0;k<256;++k ){
+			int t=counts[k];
+			counts[k]=sum;
+			sum+=t;
+		}
+		for( k=0;k<n;++k ) dst[counts[(src[k].key>>shift)&255]++]=src[k];
+		std::swap( src,dst );
+	}
+
+	if( src!=&items[0] ) memcpy( &items[0],src,n*sizeof(TransItem) );
+}
+
+//
+// Draw gathered opaque items sorted by state, so materials aren't
+// switched back and forth between models.
+//
+void World::flushOpaque(){
+
+	stats3d[8]=instances.size();
+
+	if( instances.size() ){
+		std::stable_sort( instances.begin(),instances.end(),InstanceComp() );
+		InstanceComp comp;
+		int k=0;
+		while( k<instances.size() ){
+			int end=k+1;
+			while( end<instances.size() && !comp( instances[k],instances[end] ) ) ++end;
+			MeshModel::renderInstances( &instances[k],end-k );
+			k=end;
+		}
+		instances.clear();
+	}
+
+	sort( draw_items.begin(),draw_items.end() );
+
+	Model *last=0;
+	for( int k=0;k<draw_items.size();++k ){
+		const Model::DrawItem &item=draw_items[k];
+		Model *mod=item.model;
+		if( mod!=last ){
+			if( mod->getRenderSpace()==Model::RENDER_SPACE_LOCAL ){
+				gx_scene->setWorldMatrix( (gxScene::Matrix*)&mod->getRenderTform() );
+			}else if( !last || last->getRenderSpace()==Model::RENDER_SPACE_LOCAL ){
+				gx_scene->setWorldMatrix( 0 );
+			}
+			last=mod;
+		}
+		Model::renderItem( item );
 	}
+	draw_items.clear();
+
+	if( !opaque_sprites.size() ) return;
+
+	std::stable_sort( opaque_sprites.begin(),opaque_sprites.end(),SpriteComp() );
+	gx_scene->setWorldMatrix( 0 );
+	Sprite::renderBatch( &opaque_sprites[0],opaque_sprites.size(),reflected );
+	opaque_sprites.clear();
 }
 
 void World::flushTransparent(){
 
+	radixSort( transparents,trans_tmp );
+
 	bool local=true;
 
-	for( ;transparents.size();transparents.pop() ){
-		Model *mod=transparents.top();
+	for( int k=0;k<transparents.size();++k ){
+		Model *mod=transparents[k].model;
+
+		//batch sprites that are next to each other in depth order
+		if( Sprite *spr=mod->getSprite() ){
+			sprite_run.clear();
+			sprite_run.push_back( spr );
+			while( k+1<transparents.size() && (spr=transparents[k+1].model->getSprite()) ){
+				sprite_run.push_back( spr );
+				++k;
+			}
+			if( local ){
+				gx_scene->setWorldMatrix( 0 );
+				local=false;
+			}
+			Sprite::renderBatch( &sprite_run[0],sprite_run.size(),reflected );
+			continue;
+		}
+
 		if( mod->getRenderSpace()==Model::RENDER_SPACE_LOCAL ){
 			gx_scene->setWorldMatrix( (gxScene::Matrix*)&mod->getRenderTform() );
 			local=true;
@@ -674,4 +1267,5 @@ void World::flushTransparent(){
 		}
 		mod->renderQueue( Model::QUEUE_TRANSPARENT );
 	}
+	transparents.clear();
 }
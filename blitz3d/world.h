@@ -9,9 +9,13 @@
 #include "light.h"
 #include "mirror.h"
 #include "listener.h"
+#include "broadphase.h"
 
 class World{
 public:
+	World();
+	~World();
+
 	//collision methods
 	enum{
 		COLLISION_METHOD_SPHERE=1,
@@ -38,17 +42,61 @@ public:
 	bool hitTest( const Line &line,float radius,Object *obj,const Transform &tf,int method,Collision *curr_coll  );
 	Object *traceRay( const Line &line,float radius,ObjCollision *curr_coll );
 
+	//trace many rays at once - returns number of rays that hit, results[k].with is 0 for misses
+	int traceRays( const Line *lines,int count,float radius,ObjCollision *results );
+
 private:
 	struct CollInfo{
 		int dst_type,method,response;
 	};
 
+	//collision objects of one type
+	struct CollGroup{
+		Broadphase objs;
+		float max_radius;
+		CollGroup():max_radius(0){}
+	};
+
+	struct CollHit{
+		Object *with;
+		Line line;
+		Collision coll;
+	};
+
+	//collisions found for one object, committed by commitCollisions
+	struct CollResult{
+		Object *src;
+		Vector dest;
+		vector<CollHit> hits;
+		float inv_y_scale;
+		bool moved;
+		Vector pos;
+		int tested;
+	};
+
 	vector<CollInfo> _collInfo[1000];
-	vector<Object*> _objsByType[1000];
+	CollGroup *_collGroups[1000];
+	vector<CollResult> _collResults;
+
+	//enabled pickable objects and their bounds, only rebuilt when something they depend on changes
+	vector<Object*> _pickables;
+	Broadphase _pickTree;
+	int _pickHierarchy,_pickModes,_pickTforms,_pickGeoms;
+
+	void updateBroadphase( Object *obj,int order );
+	void validatePicks();
+	Object *pick( const Line &line,float radius,Collision *curr_coll );
+	//active animators, and whether they produced a pose
+	vector<Animator*> _animators;
+	vector<char> _animPosed;
 
-	void collide( Object *src );
+	void animate( const vector<Object*> &objs,float elapsed );
+	void updateThreaded( float elapsed );
+	void collide( CollResult &res );
+	void commitCollisions( const CollResult &res );
 	void render( Camera *c,Mirror *m );
 	void render( Model *m,const RenderContext &rc );
+	void flushOpaque();
 	void flushTransparent();
 
 };
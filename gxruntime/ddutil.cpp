@@ -9,6 +9,8 @@ extern gxRuntime *gx_runtime;
 
 #include "..\freeimage\freeimage.h"
 
+#include <mutex>
+
 static AsmCoder asm_coder;
 
 static void calcShifts( unsigned mask,unsigned char *shr,unsigned char *shl ){
@@ -449,16 +451,23 @@ IDirectDrawSurface7 *loadDXTC(const char* filename,gxGraphics *gfx)
 	return newSurf;
 }
 
-ddSurf *ddUtil::loadSurface( const std::string &f,int flags,gxGraphics *gfx ){
+struct ddImage{
+	FIBITMAP *dib;
+	bool trans;
+};
+
+static std::mutex freeimage_mutex;
+
+ddImage *ddUtil::decodeImage( const std::string &f ){
 
 	int i=f.find( ".dds" );
-	if( i!=string::npos && i+4==f.size() ){
-		//dds file!
-		ddSurf *surf=loadDXTC( f.c_str(),gfx );
-		return surf;
-	}
+	if( i!=string::npos && i+4==f.size() ) return 0;
 
-	FreeImage_Initialise();
+	{
+		//FreeImage_Initialise isn't thread safe
+		std::lock_guard<std::mutex> lock( freeimage_mutex );
+		FreeImage_Initialise();
+	}
 	FREE_IMAGE_FORMAT fmt=FreeImage_GetFileType( f.c_str(),f.size() );
 	if( fmt==FIF_UNKNOWN ){
 		int n=f.find( "." );if( n==string::npos ) return 0;
@@ -475,6 +484,36 @@ ddSurf *ddUtil::loadSurface( const std::string &f,int flags,gxGraphics *gfx ){
 	if( dib ) FreeImage_Unload( t_dib );
 	else dib=t_dib;
 
+	ddImage *img=d_new ddImage;
+	img->dib=dib;
+	img->trans=trans;
+	return img;
+}
+
+void ddUtil::freeImage( ddImage *img ){
+	FreeImage_Unload( img->dib );
+	delete img;
+}
+
+ddSurf *ddUtil::loadSurface( const std::string &f,int flags,gxGraphics *gfx ){
+
+	int i=f.find( ".dds" );
+	if( i!=string::npos && i+4==f.size() ){
+		//dds file!
+		ddSurf *surf=loadDXTC( f.c_str(),gfx );
+		return surf;
+	}
+
+	ddImage *img=decodeImage( f );
+	return img ? loadSurface( img,flags,gfx ) : 0;
+}
+
+ddSurf *ddUtil::loadSurface( ddImage *img,int flags,gxGraphics *gfx ){
+
+	FIBITMAP *dib=img->dib;
+	bool trans=img->trans;
+	delete img;
+
 	int width=FreeImage_GetWidth(dib);
 	int height=FreeImage_GetHeight(dib);
 	int pitch=FreeImage_GetPitch(dib);
@@ -7,12 +7,21 @@
 class gxGraphics;
 typedef IDirectDrawSurface7 ddSurf;
 
+//image decoded from a file, but not yet copied to a surface
+struct ddImage;
+
 struct ddUtil{
 
 	static void buildMipMaps( ddSurf *surf );
 	static void copy( ddSurf *dest,int dx,int dy,int dw,int dh,ddSurf *src,int sx,int sy,int sw,int sh );
 	static ddSurf *loadSurface( const std::string &f,int flags,gxGraphics *gfx );
 	static ddSurf *createSurface( int width,int height,int flags,gxGraphics *gfx );
+
+	//decode an image file - safe to call from any thread, returns 0 for .dds files
+	static ddImage *decodeImage( const std::string &f );
+	//create a surface from a decoded image, which is freed
+	static ddSurf *loadSurface( ddImage *img,int flags,gxGraphics *gfx );
+	static void freeImage( ddImage *img );
 };
 
 class PixelFormat{
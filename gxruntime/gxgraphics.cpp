@@ -3,8 +3,14 @@
 #include "gxgraphics.h"
 #include "gxruntime.h"
 
+#include <mutex>
+
 extern gxRuntime *gx_runtime;
 
+//images decoded by preloadImage, waiting for loadCanvas
+static std::mutex image_mutex;
+static map<string,ddImage*> preloaded_images;
+
 gxGraphics::gxGraphics( gxRuntime *rt,IDirectDraw7 *dd,IDirectDrawSurface7 *fs,IDirectDrawSurface7 *bs,bool d3d ):
 runtime(rt),dirDraw(dd),dir3d(0),dir3dDev(0),def_font(0),gfx_lost(false),dummy_mesh(0){
 
@@ -198,8 +204,38 @@ gxCanvas *gxGraphics::createCanvas( int w,int h,int flags ){
 	return c;
 }
 
+bool gxGraphics::preloadImage( const string &f ){
+	{
+		std::lock_guard<std::mutex> lock( image_mutex );
+		if( preloaded_images.count( f ) ) return true;
+	}
+	ddImage *img=ddUtil::decodeImage( f );
+	if( !img ) return false;
+	std::lock_guard<std::mutex> lock( image_mutex );
+	if( preloaded_images.count( f ) ) ddUtil::freeImage( img );
+	else preloaded_images[f]=img;
+	return true;
+}
+
+void gxGraphics::discardImage( const string &f ){
+	std::lock_guard<std::mutex> lock( image_mutex );
+	map<string,ddImage*>::iterator it=preloaded_images.find( f );
+	if( it==preloaded_images.end() ) return;
+	ddUtil::freeImage( it->second );
+	preloaded_images.erase( it );
+}
+
 gxCanvas *gxGraphics::loadCanvas( const string &f,int flags ){
-	ddSurf *s=ddUtil::loadSurface( f,flags,this );
+	ddImage *img=0;
+	{
+		std::lock_guard<std::mutex> lock( image_mutex );
+		map<string,ddImage*>::iterator it=preloaded_images.find( f );
+		if( it!=preloaded_images.end() ){
+			img=it->second;
+			preloaded_images.erase( it );
+		}
+	}
+	ddSurf *s=img ? ddUtil::loadSurface( img,flags,this ) : ddUtil::loadSurface( f,flags,this );
 	if( !s ) return 0;
 	gxCanvas *c=d_new gxCanvas( this,s,flags );
 	canvas_set.insert( c );
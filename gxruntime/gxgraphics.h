@@ -93,6 +93,10 @@ public:
 	//OBJECTS
 	gxCanvas *createCanvas( int width,int height,int flags );
 	gxCanvas *loadCanvas( const std::string &file,int flags );
+	//decode file so a later loadCanvas of it only has to create the surface - safe to call from any thread
+	static bool preloadImage( const std::string &file );
+	//free a preloaded image that was never loaded
+	static void discardImage( const std::string &file );
 	gxCanvas *verifyCanvas( gxCanvas *canvas );
 	void freeCanvas( gxCanvas *canvas );
 
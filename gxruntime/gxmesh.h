@@ -61,6 +61,13 @@ public:
 		t->argb=argb;
 		memcpy( t->tex_coords,tex_coords,16 );
 	}
+	void setVertices( int n,const void *v,int count ){
+		memcpy( locked_verts+n,v,count*sizeof(dxVertex) );
+	}
+	//for writing vertices in place
+	float *lockedVertex( int n ){
+		return locked_verts[n].coords;
+	}
 	void setTriangle( int n,int v0,int v1,int v2 ){
 		tri_indices[n*3]=v0;
 		tri_indices[n*3+1]=v1;
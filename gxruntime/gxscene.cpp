@@ -15,17 +15,19 @@ void gxScene::setRS( int n,int t ){
 	if( d3d_rs[n]==t ) return;
 	dir3dDev->SetRenderState( (D3DRENDERSTATETYPE)n,t );
 	d3d_rs[n]=t;
+	++state_changes;
 }
 
 void gxScene::setTSS( int n,int s,int t ){
 	if( d3d_tss[n][s]==t ) return;
 	dir3dDev->SetTextureStageState( n,(D3DTEXTURESTAGESTATETYPE)s,t );
 	d3d_tss[n][s]=t;
+	++state_changes;
 }
 
 gxScene::gxScene( gxGraphics *g,gxCanvas *t ):
 graphics(g),target(t),dir3dDev( g->dir3dDev ),
-n_texs(0),tris_drawn(0){
+n_texs(0),tris_drawn(0),state_changes(0),draw_calls(0){
 
 	memset( d3d_rs,0x55,sizeof(d3d_rs) );
 	memset( d3d_tss,0x55,sizeof(d3d_tss) );
@@ -137,6 +139,7 @@ void gxScene::setTexState( int n,const TexState &state,bool tex_blend ){
 
 	//set canvas
 	dir3dDev->SetTexture( n,state.canvas->getTexSurface() );
+	++state_changes;
 
 	//set addressing modes
 	setTSS( n,D3DTSS_ADDRESSU,(flags & gxCanvas::CANVAS_TEX_CLAMPU) ? D3DTADDRESS_CLAMP : D3DTADDRESS_WRAP );
@@ -401,6 +404,7 @@ void gxScene::setWorldMatrix( const Matrix *m ){
 		memcpy( &worldmatrix._41,m->elements[3],12 );
 	}else worldmatrix=nullmatrix;
 	dir3dDev->SetTransform( D3DTRANSFORMSTATE_WORLD,&worldmatrix );
+	++state_changes;
 }
 
 void gxScene::setRenderState( const RenderState &rs ){
@@ -485,6 +489,7 @@ void gxScene::setRenderState( const RenderState &rs ){
 	}
 	if( setmat ){
 		dir3dDev->SetMaterial( &material );
+		++state_changes;
 	}
 
 	n_texs=0;
@@ -519,6 +524,7 @@ void gxScene::setRenderState( const RenderState &rs ){
 		setTSS( n_texs,D3DTSS_COLOROP,D3DTOP_DISABLE );
 		setTSS( n_texs,D3DTSS_ALPHAOP,D3DTOP_DISABLE );
 		dir3dDev->SetTexture( n_texs,0 );
+		++state_changes;
 	}
 }
 
@@ -561,6 +567,7 @@ void gxScene::render( gxMesh *m,int first_vert,int vert_cnt,int first_tri,int tr
 
 	m->render( first_vert,vert_cnt,first_tri,tri_cnt );
 	tris_drawn+=tri_cnt;
+	++draw_calls;
 	if( n_texs<=tex_stages ) return;
 
 	setTSS( 0,D3DTSS_COLOROP,D3DTOP_SELECTARG1 );
@@ -592,6 +599,7 @@ void gxScene::render( gxMesh *m,int first_vert,int vert_cnt,int first_tri,int tr
 		setTexState( 0,state,false );
 		m->render( first_vert,vert_cnt,first_tri,tri_cnt );
 		tris_drawn+=tri_cnt;
+		++draw_calls;
 	}
 
 	setRS( D3DRENDERSTATE_ALPHABLENDENABLE,false );
@@ -600,6 +608,16 @@ void gxScene::render( gxMesh *m,int first_vert,int vert_cnt,int first_tri,int tr
 	setTexState( 0,texstate[0],true );
 }
 
+//
+// D3D7 can't instance, so just set the world matrix and draw for each instance.
+//
+void gxScene::renderInstances( gxMesh *m,int first_vert,int vert_cnt,int first_tri,int tri_cnt,const Matrix *matrices,int count ){
+	for( int k=0;k<count;++k ){
+		setWorldMatrix( matrices+k );
+		render( m,first_vert,vert_cnt,first_tri,tri_cnt );
+	}
+}
+
 void gxScene::end(){
 	dir3dDev->EndScene();
 	RECT r={ (LONG)viewport.dwX,(LONG)viewport.dwY,(LONG)(viewport.dwX+viewport.dwWidth),(LONG)(viewport.dwY+viewport.dwHeight) };
@@ -619,3 +637,11 @@ void gxScene::freeLight( gxLight *l ){
 int gxScene::getTrianglesDrawn()const{
 	return tris_drawn;
 }
+
+int gxScene::getStateChanges()const{
+	return state_changes;
+}
+
+int gxScene::getDrawCalls()const{
+	return draw_calls;
+}
@@ -102,6 +102,7 @@ public:
 	bool begin( const std::vector<gxLight*> &lights );
 	void clear( const float rgb[3],float alpha,float z,bool clear_argb,bool clear_z );
 	void render( gxMesh *mesh,int first_vert,int vert_cnt,int first_tri,int tri_cnt );
+	void renderInstances( gxMesh *mesh,int first_vert,int vert_cnt,int first_tri,int tri_cnt,const Matrix *matrices,int count );
 	void end();
 
 	//lighting
@@ -110,6 +111,8 @@ public:
 
 	//info
 	int getTrianglesDrawn()const;
+	int getStateChanges()const;
+	int getDrawCalls()const;
 
 private:
 	gxCanvas *target;
@@ -132,7 +135,7 @@ private:
 		bool mat_valid;
 	};
 	TexState texstate[MAX_TEXTURES];
-	int n_texs,tris_drawn;
+	int n_texs,tris_drawn,state_changes,draw_calls;
 
 	std::set<gxLight*> _allLights;
 	std::vector<gxLight*> _curLights;